@@ -1,8 +1,103 @@
 #include <application.h>
 #include <vl53l0x.h>
+#include <filter.h>
+#include <budget.h>
+#include <dutycycle.h>
+#include <stream.h>
+#include <telemetry.h>
+#include <stdio.h>
+
+// Sensor GPIO1 (data ready, active low) wiring
+#define VL53L0X_GPIO1_CHANNEL BC_GPIO_P9
+#define VL53L0X_GPIO1_EXTI_LINE BC_EXTI_LINE_P9
+
+#define FILTER_WINDOW_SIZE 5
+
+// Nonzero for presence detection: the sensor ranges on its own every
+// PRESENCE_PERIOD_MS and wakes the MCU only when something is closer than
+// PRESENCE_THRESHOLD_MM
+#define PRESENCE_THRESHOLD_MM 0
+#define PRESENCE_PERIOD_MS 100
+
+// Nonzero for timed ranging every SAMPLE_PERIOD_MS, with the sensor idle and
+// the core asleep between samples; 0 for back-to-back ranging
+#define SAMPLE_PERIOD_MS 0
+
+// Nonzero to send the raw samples in binary frames over STREAM_UART (P2/P3)
+// instead of logging them, see stream.h and tools/stream_decode.c
+#define SAMPLE_STREAM 0
+#define STREAM_UART BC_UART_UART1
+
+// Nonzero to aggregate the samples into a summary every TELEMETRY_WINDOW_MS,
+// or early when their mean moves TELEMETRY_CHANGE_MM, instead of logging each
+// one; with TELEMETRY_RADIO the summaries also go out over the radio
+#define TELEMETRY_WINDOW_MS 0
+#define TELEMETRY_CHANGE_MM 50
+#define TELEMETRY_RADIO 0
+
+// Battery the estimated life in the statistics report is computed for
+#define BATTERY_CAPACITY_MAH 1000
+
+// Range noise the timing budget is adapted to
+#define BUDGET_SIGMA_TARGET_MM 5
+
+#define STATS_REPORT_INTERVAL (60 * 1000)
+
+// Core Module temperature sensor and the EEPROM slot of the sensor calibration
+#define TMP112_I2C_ADDRESS 0x49
+#define CALIBRATION_EEPROM_ADDRESS 0
+
+// Target for the offset calibration started by holding the button: white, close
+// to the sensor
+#define CALIBRATION_OFFSET_DISTANCE_MM 100
+
+// Target for the crosstalk calibration started by holding the button again:
+// grey (17 %), far enough that the cover glass crosstalk makes the sensor read
+// short
+#define CALIBRATION_XTALK_DISTANCE_MM 600
 
 bc_led_t led;
+bc_button_t button;
+vl53l0x_t vl53l0x;
 bool init_failed = true;
+dutycycle_t dutycycle;
+
+bc_tmp112_t tmp112;
+int8_t temperature;
+bool temperature_valid;
+
+filter_t filter;
+budget_t budget;
+stream_t stream;
+telemetry_t telemetry;
+
+vl53l0x_result_t sample;
+bc_tick_t sample_tick;
+bool sample_pending;
+
+// Set once the offset is calibrated; the next button hold calibrates the
+// crosstalk
+bool calibration_xtalk_next;
+
+// Calibration in progress: readings collected so far and shots left
+bc_scheduler_task_id_t calibration_task_id;
+vl53l0x_calibration_samples_t calibration_samples;
+int calibration_shots;
+
+static void sensor_event_handler(vl53l0x_t *self, vl53l0x_event_t event, const vl53l0x_result_t *result, void *param);
+static void sensor_data_ready_handler(vl53l0x_t *self, const vl53l0x_result_t *result, void *param);
+static void stats_task(void *param);
+static void tmp112_event_handler(bc_tmp112_t *self, bc_tmp112_event_t event, void *event_param);
+static void sensor_start(vl53l0x_t *self);
+static void calibration_run(vl53l0x_t *self);
+static void calibration_task(void *param);
+static void calibration_finish_offset(vl53l0x_t *self);
+static void calibration_finish_xtalk(vl53l0x_t *self);
+static void calibration_store(vl53l0x_t *self);
+static void button_event_handler(bc_button_t *self, bc_button_event_t event, void *event_param);
+#if SAMPLE_STREAM
+static void sample_stream_write(const uint8_t *buffer, size_t length, void *param);
+#endif
 
 void application_init(void)
 {
@@ -10,49 +105,416 @@ void application_init(void)
 
     bc_log_init(BC_LOG_LEVEL_DUMP, BC_LOG_TIMESTAMP_ABS);
 
-    if (!vl53l0x_init(0x29, 500, false))
+    // Button hold calibrates the offset, the next hold the crosstalk; click
+    // prints the recent I2C transactions when tracing is enabled
+    bc_button_init(&button, BC_GPIO_BUTTON, BC_GPIO_PULL_DOWN, false);
+    bc_button_set_event_handler(&button, button_event_handler, NULL);
+
+    filter_init(&filter, FILTER_TYPE_MEDIAN, FILTER_WINDOW_SIZE);
+
+    budget_init(&budget, BUDGET_SIGMA_TARGET_MM);
+
+#if SAMPLE_STREAM
+    bc_uart_init(STREAM_UART, BC_UART_BAUDRATE_115200, BC_UART_SETTING_8N1);
+    stream_init(&stream, sample_stream_write, NULL);
+#endif
+
+#if TELEMETRY_WINDOW_MS
+    telemetry_init(&telemetry, TELEMETRY_WINDOW_MS, TELEMETRY_CHANGE_MM);
+    telemetry_add_sink(&telemetry, telemetry_sink_log, NULL);
+#if TELEMETRY_RADIO
+    bc_radio_init(BC_RADIO_MODE_NODE_SLEEPING);
+    bc_radio_pairing_request("vl53l0x-distance-measure", VERSION);
+    telemetry_add_sink(&telemetry, telemetry_sink_radio, NULL);
+#endif
+#endif
+
+    vl53l0x_set_event_handler(&vl53l0x, sensor_event_handler, NULL);
+
+    bc_scheduler_register(stats_task, NULL, STATS_REPORT_INTERVAL);
+    calibration_task_id = bc_scheduler_register(calibration_task, &vl53l0x, BC_TICK_INFINITY);
+
+    // The sensor is initialized once the temperature is known, so that the
+    // calibration stored in the EEPROM can be checked against it
+    bc_tmp112_init(&tmp112, BC_I2C_I2C0, TMP112_I2C_ADDRESS);
+    bc_tmp112_set_event_handler(&tmp112, tmp112_event_handler, NULL);
+
+    if (!bc_tmp112_measure(&tmp112))
+    {
+        tmp112_event_handler(&tmp112, BC_TMP112_EVENT_ERROR, NULL);
+    }
+}
+
+// Warm start from the stored calibration, measuring the reference calibration
+// again if it was taken at another temperature; without one run the full
+// initialization and store its calibration when it completes
+static void tmp112_event_handler(bc_tmp112_t *self, bc_tmp112_event_t event, void *event_param)
+{
+    (void) event_param;
+
+    float celsius;
+    vl53l0x_calibration_t calibration;
+
+    if (!init_failed || vl53l0x_is_busy(&vl53l0x))
     {
-        bc_log_error("vl53l0x init failed");
+        return;
+    }
+
+    temperature_valid = event == BC_TMP112_EVENT_UPDATE && bc_tmp112_get_temperature_celsius(self, &celsius);
+    temperature = temperature_valid ? (int8_t) (celsius + (celsius < 0 ? -0.5f : 0.5f)) : 0;
+
+    if (vl53l0x_calibration_load(&calibration, CALIBRATION_EEPROM_ADDRESS))
+    {
+        bool recalibrate = !temperature_valid || !vl53l0x_calibration_is_current(&calibration, temperature);
+
+        if (vl53l0x_init_warm(&vl53l0x, BC_I2C_I2C0, VL53L0X_DEFAULT_ADDRESS, 500, false, &calibration, recalibrate))
+        {
+            bc_log_info("vl53l0x warm start (calibrated at %d C%s)", calibration.temperature, recalibrate ? ", recalibrated" : "");
+
+            if (recalibrate && temperature_valid)
+            {
+                vl53l0x_get_calibration(&vl53l0x, &calibration);
+                vl53l0x_calibration_save(&calibration, CALIBRATION_EEPROM_ADDRESS, temperature);
+            }
+
+            sensor_start(&vl53l0x);
+
+            return;
+        }
+    }
+
+    if (!vl53l0x_init_async(&vl53l0x, BC_I2C_I2C0, VL53L0X_DEFAULT_ADDRESS, 500, false))
+    {
+        bc_log_error("vl53l0x init failed (error %u)", vl53l0x_get_error(&vl53l0x));
         bc_led_set_mode(&led, BC_LED_MODE_BLINK);
     }
-    else
+}
+
+static void sensor_event_handler(vl53l0x_t *self, vl53l0x_event_t event, const vl53l0x_result_t *result, void *param)
+{
+    (void) result;
+    (void) param;
+
+    if (event == VL53L0X_EVENT_INIT_ERROR)
     {
-        bc_log_info("vl53l0x init success");
-        bc_led_pulse(&led, 200);
-        init_failed = false;
-        vl53l0x_start_continuous(0);
+        bc_log_error("vl53l0x init failed (error %u)", vl53l0x_get_error(&vl53l0x));
+        bc_led_set_mode(&led, BC_LED_MODE_BLINK);
+#if VL53L0X_TRACE
+        vl53l0x_trace_dump();
+#endif
+    }
+#if VL53L0X_TRACE
+    else if (event == VL53L0X_EVENT_TIMEOUT)
+    {
+        vl53l0x_trace_dump();
+    }
+#endif
+    else if (event == VL53L0X_EVENT_INIT_DONE)
+    {
+        vl53l0x_bus_stats_t bus_stats;
+        vl53l0x_get_bus_stats(self, &bus_stats);
+
+        bc_log_info("vl53l0x init success (%lu transactions, %lu bytes, %lu us on the bus, %lu retries)",
+                    (unsigned long) bus_stats.transactions, (unsigned long) bus_stats.bytes,
+                    (unsigned long) bus_stats.bus_time_us, (unsigned long) bus_stats.retries);
+
+        if (temperature_valid)
+        {
+            vl53l0x_calibration_t calibration;
+
+            vl53l0x_get_calibration(self, &calibration);
+
+            if (!vl53l0x_calibration_save(&calibration, CALIBRATION_EEPROM_ADDRESS, temperature))
+            {
+                bc_log_warning("vl53l0x calibration not stored");
+            }
+        }
+
+        sensor_start(self);
     }
 }
 
+static void sensor_start(vl53l0x_t *self)
+{
+    bc_led_pulse(&led, 200);
+    init_failed = false;
+
+    dutycycle_init(&dutycycle, self);
+
+#if PRESENCE_THRESHOLD_MM
+    vl53l0x_set_window_interrupt(self, VL53L0X_GPIO1_CHANNEL, VL53L0X_GPIO1_EXTI_LINE, VL53L0X_WINDOW_BELOW,
+                                 PRESENCE_THRESHOLD_MM, PRESENCE_THRESHOLD_MM, sensor_data_ready_handler, NULL);
+    dutycycle_set_period(&dutycycle, PRESENCE_PERIOD_MS);
+#else
+    vl53l0x_set_data_ready_interrupt(self, VL53L0X_GPIO1_CHANNEL, VL53L0X_GPIO1_EXTI_LINE, sensor_data_ready_handler, NULL);
+
+    if (!dutycycle_set_period(&dutycycle, SAMPLE_PERIOD_MS))
+    {
+        bc_log_warning("Sample period %u ms too short, ranging back-to-back", SAMPLE_PERIOD_MS);
+    }
+#endif
+
+    dutycycle_start(&dutycycle);
+}
+
+static void sensor_data_ready_handler(vl53l0x_t *self, const vl53l0x_result_t *result, void *param)
+{
+    (void) self;
+    (void) param;
+
+    sample = *result;
+    sample_tick = bc_tick_get();
+    sample_pending = true;
+
+    bc_scheduler_plan_now(0);
+}
+
 void application_task(void)
 {
-    if (init_failed)
+    if (init_failed || !sample_pending)
+    {
+        return;
+    }
+
+    sample_pending = false;
+
+    uint32_t budget_us = dutycycle_get_budget(&dutycycle);
+    uint32_t next_budget_us = budget_feed(&budget, &sample, budget_us);
+
+    if (next_budget_us != budget_us && dutycycle_set_budget(&dutycycle, next_budget_us))
+    {
+        bc_log_debug("Timing budget %lu us, period %lu ms", (unsigned long) next_budget_us,
+                     (unsigned long) dutycycle_get_period(&dutycycle));
+    }
+
+#if SAMPLE_STREAM
+    stream_feed(&stream, &sample, sample_tick);
+#elif TELEMETRY_WINDOW_MS
+    telemetry_feed(&telemetry, &sample);
+#else
+    if (sample.validity != VL53L0X_VALIDITY_VALID)
+    {
+        bc_log_warning("Measurement error %u (range status %u)", sample.validity, sample.range_status);
+    }
+    else
+    {
+        uint16_t distance = filter_feed(&filter, sample.range_mm, sample_tick);
+
+        bc_log_info("%u mm (raw %u mm, sigma %u mm)", distance, sample.range_mm, sample.sigma_mm);
+    }
+#endif
+}
+
+#if SAMPLE_STREAM
+static void sample_stream_write(const uint8_t *buffer, size_t length, void *param)
+{
+    (void) param;
+
+    bc_uart_write(STREAM_UART, buffer, length);
+}
+#endif
+
+// Report the sample wait statistics of the last interval and start a new one
+static void stats_task(void *param)
+{
+    (void) param;
+
+    vl53l0x_stats_t stats;
+    char latency[VL53L0X_STATS_BUCKETS * 11 + 1]; // " 4294967295" per bucket
+    char polls[VL53L0X_STATS_BUCKETS * 11 + 1];
+    size_t latency_length = 0;
+    size_t polls_length = 0;
+
+    vl53l0x_get_stats(&vl53l0x, &stats);
+    vl53l0x_reset_stats(&vl53l0x);
+
+    for (int i = 0; i < VL53L0X_STATS_BUCKETS; i++)
+    {
+        latency_length += snprintf(&latency[latency_length], sizeof(latency) - latency_length, " %lu", (unsigned long) stats.latency_histogram[i]);
+        polls_length += snprintf(&polls[polls_length], sizeof(polls) - polls_length, " %lu", (unsigned long) stats.polls_histogram[i]);
+    }
+
+    bc_log_info("stats: %lu samples, %lu timeouts, latency mean %lu ms max %lu ms, %lu polls",
+                (unsigned long) stats.samples, (unsigned long) stats.timeouts,
+                (unsigned long) (stats.samples != 0 ? stats.latency_sum_ms / stats.samples : 0),
+                (unsigned long) stats.latency_max_ms, (unsigned long) stats.polls);
+    bc_log_debug("stats: latency log2 ms histogram%s", latency);
+    bc_log_debug("stats: polls log2 histogram%s", polls);
+
+    if (!init_failed)
+    {
+        dutycycle_update(&dutycycle);
+
+        bc_log_info("stats: %lu uJ per sample, %lu uW, estimated %lu h on %u mAh",
+                    (unsigned long) dutycycle_get_energy_per_sample(&dutycycle),
+                    (unsigned long) dutycycle_get_average_power(&dutycycle),
+                    (unsigned long) dutycycle_estimate_battery_life(&dutycycle, BATTERY_CAPACITY_MAH),
+                    BATTERY_CAPACITY_MAH);
+
+        dutycycle_reset_energy(&dutycycle);
+    }
+
+    bc_scheduler_plan_current_relative(STATS_REPORT_INTERVAL);
+}
+
+// Calibration in two steps with their own targets, one per button hold: the
+// offset against a white target at CALIBRATION_OFFSET_DISTANCE_MM, then the
+// crosstalk against a grey one at CALIBRATION_XTALK_DISTANCE_MM. Each step is
+// stored with the reference calibration and applied by every following warm
+// start. The VL53L0X_CALIBRATION_SAMPLES measurements of a step are taken by
+// calibration_task(), one per run, so the scheduler keeps running meanwhile.
+static void calibration_run(vl53l0x_t *self)
+{
+    if (calibration_shots != 0)
     {
         return;
     }
 
-    uint16_t avg = 0;
-    bool err = false;
-    for (uint8_t i = 0; i < 5; i++)
+    vl53l0x_clear_data_ready_interrupt(self);
+    dutycycle_stop(&dutycycle);
+    sample_pending = false;
+
+    // the crosstalk compensation is left off for the offset so that it does
+    // not skew it; reference SPAD management only takes a few short reference
+    // measurements
+    vl53l0x_set_xtalk_compensation(self, 0);
+
+    if (calibration_xtalk_next)
+    {
+        bc_log_info("vl53l0x crosstalk calibration against grey target at %u mm", CALIBRATION_XTALK_DISTANCE_MM);
+
+        calibration_xtalk_next = false;
+    }
+    else
     {
-        uint16_t distance = vl53l0x_read_range_continuous_millimeters();
-        if (vl53l0x_timeout_occurred() || distance > 8000 || distance < 50)
+        bc_log_info("vl53l0x offset calibration against white target at %u mm", CALIBRATION_OFFSET_DISTANCE_MM);
+
+        vl53l0x_set_offset_calibration(self, 0);
+
+        if (!vl53l0x_perform_ref_spad_management(self))
         {
-            distance = 0;
-            err = true;
+            bc_log_error("vl53l0x offset calibration failed");
+            sensor_start(self);
+
+            return;
         }
-        avg += distance;
+
+        calibration_xtalk_next = true;
     }
-    avg = avg / 5;
 
-    if (err)
+    memset(&calibration_samples, 0, sizeof(calibration_samples));
+
+    if (!vl53l0x_trigger_single(self))
     {
-        bc_log_warning("Measurement error");
+        bc_log_error("vl53l0x calibration failed");
+        calibration_xtalk_next = false;
+        sensor_start(self);
+
+        return;
+    }
+
+    calibration_shots = VL53L0X_CALIBRATION_SAMPLES;
+
+    bc_scheduler_plan_relative(calibration_task_id, (dutycycle_get_budget(&dutycycle) + 999) / 1000);
+}
+
+// Collect the shot started one timing budget ago and start the next one right
+// away; after the last one, finish the step and resume ranging
+static void calibration_task(void *param)
+{
+    vl53l0x_t *self = param;
+    vl53l0x_result_t result;
+
+    if (!vl53l0x_read_range_pipelined(self, &result, calibration_shots > 1))
+    {
+        bc_log_error("vl53l0x calibration failed");
+        calibration_shots = 0;
+        calibration_xtalk_next = false;
+        sensor_start(self);
+
+        return;
+    }
+
+    vl53l0x_calibration_add_sample(&calibration_samples, &result);
+
+    if (--calibration_shots != 0)
+    {
+        bc_scheduler_plan_current_relative((dutycycle_get_budget(&dutycycle) + 999) / 1000);
+
+        return;
+    }
+
+    // set when the offset step started
+    if (calibration_xtalk_next)
+    {
+        calibration_finish_offset(self);
     }
     else
     {
-        bc_log_info("%u mm", avg);
+        calibration_finish_xtalk(self);
     }
 
-    bc_scheduler_plan_current_relative(10);
+    sensor_start(self);
+}
+
+static void calibration_finish_offset(vl53l0x_t *self)
+{
+    int32_t offset_um;
+
+    if (!vl53l0x_finish_offset_calibration(self, &calibration_samples, CALIBRATION_OFFSET_DISTANCE_MM, &offset_um))
+    {
+        bc_log_error("vl53l0x offset calibration failed");
+        calibration_xtalk_next = false;
+
+        return;
+    }
+
+    bc_log_info("vl53l0x calibration offset %ld um, hold the button again with a grey target at %u mm", (long) offset_um, CALIBRATION_XTALK_DISTANCE_MM);
+
+    calibration_store(self);
+}
+
+static void calibration_finish_xtalk(vl53l0x_t *self)
+{
+    uint16_t xtalk_rate;
+
+    if (!vl53l0x_finish_xtalk_calibration(self, &calibration_samples, CALIBRATION_XTALK_DISTANCE_MM, &xtalk_rate))
+    {
+        bc_log_error("vl53l0x crosstalk calibration failed");
+
+        return;
+    }
+
+    bc_log_info("vl53l0x calibration crosstalk %u (Q3.13 MCPS per SPAD)", xtalk_rate);
+
+    calibration_store(self);
+}
+
+static void calibration_store(vl53l0x_t *self)
+{
+    vl53l0x_calibration_t calibration;
+
+    vl53l0x_get_calibration(self, &calibration);
+
+    if (!vl53l0x_calibration_save(&calibration, CALIBRATION_EEPROM_ADDRESS, temperature))
+    {
+        bc_log_warning("vl53l0x calibration not stored");
+    }
+}
+
+static void button_event_handler(bc_button_t *self, bc_button_event_t event, void *event_param)
+{
+    (void) self;
+    (void) event_param;
+
+    if (event == BC_BUTTON_EVENT_HOLD && !init_failed)
+    {
+        calibration_run(&vl53l0x);
+    }
+#if VL53L0X_TRACE
+    else if (event == BC_BUTTON_EVENT_CLICK)
+    {
+        vl53l0x_trace_dump();
+    }
+#endif
 }
@@ -0,0 +1,90 @@
+#include <budget.h>
+
+#define BUDGET_RATE_SHIFT 2        // rate EMA weight of 1/4
+#define BUDGET_HYSTERESIS_SHIFT 2  // keep the budget while within 1/4 of the target
+#define BUDGET_HOLDOFF_SAMPLES 8   // samples between two changes
+#define BUDGET_STEP_US 1000
+
+// Initialize a timing budget controller that aims at a range sigma estimate
+// of sigma_target_mm, between BUDGET_MIN_US and BUDGET_DEFAULT_MAX_US
+void budget_init(budget_t *self, uint16_t sigma_target_mm)
+{
+    memset(self, 0, sizeof(*self));
+
+    self->_sigma_target_mm = sigma_target_mm == 0 ? 1 : sigma_target_mm;
+    self->_min_us = BUDGET_MIN_US;
+    self->_max_us = BUDGET_DEFAULT_MAX_US;
+}
+
+// Forget the rate history but keep the configuration
+void budget_reset(budget_t *self)
+{
+    self->_signal_rate = 0;
+    self->_ambient_rate = 0;
+    self->_primed = false;
+    self->_holdoff = 0;
+}
+
+void budget_set_limits(budget_t *self, uint32_t min_us, uint32_t max_us)
+{
+    self->_min_us = min_us < BUDGET_MIN_US ? BUDGET_MIN_US : min_us;
+    self->_max_us = max_us < self->_min_us ? self->_min_us : max_us;
+}
+
+// Feed one result measured with budget_us and return the budget to use from
+// now on. The return signal and ambient rates are smoothed and turned into the
+// budget that meets the sigma target (see vl53l0x_estimate_budget_for_sigma()),
+// so strong signal and low ambient shrink the budget and weak signal or high
+// ambient grow it. The budget only changes when the target is more than a
+// quarter away from it, and not before BUDGET_HOLDOFF_SAMPLES results after
+// the last change.
+uint32_t budget_feed(budget_t *self, const vl53l0x_result_t *result, uint32_t budget_us)
+{
+    uint32_t signal_rate = (uint32_t) result->signal_rate << 8;
+    uint32_t ambient_rate = (uint32_t) result->ambient_rate << 8;
+
+    if (!self->_primed)
+    {
+        self->_signal_rate = signal_rate;
+        self->_ambient_rate = ambient_rate;
+        self->_primed = true;
+    }
+    else
+    {
+        self->_signal_rate = self->_signal_rate - (self->_signal_rate >> BUDGET_RATE_SHIFT) + (signal_rate >> BUDGET_RATE_SHIFT);
+        self->_ambient_rate = self->_ambient_rate - (self->_ambient_rate >> BUDGET_RATE_SHIFT) + (ambient_rate >> BUDGET_RATE_SHIFT);
+    }
+
+    if (self->_holdoff < BUDGET_HOLDOFF_SAMPLES)
+    {
+        self->_holdoff++;
+
+        return budget_us;
+    }
+
+    uint32_t target_us = vl53l0x_estimate_budget_for_sigma(self->_signal_rate >> 8, self->_ambient_rate >> 8, self->_sigma_target_mm);
+
+    if (target_us < self->_min_us)
+    {
+        target_us = self->_min_us;
+    }
+    else if (target_us > self->_max_us)
+    {
+        target_us = self->_max_us;
+    }
+    else
+    {
+        target_us = (target_us + BUDGET_STEP_US - 1) / BUDGET_STEP_US * BUDGET_STEP_US;
+    }
+
+    uint32_t band_us = budget_us >> BUDGET_HYSTERESIS_SHIFT;
+
+    if (target_us > budget_us + band_us || target_us + band_us < budget_us)
+    {
+        self->_holdoff = 0;
+
+        return target_us;
+    }
+
+    return budget_us;
+}
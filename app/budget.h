@@ -0,0 +1,27 @@
+#ifndef _BUDGET_H
+#define _BUDGET_H
+
+#include <bcl.h>
+#include <vl53l0x.h>
+
+#define BUDGET_MIN_US 20000
+#define BUDGET_DEFAULT_MAX_US 200000
+
+typedef struct
+{
+    uint16_t _sigma_target_mm;
+    uint32_t _min_us;
+    uint32_t _max_us;
+
+    uint32_t _signal_rate;  // Q9.7 << 8
+    uint32_t _ambient_rate; // Q9.7 << 8
+    bool _primed;
+    uint8_t _holdoff;
+} budget_t;
+
+void budget_init(budget_t *self, uint16_t sigma_target_mm);
+void budget_reset(budget_t *self);
+void budget_set_limits(budget_t *self, uint32_t min_us, uint32_t max_us);
+uint32_t budget_feed(budget_t *self, const vl53l0x_result_t *result, uint32_t budget_us);
+
+#endif // _BUDGET_H
@@ -0,0 +1,267 @@
+#include <dutycycle.h>
+
+// Energy model, typical datasheet figures: VL53L0X average current while
+// ranging and between timed measurements, and STM32L0 run current while the
+// MCU drives the I2C bus; the core sleeps otherwise
+#define DUTYCYCLE_SUPPLY_MV 3300
+#define DUTYCYCLE_SENSOR_ACTIVE_UA 19000
+#define DUTYCYCLE_SENSOR_IDLE_UA 16
+#define DUTYCYCLE_MCU_ACTIVE_UA 3000
+
+// Headroom of the inter-measurement period over the timing budget
+#define DUTYCYCLE_PERIOD_MARGIN_MS 4
+
+static bool dutycycleApply(dutycycle_t *self, uint32_t period_ms, uint32_t budget_us);
+static uint32_t dutycycleSensorBudget(dutycycle_t *self);
+static uint32_t dutycycleCycleUs(dutycycle_t *self);
+
+// Initialize a duty cycle manager of an initialized sensor, in back-to-back
+// ranging until a period is set
+void dutycycle_init(dutycycle_t *self, vl53l0x_t *sensor)
+{
+    memset(self, 0, sizeof(*self));
+
+    self->_sensor = sensor;
+    self->_budget_us = dutycycleSensorBudget(self);
+    self->_last_tick = bc_tick_get();
+}
+
+// Sample every period_ms in timed continuous ranging, so the sensor idles
+// between measurements and the core sleeps until the data ready interrupt;
+// 0 selects back-to-back ranging. The timing budget is shortened if it does
+// not fit the period, down to the 20 ms minimum; fails if even that does not
+// fit or the sensor does not take the shortened budget, keeping the previous
+// period and budget.
+bool dutycycle_set_period(dutycycle_t *self, uint32_t period_ms)
+{
+    uint32_t budget_us = self->_budget_us;
+
+    if (period_ms != 0)
+    {
+        if (period_ms < 20 + DUTYCYCLE_PERIOD_MARGIN_MS)
+        {
+            return false;
+        }
+
+        if (budget_us > (period_ms - DUTYCYCLE_PERIOD_MARGIN_MS) * 1000)
+        {
+            budget_us = (period_ms - DUTYCYCLE_PERIOD_MARGIN_MS) * 1000;
+        }
+    }
+
+    dutycycle_update(self);
+
+    return dutycycleApply(self, period_ms, budget_us);
+}
+
+// Pick the shortest period at which the sensor and its I2C traffic stay
+// within an average power of power_uw at the current timing budget. The I2C
+// energy per sample is taken from the traffic accounted since the last reset
+// of the energy figures.
+bool dutycycle_set_power(dutycycle_t *self, uint32_t power_uw)
+{
+    uint64_t idle_uw = (uint64_t) DUTYCYCLE_SENSOR_IDLE_UA * DUTYCYCLE_SUPPLY_MV / 1000;
+
+    if (power_uw <= idle_uw)
+    {
+        return false;
+    }
+
+    dutycycle_update(self);
+
+    // energy of one measurement beyond idling through it, in nJ
+    uint64_t sample_nj = (uint64_t) (DUTYCYCLE_SENSOR_ACTIVE_UA - DUTYCYCLE_SENSOR_IDLE_UA) * DUTYCYCLE_SUPPLY_MV * self->_budget_us / 1000000;
+
+    uint64_t samples = self->_sensor_time_us / self->_budget_us;
+
+    if (samples != 0)
+    {
+        sample_nj += (uint64_t) DUTYCYCLE_MCU_ACTIVE_UA * DUTYCYCLE_SUPPLY_MV * self->_bus_time_us / 1000000 / samples;
+    }
+
+    // power = (sample + idle * period) / period, with nJ / ms = uW
+    uint64_t period_ms = (sample_nj + (power_uw - idle_uw) - 1) / (power_uw - idle_uw);
+
+    if (period_ms < self->_budget_us / 1000 + DUTYCYCLE_PERIOD_MARGIN_MS)
+    {
+        period_ms = self->_budget_us / 1000 + DUTYCYCLE_PERIOD_MARGIN_MS;
+    }
+
+    return dutycycle_set_period(self, period_ms > UINT32_MAX ? UINT32_MAX : (uint32_t) period_ms);
+}
+
+// Change the timing budget; in timed ranging the period grows if needed to
+// keep room for it. Fails if the sensor does not take the budget, keeping the
+// previous one.
+bool dutycycle_set_budget(dutycycle_t *self, uint32_t budget_us)
+{
+    uint32_t period_ms = self->_period_ms;
+
+    if (budget_us < 20000)
+    {
+        return false;
+    }
+
+    dutycycle_update(self);
+
+    if (period_ms != 0 && period_ms < budget_us / 1000 + DUTYCYCLE_PERIOD_MARGIN_MS)
+    {
+        period_ms = budget_us / 1000 + DUTYCYCLE_PERIOD_MARGIN_MS;
+    }
+
+    return dutycycleApply(self, period_ms, budget_us);
+}
+
+// Get the timing budget in effect, as last requested
+uint32_t dutycycle_get_budget(dutycycle_t *self)
+{
+    return self->_budget_us;
+}
+
+uint32_t dutycycle_get_period(dutycycle_t *self)
+{
+    return self->_period_ms;
+}
+
+// Start ranging; a budget set while stopped that the sensor does not take
+// falls back to the one it keeps
+void dutycycle_start(dutycycle_t *self)
+{
+    dutycycle_update(self);
+
+    self->_running = true;
+
+    dutycycleApply(self, self->_period_ms, self->_budget_us);
+}
+
+void dutycycle_stop(dutycycle_t *self)
+{
+    dutycycle_update(self);
+
+    vl53l0x_stop_continuous(self->_sensor);
+
+    self->_running = false;
+}
+
+// Account the energy spent since the last update: the sensor ranging for the
+// budget of every cycle and idling for the rest of it, and the MCU for the
+// modeled bus time of the I2C traffic. Called by the configuration changes;
+// call it before reading the figures.
+void dutycycle_update(dutycycle_t *self)
+{
+    bc_tick_t now = bc_tick_get();
+    uint64_t elapsed_ms = now - self->_last_tick;
+    vl53l0x_bus_stats_t bus_stats;
+
+    vl53l0x_get_bus_stats(self->_sensor, &bus_stats);
+
+    // the bus statistics may have been reset in the meantime
+    uint32_t bus_time_us = bus_stats.bus_time_us >= self->_last_bus_time_us ? bus_stats.bus_time_us - self->_last_bus_time_us : bus_stats.bus_time_us;
+
+    if (self->_running)
+    {
+        uint32_t cycle_us = dutycycleCycleUs(self);
+        uint64_t active_us = elapsed_ms * 1000 * self->_budget_us / cycle_us;
+
+        self->_energy_nj += (uint64_t) DUTYCYCLE_SENSOR_ACTIVE_UA * DUTYCYCLE_SUPPLY_MV * active_us / 1000000;
+        self->_energy_nj += (uint64_t) DUTYCYCLE_SENSOR_IDLE_UA * DUTYCYCLE_SUPPLY_MV * (elapsed_ms * 1000 - active_us) / 1000000;
+        self->_sensor_time_us += active_us;
+    }
+    else
+    {
+        self->_energy_nj += (uint64_t) DUTYCYCLE_SENSOR_IDLE_UA * DUTYCYCLE_SUPPLY_MV * elapsed_ms / 1000;
+    }
+
+    self->_energy_nj += (uint64_t) DUTYCYCLE_MCU_ACTIVE_UA * DUTYCYCLE_SUPPLY_MV * bus_time_us / 1000000;
+    self->_bus_time_us += bus_time_us;
+    self->_elapsed_ms += elapsed_ms;
+
+    self->_last_tick = now;
+    self->_last_bus_time_us = bus_stats.bus_time_us;
+}
+
+void dutycycle_reset_energy(dutycycle_t *self)
+{
+    dutycycle_update(self);
+
+    self->_energy_nj = 0;
+    self->_bus_time_us = 0;
+    self->_sensor_time_us = 0;
+    self->_elapsed_ms = 0;
+}
+
+// Estimated energy per measurement in uJ since the last reset
+uint32_t dutycycle_get_energy_per_sample(dutycycle_t *self)
+{
+    uint64_t samples = self->_sensor_time_us / self->_budget_us;
+
+    return samples == 0 ? 0 : (uint32_t) (self->_energy_nj / samples / 1000);
+}
+
+// Estimated average power in uW since the last reset
+uint32_t dutycycle_get_average_power(dutycycle_t *self)
+{
+    return self->_elapsed_ms == 0 ? 0 : (uint32_t) (self->_energy_nj / self->_elapsed_ms);
+}
+
+// Hours a battery of capacity_mah would last at the average power, counting
+// the sensor and its I2C traffic only
+uint32_t dutycycle_estimate_battery_life(dutycycle_t *self, uint32_t capacity_mah)
+{
+    uint64_t power_uw = dutycycle_get_average_power(self);
+
+    if (power_uw == 0)
+    {
+        return UINT32_MAX;
+    }
+
+    // mAh * mV = uWh
+    uint64_t hours = (uint64_t) capacity_mah * DUTYCYCLE_SUPPLY_MV / power_uw;
+
+    return hours > UINT32_MAX ? UINT32_MAX : (uint32_t) hours;
+}
+
+// Switch to period_ms and budget_us, restarting ranging with them when running.
+// If the sensor does not take the budget, ranging restarts with the previous
+// settings, or the budget the sensor keeps, and this fails.
+static bool dutycycleApply(dutycycle_t *self, uint32_t period_ms, uint32_t budget_us)
+{
+    if (!self->_running)
+    {
+        self->_period_ms = period_ms;
+        self->_budget_us = budget_us;
+
+        return true;
+    }
+
+    vl53l0x_stop_continuous(self->_sensor);
+
+    bool ok = dutycycleSensorBudget(self) == budget_us || vl53l0x_set_measurement_timing_budget(self->_sensor, budget_us);
+
+    if (ok)
+    {
+        self->_period_ms = period_ms;
+    }
+
+    self->_budget_us = dutycycleSensorBudget(self);
+
+    vl53l0x_start_continuous(self->_sensor, self->_period_ms);
+
+    return ok;
+}
+
+// The budget last set on the sensor, as cached by the driver; recomputing it
+// from the timeout registers gives a different value for the same setting
+static uint32_t dutycycleSensorBudget(dutycycle_t *self)
+{
+    vl53l0x_config_t config;
+
+    vl53l0x_get_config(self->_sensor, &config);
+
+    return config.timing_budget_us;
+}
+
+static uint32_t dutycycleCycleUs(dutycycle_t *self)
+{
+    return self->_period_ms == 0 ? self->_budget_us : self->_period_ms * 1000;
+}
@@ -0,0 +1,36 @@
+#ifndef _DUTYCYCLE_H
+#define _DUTYCYCLE_H
+
+#include <bcl.h>
+#include <vl53l0x.h>
+
+typedef struct
+{
+    vl53l0x_t *_sensor;
+    uint32_t _period_ms; // 0 for back-to-back ranging
+    uint32_t _budget_us;
+    bool _running;
+
+    bc_tick_t _last_tick;
+    uint32_t _last_bus_time_us;
+    uint64_t _energy_nj;
+    uint64_t _bus_time_us;
+    uint64_t _sensor_time_us;
+    uint64_t _elapsed_ms;
+} dutycycle_t;
+
+void dutycycle_init(dutycycle_t *self, vl53l0x_t *sensor);
+bool dutycycle_set_period(dutycycle_t *self, uint32_t period_ms);
+bool dutycycle_set_power(dutycycle_t *self, uint32_t power_uw);
+bool dutycycle_set_budget(dutycycle_t *self, uint32_t budget_us);
+uint32_t dutycycle_get_budget(dutycycle_t *self);
+uint32_t dutycycle_get_period(dutycycle_t *self);
+void dutycycle_start(dutycycle_t *self);
+void dutycycle_stop(dutycycle_t *self);
+void dutycycle_update(dutycycle_t *self);
+void dutycycle_reset_energy(dutycycle_t *self);
+uint32_t dutycycle_get_energy_per_sample(dutycycle_t *self);
+uint32_t dutycycle_get_average_power(dutycycle_t *self);
+uint32_t dutycycle_estimate_battery_life(dutycycle_t *self, uint32_t capacity_mah);
+
+#endif // _DUTYCYCLE_H
@@ -0,0 +1,264 @@
+#include <filter.h>
+
+#define FILTER_DEFAULT_EMA_ALPHA 64 // 0.25 in Q0.8
+
+#if FILTER_KALMAN
+#define FILTER_DEFAULT_PROCESS_NOISE 1000.f // (mm/s^2)^2
+#define FILTER_DEFAULT_MEASUREMENT_NOISE 100.f // mm^2
+#endif
+
+static uint16_t filterMovingAverage(filter_t *self, uint16_t value);
+static uint16_t filterMedian(filter_t *self, uint16_t value);
+static uint16_t filterEma(filter_t *self, uint16_t value);
+#if FILTER_KALMAN
+static uint16_t filterKalman(filter_t *self, uint16_t value, bc_tick_t tick);
+#endif
+static void windowPush(filter_t *self, uint16_t value, uint16_t *evicted);
+
+// Initialize a streaming filter of the given type. window_size applies to the
+// moving average and the running median and is capped at FILTER_WINDOW_MAX.
+void filter_init(filter_t *self, filter_type_t type, uint8_t window_size)
+{
+    memset(self, 0, sizeof(*self));
+
+    self->_type = type;
+    self->_window_size = window_size == 0 ? 1 : window_size > FILTER_WINDOW_MAX ? FILTER_WINDOW_MAX : window_size;
+    self->_ema_alpha = FILTER_DEFAULT_EMA_ALPHA;
+#if FILTER_KALMAN
+    self->_process_noise = FILTER_DEFAULT_PROCESS_NOISE;
+    self->_measurement_noise = FILTER_DEFAULT_MEASUREMENT_NOISE;
+#endif
+}
+
+// Forget all samples but keep the configuration
+void filter_reset(filter_t *self)
+{
+    self->_head = 0;
+    self->_count = 0;
+    self->_sum = 0;
+    self->_ema = 0;
+#if FILTER_KALMAN
+    self->_position = 0;
+    self->_velocity = 0;
+    memset(self->_p, 0, sizeof(self->_p));
+#endif
+}
+
+// Set the EMA smoothing factor in Q0.8 (1 to 256, higher follows faster)
+void filter_set_ema_alpha(filter_t *self, uint16_t alpha)
+{
+    self->_ema_alpha = alpha == 0 ? 1 : alpha > 256 ? 256 : alpha;
+}
+
+#if FILTER_KALMAN
+// Set the Kalman filter process noise (acceleration variance, (mm/s^2)^2) and
+// measurement noise (range variance, mm^2)
+void filter_set_kalman_noise(filter_t *self, float process_noise, float measurement_noise)
+{
+    self->_process_noise = process_noise;
+    self->_measurement_noise = measurement_noise;
+}
+#endif
+
+// Feed one sample taken at the given tick and return the filtered value. Every
+// filter does a constant amount of work per sample, except the running median
+// which is linear in the window size.
+uint16_t filter_feed(filter_t *self, uint16_t value, bc_tick_t tick)
+{
+    switch (self->_type)
+    {
+        case FILTER_TYPE_MOVING_AVERAGE:
+        {
+            return filterMovingAverage(self, value);
+        }
+        case FILTER_TYPE_MEDIAN:
+        {
+            return filterMedian(self, value);
+        }
+        case FILTER_TYPE_EMA:
+        {
+            return filterEma(self, value);
+        }
+#if FILTER_KALMAN
+        case FILTER_TYPE_KALMAN:
+        {
+            return filterKalman(self, value, tick);
+        }
+#endif
+        default:
+        {
+            return value;
+        }
+    }
+}
+
+#if FILTER_KALMAN
+// Get the velocity estimate of the Kalman filter in mm/s
+float filter_get_velocity(filter_t *self)
+{
+    return self->_velocity;
+}
+#endif
+
+static uint16_t filterMovingAverage(filter_t *self, uint16_t value)
+{
+    uint16_t evicted;
+
+    windowPush(self, value, &evicted);
+
+    self->_sum += value;
+    self->_sum -= evicted;
+
+    return (self->_sum + self->_count / 2) / self->_count;
+}
+
+// The window is kept sorted next to the ring buffer; each sample removes the
+// evicted value and inserts the new one by shifting
+static uint16_t filterMedian(filter_t *self, uint16_t value)
+{
+    uint16_t evicted;
+    uint8_t count = self->_count;
+    bool full = count == self->_window_size;
+    uint8_t i;
+
+    windowPush(self, value, &evicted);
+
+    if (full)
+    {
+        for (i = 0; self->_sorted[i] != evicted; i++)
+        {
+            continue;
+        }
+
+        for (; i + 1 < count; i++)
+        {
+            self->_sorted[i] = self->_sorted[i + 1];
+        }
+
+        count--;
+    }
+
+    for (i = count; i > 0 && self->_sorted[i - 1] > value; i--)
+    {
+        self->_sorted[i] = self->_sorted[i - 1];
+    }
+
+    self->_sorted[i] = value;
+
+    count = self->_count;
+
+    if (count & 1)
+    {
+        return self->_sorted[count / 2];
+    }
+
+    return ((uint32_t) self->_sorted[count / 2 - 1] + self->_sorted[count / 2] + 1) / 2;
+}
+
+static uint16_t filterEma(filter_t *self, uint16_t value)
+{
+    uint32_t sample = (uint32_t) value << 8;
+
+    if (self->_count == 0)
+    {
+        self->_count = 1;
+        self->_ema = sample;
+    }
+    else
+    {
+        int64_t step = ((int64_t) sample - (int64_t) self->_ema) * self->_ema_alpha;
+
+        // round the step away from zero so the average always moves by at
+        // least 1/256 mm and settles on the sample from either side
+        self->_ema += step > 0 ? (step + 255) / 256 : (step - 255) / 256;
+    }
+
+    return (self->_ema + 128) >> 8;
+}
+
+#if FILTER_KALMAN
+// Constant velocity model: state is position and velocity, only position is
+// measured
+static uint16_t filterKalman(filter_t *self, uint16_t value, bc_tick_t tick)
+{
+    float z = value;
+
+    if (self->_count == 0)
+    {
+        self->_count = 1;
+        self->_position = z;
+        self->_velocity = 0;
+        self->_p[0][0] = self->_measurement_noise;
+        self->_p[0][1] = 0;
+        self->_p[1][0] = 0;
+        self->_p[1][1] = self->_measurement_noise;
+        self->_last_tick = tick;
+
+        return value;
+    }
+
+    float dt = (float) (tick - self->_last_tick) / 1000.f;
+
+    self->_last_tick = tick;
+
+    // predict
+    self->_position += self->_velocity * dt;
+
+    float dt2 = dt * dt;
+    float q = self->_process_noise;
+
+    float p00 = self->_p[0][0] + dt * (self->_p[1][0] + self->_p[0][1]) + dt2 * self->_p[1][1] + q * dt2 * dt2 / 4;
+    float p01 = self->_p[0][1] + dt * self->_p[1][1] + q * dt2 * dt / 2;
+    float p10 = self->_p[1][0] + dt * self->_p[1][1] + q * dt2 * dt / 2;
+    float p11 = self->_p[1][1] + q * dt2;
+
+    // update
+    float s = p00 + self->_measurement_noise;
+    float k0 = p00 / s;
+    float k1 = p10 / s;
+    float y = z - self->_position;
+
+    self->_position += k0 * y;
+    self->_velocity += k1 * y;
+
+    self->_p[0][0] = (1 - k0) * p00;
+    self->_p[0][1] = (1 - k0) * p01;
+    self->_p[1][0] = p10 - k1 * p00;
+    self->_p[1][1] = p11 - k1 * p01;
+
+    if (self->_position < 0)
+    {
+        return 0;
+    }
+
+    if (self->_position > UINT16_MAX)
+    {
+        return UINT16_MAX;
+    }
+
+    return self->_position + 0.5f;
+}
+#endif
+
+// Append a value to the ring buffer; evicted receives the value that dropped
+// out of a full window, or 0
+static void windowPush(filter_t *self, uint16_t value, uint16_t *evicted)
+{
+    *evicted = 0;
+
+    if (self->_count == self->_window_size)
+    {
+        *evicted = self->_window[self->_head];
+    }
+    else
+    {
+        self->_count++;
+    }
+
+    self->_window[self->_head] = value;
+
+    if (++self->_head == self->_window_size)
+    {
+        self->_head = 0;
+    }
+}
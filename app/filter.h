@@ -0,0 +1,59 @@
+#ifndef _FILTER_H
+#define _FILTER_H
+
+#include <bcl.h>
+
+#define FILTER_WINDOW_MAX 16
+
+// Set to 1 to compile in the Kalman filter; it is floating point, which is
+// soft-float library calls on the FPU-less STM32L0
+#ifndef FILTER_KALMAN
+#define FILTER_KALMAN 0
+#endif
+
+typedef enum
+{
+    FILTER_TYPE_MOVING_AVERAGE,
+    FILTER_TYPE_MEDIAN,
+    FILTER_TYPE_EMA,
+#if FILTER_KALMAN
+    FILTER_TYPE_KALMAN
+#endif
+} filter_type_t;
+
+typedef struct
+{
+    filter_type_t _type;
+
+    uint16_t _window[FILTER_WINDOW_MAX];
+    uint8_t _window_size;
+    uint8_t _head;
+    uint8_t _count;
+
+    uint32_t _sum;
+    uint16_t _sorted[FILTER_WINDOW_MAX];
+
+    uint16_t _ema_alpha; // Q0.8
+    uint32_t _ema;       // Q16.8
+
+#if FILTER_KALMAN
+    float _position;
+    float _velocity;
+    float _p[2][2];
+    float _process_noise;
+    float _measurement_noise;
+    bc_tick_t _last_tick;
+#endif
+} filter_t;
+
+void filter_init(filter_t *self, filter_type_t type, uint8_t window_size);
+void filter_reset(filter_t *self);
+void filter_set_ema_alpha(filter_t *self, uint16_t alpha);
+uint16_t filter_feed(filter_t *self, uint16_t value, bc_tick_t tick);
+
+#if FILTER_KALMAN
+void filter_set_kalman_noise(filter_t *self, float process_noise, float measurement_noise);
+float filter_get_velocity(filter_t *self);
+#endif
+
+#endif // _FILTER_H
@@ -0,0 +1,77 @@
+#include <stream.h>
+#include <util.h>
+
+static void streamPut16(uint8_t *buffer, uint16_t value);
+static void streamPut32(uint8_t *buffer, uint32_t value);
+
+// Initialize a binary sample stream that hands every completed frame to write
+void stream_init(stream_t *self, stream_write_t write, void *param)
+{
+    memset(self, 0, sizeof(*self));
+
+    self->_write = write;
+    self->_param = param;
+}
+
+// Add a sample taken at tick; a full frame goes out at once
+void stream_feed(stream_t *self, const vl53l0x_result_t *result, bc_tick_t tick)
+{
+    uint8_t *sample = &self->_frame[STREAM_HEADER_SIZE + self->_count * STREAM_SAMPLE_SIZE];
+    bc_tick_t delta = 0;
+
+    if (self->_count == 0)
+    {
+        streamPut32(&self->_frame[4], (uint32_t) tick);
+    }
+    else
+    {
+        delta = tick - self->_last_tick;
+    }
+
+    streamPut16(&sample[0], delta > UINT16_MAX ? UINT16_MAX : (uint16_t) delta);
+    streamPut16(&sample[2], result->range_mm);
+    sample[4] = (uint8_t) (result->validity & 0x0F) | (uint8_t) (result->range_status << 4);
+    streamPut16(&sample[5], result->signal_rate);
+
+    self->_last_tick = tick;
+
+    if (++self->_count == STREAM_FRAME_SAMPLES)
+    {
+        stream_flush(self);
+    }
+}
+
+// Send the frame in progress, if any; the unused sample slots go out zeroed
+void stream_flush(stream_t *self)
+{
+    if (self->_count == 0)
+    {
+        return;
+    }
+
+    self->_frame[0] = STREAM_SYNC_0;
+    self->_frame[1] = STREAM_SYNC_1;
+    streamPut16(&self->_frame[2], self->_sequence);
+    self->_frame[8] = self->_count;
+
+    memset(&self->_frame[STREAM_HEADER_SIZE + self->_count * STREAM_SAMPLE_SIZE], 0, (STREAM_FRAME_SAMPLES - self->_count) * STREAM_SAMPLE_SIZE);
+
+    streamPut16(&self->_frame[STREAM_FRAME_SIZE - 2], util_crc16(&self->_frame[2], STREAM_FRAME_SIZE - 4));
+
+    self->_write(self->_frame, STREAM_FRAME_SIZE, self->_param);
+
+    self->_sequence++;
+    self->_count = 0;
+}
+
+static void streamPut16(uint8_t *buffer, uint16_t value)
+{
+    buffer[0] = value & 0xFF;
+    buffer[1] = value >> 8;
+}
+
+static void streamPut32(uint8_t *buffer, uint32_t value)
+{
+    streamPut16(&buffer[0], value & 0xFFFF);
+    streamPut16(&buffer[2], value >> 16);
+}
@@ -0,0 +1,48 @@
+#ifndef _STREAM_H
+#define _STREAM_H
+
+// Frame layout, multi-byte fields little endian:
+//   0  sync        2  0xA5 0x5A
+//   2  sequence    2  frame counter, wraps
+//   4  tick        4  absolute tick of the first sample, ms
+//   8  count       1  valid samples, the rest of the slots is zero
+//   9  samples     STREAM_FRAME_SAMPLES * STREAM_SAMPLE_SIZE
+//  -2  crc         2  CRC-16/CCITT-FALSE over sequence through samples
+// and each sample:
+//   0  delta tick  2  ms since the previous sample of the frame, saturated
+//   2  range       2  mm
+//   4  status      1  validity in bits 3:0, device range status in bits 7:4
+//   5  signal rate 2  MCPS, Q9.7
+#define STREAM_SYNC_0 0xA5
+#define STREAM_SYNC_1 0x5A
+#define STREAM_FRAME_SAMPLES 8
+#define STREAM_HEADER_SIZE 9
+#define STREAM_SAMPLE_SIZE 7
+#define STREAM_FRAME_SIZE (STREAM_HEADER_SIZE + STREAM_FRAME_SAMPLES * STREAM_SAMPLE_SIZE + 2)
+
+// The host decoder (tools/stream_decode.c) takes the layout above only
+#ifndef STREAM_LAYOUT_ONLY
+
+#include <bcl.h>
+#include <vl53l0x.h>
+
+typedef void (*stream_write_t)(const uint8_t *buffer, size_t length, void *param);
+
+typedef struct
+{
+    stream_write_t _write;
+    void *_param;
+
+    uint8_t _frame[STREAM_FRAME_SIZE];
+    uint16_t _sequence;
+    uint8_t _count;
+    bc_tick_t _last_tick;
+} stream_t;
+
+void stream_init(stream_t *self, stream_write_t write, void *param);
+void stream_feed(stream_t *self, const vl53l0x_result_t *result, bc_tick_t tick);
+void stream_flush(stream_t *self);
+
+#endif // STREAM_LAYOUT_ONLY
+
+#endif // _STREAM_H
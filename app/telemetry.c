@@ -0,0 +1,191 @@
+#include <telemetry.h>
+#include <util.h>
+
+static void telemetryTask(void *param);
+static void telemetryEmit(telemetry_t *self, bool change);
+static void telemetryPut16(uint8_t *buffer, uint16_t value);
+
+// Initialize an aggregation stage that sends a summary of the samples to its
+// sinks every window_ms, and early when the mean of the current window moves
+// change_mm or more from the last summary sent (0 disables that)
+void telemetry_init(telemetry_t *self, bc_tick_t window_ms, uint16_t change_mm)
+{
+    memset(self, 0, sizeof(*self));
+
+    self->_window_ms = window_ms;
+    self->_change_mm = change_mm;
+    self->_window_start = bc_tick_get();
+    self->_task_id = bc_scheduler_register(telemetryTask, self, self->_window_start + window_ms);
+}
+
+bool telemetry_add_sink(telemetry_t *self, telemetry_sink_t sink, void *param)
+{
+    if (self->_sink_count == TELEMETRY_SINKS_MAX)
+    {
+        return false;
+    }
+
+    self->_sinks[self->_sink_count] = sink;
+    self->_sink_params[self->_sink_count] = param;
+    self->_sink_count++;
+
+    return true;
+}
+
+void telemetry_feed(telemetry_t *self, const vl53l0x_result_t *result)
+{
+    if (self->_count < UINT16_MAX)
+    {
+        self->_count++;
+    }
+
+    if (result->validity != VL53L0X_VALIDITY_VALID || self->_valid == UINT16_MAX)
+    {
+        return;
+    }
+
+    if (self->_valid == 0 || result->range_mm < self->_min_mm)
+    {
+        self->_min_mm = result->range_mm;
+    }
+
+    if (self->_valid == 0 || result->range_mm > self->_max_mm)
+    {
+        self->_max_mm = result->range_mm;
+    }
+
+    self->_valid++;
+    self->_sum += result->range_mm;
+    self->_sum_squares += (uint32_t) result->range_mm * result->range_mm;
+
+    if (self->_change_mm != 0 && self->_have_last && self->_valid >= TELEMETRY_CHANGE_MIN_SAMPLES)
+    {
+        uint16_t mean_mm = self->_sum / self->_valid;
+        uint16_t delta = mean_mm > self->_last_mean_mm ? mean_mm - self->_last_mean_mm : self->_last_mean_mm - mean_mm;
+
+        if (delta >= self->_change_mm)
+        {
+            telemetryEmit(self, true);
+        }
+    }
+}
+
+// Send the summary of the current window now and start a new one
+void telemetry_flush(telemetry_t *self)
+{
+    telemetryEmit(self, false);
+}
+
+// Pack a summary into TELEMETRY_PACKED_SIZE bytes for the binary sinks
+size_t telemetry_pack(const telemetry_summary_t *summary, uint8_t *buffer)
+{
+    telemetryPut16(&buffer[0], summary->sequence);
+    telemetryPut16(&buffer[2], summary->duration_ms & 0xFFFF);
+    telemetryPut16(&buffer[4], summary->duration_ms >> 16);
+    telemetryPut16(&buffer[6], summary->count);
+    telemetryPut16(&buffer[8], summary->valid);
+    telemetryPut16(&buffer[10], summary->min_mm);
+    telemetryPut16(&buffer[12], summary->max_mm);
+    telemetryPut16(&buffer[14], summary->mean_mm);
+    telemetryPut16(&buffer[16], summary->stddev_mm);
+    buffer[18] = summary->change ? TELEMETRY_FLAG_CHANGE : 0;
+
+    return TELEMETRY_PACKED_SIZE;
+}
+
+void telemetry_sink_log(const telemetry_summary_t *summary, void *param)
+{
+    (void) param;
+
+    bc_log_info("telemetry %u%s: %u samples in %lu ms, %u%% valid, %u/%u/%u mm min/mean/max, stddev %u mm",
+                summary->sequence, summary->change ? " (change)" : "", summary->count, (unsigned long) summary->duration_ms,
+                summary->count != 0 ? (unsigned) (summary->valid * 100UL / summary->count) : 0,
+                summary->min_mm, summary->mean_mm, summary->max_mm, summary->stddev_mm);
+}
+
+// Binary frame on the UART the bc_uart_channel_t param points to
+void telemetry_sink_uart(const telemetry_summary_t *summary, void *param)
+{
+    const bc_uart_channel_t *channel = param;
+    uint8_t frame[2 + TELEMETRY_PACKED_SIZE + 2];
+
+    frame[0] = TELEMETRY_UART_SYNC_0;
+    frame[1] = TELEMETRY_UART_SYNC_1;
+    telemetry_pack(summary, &frame[2]);
+    telemetryPut16(&frame[2 + TELEMETRY_PACKED_SIZE], util_crc16(&frame[2], TELEMETRY_PACKED_SIZE));
+
+    bc_uart_write(*channel, frame, sizeof(frame));
+}
+
+// Packed summary as one radio buffer message; the radio has to be initialized
+void telemetry_sink_radio(const telemetry_summary_t *summary, void *param)
+{
+    (void) param;
+
+    uint8_t buffer[TELEMETRY_PACKED_SIZE];
+
+    telemetry_pack(summary, buffer);
+
+    bc_radio_pub_buffer(buffer, sizeof(buffer));
+}
+
+static void telemetryTask(void *param)
+{
+    telemetry_t *self = param;
+
+    telemetryEmit(self, false);
+}
+
+// Summarize the window for all sinks and start the next one, due a full
+// window later; an empty window sends nothing
+static void telemetryEmit(telemetry_t *self, bool change)
+{
+    bc_tick_t now = bc_tick_get();
+
+    if (self->_count != 0)
+    {
+        telemetry_summary_t summary;
+
+        memset(&summary, 0, sizeof(summary));
+
+        summary.sequence = self->_sequence++;
+        summary.duration_ms = now - self->_window_start;
+        summary.count = self->_count;
+        summary.valid = self->_valid;
+        summary.change = change;
+
+        if (self->_valid != 0)
+        {
+            // n^2 var = n sum(x^2) - sum(x)^2, exact in integers
+            uint64_t scaled_variance = self->_valid * self->_sum_squares - (uint64_t) self->_sum * self->_sum;
+            uint64_t variance_x4 = scaled_variance * 4 / self->_valid / self->_valid;
+
+            summary.min_mm = self->_min_mm;
+            summary.max_mm = self->_max_mm;
+            summary.mean_mm = (self->_sum + self->_valid / 2) / self->_valid;
+            summary.stddev_mm = (util_isqrt(variance_x4 > UINT32_MAX ? UINT32_MAX : (uint32_t) variance_x4) + 1) / 2;
+
+            self->_have_last = true;
+            self->_last_mean_mm = summary.mean_mm;
+        }
+
+        for (uint8_t i = 0; i < self->_sink_count; i++)
+        {
+            self->_sinks[i](&summary, self->_sink_params[i]);
+        }
+    }
+
+    self->_window_start = now;
+    self->_count = 0;
+    self->_valid = 0;
+    self->_sum = 0;
+    self->_sum_squares = 0;
+
+    bc_scheduler_plan_absolute(self->_task_id, now + self->_window_ms);
+}
+
+static void telemetryPut16(uint8_t *buffer, uint16_t value)
+{
+    buffer[0] = value & 0xFF;
+    buffer[1] = value >> 8;
+}
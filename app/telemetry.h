@@ -0,0 +1,68 @@
+#ifndef _TELEMETRY_H
+#define _TELEMETRY_H
+
+#include <bcl.h>
+#include <vl53l0x.h>
+
+#define TELEMETRY_SINKS_MAX 4
+
+// Valid samples a window needs before its mean can trigger a change summary
+#define TELEMETRY_CHANGE_MIN_SAMPLES 3
+
+// Packed summary, little endian: sequence 2, duration ms 4, count 2, valid 2,
+// min 2, max 2, mean 2, stddev 2 (all mm), flags 1
+#define TELEMETRY_PACKED_SIZE 19
+#define TELEMETRY_FLAG_CHANGE 0x01
+
+// UART frame: sync 0xA5 0x5B, packed summary, CRC-16/CCITT-FALSE over it
+#define TELEMETRY_UART_SYNC_0 0xA5
+#define TELEMETRY_UART_SYNC_1 0x5B
+
+// Range statistics cover the valid samples only
+typedef struct
+{
+    uint16_t sequence;
+    uint32_t duration_ms;
+    uint16_t count;
+    uint16_t valid;
+    uint16_t min_mm;
+    uint16_t max_mm;
+    uint16_t mean_mm;
+    uint16_t stddev_mm;
+    bool change; // sent before the end of the window on a significant change
+} telemetry_summary_t;
+
+typedef void (*telemetry_sink_t)(const telemetry_summary_t *summary, void *param);
+
+typedef struct
+{
+    bc_tick_t _window_ms;
+    uint16_t _change_mm;
+
+    telemetry_sink_t _sinks[TELEMETRY_SINKS_MAX];
+    void *_sink_params[TELEMETRY_SINKS_MAX];
+    uint8_t _sink_count;
+
+    bc_scheduler_task_id_t _task_id;
+    bc_tick_t _window_start;
+    uint16_t _sequence;
+    uint16_t _count;
+    uint16_t _valid;
+    uint16_t _min_mm;
+    uint16_t _max_mm;
+    uint32_t _sum;
+    uint64_t _sum_squares;
+    bool _have_last;
+    uint16_t _last_mean_mm;
+} telemetry_t;
+
+void telemetry_init(telemetry_t *self, bc_tick_t window_ms, uint16_t change_mm);
+bool telemetry_add_sink(telemetry_t *self, telemetry_sink_t sink, void *param);
+void telemetry_feed(telemetry_t *self, const vl53l0x_result_t *result);
+void telemetry_flush(telemetry_t *self);
+size_t telemetry_pack(const telemetry_summary_t *summary, uint8_t *buffer);
+void telemetry_sink_log(const telemetry_summary_t *summary, void *param);
+void telemetry_sink_uart(const telemetry_summary_t *summary, void *param);
+void telemetry_sink_radio(const telemetry_summary_t *summary, void *param);
+
+#endif // _TELEMETRY_H
@@ -0,0 +1,50 @@
+#include <util.h>
+
+// CRC-16/CCITT-FALSE, of the calibration record and the stream and telemetry
+// frames
+uint16_t util_crc16(const uint8_t *buffer, size_t length)
+{
+    uint16_t crc = 0xFFFF;
+
+    for (size_t i = 0; i < length; i++)
+    {
+        crc ^= (uint16_t) buffer[i] << 8;
+
+        for (uint8_t bit = 0; bit < 8; bit++)
+        {
+            crc = (crc & 0x8000) ? (uint16_t) ((crc << 1) ^ 0x1021) : (uint16_t) (crc << 1);
+        }
+    }
+
+    return crc;
+}
+
+// Integer square root, rounded down; for the sigma estimate of the driver and
+// the telemetry statistics
+uint32_t util_isqrt(uint32_t value)
+{
+    uint32_t root = 0;
+    uint32_t bit = (uint32_t) 1 << 30;
+
+    while (bit > value)
+    {
+        bit >>= 2;
+    }
+
+    while (bit != 0)
+    {
+        if (value >= root + bit)
+        {
+            value -= root + bit;
+            root = (root >> 1) + bit;
+        }
+        else
+        {
+            root >>= 1;
+        }
+
+        bit >>= 2;
+    }
+
+    return root;
+}
@@ -0,0 +1,13 @@
+#ifndef _UTIL_H
+#define _UTIL_H
+
+#include <stddef.h>
+#include <stdint.h>
+
+// Helpers shared by the application modules; free of the SDK so that the
+// host tools can build them too
+
+uint16_t util_crc16(const uint8_t *buffer, size_t length);
+uint32_t util_isqrt(uint32_t value);
+
+#endif // _UTIL_H
@@ -4,13 +4,25 @@
 // VL53L0X datasheet.
 
 #include <vl53l0x.h>
+#include <util.h>
 #include <bc_i2c.h>
+#include <bc_gpio.h>
+#include <bc_timer.h>
+#include <stm32l0xx.h>
 
-// Record the current time to check an upcoming timeout against
-#define startTimeout() (timeout_start_ms = bc_tick_get())
+#if VL53L0X_INTERRUPT_THRESHOLD_SETTINGS
+#include <vl53l0x_interrupt_threshold_settings.h>
+#endif
 
-// Check if timeout is enabled (set to nonzero value) and has expired
-#define checkTimeoutExpired() (io_timeout > 0 && (bc_tick_get() - timeout_start_ms) > io_timeout)
+// Record the current time and bus error count to check an upcoming timeout
+// against
+#define startTimeout() (self->_timeout_start_errors = self->_bus_errors, self->_timeout_start_ms = bc_tick_get())
+
+// Check if timeout is enabled (set to nonzero value) and has expired; a failed
+// bus transaction since the start expires it at once, as polling on would only
+// read back garbage
+#define checkTimeoutExpired() (self->_bus_errors != self->_timeout_start_errors || \
+                               (self->_io_timeout > 0 && (bc_tick_get() - self->_timeout_start_ms) > self->_io_timeout))
 
 // Decode VCSEL (vertical cavity surface emitting laser) pulse period in PCLKs
 // from register value
@@ -129,15 +141,335 @@ typedef struct
     uint32_t msrc_dss_tcc_us,    pre_range_us,    final_range_us;
 } SequenceStepTimeouts;
 
-uint8_t stop_variable; // read by init and used when starting measurement; is StopVariable field of VL53L0X_DevData_t structure in API
-uint32_t measurement_timing_budget_us;
+// DefaultTuningSettings from vl53l0x_tuning.h, as (register, value) pairs
+// replayed by writeSequence()
+static const uint8_t tuning_settings[][2] =
+{
+    { 0xFF, 0x01 },
+    { 0x00, 0x00 },
+
+    { 0xFF, 0x00 },
+    { 0x09, 0x00 },
+    { 0x10, 0x00 },
+    { 0x11, 0x00 },
+
+    { 0x24, 0x01 },
+    { 0x25, 0xFF },
+    { 0x75, 0x00 },
+
+    { 0xFF, 0x01 },
+    { 0x4E, 0x2C },
+    { 0x48, 0x00 },
+    { 0x30, 0x20 },
+
+    { 0xFF, 0x00 },
+    { 0x30, 0x09 },
+    { 0x54, 0x00 },
+    { 0x31, 0x04 },
+    { 0x32, 0x03 },
+    { 0x40, 0x83 },
+    { 0x46, 0x25 },
+    { 0x60, 0x00 },
+    { 0x27, 0x00 },
+    { 0x50, 0x06 },
+    { 0x51, 0x00 },
+    { 0x52, 0x96 },
+    { 0x56, 0x08 },
+    { 0x57, 0x30 },
+    { 0x61, 0x00 },
+    { 0x62, 0x00 },
+    { 0x64, 0x00 },
+    { 0x65, 0x00 },
+    { 0x66, 0xA0 },
+
+    { 0xFF, 0x01 },
+    { 0x22, 0x32 },
+    { 0x47, 0x14 },
+    { 0x49, 0xFF },
+    { 0x4A, 0x00 },
+
+    { 0xFF, 0x00 },
+    { 0x7A, 0x0A },
+    { 0x7B, 0x00 },
+    { 0x78, 0x21 },
+
+    { 0xFF, 0x01 },
+    { 0x23, 0x34 },
+    { 0x42, 0x00 },
+    { 0x44, 0xFF },
+    { 0x45, 0x26 },
+    { 0x46, 0x05 },
+    { 0x40, 0x40 },
+    { 0x0E, 0x06 },
+    { 0x20, 0x1A },
+    { 0x43, 0x40 },
+
+    { 0xFF, 0x00 },
+    { 0x34, 0x03 },
+    { 0x35, 0x44 },
+
+    { 0xFF, 0x01 },
+    { 0x31, 0x04 },
+    { 0x4B, 0x09 },
+    { 0x4C, 0x05 },
+    { 0x4D, 0x04 },
+
+    { 0xFF, 0x00 },
+    { 0x44, 0x00 },
+    { 0x45, 0x20 },
+    { 0x47, 0x08 },
+    { 0x48, 0x28 },
+    { 0x67, 0x00 },
+    { 0x70, 0x04 },
+    { 0x71, 0x01 },
+    { 0x72, 0xFE },
+    { 0x76, 0x00 },
+    { 0x77, 0x00 },
+
+    { 0xFF, 0x01 },
+    { 0x0D, 0x01 },
+
+    { 0xFF, 0x00 },
+    { 0x80, 0x01 },
+    { 0x01, 0xF8 },
+
+    { 0xFF, 0x01 },
+    { 0x8E, 0x01 },
+    { 0x00, 0x01 },
+    { 0xFF, 0x00 },
+    { 0x80, 0x00 }
+};
+
+// Final range phase check limits and phase calibration settings per VCSEL
+// period, from VL53L0X_set_vcsel_pulse_period(); the phase check limits are
+// written low byte first so that they go out in one burst
+static const uint8_t final_range_vcsel_period_8[][2] =
+{
+    { FINAL_RANGE_CONFIG_VALID_PHASE_LOW,  0x08 },
+    { FINAL_RANGE_CONFIG_VALID_PHASE_HIGH, 0x10 },
+    { GLOBAL_CONFIG_VCSEL_WIDTH,           0x02 },
+    { ALGO_PHASECAL_CONFIG_TIMEOUT,        0x0C },
+    { 0xFF,                                0x01 },
+    { ALGO_PHASECAL_LIM,                   0x30 },
+    { 0xFF,                                0x00 }
+};
+
+static const uint8_t final_range_vcsel_period_10[][2] =
+{
+    { FINAL_RANGE_CONFIG_VALID_PHASE_LOW,  0x08 },
+    { FINAL_RANGE_CONFIG_VALID_PHASE_HIGH, 0x28 },
+    { GLOBAL_CONFIG_VCSEL_WIDTH,           0x03 },
+    { ALGO_PHASECAL_CONFIG_TIMEOUT,        0x09 },
+    { 0xFF,                                0x01 },
+    { ALGO_PHASECAL_LIM,                   0x20 },
+    { 0xFF,                                0x00 }
+};
+
+static const uint8_t final_range_vcsel_period_12[][2] =
+{
+    { FINAL_RANGE_CONFIG_VALID_PHASE_LOW,  0x08 },
+    { FINAL_RANGE_CONFIG_VALID_PHASE_HIGH, 0x38 },
+    { GLOBAL_CONFIG_VCSEL_WIDTH,           0x03 },
+    { ALGO_PHASECAL_CONFIG_TIMEOUT,        0x08 },
+    { 0xFF,                                0x01 },
+    { ALGO_PHASECAL_LIM,                   0x20 },
+    { 0xFF,                                0x00 }
+};
+
+static const uint8_t final_range_vcsel_period_14[][2] =
+{
+    { FINAL_RANGE_CONFIG_VALID_PHASE_LOW,  0x08 },
+    { FINAL_RANGE_CONFIG_VALID_PHASE_HIGH, 0x48 },
+    { GLOBAL_CONFIG_VCSEL_WIDTH,           0x03 },
+    { ALGO_PHASECAL_CONFIG_TIMEOUT,        0x07 },
+    { 0xFF,                                0x01 },
+    { ALGO_PHASECAL_LIM,                   0x20 },
+    { 0xFF,                                0x00 }
+};
+
+// Settings of the ranging profiles, indexed by vl53l0x_profile_t; as in the
+// ST API examples, long range also raises both VCSEL periods
+static const vl53l0x_config_t profile_configs[] =
+{
+    [VL53L0X_PROFILE_DEFAULT]       = { VL53L0X_MCPS_TO_Q97(0.25), VL53L0X_DEFAULT_SIGMA_LIMIT_MM, 14, 10, 33000 },
+    [VL53L0X_PROFILE_HIGH_SPEED]    = { VL53L0X_MCPS_TO_Q97(0.25), 32, 14, 10, 20000 },
+    [VL53L0X_PROFILE_HIGH_ACCURACY] = { VL53L0X_MCPS_TO_Q97(0.25), 18, 14, 10, 200000 },
+    [VL53L0X_PROFILE_LONG_RANGE]    = { VL53L0X_MCPS_TO_Q97(0.1), 60, 18, 14, 33000 }
+};
+
+// Sequence of vl53l0x_stop_continuous(), based on VL53L0X_StopMeasurement()
+static const uint8_t stop_continuous_sequence[][2] =
+{
+    { SYSRANGE_START, 0x01 }, // VL53L0X_REG_SYSRANGE_MODE_SINGLESHOT
+    { 0xFF,           0x01 },
+    { 0x00,           0x00 },
+    { 0x91,           0x00 },
+    { 0x00,           0x01 },
+    { 0xFF,           0x00 }
+};
+
+// Undoes the interrupt threshold settings when ranging stops, from
+// VL53L0X_CheckAndLoadInterruptSettings()
+static const uint8_t interrupt_threshold_unload_sequence[][2] =
+{
+    { 0xFF, 0x04 },
+    { 0x70, 0x00 },
+    { 0xFF, 0x00 },
+    { 0x80, 0x00 }
+};
+
+// RESULT_RANGE_STATUS through the range itself, as read by
+// VL53L0X_GetRangingMeasurementData()
+#define RESULT_BLOCK_LENGTH 12
+
+// Constants of VL53L0X_calc_sigma_estimate(): effective widths of the VCSEL
+// pulse and of the ambient window in hundredths of a ns, the speed of light in
+// um per 100 ps, the integration time at which the reference sigma is 1 mm, and
+// the clip of the ambient to signal ratio and of the result
+#define SIGMA_PULSE_WIDTH_CENTI_NS 800
+#define SIGMA_AMBIENT_WIDTH_CENTI_NS 600
+#define SIGMA_SPEED_OF_LIGHT 2997
+#define SIGMA_REF_INTEGRATION_MS 25
+#define SIGMA_AMBIENT_RATIO_MAX 100
+#define SIGMA_ESTIMATE_MAX_MM 650
+
+// Longest run of consecutive registers merged into one write by writeSequence()
+#define SEQUENCE_BURST_MAX 16
+
+// Poll interval while waiting for the device in the asynchronous API
+#define ASYNC_POLL_INTERVAL 1
+
+// The first status read of a measurement is due this long before its
+// predicted data ready time
+#define WAKE_GUARD_MS 1
+
+// Results of a continuous run after which the measured cycle replaces the
+// nominal one in the data ready prediction
+#define CYCLE_LEARN_MIN_INDEX 4
+
+// Reference SPAD management: starting at GLOBAL_CONFIG_REF_EN_START_SELECT
+// 0xB4, the SPADs from index 12 on are aperture SPADs; the target reference
+// signal rate is 20 MCPS (Q9.7)
+#define REF_SPAD_MIN_COUNT 3
+#define REF_SPAD_MAX_COUNT 44
+#define REF_SPAD_FIRST_APERTURE 12
+#define REF_SPAD_TARGET_RATE 0x0A00
+
+#define isApertureSpad(spad_index) ((spad_index) >= REF_SPAD_FIRST_APERTURE)
+
+// Calibration record in the EEPROM; bump the version when the layout changes
+#define CALIBRATION_MAGIC 0x4C35
+#define CALIBRATION_VERSION 2
+
+typedef struct
+{
+    uint16_t magic;
+    uint8_t version;
+    vl53l0x_calibration_t calibration;
+    uint16_t crc; // over all the preceding fields
+} calibrationRecord;
+
+bool getSpadInfo(vl53l0x_t *self, uint8_t * count, bool * type_is_aperture);
+
+void getSequenceStepEnables(vl53l0x_t *self, SequenceStepEnables * enables);
+void getSequenceStepTimeouts(vl53l0x_t *self, SequenceStepEnables const * enables, SequenceStepTimeouts * timeouts);
+static void loadSequenceStepCache(vl53l0x_t *self);
+static void writeSequenceConfig(vl53l0x_t *self, uint8_t sequence_config);
+
+bool performSingleRefCalibration(vl53l0x_t *self, uint8_t vhv_init_byte);
+
+static void dataReadyExti(bc_exti_line_t line, void *param);
+static void dataReadyTask(void *param);
+static void registerDataReady(vl53l0x_t *self, bc_gpio_channel_t gpio_channel, bc_exti_line_t exti_line, vl53l0x_data_ready_handler_t handler, void *param);
+static void setInterruptConfig(vl53l0x_t *self, uint8_t interrupt_config);
+static void checkInterruptSettings(vl53l0x_t *self, bool start);
+#if VL53L0X_INTERRUPT_THRESHOLD_SETTINGS
+static void loadTuningSettings(vl53l0x_t *self, const uint8_t *settings);
+#endif
+
+static void initDataInit(vl53l0x_t *self, bc_i2c_channel_t i2c_channel, uint8_t addr, bc_tick_t timeout, bool io_2v8);
+static void selectReferenceSpads(vl53l0x_t *self, uint8_t spad_count, bool spad_type_is_aperture, uint8_t *ref_spad_map);
+static void initStaticInit(vl53l0x_t *self, const uint8_t *ref_spad_map);
+
+static void spadInfoBegin(vl53l0x_t *self);
+static bool spadInfoReady(vl53l0x_t *self);
+static void spadInfoEnd(vl53l0x_t *self, uint8_t * count, bool * type_is_aperture);
+
+static void refCalibrationBegin(vl53l0x_t *self, uint8_t vhv_init_byte);
+static bool refCalibrationReady(vl53l0x_t *self);
+static void refCalibrationEnd(vl53l0x_t *self);
+static void refCalibrationIo(vl53l0x_t *self, bool read, uint8_t *vhv_settings, uint8_t *phase_cal);
+static void performPhaseCalibration(vl53l0x_t *self);
+
+static uint8_t preRangeValidPhaseHigh(uint8_t period_pclks);
+static uint32_t usedTimingBudget(SequenceStepEnables const * enables, SequenceStepTimeouts const * timeouts);
+static const uint8_t (*finalRangeVcselSequence(uint8_t period_pclks, size_t *length))[2];
+
+static bool enableRefSpads(vl53l0x_t *self, bool aperture, uint8_t *ref_spad_map, uint8_t *spad_index);
+static int8_t nextGoodSpad(vl53l0x_t *self, uint8_t spad_index);
+static bool measureRefSignalRate(vl53l0x_t *self, uint16_t *rate);
+
+static bool readSingleResult(vl53l0x_t *self, vl53l0x_result_t *result);
+static bool readCalibrationSamples(vl53l0x_t *self, vl53l0x_calibration_samples_t *samples);
+static void setStopVariable(vl53l0x_t *self);
+static bool waitDataReady(vl53l0x_t *self, uint32_t *polls);
+
+static void writeSequence(vl53l0x_t *self, const uint8_t (*sequence)[2], size_t length);
+static void accountTransfer(vl53l0x_t *self, bool read, size_t length);
+static bool busTransfer(vl53l0x_t *self, bool read, uint8_t reg, uint8_t *buffer, uint8_t length);
+static void busRecover(vl53l0x_t *self);
+static void setError(vl53l0x_t *self, vl53l0x_error_t error);
+static void transferTask(void *param);
+static void transferNext(vl53l0x_t *self);
+static void dataReadyRead(vl53l0x_t *self, const vl53l0x_transfer_t *transfer, bool ok, void *param);
+static void accountSample(vl53l0x_t *self, bc_tick_t start, uint32_t polls);
+static uint8_t histogramBucket(uint32_t value);
+
+#if VL53L0X_TRACE
+
+typedef struct
+{
+    uint32_t tick;
+    uint32_t value; // data, or its first four bytes, big endian
+    uint8_t address;
+    uint8_t reg;
+    uint8_t length;
+    uint8_t flags;
+} traceEntry;
+
+#define TRACE_FLAG_READ 0x01
+#define TRACE_FLAG_OK   0x02
 
-bool getSpadInfo(uint8_t * count, bool * type_is_aperture);
+// Shared by all instances; entries carry the device address
+static traceEntry trace[VL53L0X_TRACE_SIZE];
+static size_t trace_head;
+static size_t trace_count;
 
-void getSequenceStepEnables(SequenceStepEnables * enables);
-void getSequenceStepTimeouts(SequenceStepEnables const * enables, SequenceStepTimeouts * timeouts);
+#define traceTransfer(self, read, reg, length, value, ok) traceRecord((self), (read), (reg), (length), (value), (ok))
 
-bool performSingleRefCalibration(uint8_t vhv_init_byte);
+static void traceRecord(vl53l0x_t *self, bool read, uint8_t reg, uint8_t length, uint32_t value, bool ok);
+static uint32_t traceValue(const uint8_t *buffer, uint8_t length);
+
+#else
+
+// Tracing compiled out: the transaction status is all that is evaluated
+#define traceTransfer(self, read, reg, length, value, ok) ((void) (ok))
+
+#endif
+
+static void asyncTask(void *param);
+static void asyncEnter(vl53l0x_t *self, vl53l0x_state_t state, bc_tick_t first_poll);
+static void asyncFinish(vl53l0x_t *self, vl53l0x_event_t event, const vl53l0x_result_t *result);
+
+static void measurementStarted(vl53l0x_t *self, bool continuous, uint32_t period_ms);
+static void measurementResult(vl53l0x_t *self, bc_tick_t ready_tick, bool on_edge);
+static uint32_t measurementCycle(vl53l0x_t *self);
+static bc_tick_t predictDataReady(vl53l0x_t *self);
+static bc_tick_t firstPollDelay(vl53l0x_t *self);
+
+static bool readResultIfReady(vl53l0x_t *self, vl53l0x_result_t *result);
+static void decodeResult(vl53l0x_t *self, const uint8_t *buffer, vl53l0x_result_t *result);
+static uint16_t sigmaEstimate(vl53l0x_t *self, uint32_t signal_rate, uint32_t ambient_rate);
 
 static uint16_t decodeTimeout(uint16_t value);
 static uint16_t encodeTimeout(uint16_t timeout_mclks);
@@ -150,64 +482,517 @@ static uint32_t timeoutMicrosecondsToMclks(uint32_t timeout_period_us, uint8_t v
 // This function does not perform reference SPAD calibration
 // (VL53L0X_PerformRefSpadManagement()), since the API user manual says that it
 // is performed by ST on the bare modules; it seems like that should work well
-// enough unless a cover glass is added.
+// enough unless a cover glass is added. Behind a cover glass, run
+// vl53l0x_perform_ref_spad_management() and the offset and crosstalk
+// calibrations once and restore their results with vl53l0x_init_warm().
 // If io_2v8 (optional) is true or not given, the sensor is configured for 2V8
-// mode.
-bool vl53l0x_init(uint8_t addr, bc_tick_t timeout, bool io_2v8)
+// mode. The instance must be zeroed (static storage, or memset()) before its
+// first initialization; handlers set since then are kept.
+bool vl53l0x_init(vl53l0x_t *self, bc_i2c_channel_t i2c_channel, uint8_t addr, bc_tick_t timeout, bool io_2v8)
+{
+  initDataInit(self, i2c_channel, addr, timeout, io_2v8);
+
+  // VL53L0X_StaticInit() begin
+
+  uint8_t spad_count;
+  bool spad_type_is_aperture;
+  uint8_t ref_spad_map[6];
+  if (!getSpadInfo(self, &spad_count, &spad_type_is_aperture)) { return false; }
+
+  selectReferenceSpads(self, spad_count, spad_type_is_aperture, ref_spad_map);
+  initStaticInit(self, ref_spad_map);
+
+  // VL53L0X_StaticInit() end
+
+  return vl53l0x_perform_ref_calibration(self);
+}
+
+// Run the VHV and phase reference calibration measurements
+// based on VL53L0X_PerformRefCalibration() (VL53L0X_perform_ref_calibration())
+bool vl53l0x_perform_ref_calibration(vl53l0x_t *self)
+{
+  // -- VL53L0X_perform_vhv_calibration() begin
+
+  writeSequenceConfig(self, 0x01);
+  if (!performSingleRefCalibration(self, 0x40)) { return false; }
+
+  // -- VL53L0X_perform_vhv_calibration() end
+
+  // -- VL53L0X_perform_phase_calibration() begin
+
+  writeSequenceConfig(self, 0x02);
+  if (!performSingleRefCalibration(self, 0x00)) { return false; }
+
+  // -- VL53L0X_perform_phase_calibration() end
+
+  // "restore the previous Sequence Config"
+  writeSequenceConfig(self, 0xE8);
+
+  return true;
+}
+
+// Bring up several sensors sharing one I2C bus. All of them power up at
+// VL53L0X_DEFAULT_ADDRESS, so they are first held in reset through their XSHUT
+// pins and then released one at a time, initialized and moved to their own
+// address before the next one is released. The instances are cleared first, so
+// handlers have to be set after this returns.
+bool vl53l0x_init_multi(vl53l0x_t *sensors, const bc_gpio_channel_t *xshut, const uint8_t *addresses, size_t count, bc_i2c_channel_t i2c_channel, bc_tick_t timeout, bool io_2v8)
+{
+  for (size_t i = 0; i < count; i++)
+  {
+    bc_gpio_init(xshut[i]);
+    bc_gpio_set_output(xshut[i], 0);
+    bc_gpio_set_mode(xshut[i], BC_GPIO_MODE_OUTPUT);
+  }
+
+  for (size_t i = 0; i < count; i++)
+  {
+    bc_gpio_set_output(xshut[i], 1);
+
+    memset(&sensors[i], 0, sizeof(sensors[i]));
+
+    // firmware boot time (tBOOT) is 1.2 ms at most
+    bc_tick_t boot_start = bc_tick_get();
+    while (bc_tick_get() - boot_start < 2)
+    {
+      continue;
+    }
+
+    if (!vl53l0x_init(&sensors[i], i2c_channel, VL53L0X_DEFAULT_ADDRESS, timeout, io_2v8))
+    {
+      return false;
+    }
+
+    vl53l0x_set_address(&sensors[i], addresses[i]);
+  }
+
+  return true;
+}
+
+// Initialize the sensor from the results of an earlier full initialization
+// (see vl53l0x_get_calibration()): the reference SPAD map and the VHV and phase
+// calibration are written back instead of being determined again, which skips
+// getSpadInfo() and both reference calibration measurements, the only waits of
+// vl53l0x_init(). The offset and crosstalk calibration are applied as well.
+// With recalibrate, the VHV and phase calibration are measured again, for a
+// calibration taken at another temperature (see
+// vl53l0x_calibration_is_current()). The calibration must come from the same
+// module. Fails if any bus transaction of the sequence failed.
+bool vl53l0x_init_warm(vl53l0x_t *self, bc_i2c_channel_t i2c_channel, uint8_t addr, bc_tick_t timeout, bool io_2v8, const vl53l0x_calibration_t *calibration, bool recalibrate)
+{
+  uint8_t vhv_settings = calibration->vhv_settings;
+  uint8_t phase_cal = calibration->phase_cal;
+
+  initDataInit(self, i2c_channel, addr, timeout, io_2v8);
+
+  initStaticInit(self, calibration->ref_spad_map);
+
+  if (recalibrate)
+  {
+    if (!vl53l0x_perform_ref_calibration(self)) { return false; }
+  }
+  else
+  {
+    // VL53L0X_SetRefCalibration()
+    refCalibrationIo(self, false, &vhv_settings, &phase_cal);
+  }
+
+  vl53l0x_set_offset_calibration(self, calibration->offset_um);
+  vl53l0x_set_xtalk_compensation(self, calibration->xtalk_rate);
+
+  // initDataInit() restarted the bus statistics, so every error counted was
+  // one of this sequence
+  return self->_bus_errors == 0;
+}
+
+// Get the reference SPAD selection, the reference calibration and the offset
+// and crosstalk calibration of an initialized sensor, for vl53l0x_init_warm()
+// after the next power up; temperature is left to the caller
+// based on VL53L0X_GetRefCalibration()
+void vl53l0x_get_calibration(vl53l0x_t *self, vl53l0x_calibration_t *calibration)
+{
+  memcpy(calibration->ref_spad_map, self->_ref_spad_map, sizeof(calibration->ref_spad_map));
+
+  refCalibrationIo(self, true, &calibration->vhv_settings, &calibration->phase_cal);
+
+  calibration->offset_um = vl53l0x_get_offset_calibration(self);
+  calibration->xtalk_rate = self->_xtalk_rate;
+}
+
+// Store the calibration in the EEPROM at address, stamped with the temperature
+// it was taken at and protected by a CRC
+bool vl53l0x_calibration_save(const vl53l0x_calibration_t *calibration, uint32_t address, int8_t temperature)
+{
+  calibrationRecord record;
+
+  memset(&record, 0, sizeof(record));
+  record.magic = CALIBRATION_MAGIC;
+  record.version = CALIBRATION_VERSION;
+  record.calibration = *calibration;
+  record.calibration.temperature = temperature;
+  record.crc = util_crc16((const uint8_t *) &record, offsetof(calibrationRecord, crc));
+
+  return bc_eeprom_write(address, &record, sizeof(record));
+}
+
+// Load a calibration stored by vl53l0x_calibration_save(). Fails if there is
+// none or it is corrupted or from another driver version.
+bool vl53l0x_calibration_load(vl53l0x_calibration_t *calibration, uint32_t address)
+{
+  calibrationRecord record;
+
+  if (!bc_eeprom_read(address, &record, sizeof(record)))
+  {
+    return false;
+  }
+
+  if (record.magic != CALIBRATION_MAGIC || record.version != CALIBRATION_VERSION ||
+      record.crc != util_crc16((const uint8_t *) &record, offsetof(calibrationRecord, crc)))
+  {
+    return false;
+  }
+
+  *calibration = record.calibration;
+
+  return true;
+}
+
+// Was the calibration taken within VL53L0X_CALIBRATION_TEMPERATURE_DELTA
+// degrees of temperature? The VHV and phase calibration follow the
+// temperature, so they have to be measured again otherwise; the SPAD
+// selection, offset and crosstalk calibration stay valid.
+bool vl53l0x_calibration_is_current(const vl53l0x_calibration_t *calibration, int8_t temperature)
+{
+  int16_t delta = (int16_t) temperature - calibration->temperature;
+
+  return delta <= VL53L0X_CALIBRATION_TEMPERATURE_DELTA && delta >= -VL53L0X_CALIBRATION_TEMPERATURE_DELTA;
+}
+
+// Select the reference SPADs by measurement instead of taking their count and
+// type from the NVM: starting from the minimum number of non-aperture SPADs
+// (or aperture SPADs, if those already give too much signal), good SPADs are
+// enabled one at a time until the reference signal rate reaches
+// REF_SPAD_TARGET_RATE, keeping the map that comes closest to it. Needed when
+// a cover glass reflects back into the reference array. Blocking, a single
+// ranging measurement per step.
+// based on VL53L0X_perform_ref_spad_management()
+bool vl53l0x_perform_ref_spad_management(vl53l0x_t *self)
+{
+  uint8_t ref_spad_map[6] = { 0 };
+  uint8_t last_spad_map[6];
+  uint8_t spad_index = 0;
+  bool aperture = false;
+  uint16_t rate;
+
+  vl53l0x_write_reg(self, 0xFF, 0x01);
+  vl53l0x_write_reg(self, DYNAMIC_SPAD_REF_EN_START_OFFSET, 0x00);
+  vl53l0x_write_reg(self, DYNAMIC_SPAD_NUM_REQUESTED_REF_SPAD, 0x2C);
+  vl53l0x_write_reg(self, 0xFF, 0x00);
+  vl53l0x_write_reg(self, GLOBAL_CONFIG_REF_EN_START_SELECT, 0xB4);
+  vl53l0x_write_reg(self, POWER_MANAGEMENT_GO1_POWER_FORCE, 0x00);
+
+  if (!vl53l0x_perform_ref_calibration(self)) { return false; }
+
+  // "Enable Minimum NON-APERTURE Spads"
+  if (!enableRefSpads(self, aperture, ref_spad_map, &spad_index)) { return false; }
+  if (!measureRefSignalRate(self, &rate)) { return false; }
+
+  if (rate > REF_SPAD_TARGET_RATE)
+  {
+    // "Signal rate measurement too high, switch to APERTURE SPADs"
+    memset(ref_spad_map, 0, sizeof(ref_spad_map));
+    spad_index = REF_SPAD_FIRST_APERTURE;
+    aperture = true;
+
+    if (!enableRefSpads(self, aperture, ref_spad_map, &spad_index)) { return false; }
+    if (!measureRefSignalRate(self, &rate)) { return false; }
+
+    // if the rate is still too high, the minimum number of aperture SPADs is
+    // the best there is
+  }
+
+  if (rate < REF_SPAD_TARGET_RATE)
+  {
+    uint16_t last_rate_diff = REF_SPAD_TARGET_RATE - rate;
+
+    memcpy(last_spad_map, ref_spad_map, sizeof(last_spad_map));
+
+    for (;;)
+    {
+      int8_t next_spad = nextGoodSpad(self, spad_index);
+
+      if (next_spad < 0)
+      {
+        return false;
+      }
+
+      // aperture and non-aperture SPADs cannot be combined, so all SPADs of
+      // the current type are enabled already
+      if (isApertureSpad(next_spad) != aperture)
+      {
+        break;
+      }
+
+      ref_spad_map[next_spad / 8] |= 1 << (next_spad % 8);
+      spad_index = next_spad + 1;
+
+      vl53l0x_write_multi(self, GLOBAL_CONFIG_SPAD_ENABLES_REF_0, ref_spad_map, 6);
+
+      if (!measureRefSignalRate(self, &rate)) { return false; }
+
+      if (rate > REF_SPAD_TARGET_RATE)
+      {
+        // keep whichever map came closer to the target, above or below it
+        if (rate - REF_SPAD_TARGET_RATE > last_rate_diff)
+        {
+          memcpy(ref_spad_map, last_spad_map, sizeof(ref_spad_map));
+          vl53l0x_write_multi(self, GLOBAL_CONFIG_SPAD_ENABLES_REF_0, ref_spad_map, 6);
+        }
+
+        break;
+      }
+
+      last_rate_diff = REF_SPAD_TARGET_RATE - rate;
+      memcpy(last_spad_map, ref_spad_map, sizeof(last_spad_map));
+    }
+  }
+
+  memcpy(self->_ref_spad_map, ref_spad_map, sizeof(self->_ref_spad_map));
+
+  return true;
+}
+
+// Measure the range of a target at distance_mm and set the part-to-part
+// offset that corrects the average of the valid readings among
+// VL53L0X_CALIBRATION_SAMPLES to it; the offset is stored in offset_um. ST
+// recommends a white target at 100 mm. Blocking; see
+// vl53l0x_finish_offset_calibration() to take the readings in between other
+// work.
+// based on VL53L0X_perform_offset_calibration()
+bool vl53l0x_perform_offset_calibration(vl53l0x_t *self, uint16_t distance_mm, int32_t *offset_um)
+{
+  vl53l0x_calibration_samples_t samples;
+
+  vl53l0x_set_offset_calibration(self, 0);
+
+  if (!readCalibrationSamples(self, &samples)) { return false; }
+
+  return vl53l0x_finish_offset_calibration(self, &samples, distance_mm, offset_um);
+}
+
+// Measure a target at distance_mm, closer than where the crosstalk of the
+// cover glass makes the sensor read short, and set the crosstalk compensation
+// from the average of the valid readings among VL53L0X_CALIBRATION_SAMPLES;
+// the rate (MCPS per SPAD, Q3.13) is stored in xtalk_rate. ST recommends a
+// grey (17 %) target. Blocking; see vl53l0x_finish_xtalk_calibration() to take
+// the readings in between other work.
+// based on VL53L0X_perform_xtalk_calibration()
+bool vl53l0x_perform_xtalk_calibration(vl53l0x_t *self, uint16_t distance_mm, uint16_t *xtalk_rate)
+{
+  vl53l0x_calibration_samples_t samples;
+
+  vl53l0x_set_xtalk_compensation(self, 0);
+
+  if (!readCalibrationSamples(self, &samples)) { return false; }
+
+  return vl53l0x_finish_xtalk_calibration(self, &samples, distance_mm, xtalk_rate);
+}
+
+// Collect a reading for an offset or crosstalk calibration; invalid ones are
+// left out. Start from zeroed samples.
+void vl53l0x_calibration_add_sample(vl53l0x_calibration_samples_t *samples, const vl53l0x_result_t *result)
+{
+  if (result->validity == VL53L0X_VALIDITY_VALID)
+  {
+    samples->sum_range_mm += result->range_mm;
+    samples->sum_signal_rate += result->signal_rate;
+    samples->sum_spads += result->effective_spad_count >> 8;
+    samples->count++;
+  }
+}
+
+// Set the offset from readings of a target at distance_mm taken with the
+// offset cleared (vl53l0x_set_offset_calibration(self, 0)), as
+// vl53l0x_perform_offset_calibration() does. False without a valid reading.
+bool vl53l0x_finish_offset_calibration(vl53l0x_t *self, const vl53l0x_calibration_samples_t *samples, uint16_t distance_mm, int32_t *offset_um)
+{
+  uint32_t count = samples->count;
+
+  if (count == 0)
+  {
+    return false;
+  }
+
+  *offset_um = (int32_t) distance_mm * 1000 - (int32_t) ((samples->sum_range_mm * 1000 + count / 2) / count);
+
+  vl53l0x_set_offset_calibration(self, *offset_um);
+
+  return true;
+}
+
+// Set the crosstalk compensation from readings of a target at distance_mm
+// taken with the compensation off (vl53l0x_set_xtalk_compensation(self, 0)),
+// as vl53l0x_perform_xtalk_calibration() does. False without a valid reading.
+bool vl53l0x_finish_xtalk_calibration(vl53l0x_t *self, const vl53l0x_calibration_samples_t *samples, uint16_t distance_mm, uint16_t *xtalk_rate)
+{
+  uint32_t count = samples->count;
+
+  if (count == 0)
+  {
+    return false;
+  }
+
+  // the mean SPAD count is very close to a whole number, so rounding it
+  // loses next to nothing
+  uint32_t mean_spads = (samples->sum_spads + count / 2) / count;
+  uint32_t sum_distance_mm = (uint32_t) distance_mm * count;
+
+  if (mean_spads == 0 || samples->sum_range_mm >= sum_distance_mm)
+  {
+    *xtalk_rate = 0;
+  }
+  else
+  {
+    // signal rate per SPAD times (1 - mean range / distance), Q3.13
+    uint64_t rate = ((uint64_t) samples->sum_signal_rate << 6) * (sum_distance_mm - samples->sum_range_mm) /
+                    ((uint64_t) count * mean_spads * sum_distance_mm);
+
+    *xtalk_rate = rate > UINT16_MAX ? UINT16_MAX : rate;
+  }
+
+  vl53l0x_set_xtalk_compensation(self, *xtalk_rate);
+
+  return true;
+}
+
+// VL53L0X_CALIBRATION_SAMPLES single-shot readings for a calibration
+static bool readCalibrationSamples(vl53l0x_t *self, vl53l0x_calibration_samples_t *samples)
+{
+  vl53l0x_result_t result;
+
+  memset(samples, 0, sizeof(*samples));
+
+  for (int i = 0; i < VL53L0X_CALIBRATION_SAMPLES; i++)
+  {
+    if (!readSingleResult(self, &result)) { return false; }
+
+    vl53l0x_calibration_add_sample(samples, &result);
+  }
+
+  return true;
+}
+
+// Set the part-to-part range offset the device adds to every reading, in
+// micrometers; the register has a resolution of 250 um and a range of
+// -512 mm to 511 mm
+// based on VL53L0X_SetOffsetCalibrationDataMicroMeter()
+void vl53l0x_set_offset_calibration(vl53l0x_t *self, int32_t offset_um)
+{
+  if (offset_um > 511000)
+  {
+    offset_um = 511000;
+  }
+  else if (offset_um < -512000)
+  {
+    offset_um = -512000;
+  }
+
+  // 12-bit two's complement in quarter millimeters
+  vl53l0x_write_reg16_bit(self, ALGO_PART_TO_PART_RANGE_OFFSET_MM, (uint16_t) (offset_um / 250) & 0x0FFF);
+}
+
+// based on VL53L0X_GetOffsetCalibrationDataMicroMeter()
+int32_t vl53l0x_get_offset_calibration(vl53l0x_t *self)
+{
+  uint16_t value = vl53l0x_read_reg16_bit(self, ALGO_PART_TO_PART_RANGE_OFFSET_MM) & 0x0FFF;
+
+  return (value & 0x0800 ? (int32_t) value - 0x1000 : (int32_t) value) * 250;
+}
+
+// Set the crosstalk compensation rate in MCPS per SPAD, Q3.13; 0 disables it.
+// The device uses it for its signal rates and the range is corrected for it
+// when a result is decoded.
+// based on VL53L0X_SetXTalkCompensationRateMegaCps()
+void vl53l0x_set_xtalk_compensation(vl53l0x_t *self, uint16_t xtalk_rate)
+{
+  vl53l0x_write_reg16_bit(self, CROSSTALK_COMPENSATION_PEAK_RATE_MCPS, xtalk_rate);
+  self->_xtalk_rate = xtalk_rate;
+}
+
+uint16_t vl53l0x_get_xtalk_compensation(vl53l0x_t *self)
 {
-  address = addr;
-  io_timeout = timeout;
-  did_timeout = false;
+  return self->_xtalk_rate;
+}
 
-  bc_i2c_init(BC_I2C_I2C0, BC_I2C_SPEED_100_KHZ);
+// VL53L0X_DataInit() part of the initialization, shared by vl53l0x_init(),
+// vl53l0x_init_async() and vl53l0x_init_warm()
+static void initDataInit(vl53l0x_t *self, bc_i2c_channel_t i2c_channel, uint8_t addr, bc_tick_t timeout, bool io_2v8)
+{
+  self->_i2c_channel = i2c_channel;
+  self->_i2c_address = addr;
+  self->_io_timeout = timeout;
+  self->_did_timeout = false;
+  self->_error = VL53L0X_ERROR_NONE;
+  vl53l0x_reset_bus_stats(self);
+  vl53l0x_reset_stats(self);
+  self->_sigma_limit_mm = VL53L0X_DEFAULT_SIGMA_LIMIT_MM;
+  self->_sequence_cache_valid = false;
+  self->_transfer_head = 0;
+  self->_transfer_count = 0;
+  self->_transfer_done = 0;
+  self->_data_ready_queued = false;
+
+  // the bus may have been initialized at another speed by a device sharing it
+  bc_i2c_init(self->_i2c_channel, VL53L0X_I2C_SPEED);
+  vl53l0x_set_bus_speed(self, VL53L0X_I2C_SPEED);
+
+  // busRecover() times the bus clock with bc_timer
+  bc_timer_init();
 
   // sensor uses 1V8 mode for I/O by default; switch to 2V8 mode if necessary
   if (io_2v8)
   {
-    vl53l0x_write_reg(VHV_CONFIG_PAD_SCL_SDA__EXTSUP_HV,
-      vl53l0x_read_reg(VHV_CONFIG_PAD_SCL_SDA__EXTSUP_HV) | 0x01); // set bit 0
+    vl53l0x_write_reg(self, VHV_CONFIG_PAD_SCL_SDA__EXTSUP_HV,
+      vl53l0x_read_reg(self, VHV_CONFIG_PAD_SCL_SDA__EXTSUP_HV) | 0x01); // set bit 0
   }
 
   // "Set I2C standard mode"
-  vl53l0x_write_reg(0x88, 0x00);
-
-  vl53l0x_write_reg(0x80, 0x01);
-  vl53l0x_write_reg(0xFF, 0x01);
-  vl53l0x_write_reg(0x00, 0x00);
-  stop_variable = vl53l0x_read_reg(0x91);
-  vl53l0x_write_reg(0x00, 0x01);
-  vl53l0x_write_reg(0xFF, 0x00);
-  vl53l0x_write_reg(0x80, 0x00);
+  vl53l0x_write_reg(self, 0x88, 0x00);
+
+  vl53l0x_write_reg(self, 0x80, 0x01);
+  vl53l0x_write_reg(self, 0xFF, 0x01);
+  vl53l0x_write_reg(self, 0x00, 0x00);
+  self->_stop_variable = vl53l0x_read_reg(self, 0x91);
+  self->_stop_variable_set = false;
+  self->_shot_pending = false;
+  vl53l0x_write_reg(self, 0x00, 0x01);
+  vl53l0x_write_reg(self, 0xFF, 0x00);
+  vl53l0x_write_reg(self, 0x80, 0x00);
 
   // disable SIGNAL_RATE_MSRC (bit 1) and SIGNAL_RATE_PRE_RANGE (bit 4) limit checks
-  vl53l0x_write_reg(MSRC_CONFIG_CONTROL, vl53l0x_read_reg(MSRC_CONFIG_CONTROL) | 0x12);
+  vl53l0x_write_reg(self, MSRC_CONFIG_CONTROL, vl53l0x_read_reg(self, MSRC_CONFIG_CONTROL) | 0x12);
 
   // set final range signal rate limit to 0.25 MCPS (million counts per second)
-  vl53l0x_set_signal_rate_limit(0.25);
+  vl53l0x_set_signal_rate_limit_q97(self, VL53L0X_MCPS_TO_Q97(0.25));
 
-  vl53l0x_write_reg(SYSTEM_SEQUENCE_CONFIG, 0xFF);
+  writeSequenceConfig(self, 0xFF);
 
   // VL53L0X_DataInit() end
 
-  // VL53L0X_StaticInit() begin
-
-  uint8_t spad_count;
-  bool spad_type_is_aperture;
-  if (!getSpadInfo(&spad_count, &spad_type_is_aperture)) { return false; }
-
   // The SPAD map (RefGoodSpadMap) is read by VL53L0X_get_info_from_device() in
   // the API, but the same data seems to be more easily readable from
-  // GLOBAL_CONFIG_SPAD_ENABLES_REF_0 through _6, so read it from there
-  uint8_t ref_spad_map[6];
-  vl53l0x_read_multi(GLOBAL_CONFIG_SPAD_ENABLES_REF_0, ref_spad_map, 6);
+  // GLOBAL_CONFIG_SPAD_ENABLES_REF_0 through _6, so read it from there before
+  // the reference SPAD selection overwrites it
+  vl53l0x_read_multi(self, GLOBAL_CONFIG_SPAD_ENABLES_REF_0, self->_good_spad_map, 6);
 
-  // -- VL53L0X_set_reference_spads() begin (assume NVM values are valid)
+  // no crosstalk compensation after reset
+  self->_xtalk_rate = 0;
+}
 
-  vl53l0x_write_reg(0xFF, 0x01);
-  vl53l0x_write_reg(DYNAMIC_SPAD_REF_EN_START_OFFSET, 0x00);
-  vl53l0x_write_reg(DYNAMIC_SPAD_NUM_REQUESTED_REF_SPAD, 0x2C);
-  vl53l0x_write_reg(0xFF, 0x00);
-  vl53l0x_write_reg(GLOBAL_CONFIG_REF_EN_START_SELECT, 0xB4);
+// Build the reference SPAD map from the getSpadInfo() results
+static void selectReferenceSpads(vl53l0x_t *self, uint8_t spad_count, bool spad_type_is_aperture, uint8_t *ref_spad_map)
+{
+  memcpy(ref_spad_map, self->_good_spad_map, 6);
 
   uint8_t first_spad_to_enable = spad_type_is_aperture ? 12 : 0; // 12 is the first aperture spad
   uint8_t spads_enabled = 0;
@@ -225,280 +1010,299 @@ bool vl53l0x_init(uint8_t addr, bc_tick_t timeout, bool io_2v8)
       spads_enabled++;
     }
   }
+}
+
+// VL53L0X_StaticInit() part of the initialization following the reference SPAD
+// selection, shared by vl53l0x_init(), vl53l0x_init_async() and
+// vl53l0x_init_warm()
+static void initStaticInit(vl53l0x_t *self, const uint8_t *ref_spad_map)
+{
+  // -- VL53L0X_set_reference_spads() begin (assume NVM values are valid)
 
-  vl53l0x_write_multi(GLOBAL_CONFIG_SPAD_ENABLES_REF_0, ref_spad_map, 6);
+  vl53l0x_write_reg(self, 0xFF, 0x01);
+  vl53l0x_write_reg(self, DYNAMIC_SPAD_REF_EN_START_OFFSET, 0x00);
+  vl53l0x_write_reg(self, DYNAMIC_SPAD_NUM_REQUESTED_REF_SPAD, 0x2C);
+  vl53l0x_write_reg(self, 0xFF, 0x00);
+  vl53l0x_write_reg(self, GLOBAL_CONFIG_REF_EN_START_SELECT, 0xB4);
+
+  vl53l0x_write_multi(self, GLOBAL_CONFIG_SPAD_ENABLES_REF_0, ref_spad_map, 6);
+  memcpy(self->_ref_spad_map, ref_spad_map, sizeof(self->_ref_spad_map));
 
   // -- VL53L0X_set_reference_spads() end
 
   // -- VL53L0X_load_tuning_settings() begin
-  // DefaultTuningSettings from vl53l0x_tuning.h
-
-  vl53l0x_write_reg(0xFF, 0x01);
-  vl53l0x_write_reg(0x00, 0x00);
-
-  vl53l0x_write_reg(0xFF, 0x00);
-  vl53l0x_write_reg(0x09, 0x00);
-  vl53l0x_write_reg(0x10, 0x00);
-  vl53l0x_write_reg(0x11, 0x00);
-
-  vl53l0x_write_reg(0x24, 0x01);
-  vl53l0x_write_reg(0x25, 0xFF);
-  vl53l0x_write_reg(0x75, 0x00);
-
-  vl53l0x_write_reg(0xFF, 0x01);
-  vl53l0x_write_reg(0x4E, 0x2C);
-  vl53l0x_write_reg(0x48, 0x00);
-  vl53l0x_write_reg(0x30, 0x20);
-
-  vl53l0x_write_reg(0xFF, 0x00);
-  vl53l0x_write_reg(0x30, 0x09);
-  vl53l0x_write_reg(0x54, 0x00);
-  vl53l0x_write_reg(0x31, 0x04);
-  vl53l0x_write_reg(0x32, 0x03);
-  vl53l0x_write_reg(0x40, 0x83);
-  vl53l0x_write_reg(0x46, 0x25);
-  vl53l0x_write_reg(0x60, 0x00);
-  vl53l0x_write_reg(0x27, 0x00);
-  vl53l0x_write_reg(0x50, 0x06);
-  vl53l0x_write_reg(0x51, 0x00);
-  vl53l0x_write_reg(0x52, 0x96);
-  vl53l0x_write_reg(0x56, 0x08);
-  vl53l0x_write_reg(0x57, 0x30);
-  vl53l0x_write_reg(0x61, 0x00);
-  vl53l0x_write_reg(0x62, 0x00);
-  vl53l0x_write_reg(0x64, 0x00);
-  vl53l0x_write_reg(0x65, 0x00);
-  vl53l0x_write_reg(0x66, 0xA0);
-
-  vl53l0x_write_reg(0xFF, 0x01);
-  vl53l0x_write_reg(0x22, 0x32);
-  vl53l0x_write_reg(0x47, 0x14);
-  vl53l0x_write_reg(0x49, 0xFF);
-  vl53l0x_write_reg(0x4A, 0x00);
-
-  vl53l0x_write_reg(0xFF, 0x00);
-  vl53l0x_write_reg(0x7A, 0x0A);
-  vl53l0x_write_reg(0x7B, 0x00);
-  vl53l0x_write_reg(0x78, 0x21);
-
-  vl53l0x_write_reg(0xFF, 0x01);
-  vl53l0x_write_reg(0x23, 0x34);
-  vl53l0x_write_reg(0x42, 0x00);
-  vl53l0x_write_reg(0x44, 0xFF);
-  vl53l0x_write_reg(0x45, 0x26);
-  vl53l0x_write_reg(0x46, 0x05);
-  vl53l0x_write_reg(0x40, 0x40);
-  vl53l0x_write_reg(0x0E, 0x06);
-  vl53l0x_write_reg(0x20, 0x1A);
-  vl53l0x_write_reg(0x43, 0x40);
-
-  vl53l0x_write_reg(0xFF, 0x00);
-  vl53l0x_write_reg(0x34, 0x03);
-  vl53l0x_write_reg(0x35, 0x44);
-
-  vl53l0x_write_reg(0xFF, 0x01);
-  vl53l0x_write_reg(0x31, 0x04);
-  vl53l0x_write_reg(0x4B, 0x09);
-  vl53l0x_write_reg(0x4C, 0x05);
-  vl53l0x_write_reg(0x4D, 0x04);
-
-  vl53l0x_write_reg(0xFF, 0x00);
-  vl53l0x_write_reg(0x44, 0x00);
-  vl53l0x_write_reg(0x45, 0x20);
-  vl53l0x_write_reg(0x47, 0x08);
-  vl53l0x_write_reg(0x48, 0x28);
-  vl53l0x_write_reg(0x67, 0x00);
-  vl53l0x_write_reg(0x70, 0x04);
-  vl53l0x_write_reg(0x71, 0x01);
-  vl53l0x_write_reg(0x72, 0xFE);
-  vl53l0x_write_reg(0x76, 0x00);
-  vl53l0x_write_reg(0x77, 0x00);
-
-  vl53l0x_write_reg(0xFF, 0x01);
-  vl53l0x_write_reg(0x0D, 0x01);
-
-  vl53l0x_write_reg(0xFF, 0x00);
-  vl53l0x_write_reg(0x80, 0x01);
-  vl53l0x_write_reg(0x01, 0xF8);
-
-  vl53l0x_write_reg(0xFF, 0x01);
-  vl53l0x_write_reg(0x8E, 0x01);
-  vl53l0x_write_reg(0x00, 0x01);
-  vl53l0x_write_reg(0xFF, 0x00);
-  vl53l0x_write_reg(0x80, 0x00);
+
+  writeSequence(self, tuning_settings, sizeof(tuning_settings) / sizeof(tuning_settings[0]));
+
+  // the tuning settings rewrite the sequence step timeouts and VCSEL periods
+  self->_sequence_cache_valid = false;
 
   // -- VL53L0X_load_tuning_settings() end
 
   // "Set interrupt config to new sample ready"
   // -- VL53L0X_SetGpioConfig() begin
 
-  vl53l0x_write_reg(SYSTEM_INTERRUPT_CONFIG_GPIO, 0x04);
-  vl53l0x_write_reg(GPIO_HV_MUX_ACTIVE_HIGH, vl53l0x_read_reg(GPIO_HV_MUX_ACTIVE_HIGH) & ~0x10); // active low
-  vl53l0x_write_reg(SYSTEM_INTERRUPT_CLEAR, 0x01);
+  vl53l0x_write_reg(self, SYSTEM_INTERRUPT_CONFIG_GPIO, 0x04);
+  self->_interrupt_config = 0x04;
+  vl53l0x_write_reg(self, GPIO_HV_MUX_ACTIVE_HIGH, vl53l0x_read_reg(self, GPIO_HV_MUX_ACTIVE_HIGH) & ~0x10); // active low
+  vl53l0x_write_reg(self, SYSTEM_INTERRUPT_CLEAR, 0x01);
 
   // -- VL53L0X_SetGpioConfig() end
 
-  measurement_timing_budget_us = vl53l0x_get_measurement_timing_budget();
+  self->_measurement_timing_budget_us = vl53l0x_get_measurement_timing_budget(self);
 
   // "Disable MSRC and TCC by default"
   // MSRC = Minimum Signal Rate Check
   // TCC = Target CentreCheck
   // -- VL53L0X_SetSequenceStepEnable() begin
 
-  vl53l0x_write_reg(SYSTEM_SEQUENCE_CONFIG, 0xE8);
+  writeSequenceConfig(self, 0xE8);
 
   // -- VL53L0X_SetSequenceStepEnable() end
 
   // "Recalculate timing budget"
-  vl53l0x_set_measurement_timing_budget(measurement_timing_budget_us);
-
-  // VL53L0X_StaticInit() end
-
-  // VL53L0X_PerformRefCalibration() begin (VL53L0X_perform_ref_calibration())
-
-  // -- VL53L0X_perform_vhv_calibration() begin
-
-  vl53l0x_write_reg(SYSTEM_SEQUENCE_CONFIG, 0x01);
-  if (!performSingleRefCalibration(0x40)) { return false; }
-
-  // -- VL53L0X_perform_vhv_calibration() end
-
-  // -- VL53L0X_perform_phase_calibration() begin
-
-  vl53l0x_write_reg(SYSTEM_SEQUENCE_CONFIG, 0x02);
-  if (!performSingleRefCalibration(0x00)) { return false; }
-
-  // -- VL53L0X_perform_phase_calibration() end
+  vl53l0x_set_measurement_timing_budget(self, self->_measurement_timing_budget_us);
+}
 
-  // "restore the previous Sequence Config"
-  vl53l0x_write_reg(SYSTEM_SEQUENCE_CONFIG, 0xE8);
+uint8_t vl53l0x_get_address(vl53l0x_t *self)
+{
+  return self->_i2c_address;
+}
 
-  // VL53L0X_PerformRefCalibration() end
+void vl53l0x_set_address(vl53l0x_t *self, uint8_t new_addr)
+{
+  vl53l0x_write_reg(self, I2C_SLAVE_DEVICE_ADDRESS, new_addr & 0x7F);
+  self->_i2c_address = new_addr;
+}
 
-  return true;
+bc_tick_t vl53l0x_get_timeout(vl53l0x_t *self)
+{
+  return self->_io_timeout;
 }
 
-void vl53l0x_set_address(uint8_t new_addr)
+void vl53l0x_set_timeout(vl53l0x_t *self, bc_tick_t timeout)
 {
-    vl53l0x_write_reg(I2C_SLAVE_DEVICE_ADDRESS, new_addr & 0x7F);
-    address = new_addr;
+  self->_io_timeout = timeout;
 }
 
 // Write an 8-bit register
-void vl53l0x_write_reg(uint8_t reg, uint8_t value)
+void vl53l0x_write_reg(vl53l0x_t *self, uint8_t reg, uint8_t value)
 {
-    bc_i2c_memory_write_8b(BC_I2C_I2C0, address, reg, value);
+  vl53l0x_flush_transfers(self);
+
+  busTransfer(self, false, reg, &value, 1);
 }
 
 // Write a 16-bit register
-void vl53l0x_write_reg16_bit(uint8_t reg, uint16_t value)
+void vl53l0x_write_reg16_bit(vl53l0x_t *self, uint8_t reg, uint16_t value)
 {
-    bc_i2c_memory_write_16b(BC_I2C_I2C0, address, reg, value);
+  vl53l0x_flush_transfers(self);
+
+  uint8_t buffer[2];
+  buffer[0] = (value >> 8) & 0xFF;
+  buffer[1] =  value       & 0xFF;
+
+  busTransfer(self, false, reg, buffer, 2);
 }
 
 // Write a 32-bit register
-void vl53l0x_write_reg32_bit(uint8_t reg, uint32_t value)
+void vl53l0x_write_reg32_bit(vl53l0x_t *self, uint8_t reg, uint32_t value)
 {
-    uint8_t buffer[4];
-    buffer[0] = (value >> 24) & 0xFF;
-    buffer[1] = (value >> 16) & 0xFF;
-    buffer[2] = (value >>  8) & 0xFF;
-    buffer[3] =  value        & 0xFF;
+  vl53l0x_flush_transfers(self);
 
-    bc_i2c_memory_transfer_t transfer;
-    transfer.device_address = address;
-    transfer.memory_address = reg;
-    transfer.buffer = buffer;
-    transfer.length = 4;
+  uint8_t buffer[4];
+  buffer[0] = (value >> 24) & 0xFF;
+  buffer[1] = (value >> 16) & 0xFF;
+  buffer[2] = (value >>  8) & 0xFF;
+  buffer[3] =  value        & 0xFF;
 
-    bc_i2c_memory_write(BC_I2C_I2C0, &transfer);
+  busTransfer(self, false, reg, buffer, 4);
 }
 
-// Read an 8-bit register
-uint8_t vl53l0x_read_reg(uint8_t reg)
+// Read an 8-bit register; 0 if the transaction failed
+uint8_t vl53l0x_read_reg(vl53l0x_t *self, uint8_t reg)
 {
-    uint8_t value;
-    bc_i2c_memory_read_8b(BC_I2C_I2C0, address, reg, &value);
-    return value;
+  vl53l0x_flush_transfers(self);
+
+  uint8_t value;
+  busTransfer(self, true, reg, &value, 1);
+  return value;
 }
 
-// Read a 16-bit register
-uint16_t vl53l0x_read_reg16_bit(uint8_t reg)
+// Read a 16-bit register; 0 if the transaction failed
+uint16_t vl53l0x_read_reg16_bit(vl53l0x_t *self, uint8_t reg)
 {
-    uint16_t value;
-    bc_i2c_memory_read_16b(BC_I2C_I2C0, address, reg, &value);
-    return value;
+  vl53l0x_flush_transfers(self);
+
+  uint8_t buffer[2];
+  busTransfer(self, true, reg, buffer, 2);
+  return ((uint16_t) buffer[0] << 8) | buffer[1];
 }
 
-// Read a 32-bit register
-uint32_t vl53l0x_read_reg32_bit(uint8_t reg)
+// Read a 32-bit register; 0 if the transaction failed
+uint32_t vl53l0x_read_reg32_bit(vl53l0x_t *self, uint8_t reg)
 {
-    uint32_t value;
-    uint8_t buffer[4];
+  vl53l0x_flush_transfers(self);
 
-    bc_i2c_memory_transfer_t transfer;
-    transfer.device_address = address;
-    transfer.memory_address = reg;
-    transfer.buffer = buffer;
-    transfer.length = 4;
+  uint32_t value;
+  uint8_t buffer[4];
 
-    bc_i2c_memory_read(BC_I2C_I2C0, &transfer);
+  busTransfer(self, true, reg, buffer, 4);
 
-    value  = (uint32_t)buffer[0] << 24; // value highest byte
-    value |= (uint32_t)buffer[1] << 16;
-    value |= (uint16_t)buffer[2] <<  8;
-    value |=           buffer[3];       // value lowest byte
+  value  = (uint32_t)buffer[0] << 24; // value highest byte
+  value |= (uint32_t)buffer[1] << 16;
+  value |= (uint16_t)buffer[2] <<  8;
+  value |=           buffer[3];       // value lowest byte
 
-    return value;
+  return value;
 }
 
 // Write an arbitrary number of bytes from the given array to the sensor,
 // starting at the given register
-void vl53l0x_write_multi(uint8_t reg, uint8_t const *src, uint8_t count)
+void vl53l0x_write_multi(vl53l0x_t *self, uint8_t reg, uint8_t const *src, uint8_t count)
 {
-    bc_i2c_memory_transfer_t transfer;
-    transfer.device_address = address;
-    transfer.memory_address = reg;
-    transfer.buffer = (uint8_t *) src;
-    transfer.length = count;
+  vl53l0x_flush_transfers(self);
 
-    bc_i2c_memory_write(BC_I2C_I2C0, &transfer);
+  busTransfer(self, false, reg, (uint8_t *) src, count);
 }
 
 // Read an arbitrary number of bytes from the sensor, starting at the given
 // register, into the given array
-void vl53l0x_read_multi(uint8_t reg, uint8_t *dst, uint8_t count)
+void vl53l0x_read_multi(vl53l0x_t *self, uint8_t reg, uint8_t *dst, uint8_t count)
 {
-    bc_i2c_memory_transfer_t transfer;
-    transfer.device_address = address;
-    transfer.memory_address = reg;
-    transfer.buffer = dst;
-    transfer.length = count;
+  vl53l0x_flush_transfers(self);
 
-    bc_i2c_memory_read(BC_I2C_I2C0, &transfer);
+  busTransfer(self, true, reg, dst, count);
 }
 
-// Set the return signal rate limit check value in units of MCPS (mega counts
-// per second). "This represents the amplitude of the signal reflected from the
-// target and detected by the device"; setting this limit presumably determines
-// the minimum measurement necessary for the sensor to report a valid reading.
-// Setting a lower limit increases the potential range of the sensor but also
-// seems to increase the likelihood of getting an inaccurate reading because of
-// unwanted reflections from objects other than the intended target.
+// Queue a register transaction to run from the scheduler, one transaction per
+// task run, so other tasks get the core between them; its handler is called
+// on completion and may queue the next one. Transactions of an instance run
+// in order, and the blocking register access runs all queued ones first.
+// Handlers are only ever called from the scheduler, never from within a
+// blocking call.
+// The descriptor is copied; a buffer it points to must stay valid until
+// completion. Fails if the queue is full.
+bool vl53l0x_queue_transfer(vl53l0x_t *self, const vl53l0x_transfer_t *transfer)
+{
+  if (self->_transfer_count == VL53L0X_TRANSFER_QUEUE_SIZE || (transfer->buffer == NULL && transfer->length > sizeof(transfer->data)))
+  {
+    return false;
+  }
+
+  if (!self->_transfer_task_registered)
+  {
+    self->_transfer_task_id = bc_scheduler_register(transferTask, self, BC_TICK_INFINITY);
+    self->_transfer_task_registered = true;
+  }
+
+  self->_transfers[(self->_transfer_head + self->_transfer_count) % VL53L0X_TRANSFER_QUEUE_SIZE] = *transfer;
+  self->_transfer_count++;
+
+  bc_scheduler_plan_now(self->_transfer_task_id);
+
+  return true;
+}
+
+// Run all queued transactions now. Their handlers are left to the transfer
+// task, so a blocking call does not call back into the caller, which may be in
+// the middle of a handler or of reconfiguring the sensor.
+void vl53l0x_flush_transfers(vl53l0x_t *self)
+{
+  for (; self->_transfer_done < self->_transfer_count; self->_transfer_done++)
+  {
+    uint8_t index = (self->_transfer_head + self->_transfer_done) % VL53L0X_TRANSFER_QUEUE_SIZE;
+    vl53l0x_transfer_t *transfer = &self->_transfers[index];
+
+    self->_transfer_ok[index] = busTransfer(self, transfer->read, transfer->reg, transfer->buffer != NULL ? transfer->buffer : transfer->data, transfer->length);
+  }
+}
+
+size_t vl53l0x_get_pending_transfers(vl53l0x_t *self)
+{
+  return self->_transfer_count;
+}
+
+// Set the return signal rate limit check value in units of MCPS (mega counts
+// per second) as Q9.7 fixed point (9 integer bits, 7 fractional bits, see
+// VL53L0X_MCPS_TO_Q97()). "This represents the amplitude of the signal
+// reflected from the target and detected by the device"; setting this limit
+// presumably determines the minimum measurement necessary for the sensor to
+// report a valid reading. Setting a lower limit increases the potential range
+// of the sensor but also seems to increase the likelihood of getting an
+// inaccurate reading because of unwanted reflections from objects other than
+// the intended target.
 // Defaults to 0.25 MCPS as initialized by the ST API and this library.
-bool vl53l0x_set_signal_rate_limit(float limit_mcps)
+void vl53l0x_set_signal_rate_limit_q97(vl53l0x_t *self, uint16_t limit)
+{
+  self->_signal_rate_limit = limit;
+  vl53l0x_write_reg16_bit(self, FINAL_RANGE_CONFIG_MIN_COUNT_RATE_RTN_LIMIT, limit);
+}
+
+// Get the return signal rate limit check value in MCPS as Q9.7
+uint16_t vl53l0x_get_signal_rate_limit_q97(vl53l0x_t *self)
+{
+  return self->_signal_rate_limit;
+}
+
+#if VL53L0X_FLOAT_API
+
+// Floating point wrapper of vl53l0x_set_signal_rate_limit_q97()
+bool vl53l0x_set_signal_rate_limit(vl53l0x_t *self, float limit_mcps)
 {
   if (limit_mcps < 0 || limit_mcps > 511.99) { return false; }
 
-  // Q9.7 fixed point format (9 integer bits, 7 fractional bits)
-  vl53l0x_write_reg16_bit(FINAL_RANGE_CONFIG_MIN_COUNT_RATE_RTN_LIMIT, limit_mcps * (1 << 7));
+  vl53l0x_set_signal_rate_limit_q97(self, limit_mcps * (1 << 7));
   return true;
 }
 
-// Get the return signal rate limit check value im MCPS
-float vl53l0x_get_signal_rate_limit()
+// Floating point wrapper of vl53l0x_get_signal_rate_limit_q97()
+float vl53l0x_get_signal_rate_limit(vl53l0x_t *self)
+{
+  return (float)vl53l0x_get_signal_rate_limit_q97(self) / (1 << 7);
+}
+
+#endif
+
+// Set the limit of the range sigma estimate above which results are flagged
+// VL53L0X_VALIDITY_SIGMA_FAIL; 0 disables the check.
+// Defaults to VL53L0X_DEFAULT_SIGMA_LIMIT_MM.
+void vl53l0x_set_sigma_limit(vl53l0x_t *self, uint16_t sigma_mm)
+{
+  self->_sigma_limit_mm = sigma_mm;
+}
+
+// Timing budget in microseconds at which the sigma estimate of results with
+// the given return signal and ambient rates (Q9.7) comes to sigma_mm; the
+// inverse of the estimate made when a result is decoded, taking the sequence
+// step timeouts as the whole budget and the default final range VCSEL period
+// of 10 PCLKs, at which the VCSEL is on for 3 * 2048 / (2304 * 10) = 4/15 of
+// the time. UINT32_MAX without signal.
+uint32_t vl53l0x_estimate_budget_for_sigma(uint16_t signal_rate, uint16_t ambient_rate, uint16_t sigma_mm)
 {
-  return (float)vl53l0x_read_reg16_bit(FINAL_RANGE_CONFIG_MIN_COUNT_RATE_RTN_LIMIT) / (1 << 7);
+  if (signal_rate == 0 || sigma_mm == 0)
+  {
+    return UINT32_MAX;
+  }
+
+  uint32_t ratio = ((uint32_t) ambient_rate << 16) / signal_rate;
+
+  if (ratio > ((uint32_t) SIGMA_AMBIENT_RATIO_MAX << 16))
+  {
+    ratio = (uint32_t) SIGMA_AMBIENT_RATIO_MAX << 16;
+  }
+
+  uint64_t pulse = SIGMA_PULSE_WIDTH_CENTI_NS;
+  uint64_t ambient = (ratio * SIGMA_AMBIENT_WIDTH_CENTI_NS + 0x8000) >> 16;
+
+  // sigma^2 = sigma_rtn^2 + sigma_ref^2 in um^2 with N = s / 128 * 4/15 * T:
+  //   c^2 * width^2 / (48 * N) + 1000^2 * 25 ms / T
+  //   = (c^2 * width^2 * 10 / s + 25e9 us) / T
+  uint64_t budget_us = ((uint64_t) SIGMA_SPEED_OF_LIGHT * SIGMA_SPEED_OF_LIGHT * (pulse * pulse + ambient * ambient) * 10 / signal_rate +
+                        (uint64_t) 1000 * 1000 * 1000 * SIGMA_REF_INTEGRATION_MS) /
+                       ((uint64_t) sigma_mm * sigma_mm * 1000 * 1000);
+
+  return budget_us > UINT32_MAX ? UINT32_MAX : (uint32_t) budget_us;
 }
 
 // Set the measurement timing budget in microseconds, which is the time allowed
@@ -508,51 +1312,22 @@ float vl53l0x_get_signal_rate_limit()
 // factor of N decreases the range measurement standard deviation by a factor of
 // sqrt(N). Defaults to about 33 milliseconds; the minimum is 20 ms.
 // based on VL53L0X_set_measurement_timing_budget_micro_seconds()
-bool vl53l0x_set_measurement_timing_budget(uint32_t budget_us)
+bool vl53l0x_set_measurement_timing_budget(vl53l0x_t *self, uint32_t budget_us)
 {
   SequenceStepEnables enables;
   SequenceStepTimeouts timeouts;
 
-  uint16_t const StartOverhead      = 1320; // note that this is different than the value in get_
-  uint16_t const EndOverhead        = 960;
-  uint16_t const MsrcOverhead       = 660;
-  uint16_t const TccOverhead        = 590;
-  uint16_t const DssOverhead        = 690;
-  uint16_t const PreRangeOverhead   = 660;
-  uint16_t const FinalRangeOverhead = 550;
-
   uint32_t const MinTimingBudget = 20000;
 
   if (budget_us < MinTimingBudget) { return false; }
 
-  uint32_t used_budget_us = StartOverhead + EndOverhead;
-
-  getSequenceStepEnables(&enables);
-  getSequenceStepTimeouts(&enables, &timeouts);
-
-  if (enables.tcc)
-  {
-    used_budget_us += (timeouts.msrc_dss_tcc_us + TccOverhead);
-  }
-
-  if (enables.dss)
-  {
-    used_budget_us += 2 * (timeouts.msrc_dss_tcc_us + DssOverhead);
-  }
-  else if (enables.msrc)
-  {
-    used_budget_us += (timeouts.msrc_dss_tcc_us + MsrcOverhead);
-  }
+  getSequenceStepEnables(self, &enables);
+  getSequenceStepTimeouts(self, &enables, &timeouts);
 
-  if (enables.pre_range)
-  {
-    used_budget_us += (timeouts.pre_range_us + PreRangeOverhead);
-  }
+  uint32_t used_budget_us = usedTimingBudget(&enables, &timeouts);
 
   if (enables.final_range)
   {
-    used_budget_us += FinalRangeOverhead;
-
     // "Note that the final range timeout is determined by the timing
     // budget and the sum of all other timeouts within the sequence.
     // If there is no room for the final range timeout, then an error
@@ -575,7 +1350,7 @@ bool vl53l0x_set_measurement_timing_budget(uint32_t budget_us)
     //  timeouts must be expressed in macro periods MClks
     //  because they have different vcsel periods."
 
-    uint16_t final_range_timeout_mclks =
+    uint32_t final_range_timeout_mclks =
       timeoutMicrosecondsToMclks(final_range_timeout_us,
                                  timeouts.final_range_vcsel_period_pclks);
 
@@ -584,20 +1359,69 @@ bool vl53l0x_set_measurement_timing_budget(uint32_t budget_us)
       final_range_timeout_mclks += timeouts.pre_range_mclks;
     }
 
-    vl53l0x_write_reg16_bit(FINAL_RANGE_CONFIG_TIMEOUT_MACROP_HI,
-      encodeTimeout(final_range_timeout_mclks));
+    // the timeout is encoded from 16 bits of MCLKs, about 2.5 s at the
+    // default final range VCSEL period; longer budgets would wrap around
+    if (final_range_timeout_mclks > 0xFFFF) { return false; }
+
+    uint16_t final_range_timeout_reg = encodeTimeout(final_range_timeout_mclks);
+    vl53l0x_write_reg16_bit(self, FINAL_RANGE_CONFIG_TIMEOUT_MACROP_HI, final_range_timeout_reg);
+    self->_final_range_mclks = decodeTimeout(final_range_timeout_reg);
 
     // set_sequence_step_timeout() end
 
-    measurement_timing_budget_us = budget_us; // store for internal reuse
+    self->_measurement_timing_budget_us = budget_us; // store for internal reuse
   }
   return true;
 }
 
-// Get the measurement timing budget in microseconds
+// Time the sequence steps other than the final range take out of the timing
+// budget, with the overheads of the setter; the final range gets the rest
+static uint32_t usedTimingBudget(SequenceStepEnables const * enables, SequenceStepTimeouts const * timeouts)
+{
+  uint16_t const StartOverhead      = 1320; // note that this is different than the value in get_
+  uint16_t const EndOverhead        = 960;
+  uint16_t const MsrcOverhead       = 660;
+  uint16_t const TccOverhead        = 590;
+  uint16_t const DssOverhead        = 690;
+  uint16_t const PreRangeOverhead   = 660;
+  uint16_t const FinalRangeOverhead = 550;
+
+  uint32_t used_budget_us = StartOverhead + EndOverhead;
+
+  if (enables->tcc)
+  {
+    used_budget_us += (timeouts->msrc_dss_tcc_us + TccOverhead);
+  }
+
+  if (enables->dss)
+  {
+    used_budget_us += 2 * (timeouts->msrc_dss_tcc_us + DssOverhead);
+  }
+  else if (enables->msrc)
+  {
+    used_budget_us += (timeouts->msrc_dss_tcc_us + MsrcOverhead);
+  }
+
+  if (enables->pre_range)
+  {
+    used_budget_us += (timeouts->pre_range_us + PreRangeOverhead);
+  }
+
+  if (enables->final_range)
+  {
+    used_budget_us += FinalRangeOverhead;
+  }
+
+  return used_budget_us;
+}
+
+// Get the measurement timing budget in microseconds, computed from the
+// sequence step timeouts. The start overhead differs from the one the setter
+// uses, so this does not round trip and leaves the budget last set, which the
+// driver keeps using, alone.
 // based on VL53L0X_get_measurement_timing_budget_micro_seconds()
 // in us
-uint32_t vl53l0x_get_measurement_timing_budget(void)
+uint32_t vl53l0x_get_measurement_timing_budget(vl53l0x_t *self)
 {
   SequenceStepEnables enables;
   SequenceStepTimeouts timeouts;
@@ -613,8 +1437,8 @@ uint32_t vl53l0x_get_measurement_timing_budget(void)
   // "Start and end overhead times always present"
   uint32_t budget_us = StartOverhead + EndOverhead;
 
-  getSequenceStepEnables(&enables);
-  getSequenceStepTimeouts(&enables, &timeouts);
+  getSequenceStepEnables(self, &enables);
+  getSequenceStepTimeouts(self, &enables, &timeouts);
 
   if (enables.tcc)
   {
@@ -640,7 +1464,6 @@ uint32_t vl53l0x_get_measurement_timing_budget(void)
     budget_us += (timeouts.final_range_us + FinalRangeOverhead);
   }
 
-  measurement_timing_budget_us = budget_us; // store for internal reuse
   return budget_us;
 }
 
@@ -651,15 +1474,15 @@ uint32_t vl53l0x_get_measurement_timing_budget(void)
 //  pre:  12 to 18 (initialized default: 14)
 //  final: 8 to 14 (initialized default: 10)
 // based on VL53L0X_set_vcsel_pulse_period()
-bool vl53l0x_set_vcsel_pulse_period(vcselPeriodType type, uint8_t period_pclks)
+bool vl53l0x_set_vcsel_pulse_period(vl53l0x_t *self, vcselPeriodType type, uint8_t period_pclks)
 {
   uint8_t vcsel_period_reg = encodeVcselPeriod(period_pclks);
 
   SequenceStepEnables enables;
   SequenceStepTimeouts timeouts;
 
-  getSequenceStepEnables(&enables);
-  getSequenceStepTimeouts(&enables, &timeouts);
+  getSequenceStepEnables(self, &enables);
+  getSequenceStepTimeouts(self, &enables, &timeouts);
 
   // "Apply specific settings for the requested clock period"
   // "Re-calculate and apply timeouts, in macro periods"
@@ -676,33 +1499,21 @@ bool vl53l0x_set_vcsel_pulse_period(vcselPeriodType type, uint8_t period_pclks)
 
   if (type == VcselPeriodPreRange)
   {
-    // "Set phase check limits"
-    switch (period_pclks)
-    {
-      case 12:
-        vl53l0x_write_reg(PRE_RANGE_CONFIG_VALID_PHASE_HIGH, 0x18);
-        break;
-
-      case 14:
-        vl53l0x_write_reg(PRE_RANGE_CONFIG_VALID_PHASE_HIGH, 0x30);
-        break;
-
-      case 16:
-        vl53l0x_write_reg(PRE_RANGE_CONFIG_VALID_PHASE_HIGH, 0x40);
-        break;
-
-      case 18:
-        vl53l0x_write_reg(PRE_RANGE_CONFIG_VALID_PHASE_HIGH, 0x50);
-        break;
+    uint8_t phase_high = preRangeValidPhaseHigh(period_pclks);
 
-      default:
-        // invalid period
-        return false;
+    if (phase_high == 0)
+    {
+      // invalid period
+      return false;
     }
-    vl53l0x_write_reg(PRE_RANGE_CONFIG_VALID_PHASE_LOW, 0x08);
+
+    // "Set phase check limits"
+    vl53l0x_write_reg(self, PRE_RANGE_CONFIG_VALID_PHASE_HIGH, phase_high);
+    vl53l0x_write_reg(self, PRE_RANGE_CONFIG_VALID_PHASE_LOW, 0x08);
 
     // apply new VCSEL period
-    vl53l0x_write_reg(PRE_RANGE_CONFIG_VCSEL_PERIOD, vcsel_period_reg);
+    vl53l0x_write_reg(self, PRE_RANGE_CONFIG_VCSEL_PERIOD, vcsel_period_reg);
+    self->_pre_range_vcsel_period_pclks = period_pclks;
 
     // update timeouts
 
@@ -712,8 +1523,9 @@ bool vl53l0x_set_vcsel_pulse_period(vcselPeriodType type, uint8_t period_pclks)
     uint16_t new_pre_range_timeout_mclks =
       timeoutMicrosecondsToMclks(timeouts.pre_range_us, period_pclks);
 
-    vl53l0x_write_reg16_bit(PRE_RANGE_CONFIG_TIMEOUT_MACROP_HI,
-      encodeTimeout(new_pre_range_timeout_mclks));
+    uint16_t new_pre_range_timeout_reg = encodeTimeout(new_pre_range_timeout_mclks);
+    vl53l0x_write_reg16_bit(self, PRE_RANGE_CONFIG_TIMEOUT_MACROP_HI, new_pre_range_timeout_reg);
+    self->_pre_range_mclks = decodeTimeout(new_pre_range_timeout_reg);
 
     // set_sequence_step_timeout() end
 
@@ -723,62 +1535,28 @@ bool vl53l0x_set_vcsel_pulse_period(vcselPeriodType type, uint8_t period_pclks)
     uint16_t new_msrc_timeout_mclks =
       timeoutMicrosecondsToMclks(timeouts.msrc_dss_tcc_us, period_pclks);
 
-    vl53l0x_write_reg(MSRC_CONFIG_TIMEOUT_MACROP,
-      (new_msrc_timeout_mclks > 256) ? 255 : (new_msrc_timeout_mclks - 1));
+    uint8_t new_msrc_timeout_reg = (new_msrc_timeout_mclks > 256) ? 255 : (new_msrc_timeout_mclks - 1);
+    vl53l0x_write_reg(self, MSRC_CONFIG_TIMEOUT_MACROP, new_msrc_timeout_reg);
+    self->_msrc_dss_tcc_mclks = new_msrc_timeout_reg + 1;
 
     // set_sequence_step_timeout() end
   }
   else if (type == VcselPeriodFinalRange)
   {
-    switch (period_pclks)
-    {
-      case 8:
-        vl53l0x_write_reg(FINAL_RANGE_CONFIG_VALID_PHASE_HIGH, 0x10);
-        vl53l0x_write_reg(FINAL_RANGE_CONFIG_VALID_PHASE_LOW,  0x08);
-        vl53l0x_write_reg(GLOBAL_CONFIG_VCSEL_WIDTH, 0x02);
-        vl53l0x_write_reg(ALGO_PHASECAL_CONFIG_TIMEOUT, 0x0C);
-        vl53l0x_write_reg(0xFF, 0x01);
-        vl53l0x_write_reg(ALGO_PHASECAL_LIM, 0x30);
-        vl53l0x_write_reg(0xFF, 0x00);
-        break;
-
-      case 10:
-        vl53l0x_write_reg(FINAL_RANGE_CONFIG_VALID_PHASE_HIGH, 0x28);
-        vl53l0x_write_reg(FINAL_RANGE_CONFIG_VALID_PHASE_LOW,  0x08);
-        vl53l0x_write_reg(GLOBAL_CONFIG_VCSEL_WIDTH, 0x03);
-        vl53l0x_write_reg(ALGO_PHASECAL_CONFIG_TIMEOUT, 0x09);
-        vl53l0x_write_reg(0xFF, 0x01);
-        vl53l0x_write_reg(ALGO_PHASECAL_LIM, 0x20);
-        vl53l0x_write_reg(0xFF, 0x00);
-        break;
+    size_t length;
+    const uint8_t (*sequence)[2] = finalRangeVcselSequence(period_pclks, &length);
 
-      case 12:
-        vl53l0x_write_reg(FINAL_RANGE_CONFIG_VALID_PHASE_HIGH, 0x38);
-        vl53l0x_write_reg(FINAL_RANGE_CONFIG_VALID_PHASE_LOW,  0x08);
-        vl53l0x_write_reg(GLOBAL_CONFIG_VCSEL_WIDTH, 0x03);
-        vl53l0x_write_reg(ALGO_PHASECAL_CONFIG_TIMEOUT, 0x08);
-        vl53l0x_write_reg(0xFF, 0x01);
-        vl53l0x_write_reg(ALGO_PHASECAL_LIM, 0x20);
-        vl53l0x_write_reg(0xFF, 0x00);
-        break;
-
-      case 14:
-        vl53l0x_write_reg(FINAL_RANGE_CONFIG_VALID_PHASE_HIGH, 0x48);
-        vl53l0x_write_reg(FINAL_RANGE_CONFIG_VALID_PHASE_LOW,  0x08);
-        vl53l0x_write_reg(GLOBAL_CONFIG_VCSEL_WIDTH, 0x03);
-        vl53l0x_write_reg(ALGO_PHASECAL_CONFIG_TIMEOUT, 0x07);
-        vl53l0x_write_reg(0xFF, 0x01);
-        vl53l0x_write_reg(ALGO_PHASECAL_LIM, 0x20);
-        vl53l0x_write_reg(0xFF, 0x00);
-        break;
-
-      default:
-        // invalid period
-        return false;
+    if (sequence == NULL)
+    {
+      // invalid period
+      return false;
     }
 
+    writeSequence(self, sequence, length);
+
     // apply new VCSEL period
-    vl53l0x_write_reg(FINAL_RANGE_CONFIG_VCSEL_PERIOD, vcsel_period_reg);
+    vl53l0x_write_reg(self, FINAL_RANGE_CONFIG_VCSEL_PERIOD, vcsel_period_reg);
+    self->_final_range_vcsel_period_pclks = period_pclks;
 
     // update timeouts
 
@@ -798,8 +1576,9 @@ bool vl53l0x_set_vcsel_pulse_period(vcselPeriodType type, uint8_t period_pclks)
       new_final_range_timeout_mclks += timeouts.pre_range_mclks;
     }
 
-    vl53l0x_write_reg16_bit(FINAL_RANGE_CONFIG_TIMEOUT_MACROP_HI,
-      encodeTimeout(new_final_range_timeout_mclks));
+    uint16_t new_final_range_timeout_reg = encodeTimeout(new_final_range_timeout_mclks);
+    vl53l0x_write_reg16_bit(self, FINAL_RANGE_CONFIG_TIMEOUT_MACROP_HI, new_final_range_timeout_reg);
+    self->_final_range_mclks = decodeTimeout(new_final_range_timeout_reg);
 
     // set_sequence_step_timeout end
   }
@@ -811,32 +1590,153 @@ bool vl53l0x_set_vcsel_pulse_period(vcselPeriodType type, uint8_t period_pclks)
 
   // "Finally, the timing budget must be re-applied"
 
-  vl53l0x_set_measurement_timing_budget(measurement_timing_budget_us);
+  vl53l0x_set_measurement_timing_budget(self, self->_measurement_timing_budget_us);
 
   // "Perform the phase calibration. This is needed after changing on vcsel period."
-  // VL53L0X_perform_phase_calibration() begin
+  performPhaseCalibration(self);
 
-  uint8_t sequence_config = vl53l0x_read_reg(SYSTEM_SEQUENCE_CONFIG);
-  vl53l0x_write_reg(SYSTEM_SEQUENCE_CONFIG, 0x02);
-  performSingleRefCalibration(0x0);
-  vl53l0x_write_reg(SYSTEM_SEQUENCE_CONFIG, sequence_config);
+  return true;
+}
+
+// Get the settings of one of the predefined ranging profiles
+void vl53l0x_get_profile_config(vl53l0x_profile_t profile, vl53l0x_config_t *config)
+{
+  if ((size_t) profile >= sizeof(profile_configs) / sizeof(profile_configs[0]))
+  {
+    profile = VL53L0X_PROFILE_DEFAULT;
+  }
+
+  *config = profile_configs[profile];
+}
+
+// Get the current ranging configuration, from the driver's shadow
+void vl53l0x_get_config(vl53l0x_t *self, vl53l0x_config_t *config)
+{
+  loadSequenceStepCache(self);
+
+  config->signal_rate_limit = self->_signal_rate_limit;
+  config->sigma_limit_mm = self->_sigma_limit_mm;
+  config->pre_range_vcsel_period_pclks = self->_pre_range_vcsel_period_pclks;
+  config->final_range_vcsel_period_pclks = self->_final_range_vcsel_period_pclks;
+  config->timing_budget_us = self->_measurement_timing_budget_us;
+}
+
+// Switch to a whole ranging configuration in one pass. All settings are
+// checked before anything is written and only what differs from the current
+// configuration is written, the pre-range period and timeout in one burst.
+// The timing budget is applied and the phase calibration run once at the end,
+// instead of once per vl53l0x_set_vcsel_pulse_period() call. Stop continuous
+// ranging first.
+bool vl53l0x_apply_config(vl53l0x_t *self, const vl53l0x_config_t *config)
+{
+  SequenceStepEnables enables;
+  SequenceStepTimeouts timeouts;
+  size_t final_range_length;
+
+  uint8_t pre_range_phase_high = preRangeValidPhaseHigh(config->pre_range_vcsel_period_pclks);
+  const uint8_t (*final_range_sequence)[2] = finalRangeVcselSequence(config->final_range_vcsel_period_pclks, &final_range_length);
+
+  if (pre_range_phase_high == 0 || final_range_sequence == NULL || config->timing_budget_us < 20000)
+  {
+    return false;
+  }
+
+  getSequenceStepEnables(self, &enables);
+  getSequenceStepTimeouts(self, &enables, &timeouts);
+
+  bool pre_range_changed = config->pre_range_vcsel_period_pclks != timeouts.pre_range_vcsel_period_pclks;
+  bool final_range_changed = config->final_range_vcsel_period_pclks != timeouts.final_range_vcsel_period_pclks;
+
+  // the pre-range and MSRC timeouts are kept in microseconds across a period
+  // change, within the resolution of the new period
+  uint8_t pre_range_period_pclks = config->pre_range_vcsel_period_pclks;
+  uint16_t pre_range_timeout_reg = encodeTimeout(timeoutMicrosecondsToMclks(timeouts.pre_range_us, pre_range_period_pclks));
+  uint16_t msrc_timeout_mclks = timeoutMicrosecondsToMclks(timeouts.msrc_dss_tcc_us, pre_range_period_pclks);
+  uint8_t msrc_timeout_reg = (msrc_timeout_mclks > 256) ? 255 : (msrc_timeout_mclks - 1);
+
+  if (pre_range_changed)
+  {
+    timeouts.pre_range_us = timeoutMclksToMicroseconds(decodeTimeout(pre_range_timeout_reg), pre_range_period_pclks);
+    timeouts.msrc_dss_tcc_us = timeoutMclksToMicroseconds(msrc_timeout_reg + 1, pre_range_period_pclks);
+  }
+
+  // the final range has to fit in what the budget leaves of the new timeouts,
+  // checked before anything is written
+  if (enables.final_range && usedTimingBudget(&enables, &timeouts) > config->timing_budget_us)
+  {
+    return false;
+  }
+
+  if (config->signal_rate_limit != self->_signal_rate_limit)
+  {
+    vl53l0x_set_signal_rate_limit_q97(self, config->signal_rate_limit);
+  }
+
+  self->_sigma_limit_mm = config->sigma_limit_mm;
+
+  if (pre_range_changed)
+  {
+    // "Set phase check limits"
+    uint8_t phase[2] = { 0x08, pre_range_phase_high }; // PRE_RANGE_CONFIG_VALID_PHASE_LOW, _HIGH
+    vl53l0x_write_multi(self, PRE_RANGE_CONFIG_VALID_PHASE_LOW, phase, sizeof(phase));
+
+    // new VCSEL period and the pre-range timeout
+    uint8_t pre_range[3] = { encodeVcselPeriod(pre_range_period_pclks), pre_range_timeout_reg >> 8, pre_range_timeout_reg & 0xFF };
+    vl53l0x_write_multi(self, PRE_RANGE_CONFIG_VCSEL_PERIOD, pre_range, sizeof(pre_range));
+    self->_pre_range_vcsel_period_pclks = pre_range_period_pclks;
+    self->_pre_range_mclks = decodeTimeout(pre_range_timeout_reg);
+
+    // the MSRC timeout depends on the pre-range period as well
+    vl53l0x_write_reg(self, MSRC_CONFIG_TIMEOUT_MACROP, msrc_timeout_reg);
+    self->_msrc_dss_tcc_mclks = msrc_timeout_reg + 1;
+  }
+
+  if (final_range_changed)
+  {
+    writeSequence(self, final_range_sequence, final_range_length);
+
+    vl53l0x_write_reg(self, FINAL_RANGE_CONFIG_VCSEL_PERIOD, encodeVcselPeriod(config->final_range_vcsel_period_pclks));
+    self->_final_range_vcsel_period_pclks = config->final_range_vcsel_period_pclks;
+  }
+
+  // the final range timeout follows from the budget and the other steps
+  if (!vl53l0x_set_measurement_timing_budget(self, config->timing_budget_us))
+  {
+    return false;
+  }
 
-  // VL53L0X_perform_phase_calibration() end
+  if (pre_range_changed || final_range_changed)
+  {
+    performPhaseCalibration(self);
+  }
 
   return true;
 }
 
+// Switch to one of the predefined ranging profiles, see vl53l0x_apply_config()
+bool vl53l0x_set_profile(vl53l0x_t *self, vl53l0x_profile_t profile)
+{
+  vl53l0x_config_t config;
+
+  vl53l0x_get_profile_config(profile, &config);
+
+  return vl53l0x_apply_config(self, &config);
+}
+
 // Get the VCSEL pulse period in PCLKs for the given period type.
+// Served from the driver's shadow of the sequence step configuration.
 // based on VL53L0X_get_vcsel_pulse_period()
-uint8_t vl53l0x_get_vcsel_pulse_period(vcselPeriodType type)
+uint8_t vl53l0x_get_vcsel_pulse_period(vl53l0x_t *self, vcselPeriodType type)
 {
+  loadSequenceStepCache(self);
+
   if (type == VcselPeriodPreRange)
   {
-    return decodeVcselPeriod(vl53l0x_read_reg(PRE_RANGE_CONFIG_VCSEL_PERIOD));
+    return self->_pre_range_vcsel_period_pclks;
   }
   else if (type == VcselPeriodFinalRange)
   {
-    return decodeVcselPeriod(vl53l0x_read_reg(FINAL_RANGE_CONFIG_VCSEL_PERIOD));
+    return self->_final_range_vcsel_period_pclks;
   }
   else { return 255; }
 }
@@ -847,15 +1747,13 @@ uint8_t vl53l0x_get_vcsel_pulse_period(vcselPeriodType type)
 // inter-measurement period in milliseconds determining how often the sensor
 // takes a measurement.
 // based on VL53L0X_StartMeasurement()
-void vl53l0x_start_continuous(uint32_t period_ms)
+void vl53l0x_start_continuous(vl53l0x_t *self, uint32_t period_ms)
 {
-  vl53l0x_write_reg(0x80, 0x01);
-  vl53l0x_write_reg(0xFF, 0x01);
-  vl53l0x_write_reg(0x00, 0x00);
-  vl53l0x_write_reg(0x91, stop_variable);
-  vl53l0x_write_reg(0x00, 0x01);
-  vl53l0x_write_reg(0xFF, 0x00);
-  vl53l0x_write_reg(0x80, 0x00);
+  uint32_t nominal_period_ms = period_ms;
+
+  setStopVariable(self);
+
+  checkInterruptSettings(self, true);
 
   if (period_ms != 0)
   {
@@ -863,263 +1761,1721 @@ void vl53l0x_start_continuous(uint32_t period_ms)
 
     // VL53L0X_SetInterMeasurementPeriodMilliSeconds() begin
 
-    uint16_t osc_calibrate_val = vl53l0x_read_reg16_bit(OSC_CALIBRATE_VAL);
+    uint16_t osc_calibrate_val = vl53l0x_read_reg16_bit(self, OSC_CALIBRATE_VAL);
 
     if (osc_calibrate_val != 0)
     {
       period_ms *= osc_calibrate_val;
     }
 
-    vl53l0x_write_reg32_bit(SYSTEM_INTERMEASUREMENT_PERIOD, period_ms);
+    vl53l0x_write_reg32_bit(self, SYSTEM_INTERMEASUREMENT_PERIOD, period_ms);
 
     // VL53L0X_SetInterMeasurementPeriodMilliSeconds() end
 
-    vl53l0x_write_reg(SYSRANGE_START, 0x04); // VL53L0X_REG_SYSRANGE_MODE_TIMED
+    vl53l0x_write_reg(self, SYSRANGE_START, 0x04); // VL53L0X_REG_SYSRANGE_MODE_TIMED
   }
   else
   {
     // continuous back-to-back mode
-    vl53l0x_write_reg(SYSRANGE_START, 0x02); // VL53L0X_REG_SYSRANGE_MODE_BACKTOBACK
+    vl53l0x_write_reg(self, SYSRANGE_START, 0x02); // VL53L0X_REG_SYSRANGE_MODE_BACKTOBACK
   }
+
+  measurementStarted(self, true, nominal_period_ms);
 }
 
 // Stop continuous measurements
 // based on VL53L0X_StopMeasurement()
-void vl53l0x_stop_continuous(void)
+void vl53l0x_stop_continuous(vl53l0x_t *self)
 {
-  vl53l0x_write_reg(SYSRANGE_START, 0x01); // VL53L0X_REG_SYSRANGE_MODE_SINGLESHOT
+  writeSequence(self, stop_continuous_sequence, sizeof(stop_continuous_sequence) / sizeof(stop_continuous_sequence[0]));
 
-  vl53l0x_write_reg(0xFF, 0x01);
-  vl53l0x_write_reg(0x00, 0x00);
-  vl53l0x_write_reg(0x91, 0x00);
-  vl53l0x_write_reg(0x00, 0x01);
-  vl53l0x_write_reg(0xFF, 0x00);
+  checkInterruptSettings(self, false);
+
+  // the sequence zeroes the stop variable
+  self->_stop_variable_set = false;
+  self->_shot_pending = false;
+  self->_measurement_continuous = false;
 }
 
 // Returns a range reading in millimeters when continuous mode is active
 // (readRangeSingleMillimeters() also calls this function after starting a
 // single-shot range measurement)
-uint16_t vl53l0x_read_range_continuous_millimeters(void)
+uint16_t vl53l0x_read_range_continuous_millimeters(vl53l0x_t *self)
 {
-  startTimeout();
-  while ((vl53l0x_read_reg(RESULT_INTERRUPT_STATUS) & 0x07) == 0)
+  vl53l0x_result_t result;
+
+  if (!vl53l0x_read_result(self, &result))
   {
-    if (checkTimeoutExpired())
-    {
-      did_timeout = true;
-      return 65535;
-    }
+    return 65535;
   }
 
-  // assumptions: Linearity Corrective Gain is 1000 (default);
-  // fractional ranging is not enabled
-  uint16_t range = vl53l0x_read_reg16_bit(RESULT_RANGE_STATUS + 10);
-
-  vl53l0x_write_reg(SYSTEM_INTERRUPT_CLEAR, 0x01);
-
-  return range;
+  return result.range_mm;
 }
 
-// Performs a single-shot range measurement and returns the reading in
-// millimeters
-// based on VL53L0X_PerformSingleRangingMeasurement()
-uint16_t vl53l0x_read_range_single_millimeters(void)
+// Wait for the next measurement like vl53l0x_read_range_continuous_millimeters(),
+// but fetch the whole result block in a single transaction and decode it,
+// so range status, signal and ambient rates and the effective SPAD count come
+// at no extra cost. Returns false on timeout.
+// based on VL53L0X_GetRangingMeasurementData()
+bool vl53l0x_read_result(vl53l0x_t *self, vl53l0x_result_t *result)
 {
-  vl53l0x_write_reg(0x80, 0x01);
-  vl53l0x_write_reg(0xFF, 0x01);
-  vl53l0x_write_reg(0x00, 0x00);
-  vl53l0x_write_reg(0x91, stop_variable);
-  vl53l0x_write_reg(0x00, 0x01);
-  vl53l0x_write_reg(0xFF, 0x00);
-  vl53l0x_write_reg(0x80, 0x00);
-
-  vl53l0x_write_reg(SYSRANGE_START, 0x01);
+  uint8_t buffer[RESULT_BLOCK_LENGTH];
+  uint32_t polls;
 
-  // "Wait until start bit has been cleared"
-  startTimeout();
-  while (vl53l0x_read_reg(SYSRANGE_START) & 0x01)
+  if (!waitDataReady(self, &polls))
   {
-    if (checkTimeoutExpired())
-    {
-      did_timeout = true;
-      return 65535;
-    }
+    return false;
   }
 
-  return vl53l0x_read_range_continuous_millimeters();
+  vl53l0x_read_multi(self, RESULT_RANGE_STATUS, buffer, RESULT_BLOCK_LENGTH);
+
+  vl53l0x_write_reg(self, SYSTEM_INTERRUPT_CLEAR, 0x01);
+
+  decodeResult(self, buffer, result);
+
+  accountSample(self, self->_timeout_start_ms, polls);
+  measurementResult(self, bc_tick_get(), polls > 1);
+
+  return true;
 }
 
-// Did a timeout occur in one of the read functions since the last call to
-// timeoutOccurred()?
-bool vl53l0x_timeout_occurred()
+// Start a single-shot measurement and return without waiting for it, so that
+// several sensors can be triggered together; collect it with
+// vl53l0x_read_range_pipelined(). Returns false on a bus error.
+bool vl53l0x_trigger_single(vl53l0x_t *self)
 {
-  bool tmp = did_timeout;
-  did_timeout = false;
-  return tmp;
-}
+  uint32_t bus_errors = self->_bus_errors;
 
-// Private Methods /////////////////////////////////////////////////////////////
+  setStopVariable(self);
 
-// Get reference SPAD (single photon avalanche diode) count and type
-// based on VL53L0X_get_info_from_device(),
-// but only gets reference SPAD count and type
-bool getSpadInfo(uint8_t * count, bool * type_is_aperture)
-{
-  uint8_t tmp;
+  vl53l0x_write_reg(self, SYSRANGE_START, 0x01);
 
-  vl53l0x_write_reg(0x80, 0x01);
-  vl53l0x_write_reg(0xFF, 0x01);
-  vl53l0x_write_reg(0x00, 0x00);
+  measurementStarted(self, false, 0);
+  self->_shot_pending = self->_bus_errors == bus_errors;
 
-  vl53l0x_write_reg(0xFF, 0x06);
-  vl53l0x_write_reg(0x83, vl53l0x_read_reg(0x83) | 0x04);
-  vl53l0x_write_reg(0xFF, 0x07);
-  vl53l0x_write_reg(0x81, 0x01);
+  return self->_shot_pending;
+}
 
-  vl53l0x_write_reg(0x80, 0x01);
+// Wait for the shot started by vl53l0x_trigger_single() or by the previous
+// call and read it. With rearm, the next shot starts right after the interrupt
+// clear, before this one is decoded, and ranges while the caller processes
+// this result; unlike vl53l0x_read_range_single_millimeters(), neither the
+// stop variable sequence nor the start bit poll precedes it. The interrupt
+// clear and the start are separate registers, so they take two back-to-back
+// transactions. Returns false on timeout or bus error, or if no shot is
+// pending.
+bool vl53l0x_read_range_pipelined(vl53l0x_t *self, vl53l0x_result_t *result, bool rearm)
+{
+  uint8_t buffer[RESULT_BLOCK_LENGTH];
+  uint32_t polls;
 
-  vl53l0x_write_reg(0x94, 0x6b);
-  vl53l0x_write_reg(0x83, 0x00);
-  startTimeout();
-  while (vl53l0x_read_reg(0x83) == 0x00)
+  if (!self->_shot_pending)
   {
-    if (checkTimeoutExpired()) { return false; }
+    return false;
   }
-  vl53l0x_write_reg(0x83, 0x01);
-  tmp = vl53l0x_read_reg(0x92);
 
-  *count = tmp & 0x7f;
-  *type_is_aperture = (tmp >> 7) & 0x01;
+  self->_shot_pending = false;
+
+  if (!waitDataReady(self, &polls))
+  {
+    return false;
+  }
 
-  vl53l0x_write_reg(0x81, 0x00);
-  vl53l0x_write_reg(0xFF, 0x06);
-  vl53l0x_write_reg(0x83, vl53l0x_read_reg(0x83)  & ~0x04);
-  vl53l0x_write_reg(0xFF, 0x01);
-  vl53l0x_write_reg(0x00, 0x01);
+  vl53l0x_read_multi(self, RESULT_RANGE_STATUS, buffer, RESULT_BLOCK_LENGTH);
 
-  vl53l0x_write_reg(0xFF, 0x00);
-  vl53l0x_write_reg(0x80, 0x00);
+  vl53l0x_write_reg(self, SYSTEM_INTERRUPT_CLEAR, 0x01);
+
+  accountSample(self, self->_timeout_start_ms, polls);
+
+  if (rearm)
+  {
+    vl53l0x_trigger_single(self);
+  }
+
+  decodeResult(self, buffer, result);
 
   return true;
 }
 
-// Get sequence step enables
-// based on VL53L0X_GetSequenceStepEnables()
-void getSequenceStepEnables(SequenceStepEnables * enables)
+// Performs a single-shot range measurement and returns the reading in
+// millimeters
+uint16_t vl53l0x_read_range_single_millimeters(vl53l0x_t *self)
 {
-  uint8_t sequence_config = vl53l0x_read_reg(SYSTEM_SEQUENCE_CONFIG);
+  vl53l0x_result_t result;
 
-  enables->tcc          = (sequence_config >> 4) & 0x1;
-  enables->dss          = (sequence_config >> 3) & 0x1;
-  enables->msrc         = (sequence_config >> 2) & 0x1;
-  enables->pre_range    = (sequence_config >> 6) & 0x1;
-  enables->final_range  = (sequence_config >> 7) & 0x1;
+  if (!readSingleResult(self, &result))
+  {
+    return 65535;
+  }
+
+  return result.range_mm;
 }
 
-// Get sequence step timeouts
-// based on get_sequence_step_timeout(),
-// but gets all timeouts instead of just the requested one, and also stores
-// intermediate values
-void getSequenceStepTimeouts(SequenceStepEnables const * enables, SequenceStepTimeouts * timeouts)
+// Performs a single-shot range measurement and decodes the whole result
+// based on VL53L0X_PerformSingleRangingMeasurement()
+static bool readSingleResult(vl53l0x_t *self, vl53l0x_result_t *result)
 {
-  timeouts->pre_range_vcsel_period_pclks = vl53l0x_get_vcsel_pulse_period(VcselPeriodPreRange);
+  setStopVariable(self);
 
-  timeouts->msrc_dss_tcc_mclks = vl53l0x_read_reg(MSRC_CONFIG_TIMEOUT_MACROP) + 1;
-  timeouts->msrc_dss_tcc_us =
-    timeoutMclksToMicroseconds(timeouts->msrc_dss_tcc_mclks,
-                               timeouts->pre_range_vcsel_period_pclks);
+  vl53l0x_write_reg(self, SYSRANGE_START, 0x01);
 
-  timeouts->pre_range_mclks =
-    decodeTimeout(vl53l0x_read_reg16_bit(PRE_RANGE_CONFIG_TIMEOUT_MACROP_HI));
-  timeouts->pre_range_us =
-    timeoutMclksToMicroseconds(timeouts->pre_range_mclks,
-                               timeouts->pre_range_vcsel_period_pclks);
+  measurementStarted(self, false, 0);
 
-  timeouts->final_range_vcsel_period_pclks = vl53l0x_get_vcsel_pulse_period(VcselPeriodFinalRange);
+  // "Wait until start bit has been cleared"
+  startTimeout();
+  while (vl53l0x_read_reg(self, SYSRANGE_START) & 0x01)
+  {
+    if (checkTimeoutExpired())
+    {
+      self->_did_timeout = true;
+      setError(self, VL53L0X_ERROR_TIMEOUT);
+      return false;
+    }
+  }
 
-  timeouts->final_range_mclks =
-    decodeTimeout(vl53l0x_read_reg16_bit(FINAL_RANGE_CONFIG_TIMEOUT_MACROP_HI));
+  return vl53l0x_read_result(self, result);
+}
 
-  if (enables->pre_range)
+// Write the stop variable read by init back before starting a measurement,
+// unless it is still in place; only the stop sequence clears it
+// based on VL53L0X_StartMeasurement()
+static void setStopVariable(vl53l0x_t *self)
+{
+  if (self->_stop_variable_set)
   {
-    timeouts->final_range_mclks -= timeouts->pre_range_mclks;
+    return;
   }
 
-  timeouts->final_range_us =
-    timeoutMclksToMicroseconds(timeouts->final_range_mclks,
-                               timeouts->final_range_vcsel_period_pclks);
+  vl53l0x_write_reg(self, 0x80, 0x01);
+  vl53l0x_write_reg(self, 0xFF, 0x01);
+  vl53l0x_write_reg(self, 0x00, 0x00);
+  vl53l0x_write_reg(self, 0x91, self->_stop_variable);
+  vl53l0x_write_reg(self, 0x00, 0x01);
+  vl53l0x_write_reg(self, 0xFF, 0x00);
+  vl53l0x_write_reg(self, 0x80, 0x00);
+
+  self->_stop_variable_set = true;
 }
 
-// Decode sequence step timeout in MCLKs from register value
-// based on VL53L0X_decode_timeout()
-// Note: the original function returned a uint32_t, but the return value is
-// always stored in a uint16_t.
-uint16_t decodeTimeout(uint16_t reg_val)
+// Wait until the interrupt status reports the current measurement done, with
+// no status reads before it can have completed; polls returns the status
+// reads it took. Counts a timeout in the statistics.
+static bool waitDataReady(vl53l0x_t *self, uint32_t *polls)
 {
-  // format: "(LSByte * 2^MSByte) + 1"
-  return (uint16_t)((reg_val & 0x00FF) <<
-         (uint16_t)((reg_val & 0xFF00) >> 8)) + 1;
+  startTimeout();
+
+  bc_tick_t first_poll = self->_timeout_start_ms + firstPollDelay(self);
+
+  // sleep until then, woken by the tick interrupt at the latest
+  while (bc_tick_get() < first_poll && !checkTimeoutExpired())
+  {
+    __WFI();
+  }
+
+  *polls = 1;
+
+  while ((vl53l0x_read_reg(self, RESULT_INTERRUPT_STATUS) & 0x07) == 0)
+  {
+    if (checkTimeoutExpired())
+    {
+      self->_did_timeout = true;
+      setError(self, VL53L0X_ERROR_TIMEOUT);
+      self->_stats.timeouts++;
+      self->_stats.polls += *polls;
+      return false;
+    }
+
+    (*polls)++;
+  }
+
+  return true;
 }
 
-// Encode sequence step timeout register value from timeout in MCLKs
-// based on VL53L0X_encode_timeout()
-// Note: the original function took a uint16_t, but the argument passed to it
-// is always a uint16_t.
-uint16_t encodeTimeout(uint16_t timeout_mclks)
+// Deliver range readings from an interrupt instead of polling. GPIO1 of the
+// sensor is configured by init to go low on "new sample ready"; its falling
+// edge plans a scheduler task which reads the result, clears the interrupt and
+// calls the handler, so the MCU can sleep between samples. Start continuous or
+// single-shot ranging after calling this; do not mix it with
+// vl53l0x_read_range_continuous_millimeters().
+void vl53l0x_set_data_ready_interrupt(vl53l0x_t *self, bc_gpio_channel_t gpio_channel, bc_exti_line_t exti_line, vl53l0x_data_ready_handler_t handler, void *param)
 {
-  // format: "(LSByte * 2^MSByte) + 1"
+  // "new sample ready"
+  setInterruptConfig(self, 0x04);
+  self->_window_inside = false;
 
-  uint32_t ls_byte = 0;
-  uint16_t ms_byte = 0;
+  registerDataReady(self, gpio_channel, exti_line, handler, param);
+}
 
-  if (timeout_mclks > 0)
+// Hook the handler to the falling edges of GPIO1
+static void registerDataReady(vl53l0x_t *self, bc_gpio_channel_t gpio_channel, bc_exti_line_t exti_line, vl53l0x_data_ready_handler_t handler, void *param)
+{
+  vl53l0x_clear_data_ready_interrupt(self);
+
+  self->_data_ready_exti_line = exti_line;
+  self->_data_ready_handler = handler;
+  self->_data_ready_param = param;
+
+  // GPIO1 is an open-drain output on the sensor side
+  bc_gpio_init(gpio_channel);
+  bc_gpio_set_mode(gpio_channel, BC_GPIO_MODE_INPUT);
+  bc_gpio_set_pull(gpio_channel, BC_GPIO_PULL_UP);
+
+  // The task also runs once right away in case a sample is already pending
+  // and the edge was missed
+  self->_data_ready_task_id = bc_scheduler_register(dataReadyTask, self, 0);
+
+  bc_exti_register(exti_line, BC_EXTI_EDGE_FALLING, dataReadyExti, self);
+}
+
+// Deliver only the readings that fall into a range window, for timed
+// continuous ranging: the sensor compares every range with the thresholds
+// itself and pulls GPIO1 low only on a match, so the MCU stays asleep in
+// between. Below and above compare with low_mm and high_mm respectively.
+// The sensor cannot signal ranges inside the window, so that mode wakes for
+// every sample and the driver drops those outside. The sensor keeps the
+// thresholds in 2 mm steps. Otherwise like vl53l0x_set_data_ready_interrupt(),
+// which switches back to every sample.
+// based on VL53L0X_SetInterruptThresholds() and VL53L0X_SetGpioConfig()
+bool vl53l0x_set_window_interrupt(vl53l0x_t *self, bc_gpio_channel_t gpio_channel, bc_exti_line_t exti_line, vl53l0x_window_t window, uint16_t low_mm, uint16_t high_mm, vl53l0x_data_ready_handler_t handler, void *param)
+{
+  uint8_t interrupt_config;
+
+  switch (window)
   {
-    ls_byte = timeout_mclks - 1;
+    case VL53L0X_WINDOW_BELOW:
+    {
+      interrupt_config = 0x01; // VL53L0X_GPIOFUNCTIONALITY_THRESHOLD_CROSSED_LOW
+      break;
+    }
+    case VL53L0X_WINDOW_ABOVE:
+    {
+      interrupt_config = 0x02; // VL53L0X_GPIOFUNCTIONALITY_THRESHOLD_CROSSED_HIGH
+      break;
+    }
+    case VL53L0X_WINDOW_OUTSIDE:
+    {
+      interrupt_config = 0x03; // VL53L0X_GPIOFUNCTIONALITY_THRESHOLD_CROSSED_OUT
+      break;
+    }
+    case VL53L0X_WINDOW_INSIDE:
+    {
+      interrupt_config = 0x04; // VL53L0X_GPIOFUNCTIONALITY_NEW_MEASURE_READY
+      break;
+    }
+    default:
+    {
+      return false;
+    }
+  }
 
-    while ((ls_byte & 0xFFFFFF00) > 0)
+  if (low_mm > high_mm)
+  {
+    return false;
+  }
+
+  // SYSTEM_THRESH_HIGH and SYSTEM_THRESH_LOW follow each other, "the FW will
+  // apply a x2"
+  uint16_t thresh_high = (high_mm >> 1) & 0x0FFF;
+  uint16_t thresh_low = (low_mm >> 1) & 0x0FFF;
+  uint8_t thresholds[4] = { thresh_high >> 8, thresh_high & 0xFF, thresh_low >> 8, thresh_low & 0xFF };
+  vl53l0x_write_multi(self, SYSTEM_THRESH_HIGH, thresholds, sizeof(thresholds));
+
+  setInterruptConfig(self, interrupt_config);
+  vl53l0x_write_reg(self, SYSTEM_INTERRUPT_CLEAR, 0x01);
+
+  self->_window_inside = window == VL53L0X_WINDOW_INSIDE;
+  self->_window_low_mm = low_mm;
+  self->_window_high_mm = high_mm;
+
+  registerDataReady(self, gpio_channel, exti_line, handler, param);
+
+  return true;
+}
+
+// Stop delivering readings through the data ready interrupt
+void vl53l0x_clear_data_ready_interrupt(vl53l0x_t *self)
+{
+  if (self->_data_ready_handler == NULL)
+  {
+    return;
+  }
+
+  bc_exti_unregister(self->_data_ready_exti_line);
+  bc_scheduler_unregister(self->_data_ready_task_id);
+
+  self->_data_ready_handler = NULL;
+}
+
+// Set the handler for events of the asynchronous API. The state machine runs
+// as its own scheduler task: it yields between polls of the device and plans
+// its wake-up at the time the device is expected to be done.
+void vl53l0x_set_event_handler(vl53l0x_t *self, vl53l0x_event_handler_t handler, void *param)
+{
+  self->_event_handler = handler;
+  self->_event_param = param;
+
+  if (!self->_async_task_registered)
+  {
+    self->_async_task_id = bc_scheduler_register(asyncTask, self, BC_TICK_INFINITY);
+    self->_async_task_registered = true;
+  }
+}
+
+// Non-blocking counterpart of vl53l0x_init(); completion is reported by
+// VL53L0X_EVENT_INIT_DONE or VL53L0X_EVENT_INIT_ERROR
+bool vl53l0x_init_async(vl53l0x_t *self, bc_i2c_channel_t i2c_channel, uint8_t addr, bc_tick_t timeout, bool io_2v8)
+{
+  if (!self->_async_task_registered || self->_async_state != VL53L0X_STATE_IDLE)
+  {
+    return false;
+  }
+
+  initDataInit(self, i2c_channel, addr, timeout, io_2v8);
+
+  spadInfoBegin(self);
+
+  asyncEnter(self, VL53L0X_STATE_INIT_SPAD, ASYNC_POLL_INTERVAL);
+  bc_scheduler_plan_relative(self->_async_task_id, self->_async_next_poll);
+
+  return true;
+}
+
+// Non-blocking counterpart of vl53l0x_read_range_single_millimeters(); the
+// reading is reported by VL53L0X_EVENT_RESULT or VL53L0X_EVENT_TIMEOUT
+bool vl53l0x_read_range_single_async(vl53l0x_t *self)
+{
+  if (!self->_async_task_registered || self->_async_state != VL53L0X_STATE_IDLE)
+  {
+    return false;
+  }
+
+  setStopVariable(self);
+
+  vl53l0x_write_reg(self, SYSRANGE_START, 0x01);
+
+  measurementStarted(self, false, 0);
+
+  asyncEnter(self, VL53L0X_STATE_START, ASYNC_POLL_INTERVAL);
+  bc_scheduler_plan_relative(self->_async_task_id, self->_async_next_poll);
+
+  return true;
+}
+
+// Non-blocking counterpart of vl53l0x_read_range_continuous_millimeters();
+// waits for the next reading of a measurement started by
+// vl53l0x_start_continuous()
+bool vl53l0x_read_range_continuous_async(vl53l0x_t *self)
+{
+  if (!self->_async_task_registered || self->_async_state != VL53L0X_STATE_IDLE)
+  {
+    return false;
+  }
+
+  asyncEnter(self, VL53L0X_STATE_RESULT, firstPollDelay(self));
+  bc_scheduler_plan_relative(self->_async_task_id, self->_async_next_poll);
+
+  return true;
+}
+
+// Advance the asynchronous state machine by at most one poll of the device.
+// Returns true while an operation is in progress. Called by the driver's own
+// scheduler task, but may also be called directly.
+bool vl53l0x_step(vl53l0x_t *self)
+{
+  uint8_t spad_count;
+  bool spad_type_is_aperture;
+  uint8_t ref_spad_map[6];
+
+  self->_async_next_poll = ASYNC_POLL_INTERVAL;
+
+  switch (self->_async_state)
+  {
+    case VL53L0X_STATE_IDLE:
     {
-      ls_byte >>= 1;
-      ms_byte++;
+      return false;
     }
+    case VL53L0X_STATE_INIT_SPAD:
+    {
+      if (!spadInfoReady(self))
+      {
+        break;
+      }
 
-    return (ms_byte << 8) | (ls_byte & 0xFF);
+      spadInfoEnd(self, &spad_count, &spad_type_is_aperture);
+
+      selectReferenceSpads(self, spad_count, spad_type_is_aperture, ref_spad_map);
+      initStaticInit(self, ref_spad_map);
+
+      // -- VL53L0X_perform_vhv_calibration() begin
+      writeSequenceConfig(self, 0x01);
+      refCalibrationBegin(self, 0x40);
+
+      asyncEnter(self, VL53L0X_STATE_INIT_VHV, ASYNC_POLL_INTERVAL);
+
+      return true;
+    }
+    case VL53L0X_STATE_INIT_VHV:
+    {
+      if (!refCalibrationReady(self))
+      {
+        break;
+      }
+
+      refCalibrationEnd(self);
+
+      // -- VL53L0X_perform_phase_calibration() begin
+      writeSequenceConfig(self, 0x02);
+      refCalibrationBegin(self, 0x00);
+
+      asyncEnter(self, VL53L0X_STATE_INIT_PHASE, ASYNC_POLL_INTERVAL);
+
+      return true;
+    }
+    case VL53L0X_STATE_INIT_PHASE:
+    {
+      if (!refCalibrationReady(self))
+      {
+        break;
+      }
+
+      refCalibrationEnd(self);
+
+      // "restore the previous Sequence Config"
+      writeSequenceConfig(self, 0xE8);
+
+      asyncFinish(self, VL53L0X_EVENT_INIT_DONE, NULL);
+
+      return false;
+    }
+    case VL53L0X_STATE_START:
+    {
+      // "Wait until start bit has been cleared"
+      if (vl53l0x_read_reg(self, SYSRANGE_START) & 0x01)
+      {
+        break;
+      }
+
+      asyncEnter(self, VL53L0X_STATE_RESULT, firstPollDelay(self));
+
+      return true;
+    }
+    case VL53L0X_STATE_RESULT:
+    {
+      vl53l0x_result_t result;
+
+      self->_async_polls++;
+
+      if (!readResultIfReady(self, &result))
+      {
+        break;
+      }
+
+      accountSample(self, self->_timeout_start_ms, self->_async_polls);
+      measurementResult(self, bc_tick_get(), self->_async_polls > 1);
+
+      asyncFinish(self, VL53L0X_EVENT_RESULT, &result);
+
+      return false;
+    }
+    default:
+    {
+      return false;
+    }
   }
-  else { return 0; }
+
+  if (checkTimeoutExpired())
+  {
+    bool init = self->_async_state == VL53L0X_STATE_INIT_SPAD ||
+                self->_async_state == VL53L0X_STATE_INIT_VHV ||
+                self->_async_state == VL53L0X_STATE_INIT_PHASE;
+
+    asyncFinish(self, init ? VL53L0X_EVENT_INIT_ERROR : VL53L0X_EVENT_TIMEOUT, NULL);
+
+    return false;
+  }
+
+  return true;
 }
 
-// Convert sequence step timeout from MCLKs to microseconds with given VCSEL period in PCLKs
-// based on VL53L0X_calc_timeout_us()
-uint32_t timeoutMclksToMicroseconds(uint16_t timeout_period_mclks, uint8_t vcsel_period_pclks)
+// Is an operation of the asynchronous API in progress?
+bool vl53l0x_is_busy(vl53l0x_t *self)
 {
-  uint32_t macro_period_ns = calcMacroPeriod(vcsel_period_pclks);
+  return self->_async_state != VL53L0X_STATE_IDLE;
+}
 
-  return ((timeout_period_mclks * macro_period_ns) + (macro_period_ns / 2)) / 1000;
+// Get the I2C traffic of the instance since init or the last reset, with the
+// bus time it takes at standard and fast mode. The model counts 9 bit times
+// per byte (with ACK), a START and a STOP per transaction and a repeated START
+// per read; clock stretching and gaps between transactions are not included.
+void vl53l0x_get_bus_stats(vl53l0x_t *self, vl53l0x_bus_stats_t *stats)
+{
+  uint32_t bits = self->_bus_bytes * 9 + (self->_bus_reads + self->_bus_writes) * 2 + self->_bus_reads;
+
+  stats->transactions = self->_bus_reads + self->_bus_writes;
+  stats->reads = self->_bus_reads;
+  stats->writes = self->_bus_writes;
+  stats->bytes = self->_bus_bytes;
+  stats->bus_time_100khz_us = bits * 10;
+  stats->bus_time_400khz_us = (bits * 5 + 1) / 2;
+  stats->bus_time_us = self->_i2c_speed == BC_I2C_SPEED_400_KHZ ? stats->bus_time_400khz_us : stats->bus_time_100khz_us;
+  stats->retries = self->_bus_retries;
+  stats->errors = self->_bus_errors;
 }
 
-// Convert sequence step timeout from microseconds to MCLKs with given VCSEL period in PCLKs
-// based on VL53L0X_calc_timeout_mclks()
-uint32_t timeoutMicrosecondsToMclks(uint32_t timeout_period_us, uint8_t vcsel_period_pclks)
+void vl53l0x_reset_bus_stats(vl53l0x_t *self)
 {
-  uint32_t macro_period_ns = calcMacroPeriod(vcsel_period_pclks);
+  self->_bus_reads = 0;
+  self->_bus_writes = 0;
+  self->_bus_bytes = 0;
+  self->_bus_retries = 0;
+  self->_bus_errors = 0;
+  self->_timeout_start_errors = 0;
+}
+
+// Get how many I2C transactions and bytes on the wire the merging of register
+// runs in the fixed register sequences (tuning settings etc.) has saved so far,
+// compared to writing them one register at a time
+void vl53l0x_get_sequence_savings(vl53l0x_t *self, uint32_t *transactions, uint32_t *bytes)
+{
+  *transactions = self->_sequence_transactions_saved;
+  *bytes = self->_sequence_bytes_saved;
+}
 
-  return (((timeout_period_us * 1000) + (macro_period_ns / 2)) / macro_period_ns);
+// Get the per-sample wait statistics since init or the last reset; covers the
+// blocking, asynchronous and interrupt driven reads
+void vl53l0x_get_stats(vl53l0x_t *self, vl53l0x_stats_t *stats)
+{
+  *stats = self->_stats;
 }
 
+void vl53l0x_reset_stats(vl53l0x_t *self)
+{
+  memset(&self->_stats, 0, sizeof(self->_stats));
+}
 
-// based on VL53L0X_perform_single_ref_calibration()
-bool performSingleRefCalibration(uint8_t vhv_init_byte)
+// Did a timeout occur in one of the read functions since the last call to
+// timeoutOccurred()?
+bool vl53l0x_timeout_occurred(vl53l0x_t *self)
+{
+  bool tmp = self->_did_timeout;
+  self->_did_timeout = false;
+  return tmp;
+}
+
+// Get the first error since the last call, or VL53L0X_ERROR_NONE. A bus error
+// ends a wait for the sensor at once, so an operation that returned failure
+// can be told apart from a sensor that took too long.
+vl53l0x_error_t vl53l0x_get_error(vl53l0x_t *self)
+{
+  vl53l0x_error_t error = self->_error;
+  self->_error = VL53L0X_ERROR_NONE;
+  return error;
+}
+
+// Change the speed of the bus the sensor is on, for all devices on it; up to
+// 400 kHz
+void vl53l0x_set_bus_speed(vl53l0x_t *self, bc_i2c_speed_t speed)
+{
+  bc_i2c_set_speed(self->_i2c_channel, speed);
+  self->_i2c_speed = speed;
+}
+
+bc_i2c_speed_t vl53l0x_get_bus_speed(vl53l0x_t *self)
 {
-  vl53l0x_write_reg(SYSRANGE_START, 0x01 | vhv_init_byte); // VL53L0X_REG_SYSRANGE_MODE_START_STOP
+  return self->_i2c_speed;
+}
+
+// Private Methods /////////////////////////////////////////////////////////////
+
+// Get reference SPAD (single photon avalanche diode) count and type
+// based on VL53L0X_get_info_from_device(),
+// but only gets reference SPAD count and type
+bool getSpadInfo(vl53l0x_t *self, uint8_t * count, bool * type_is_aperture)
+{
+  spadInfoBegin(self);
 
   startTimeout();
-  while ((vl53l0x_read_reg(RESULT_INTERRUPT_STATUS) & 0x07) == 0)
+  while (!spadInfoReady(self))
   {
     if (checkTimeoutExpired()) { return false; }
   }
 
-  vl53l0x_write_reg(SYSTEM_INTERRUPT_CLEAR, 0x01);
-
-  vl53l0x_write_reg(SYSRANGE_START, 0x00);
+  spadInfoEnd(self, count, type_is_aperture);
 
   return true;
 }
+
+// First part of getSpadInfo(), up to the point where the device is busy
+static void spadInfoBegin(vl53l0x_t *self)
+{
+  vl53l0x_write_reg(self, 0x80, 0x01);
+  vl53l0x_write_reg(self, 0xFF, 0x01);
+  vl53l0x_write_reg(self, 0x00, 0x00);
+
+  vl53l0x_write_reg(self, 0xFF, 0x06);
+  vl53l0x_write_reg(self, 0x83, vl53l0x_read_reg(self, 0x83) | 0x04);
+  vl53l0x_write_reg(self, 0xFF, 0x07);
+  vl53l0x_write_reg(self, 0x81, 0x01);
+
+  vl53l0x_write_reg(self, 0x80, 0x01);
+
+  vl53l0x_write_reg(self, 0x94, 0x6b);
+  vl53l0x_write_reg(self, 0x83, 0x00);
+}
+
+static bool spadInfoReady(vl53l0x_t *self)
+{
+  return vl53l0x_read_reg(self, 0x83) != 0x00;
+}
+
+// Second part of getSpadInfo(), once the device is done
+static void spadInfoEnd(vl53l0x_t *self, uint8_t * count, bool * type_is_aperture)
+{
+  uint8_t tmp;
+
+  vl53l0x_write_reg(self, 0x83, 0x01);
+  tmp = vl53l0x_read_reg(self, 0x92);
+
+  *count = tmp & 0x7f;
+  *type_is_aperture = (tmp >> 7) & 0x01;
+
+  vl53l0x_write_reg(self, 0x81, 0x00);
+  vl53l0x_write_reg(self, 0xFF, 0x06);
+  vl53l0x_write_reg(self, 0x83, vl53l0x_read_reg(self, 0x83)  & ~0x04);
+  vl53l0x_write_reg(self, 0xFF, 0x01);
+  vl53l0x_write_reg(self, 0x00, 0x01);
+
+  vl53l0x_write_reg(self, 0xFF, 0x00);
+  vl53l0x_write_reg(self, 0x80, 0x00);
+}
+
+// Write a table of (register, value) pairs in order, merging each run of
+// consecutive registers into one auto-incrementing burst write. Every merged
+// register saves a whole transaction: START, device address and register
+// address.
+static void writeSequence(vl53l0x_t *self, const uint8_t (*sequence)[2], size_t length)
+{
+  uint8_t burst[SEQUENCE_BURST_MAX];
+  size_t i = 0;
+
+  while (i < length)
+  {
+    uint8_t reg = sequence[i][0];
+    uint8_t count = 0;
+
+    do
+    {
+      burst[count++] = sequence[i++][1];
+    }
+    while (i < length && count < SEQUENCE_BURST_MAX &&
+           sequence[i][0] == reg + count && sequence[i][0] != 0xFF); // never merge into the page select register
+
+    if (count == 1)
+    {
+      vl53l0x_write_reg(self, reg, burst[0]);
+    }
+    else
+    {
+      vl53l0x_write_multi(self, reg, burst, count);
+
+      self->_sequence_transactions_saved += count - 1;
+      self->_sequence_bytes_saved += 2 * (count - 1);
+    }
+  }
+}
+
+#if VL53L0X_TRACE
+
+// Print the trace ring, oldest entry first, one line per transaction:
+// tick, device address, R/W, register, data length, data and status
+void vl53l0x_trace_dump(void)
+{
+  size_t index = (trace_head + VL53L0X_TRACE_SIZE - trace_count) % VL53L0X_TRACE_SIZE;
+
+  bc_log_debug("vl53l0x trace: %u entries", (unsigned) trace_count);
+
+  for (size_t i = 0; i < trace_count; i++)
+  {
+    traceEntry *entry = &trace[index];
+
+    bc_log_debug("%lu %02x %c%02x/%u %08lx %s", (unsigned long) entry->tick, entry->address,
+                 (entry->flags & TRACE_FLAG_READ) ? 'R' : 'W', entry->reg, entry->length,
+                 (unsigned long) entry->value, (entry->flags & TRACE_FLAG_OK) ? "ok" : "ERR");
+
+    index = (index + 1) % VL53L0X_TRACE_SIZE;
+  }
+}
+
+void vl53l0x_trace_clear(void)
+{
+  trace_head = 0;
+  trace_count = 0;
+}
+
+// Store one transaction in the ring, overwriting the oldest entry when full;
+// constant time, one entry copy
+static void traceRecord(vl53l0x_t *self, bool read, uint8_t reg, uint8_t length, uint32_t value, bool ok)
+{
+  traceEntry *entry = &trace[trace_head];
+
+  entry->tick = bc_tick_get();
+  entry->value = value;
+  entry->address = self->_i2c_address;
+  entry->reg = reg;
+  entry->length = length;
+  entry->flags = (read ? TRACE_FLAG_READ : 0) | (ok ? TRACE_FLAG_OK : 0);
+
+  if (++trace_head == VL53L0X_TRACE_SIZE)
+  {
+    trace_head = 0;
+  }
+
+  if (trace_count < VL53L0X_TRACE_SIZE)
+  {
+    trace_count++;
+  }
+}
+
+static uint32_t traceValue(const uint8_t *buffer, uint8_t length)
+{
+  uint32_t value = 0;
+
+  for (uint8_t i = 0; i < length && i < 4; i++)
+  {
+    value = (value << 8) | buffer[i];
+  }
+
+  return value;
+}
+
+#endif
+
+// Count one delivered sample that waited since start and took polls status reads
+static void accountSample(vl53l0x_t *self, bc_tick_t start, uint32_t polls)
+{
+  uint32_t latency_ms = bc_tick_get() - start;
+
+  self->_stats.samples++;
+  self->_stats.polls += polls;
+  self->_stats.latency_sum_ms += latency_ms;
+
+  if (latency_ms > self->_stats.latency_max_ms)
+  {
+    self->_stats.latency_max_ms = latency_ms;
+  }
+
+  self->_stats.latency_histogram[histogramBucket(latency_ms)]++;
+  self->_stats.polls_histogram[histogramBucket(polls)]++;
+}
+
+// Index of the log2 bucket of value, see VL53L0X_STATS_BUCKETS
+static uint8_t histogramBucket(uint32_t value)
+{
+  uint8_t bucket = 0;
+
+  while (value != 0 && bucket < VL53L0X_STATS_BUCKETS - 1)
+  {
+    value >>= 1;
+    bucket++;
+  }
+
+  return bucket;
+}
+
+// Run one transaction on the bus and account and trace it. A failed attempt
+// is retried up to VL53L0X_I2C_RETRIES times after a bus recovery; if all
+// fail, the error is recorded and a read buffer is zeroed rather than left
+// holding whatever the failed attempts put there.
+static bool busTransfer(vl53l0x_t *self, bool read, uint8_t reg, uint8_t *buffer, uint8_t length)
+{
+  bc_i2c_memory_transfer_t transfer;
+  transfer.device_address = self->_i2c_address;
+  transfer.memory_address = reg;
+  transfer.buffer = buffer;
+  transfer.length = length;
+
+  bool ok = false;
+
+  for (int attempt = 0; !ok && attempt <= VL53L0X_I2C_RETRIES; attempt++)
+  {
+    if (attempt != 0)
+    {
+      self->_bus_retries++;
+      busRecover(self);
+    }
+
+    ok = read ? bc_i2c_memory_read(self->_i2c_channel, &transfer) : bc_i2c_memory_write(self->_i2c_channel, &transfer);
+    accountTransfer(self, read, length);
+    traceTransfer(self, read, reg, length, traceValue(buffer, length), ok);
+  }
+
+  if (!ok)
+  {
+    self->_bus_errors++;
+    setError(self, VL53L0X_ERROR_BUS);
+
+    if (read)
+    {
+      memset(buffer, 0, length);
+    }
+  }
+
+  return ok;
+}
+
+// Free a bus held by a device stuck in the middle of a byte with SDA low: clock
+// SCL until it lets go, at most 9 times, then generate a STOP. The pins are
+// driven as open drain GPIOs at about 100 kHz and handed back to the I2C
+// peripheral afterwards.
+static void busRecover(vl53l0x_t *self)
+{
+  bc_gpio_channel_t scl = self->_i2c_channel == BC_I2C_I2C0 ? BC_GPIO_SCL0 : BC_GPIO_SCL1;
+  bc_gpio_channel_t sda = self->_i2c_channel == BC_I2C_I2C0 ? BC_GPIO_SDA0 : BC_GPIO_SDA1;
+  bc_gpio_mode_t scl_mode = bc_gpio_get_mode(scl);
+  bc_gpio_mode_t sda_mode = bc_gpio_get_mode(sda);
+
+  bc_timer_start();
+
+  bc_gpio_set_output(scl, 1);
+  bc_gpio_set_mode(scl, BC_GPIO_MODE_OUTPUT_OD);
+
+  for (int i = 0; i < 9 && !bc_gpio_get_input(sda); i++)
+  {
+    bc_gpio_set_output(scl, 0);
+    bc_timer_delay(5);
+    bc_gpio_set_output(scl, 1);
+    bc_timer_delay(5);
+  }
+
+  // STOP: SDA rising while SCL is high
+  bc_gpio_set_output(scl, 0);
+  bc_gpio_set_output(sda, 0);
+  bc_gpio_set_mode(sda, BC_GPIO_MODE_OUTPUT_OD);
+  bc_timer_delay(5);
+  bc_gpio_set_output(scl, 1);
+  bc_timer_delay(5);
+  bc_gpio_set_output(sda, 1);
+  bc_timer_delay(5);
+
+  bc_timer_stop();
+
+  bc_gpio_set_mode(scl, scl_mode);
+  bc_gpio_set_mode(sda, sda_mode);
+}
+
+// Keep the first error until vl53l0x_get_error() collects it
+static void setError(vl53l0x_t *self, vl53l0x_error_t error)
+{
+  if (self->_error == VL53L0X_ERROR_NONE)
+  {
+    self->_error = error;
+  }
+}
+
+static void transferTask(void *param)
+{
+  vl53l0x_t *self = param;
+
+  if (self->_transfer_count != 0)
+  {
+    transferNext(self);
+  }
+
+  if (self->_transfer_count != 0)
+  {
+    bc_scheduler_plan_current_now();
+  }
+}
+
+// Dequeue and run the oldest transaction, unless a flush ran it already, then
+// call its handler; the descriptor leaves the queue first so the handler can
+// queue the next one
+static void transferNext(vl53l0x_t *self)
+{
+  vl53l0x_transfer_t transfer = self->_transfers[self->_transfer_head];
+  bool ok;
+
+  if (self->_transfer_done != 0)
+  {
+    ok = self->_transfer_ok[self->_transfer_head];
+    self->_transfer_done--;
+  }
+  else
+  {
+    ok = busTransfer(self, transfer.read, transfer.reg, transfer.buffer != NULL ? transfer.buffer : transfer.data, transfer.length);
+  }
+
+  self->_transfer_head = (self->_transfer_head + 1) % VL53L0X_TRANSFER_QUEUE_SIZE;
+  self->_transfer_count--;
+
+  if (transfer.handler != NULL)
+  {
+    transfer.handler(self, &transfer, ok, transfer.param);
+  }
+}
+
+// Count one transaction of length data bytes for vl53l0x_get_bus_stats(); a
+// write also carries the device and register address, a read additionally the
+// device address again after the repeated START
+static void accountTransfer(vl53l0x_t *self, bool read, size_t length)
+{
+  if (read)
+  {
+    self->_bus_reads++;
+    self->_bus_bytes += 3 + length;
+  }
+  else
+  {
+    self->_bus_writes++;
+    self->_bus_bytes += 2 + length;
+  }
+}
+
+// Get sequence step enables
+// based on VL53L0X_GetSequenceStepEnables()
+void getSequenceStepEnables(vl53l0x_t *self, SequenceStepEnables * enables)
+{
+  loadSequenceStepCache(self);
+
+  uint8_t sequence_config = self->_sequence_config;
+
+  enables->tcc          = (sequence_config >> 4) & 0x1;
+  enables->dss          = (sequence_config >> 3) & 0x1;
+  enables->msrc         = (sequence_config >> 2) & 0x1;
+  enables->pre_range    = (sequence_config >> 6) & 0x1;
+  enables->final_range  = (sequence_config >> 7) & 0x1;
+}
+
+// Get sequence step timeouts
+// based on get_sequence_step_timeout(),
+// but gets all timeouts instead of just the requested one, and also stores
+// intermediate values
+void getSequenceStepTimeouts(vl53l0x_t *self, SequenceStepEnables const * enables, SequenceStepTimeouts * timeouts)
+{
+  loadSequenceStepCache(self);
+
+  timeouts->pre_range_vcsel_period_pclks = self->_pre_range_vcsel_period_pclks;
+
+  timeouts->msrc_dss_tcc_mclks = self->_msrc_dss_tcc_mclks;
+  timeouts->msrc_dss_tcc_us =
+    timeoutMclksToMicroseconds(timeouts->msrc_dss_tcc_mclks,
+                               timeouts->pre_range_vcsel_period_pclks);
+
+  timeouts->pre_range_mclks = self->_pre_range_mclks;
+  timeouts->pre_range_us =
+    timeoutMclksToMicroseconds(timeouts->pre_range_mclks,
+                               timeouts->pre_range_vcsel_period_pclks);
+
+  timeouts->final_range_vcsel_period_pclks = self->_final_range_vcsel_period_pclks;
+
+  timeouts->final_range_mclks = self->_final_range_mclks;
+
+  if (enables->pre_range)
+  {
+    timeouts->final_range_mclks -= timeouts->pre_range_mclks;
+  }
+
+  timeouts->final_range_us =
+    timeoutMclksToMicroseconds(timeouts->final_range_mclks,
+                               timeouts->final_range_vcsel_period_pclks);
+}
+
+// Fill the shadow of the sequence step configuration from the device, once
+// after init; from then on every write path of the driver keeps it up to date,
+// so reconfiguration needs no reads. Registers written directly through
+// vl53l0x_write_reg() bypass the shadow.
+static void loadSequenceStepCache(vl53l0x_t *self)
+{
+  if (self->_sequence_cache_valid)
+  {
+    return;
+  }
+
+  self->_sequence_config = vl53l0x_read_reg(self, SYSTEM_SEQUENCE_CONFIG);
+
+  self->_pre_range_vcsel_period_pclks = decodeVcselPeriod(vl53l0x_read_reg(self, PRE_RANGE_CONFIG_VCSEL_PERIOD));
+  self->_msrc_dss_tcc_mclks = vl53l0x_read_reg(self, MSRC_CONFIG_TIMEOUT_MACROP) + 1;
+  self->_pre_range_mclks = decodeTimeout(vl53l0x_read_reg16_bit(self, PRE_RANGE_CONFIG_TIMEOUT_MACROP_HI));
+
+  self->_final_range_vcsel_period_pclks = decodeVcselPeriod(vl53l0x_read_reg(self, FINAL_RANGE_CONFIG_VCSEL_PERIOD));
+  self->_final_range_mclks = decodeTimeout(vl53l0x_read_reg16_bit(self, FINAL_RANGE_CONFIG_TIMEOUT_MACROP_HI));
+
+  self->_sequence_cache_valid = true;
+}
+
+static void writeSequenceConfig(vl53l0x_t *self, uint8_t sequence_config)
+{
+  vl53l0x_write_reg(self, SYSTEM_SEQUENCE_CONFIG, sequence_config);
+  self->_sequence_config = sequence_config;
+}
+
+// Decode sequence step timeout in MCLKs from register value
+// based on VL53L0X_decode_timeout()
+// Note: the original function returned a uint32_t, but the return value is
+// always stored in a uint16_t.
+uint16_t decodeTimeout(uint16_t reg_val)
+{
+  // format: "(LSByte * 2^MSByte) + 1"
+  return (uint16_t)((reg_val & 0x00FF) <<
+         (uint16_t)((reg_val & 0xFF00) >> 8)) + 1;
+}
+
+// Encode sequence step timeout register value from timeout in MCLKs
+// based on VL53L0X_encode_timeout()
+// Note: the original function took a uint16_t, but the argument passed to it
+// is always a uint16_t.
+uint16_t encodeTimeout(uint16_t timeout_mclks)
+{
+  // format: "(LSByte * 2^MSByte) + 1"
+
+  uint32_t ls_byte = 0;
+  uint16_t ms_byte = 0;
+
+  if (timeout_mclks > 0)
+  {
+    ls_byte = timeout_mclks - 1;
+
+    while ((ls_byte & 0xFFFFFF00) > 0)
+    {
+      ls_byte >>= 1;
+      ms_byte++;
+    }
+
+    return (ms_byte << 8) | (ls_byte & 0xFF);
+  }
+  else { return 0; }
+}
+
+// Convert sequence step timeout from MCLKs to microseconds with given VCSEL period in PCLKs
+// based on VL53L0X_calc_timeout_us()
+uint32_t timeoutMclksToMicroseconds(uint16_t timeout_period_mclks, uint8_t vcsel_period_pclks)
+{
+  uint32_t macro_period_ns = calcMacroPeriod(vcsel_period_pclks);
+
+  return ((timeout_period_mclks * macro_period_ns) + (macro_period_ns / 2)) / 1000;
+}
+
+// Convert sequence step timeout from microseconds to MCLKs with given VCSEL period in PCLKs
+// based on VL53L0X_calc_timeout_mclks()
+uint32_t timeoutMicrosecondsToMclks(uint32_t timeout_period_us, uint8_t vcsel_period_pclks)
+{
+  uint32_t macro_period_ns = calcMacroPeriod(vcsel_period_pclks);
+
+  return (((uint64_t)timeout_period_us * 1000) + (macro_period_ns / 2)) / macro_period_ns;
+}
+
+
+// based on VL53L0X_perform_single_ref_calibration()
+bool performSingleRefCalibration(vl53l0x_t *self, uint8_t vhv_init_byte)
+{
+  refCalibrationBegin(self, vhv_init_byte);
+
+  startTimeout();
+  while (!refCalibrationReady(self))
+  {
+    if (checkTimeoutExpired()) { return false; }
+  }
+
+  refCalibrationEnd(self);
+
+  return true;
+}
+
+static void refCalibrationBegin(vl53l0x_t *self, uint8_t vhv_init_byte)
+{
+  vl53l0x_write_reg(self, SYSRANGE_START, 0x01 | vhv_init_byte); // VL53L0X_REG_SYSRANGE_MODE_START_STOP
+}
+
+static bool refCalibrationReady(vl53l0x_t *self)
+{
+  return (vl53l0x_read_reg(self, RESULT_INTERRUPT_STATUS) & 0x07) != 0;
+}
+
+static void refCalibrationEnd(vl53l0x_t *self)
+{
+  vl53l0x_write_reg(self, SYSTEM_INTERRUPT_CLEAR, 0x01);
+
+  vl53l0x_write_reg(self, SYSRANGE_START, 0x00);
+}
+
+// Phase calibration alone, needed after a VCSEL period change
+// based on VL53L0X_perform_phase_calibration()
+static void performPhaseCalibration(vl53l0x_t *self)
+{
+  uint8_t sequence_config = self->_sequence_config;
+  writeSequenceConfig(self, 0x02);
+  performSingleRefCalibration(self, 0x0);
+  writeSequenceConfig(self, sequence_config);
+}
+
+// PRE_RANGE_CONFIG_VALID_PHASE_HIGH for a pre-range VCSEL period, 0 if the
+// period is not supported
+static uint8_t preRangeValidPhaseHigh(uint8_t period_pclks)
+{
+  switch (period_pclks)
+  {
+    case 12: return 0x18;
+    case 14: return 0x30;
+    case 16: return 0x40;
+    case 18: return 0x50;
+    default: return 0;
+  }
+}
+
+// Register settings for a final range VCSEL period, NULL if the period is not
+// supported
+static const uint8_t (*finalRangeVcselSequence(uint8_t period_pclks, size_t *length))[2]
+{
+  switch (period_pclks)
+  {
+    case 8:
+      *length = sizeof(final_range_vcsel_period_8) / sizeof(final_range_vcsel_period_8[0]);
+      return final_range_vcsel_period_8;
+
+    case 10:
+      *length = sizeof(final_range_vcsel_period_10) / sizeof(final_range_vcsel_period_10[0]);
+      return final_range_vcsel_period_10;
+
+    case 12:
+      *length = sizeof(final_range_vcsel_period_12) / sizeof(final_range_vcsel_period_12[0]);
+      return final_range_vcsel_period_12;
+
+    case 14:
+      *length = sizeof(final_range_vcsel_period_14) / sizeof(final_range_vcsel_period_14[0]);
+      return final_range_vcsel_period_14;
+
+    default:
+      return NULL;
+  }
+}
+
+// Enable the minimum number of good reference SPADs of the given type from
+// spad_index on and write the map; spad_index is advanced past the last one
+// based on enable_ref_spads()
+static bool enableRefSpads(vl53l0x_t *self, bool aperture, uint8_t *ref_spad_map, uint8_t *spad_index)
+{
+  for (uint8_t i = 0; i < REF_SPAD_MIN_COUNT; i++)
+  {
+    int8_t next_spad = nextGoodSpad(self, *spad_index);
+
+    if (next_spad < 0 || isApertureSpad(next_spad) != aperture)
+    {
+      return false;
+    }
+
+    ref_spad_map[next_spad / 8] |= 1 << (next_spad % 8);
+    *spad_index = next_spad + 1;
+  }
+
+  vl53l0x_write_multi(self, GLOBAL_CONFIG_SPAD_ENABLES_REF_0, ref_spad_map, 6);
+
+  return true;
+}
+
+// Index of the first good reference SPAD at or after spad_index, or -1
+// based on get_next_good_spad()
+static int8_t nextGoodSpad(vl53l0x_t *self, uint8_t spad_index)
+{
+  for (uint8_t i = spad_index; i < REF_SPAD_MAX_COUNT; i++)
+  {
+    if ((self->_good_spad_map[i / 8] >> (i % 8)) & 0x01)
+    {
+      return i;
+    }
+  }
+
+  return -1;
+}
+
+// Range once with only the pre-range and final range steps and read the
+// return signal rate of the reference array (Q9.7)
+// based on VL53L0X_perform_ref_signal_measurement()
+static bool measureRefSignalRate(vl53l0x_t *self, uint16_t *rate)
+{
+  vl53l0x_result_t result;
+  uint8_t sequence_config = self->_sequence_config;
+
+  writeSequenceConfig(self, 0xC0);
+
+  bool ok = readSingleResult(self, &result);
+
+  vl53l0x_write_reg(self, 0xFF, 0x01);
+  *rate = vl53l0x_read_reg16_bit(self, RESULT_PEAK_SIGNAL_RATE_REF);
+  vl53l0x_write_reg(self, 0xFF, 0x00);
+
+  writeSequenceConfig(self, sequence_config);
+
+  return ok;
+}
+
+// Read or write the VHV settings and phase calibration results, which live in
+// a hidden register page
+// based on VL53L0X_ref_calibration_io()
+static void refCalibrationIo(vl53l0x_t *self, bool read, uint8_t *vhv_settings, uint8_t *phase_cal)
+{
+  vl53l0x_write_reg(self, 0xFF, 0x01);
+  vl53l0x_write_reg(self, 0x00, 0x00);
+  vl53l0x_write_reg(self, 0xFF, 0x00);
+
+  if (read)
+  {
+    *vhv_settings = vl53l0x_read_reg(self, 0xCB);
+    *phase_cal = vl53l0x_read_reg(self, 0xEE) & 0xEF;
+  }
+  else
+  {
+    vl53l0x_write_reg(self, 0xCB, *vhv_settings);
+    vl53l0x_write_reg(self, 0xEE, (vl53l0x_read_reg(self, 0xEE) & 0x80) | *phase_cal);
+  }
+
+  vl53l0x_write_reg(self, 0xFF, 0x01);
+  vl53l0x_write_reg(self, 0x00, 0x01);
+  vl53l0x_write_reg(self, 0xFF, 0x00);
+}
+
+// Runs in interrupt context, so only hand over to the scheduler
+static void dataReadyExti(bc_exti_line_t line, void *param)
+{
+  (void) line;
+
+  vl53l0x_t *self = param;
+
+  self->_data_ready_tick = bc_tick_get();
+
+  bc_scheduler_plan_now(self->_data_ready_task_id);
+}
+
+// Queue the read of the interrupt status and result block; the interrupt
+// clear and the handler follow on its completion. A read still waiting for its
+// handler covers the edge, the interrupt is not cleared before that.
+static void dataReadyTask(void *param)
+{
+  vl53l0x_t *self = param;
+
+  if (self->_data_ready_queued)
+  {
+    return;
+  }
+
+  vl53l0x_transfer_t transfer = { .read = true, .reg = RESULT_INTERRUPT_STATUS, .length = sizeof(self->_result_buffer),
+                                .buffer = self->_result_buffer, .handler = dataReadyRead };
+
+  if (!vl53l0x_queue_transfer(self, &transfer))
+  {
+    // queue full; take the result the blocking way
+    transferNext(self);
+    vl53l0x_queue_transfer(self, &transfer);
+  }
+
+  self->_data_ready_queued = true;
+}
+
+static void dataReadyRead(vl53l0x_t *self, const vl53l0x_transfer_t *transfer, bool ok, void *param)
+{
+  (void) param;
+
+  vl53l0x_result_t result;
+
+  self->_data_ready_queued = false;
+
+  if (!ok || (transfer->buffer[0] & 0x07) == 0 || self->_data_ready_handler == NULL)
+  {
+    // spurious edge, nothing pending yet, or the interrupt was cleared since
+    return;
+  }
+
+  vl53l0x_transfer_t clear = { .read = false, .reg = SYSTEM_INTERRUPT_CLEAR, .length = 1, .data = { 0x01 } };
+
+  if (!vl53l0x_queue_transfer(self, &clear))
+  {
+    vl53l0x_write_reg(self, SYSTEM_INTERRUPT_CLEAR, 0x01);
+  }
+
+  decodeResult(self, &transfer->buffer[1], &result);
+
+  accountSample(self, self->_data_ready_tick, 1);
+  measurementResult(self, self->_data_ready_tick, true);
+
+  if (self->_window_inside && (result.range_mm < self->_window_low_mm || result.range_mm > self->_window_high_mm))
+  {
+    return;
+  }
+
+  self->_data_ready_handler(self, &result, self->_data_ready_param);
+}
+
+// Write SYSTEM_INTERRUPT_CONFIG_GPIO unless it holds the value already
+static void setInterruptConfig(vl53l0x_t *self, uint8_t interrupt_config)
+{
+  if (self->_interrupt_config != interrupt_config)
+  {
+    vl53l0x_write_reg(self, SYSTEM_INTERRUPT_CONFIG_GPIO, interrupt_config);
+    self->_interrupt_config = interrupt_config;
+  }
+}
+
+// Range thresholds above 255 mm need ST's interrupt threshold tuning, loaded
+// when ranging starts and undone when it stops
+// based on VL53L0X_CheckAndLoadInterruptSettings()
+static void checkInterruptSettings(vl53l0x_t *self, bool start)
+{
+  if (self->_interrupt_config < 0x01 || self->_interrupt_config > 0x03 ||
+      (self->_window_low_mm <= 255 && self->_window_high_mm <= 255))
+  {
+    return;
+  }
+
+  if (start)
+  {
+#if VL53L0X_INTERRUPT_THRESHOLD_SETTINGS
+    loadTuningSettings(self, InterruptThresholdSettings);
+#endif
+  }
+  else
+  {
+    writeSequence(self, interrupt_threshold_unload_sequence, sizeof(interrupt_threshold_unload_sequence) / sizeof(interrupt_threshold_unload_sequence[0]));
+  }
+}
+
+#if VL53L0X_INTERRUPT_THRESHOLD_SETTINGS
+
+// Write a tuning table in the format of the ST API: a count of values, the
+// register and the values, up to a zero count. Entries with a count of 0xFF
+// set ST API parameters and are skipped.
+// based on VL53L0X_load_tuning_settings()
+static void loadTuningSettings(vl53l0x_t *self, const uint8_t *settings)
+{
+  size_t i = 0;
+
+  while (settings[i] != 0)
+  {
+    uint8_t count = settings[i];
+
+    if (count == 0xFF)
+    {
+      i += 4;
+      continue;
+    }
+
+    vl53l0x_write_multi(self, settings[i + 1], &settings[i + 2], count);
+
+    i += 2 + count;
+  }
+}
+
+#endif
+
+static void asyncTask(void *param)
+{
+  vl53l0x_t *self = param;
+
+  if (vl53l0x_step(self))
+  {
+    bc_scheduler_plan_current_relative(self->_async_next_poll);
+  }
+}
+
+// Enter the next state of the asynchronous state machine and decide when its
+// first poll is due
+static void asyncEnter(vl53l0x_t *self, vl53l0x_state_t state, bc_tick_t first_poll)
+{
+  self->_async_state = state;
+  self->_async_next_poll = first_poll;
+  self->_async_polls = 0;
+  startTimeout();
+}
+
+// Note the start of ranging, from which the data ready times of its results
+// are predicted; period_ms as requested, before the OSC_CALIBRATE_VAL scaling
+static void measurementStarted(vl53l0x_t *self, bool continuous, uint32_t period_ms)
+{
+  self->_measurement_start_tick = bc_tick_get();
+  self->_measurement_period_ms = period_ms;
+  self->_measurement_continuous = continuous;
+  self->_measurement_index = 0;
+  self->_cycle_us = 0;
+}
+
+// Account a result of continuous ranging read at ready_tick, which is its
+// actual data ready time if on_edge, i.e. known to within a poll. Result k is
+// ready one budget plus k cycles after the start; results nobody read in
+// time are skipped. The timed period is programmed in oscillator ticks scaled
+// by OSC_CALIBRATE_VAL and the back-to-back cycle carries some overhead over
+// the budget, so both drift from their nominal values; once enough results
+// are in, the cycle is measured as the average over the whole run.
+static void measurementResult(vl53l0x_t *self, bc_tick_t ready_tick, bool on_edge)
+{
+  if (!self->_measurement_continuous)
+  {
+    return;
+  }
+
+  uint32_t budget_us = self->_measurement_timing_budget_us;
+  uint32_t cycle_us = measurementCycle(self);
+  uint64_t elapsed_us = (uint64_t) (ready_tick - self->_measurement_start_tick) * 1000;
+  uint32_t index = 0;
+
+  if (elapsed_us > budget_us)
+  {
+    index = (elapsed_us - budget_us + (on_edge ? cycle_us / 2 : 0)) / cycle_us;
+  }
+
+  if (index < self->_measurement_index)
+  {
+    index = self->_measurement_index;
+  }
+
+  if (on_edge && index >= CYCLE_LEARN_MIN_INDEX && elapsed_us > budget_us)
+  {
+    self->_cycle_us = (elapsed_us - budget_us) / index;
+  }
+
+  self->_measurement_index = index + 1;
+}
+
+// Learned cycle of continuous ranging, or the nominal one until known
+static uint32_t measurementCycle(vl53l0x_t *self)
+{
+  if (self->_cycle_us != 0)
+  {
+    return self->_cycle_us;
+  }
+
+  return self->_measurement_period_ms != 0 ? self->_measurement_period_ms * 1000 : self->_measurement_timing_budget_us;
+}
+
+// Predicted data ready time of the next result
+static bc_tick_t predictDataReady(vl53l0x_t *self)
+{
+  uint32_t budget_us = self->_measurement_timing_budget_us;
+
+  if (!self->_measurement_continuous)
+  {
+    return self->_measurement_start_tick + budget_us / 1000;
+  }
+
+  uint32_t cycle_us = measurementCycle(self);
+
+  return self->_measurement_start_tick + (budget_us + (uint64_t) self->_measurement_index * cycle_us) / 1000;
+}
+
+// Time from now until the status is worth reading for the next result
+static bc_tick_t firstPollDelay(vl53l0x_t *self)
+{
+  bc_tick_t now = bc_tick_get();
+  bc_tick_t first_poll = predictDataReady(self);
+
+  first_poll = first_poll > WAKE_GUARD_MS ? first_poll - WAKE_GUARD_MS : 0;
+
+  return first_poll > now ? first_poll - now : 0;
+}
+
+static void asyncFinish(vl53l0x_t *self, vl53l0x_event_t event, const vl53l0x_result_t *result)
+{
+  self->_async_state = VL53L0X_STATE_IDLE;
+
+  if (event == VL53L0X_EVENT_TIMEOUT || event == VL53L0X_EVENT_INIT_ERROR)
+  {
+    self->_did_timeout = true;
+    setError(self, VL53L0X_ERROR_TIMEOUT);
+  }
+
+  if (event == VL53L0X_EVENT_TIMEOUT)
+  {
+    self->_stats.timeouts++;
+    self->_stats.polls += self->_async_polls;
+  }
+
+  if (self->_event_handler != NULL)
+  {
+    self->_event_handler(self, event, result, self->_event_param);
+  }
+}
+
+// Read the interrupt status together with the result block that follows it in
+// one transaction; if a measurement is ready, decode it and clear the
+// interrupt. Used where a result is expected to be ready already, so that the
+// usual status poll and the result read collapse into one transaction.
+static bool readResultIfReady(vl53l0x_t *self, vl53l0x_result_t *result)
+{
+  uint8_t buffer[1 + RESULT_BLOCK_LENGTH];
+
+  vl53l0x_read_multi(self, RESULT_INTERRUPT_STATUS, buffer, sizeof(buffer));
+
+  if ((buffer[0] & 0x07) == 0)
+  {
+    return false;
+  }
+
+  vl53l0x_write_reg(self, SYSTEM_INTERRUPT_CLEAR, 0x01);
+
+  decodeResult(self, &buffer[1], result);
+
+  return true;
+}
+
+// Decode the result block starting at RESULT_RANGE_STATUS and judge its
+// validity the way VL53L0X_get_pal_range_status() does: device range status
+// first, then the signal rate and sigma limit checks
+// based on VL53L0X_GetRangingMeasurementData()
+static void decodeResult(vl53l0x_t *self, const uint8_t *buffer, vl53l0x_result_t *result)
+{
+  result->range_status = (buffer[0] & 0x78) >> 3;
+  result->effective_spad_count = ((uint16_t) buffer[2] << 8) | buffer[3];
+  result->signal_rate = ((uint16_t) buffer[6] << 8) | buffer[7];
+  result->ambient_rate = ((uint16_t) buffer[8] << 8) | buffer[9];
+
+  // assumptions: Linearity Corrective Gain is 1000 (default);
+  // fractional ranging is not enabled
+  result->range_mm = ((uint16_t) buffer[10] << 8) | buffer[11];
+
+  if (self->_xtalk_rate != 0)
+  {
+    // crosstalk of all effective SPADs, Q3.13 * Q8.8 to Q9.7
+    uint32_t xtalk = ((uint32_t) self->_xtalk_rate * result->effective_spad_count) >> 14;
+
+    if (result->signal_rate <= xtalk)
+    {
+      result->range_mm = 8888; // as the ST API does: nothing left but crosstalk
+    }
+    else
+    {
+      result->range_mm = (uint32_t) result->range_mm * result->signal_rate / (result->signal_rate - xtalk);
+    }
+  }
+
+  // Photon counting SNR: with S signal and A ambient events collected over
+  // the timing budget T, S / sqrt(S + A), i.e. sqrt(s * s * T / (s + a)) for
+  // rates s and a
+  uint32_t signal = result->signal_rate;
+  uint32_t total = signal + result->ambient_rate;
+
+  if (signal == 0)
+  {
+    result->snr = 0;
+  }
+  else
+  {
+    // rates are Q9.7, so T in units of 128 us
+    uint32_t snr = util_isqrt((signal * (self->_measurement_timing_budget_us >> 7)) / total * signal);
+
+    result->snr = snr > UINT16_MAX ? UINT16_MAX : snr;
+  }
+
+  result->sigma_mm = sigmaEstimate(self, signal, result->ambient_rate);
+
+  switch (result->range_status)
+  {
+    case 1:
+    case 2:
+    case 3:
+    {
+      result->validity = VL53L0X_VALIDITY_HARDWARE_FAIL;
+      return;
+    }
+    case 6:
+    case 9:
+    {
+      result->validity = VL53L0X_VALIDITY_PHASE_FAIL;
+      return;
+    }
+    case 8:
+    case 10:
+    {
+      result->validity = VL53L0X_VALIDITY_MIN_RANGE_FAIL;
+      return;
+    }
+    case 4:
+    {
+      result->validity = VL53L0X_VALIDITY_SIGNAL_FAIL;
+      return;
+    }
+    default:
+    {
+      break;
+    }
+  }
+
+  if (result->signal_rate < self->_signal_rate_limit)
+  {
+    result->validity = VL53L0X_VALIDITY_SIGNAL_FAIL;
+  }
+  else if (self->_sigma_limit_mm != 0 && result->sigma_mm > self->_sigma_limit_mm)
+  {
+    result->validity = VL53L0X_VALIDITY_SIGMA_FAIL;
+  }
+  else
+  {
+    result->validity = VL53L0X_VALIDITY_VALID;
+  }
+}
+
+// Range sigma estimate in mm for the return signal and ambient rates (Q9.7) of
+// a result at the current sequence step timeouts
+// based on VL53L0X_calc_sigma_estimate(), without its crosstalk term, which is
+// 1 when no crosstalk compensation is set up:
+//   sigma_rtn = c * sqrt(pulse_width^2 + (ambient_width * A / S)^2) / (2 * sqrt(12 * N))
+// with N the signal events collected while the VCSEL is on, combined with a
+// reference sigma of 1 mm * sqrt(25 ms / T) over the integration time T of the
+// pre-range and final range steps
+static uint16_t sigmaEstimate(vl53l0x_t *self, uint32_t signal_rate, uint32_t ambient_rate)
+{
+  if (signal_rate == 0)
+  {
+    return UINT16_MAX;
+  }
+
+  SequenceStepEnables enables;
+  SequenceStepTimeouts timeouts;
+
+  getSequenceStepEnables(self, &enables);
+  getSequenceStepTimeouts(self, &enables, &timeouts);
+
+  // the VCSEL is on for 2 or 3 PLL periods of each of the 2048 VCSEL periods of
+  // a macro period
+  uint32_t vcsel_width = timeouts.final_range_vcsel_period_pclks == 8 ? 2 : 3;
+  uint32_t peak_vcsel_us = (vcsel_width * 2048 * ((uint32_t) timeouts.pre_range_mclks + timeouts.final_range_mclks) + 500) / 1000;
+  peak_vcsel_us = (peak_vcsel_us * 1655 + 500) / 1000;
+
+  uint64_t events = ((uint64_t) signal_rate * peak_vcsel_us + 64) >> 7;
+
+  if (events < 1)
+  {
+    events = 1;
+  }
+  else if (events > UINT32_MAX / 12)
+  {
+    events = UINT32_MAX / 12;
+  }
+
+  uint32_t ratio = (ambient_rate << 16) / signal_rate;
+
+  if (ratio > ((uint32_t) SIGMA_AMBIENT_RATIO_MAX << 16))
+  {
+    ratio = (uint32_t) SIGMA_AMBIENT_RATIO_MAX << 16;
+  }
+
+  uint32_t pulse = SIGMA_PULSE_WIDTH_CENTI_NS;
+  uint32_t ambient = (ratio * SIGMA_AMBIENT_WIDTH_CENTI_NS + 0x8000) >> 16;
+  uint32_t width_centi_ns = util_isqrt(pulse * pulse + ambient * ambient);
+
+  // centi-ns * um per 100 ps is in um; kept in units of 10 um
+  uint32_t sigma_rtn = (width_centi_ns * SIGMA_SPEED_OF_LIGHT / (2 * util_isqrt(events * 12)) + 5) / 10;
+
+  if (sigma_rtn > SIGMA_ESTIMATE_MAX_MM * 100)
+  {
+    sigma_rtn = SIGMA_ESTIMATE_MAX_MM * 100;
+  }
+
+  uint32_t integration_ms = (timeouts.pre_range_us + timeouts.final_range_us + 500) / 1000;
+
+  if (integration_ms == 0)
+  {
+    integration_ms = 1;
+  }
+
+  // (1 mm in units of 10 um)^2 * 25 ms / T
+  uint32_t sigma_ref_squared = (uint32_t) 100 * 100 * SIGMA_REF_INTEGRATION_MS / integration_ms;
+
+  return (util_isqrt(sigma_rtn * sigma_rtn + sigma_ref_squared) + 50) / 100;
+}
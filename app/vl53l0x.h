@@ -3,10 +3,73 @@
 
 #include <bcl.h>
 
-uint8_t address;
-bool did_timeout;
-bc_tick_t io_timeout;
-bc_tick_t timeout_start_ms;
+#define VL53L0X_DEFAULT_ADDRESS 0x29
+#define VL53L0X_DEFAULT_SIGMA_LIMIT_MM 18
+
+// Set to 0 to compile out the floating point wrappers of the fixed point API
+#ifndef VL53L0X_FLOAT_API
+#define VL53L0X_FLOAT_API 1
+#endif
+
+// ST's tuning for range window thresholds above 255 mm, InterruptThresholdSettings
+// from vl53l0x_interrupt_threshold_settings.h of the ST API (STSW-IMG005). It
+// is loaded when that header is on the include path.
+#ifndef VL53L0X_INTERRUPT_THRESHOLD_SETTINGS
+#if defined(__has_include)
+#if __has_include(<vl53l0x_interrupt_threshold_settings.h>)
+#define VL53L0X_INTERRUPT_THRESHOLD_SETTINGS 1
+#endif
+#endif
+#endif
+
+#ifndef VL53L0X_INTERRUPT_THRESHOLD_SETTINGS
+#define VL53L0X_INTERRUPT_THRESHOLD_SETTINGS 0
+#endif
+
+// Set to 1 to keep a RAM ring of the last VL53L0X_TRACE_SIZE I2C transactions
+// of all instances, printed by vl53l0x_trace_dump()
+#ifndef VL53L0X_TRACE
+#define VL53L0X_TRACE 0
+#endif
+
+#ifndef VL53L0X_TRACE_SIZE
+#define VL53L0X_TRACE_SIZE 64
+#endif
+
+// Histogram bucket 0 counts zeros, bucket n values in [2^(n-1), 2^n); the last
+// bucket also takes everything above
+#define VL53L0X_STATS_BUCKETS 12
+
+// Bus speed set up by init; the sensor supports fast mode
+#ifndef VL53L0X_I2C_SPEED
+#define VL53L0X_I2C_SPEED BC_I2C_SPEED_400_KHZ
+#endif
+
+// Attempts after a failed transaction, each preceded by a bus recovery
+#ifndef VL53L0X_I2C_RETRIES
+#define VL53L0X_I2C_RETRIES 2
+#endif
+
+// Transfers vl53l0x_queue_transfer() can hold per instance
+#ifndef VL53L0X_TRANSFER_QUEUE_SIZE
+#define VL53L0X_TRANSFER_QUEUE_SIZE 8
+#endif
+
+// Stored calibration is reused within this many degrees Celsius of the
+// temperature it was taken at
+#define VL53L0X_CALIBRATION_TEMPERATURE_DELTA 8
+
+// Ranging measurements averaged by the offset and crosstalk calibration
+#define VL53L0X_CALIBRATION_SAMPLES 50
+
+// Rates are MCPS in Q9.7 fixed point; the conversion from a constant folds at
+// compile time
+#define VL53L0X_MCPS_TO_Q97(mcps) ((uint16_t) ((mcps) * (1 << 7) + 0.5))
+#define VL53L0X_Q97_TO_Q1616(q97) ((uint32_t) (q97) << 9)
+#define VL53L0X_Q1616_TO_Q97(q1616) ((uint16_t) (((q1616) + (1 << 8)) >> 9))
+// Integer part and hundredths of a Q9.7 rate, for printing without floats
+#define VL53L0X_Q97_INT(q97) ((q97) >> 7)
+#define VL53L0X_Q97_CENTI(q97) ((((q97) & 0x7F) * 100 + 64) >> 7)
 
 typedef enum
 {
@@ -14,29 +77,303 @@ typedef enum
     VcselPeriodFinalRange
 } vcselPeriodType;
 
-bool vl53l0x_init(uint8_t addr, bc_tick_t timeout, bool io_2v8);
-uint16_t vl53l0x_read_range_single_millimeters();
-inline uint8_t vl53l0x_get_address() { return address; }
-void vl53l0x_set_address(uint8_t new_addr);
-inline bc_tick_t vl53l0x_get_timeout() { return io_timeout; }
-inline void vl53l0x_set_timeout(bc_tick_t timeout) { io_timeout = timeout; }
-bool vl53l0x_timeout_occurred();
-void vl53l0x_write_reg(uint8_t reg, uint8_t value);
-void vl53l0x_write_reg16_bit(uint8_t reg, uint16_t value);
-void vl53l0x_write_reg32_bit(uint8_t reg, uint32_t value);
-uint8_t vl53l0x_read_reg(uint8_t reg);
-uint16_t vl53l0x_read_reg16_bit(uint8_t reg);
-uint32_t vl53l0x_read_reg32_bit(uint8_t reg);
-void vl53l0x_write_multi(uint8_t reg, uint8_t const * src, uint8_t count);
-void vl53l0x_read_multi(uint8_t reg, uint8_t * dst, uint8_t count);
-bool vl53l0x_set_signal_rate_limit(float limit_mcps);
-float vl53l0x_get_signal_rate_limit();
-bool vl53l0x_set_measurement_timing_budget(uint32_t budget_us);
-uint32_t vl53l0x_get_measurement_timing_budget();
-bool vl53l0x_set_vcsel_pulse_period(vcselPeriodType type, uint8_t period_pclks);
-uint8_t vl53l0x_get_vcsel_pulse_period(vcselPeriodType type);
-void vl53l0x_start_continuous(uint32_t period_ms);
-void vl53l0x_stop_continuous();
-uint16_t vl53l0x_read_range_continuous_millimeters();
+typedef enum
+{
+    VL53L0X_STATE_IDLE,
+    VL53L0X_STATE_INIT_SPAD,
+    VL53L0X_STATE_INIT_VHV,
+    VL53L0X_STATE_INIT_PHASE,
+    VL53L0X_STATE_START,
+    VL53L0X_STATE_RESULT
+} vl53l0x_state_t;
+
+typedef enum
+{
+    VL53L0X_EVENT_INIT_DONE,
+    VL53L0X_EVENT_INIT_ERROR,
+    VL53L0X_EVENT_RESULT,
+    VL53L0X_EVENT_TIMEOUT
+} vl53l0x_event_t;
+
+// Per-sample verdict, numbered like the RangeStatus of the ST API
+typedef enum
+{
+    VL53L0X_VALIDITY_VALID = 0,
+    VL53L0X_VALIDITY_SIGMA_FAIL = 1,
+    VL53L0X_VALIDITY_SIGNAL_FAIL = 2,
+    VL53L0X_VALIDITY_MIN_RANGE_FAIL = 3,
+    VL53L0X_VALIDITY_PHASE_FAIL = 4,
+    VL53L0X_VALIDITY_HARDWARE_FAIL = 5
+} vl53l0x_validity_t;
+
+typedef struct
+{
+    uint16_t range_mm;
+    uint8_t range_status;          // DeviceRangeStatus, bits 6:3 of RESULT_RANGE_STATUS
+    uint16_t signal_rate;          // return signal rate in MCPS, Q9.7
+    uint16_t ambient_rate;         // return ambient rate in MCPS, Q9.7
+    uint16_t effective_spad_count; // effective return SPAD count, Q8.8
+    uint16_t snr;                  // signal to noise ratio estimate
+    uint16_t sigma_mm;             // range standard deviation estimate in mm, as VL53L0X_calc_sigma_estimate()
+    vl53l0x_validity_t validity;
+} vl53l0x_result_t;
+
+typedef struct
+{
+    uint32_t transactions;
+    uint32_t reads;
+    uint32_t writes;
+    uint32_t bytes; // on the wire, including device and register address bytes
+    uint32_t bus_time_100khz_us;
+    uint32_t bus_time_400khz_us;
+    uint32_t bus_time_us; // at the configured speed
+    uint32_t retries;     // failed attempts that were retried
+    uint32_t errors;      // transactions that failed all attempts
+} vl53l0x_bus_stats_t;
+
+typedef enum
+{
+    VL53L0X_ERROR_NONE,
+    VL53L0X_ERROR_BUS,     // an I2C transaction failed despite retries and bus recovery
+    VL53L0X_ERROR_TIMEOUT, // the sensor did not finish in time
+} vl53l0x_error_t;
+
+// Per-sample wait statistics. Latency is measured in milliseconds from the
+// start of the wait (polling) or from the data ready edge (interrupt) to the
+// result read; polls are the RESULT_INTERRUPT_STATUS reads it took.
+typedef struct
+{
+    uint32_t samples;
+    uint32_t timeouts;
+    uint32_t polls;
+    uint32_t latency_sum_ms;
+    uint32_t latency_max_ms;
+    uint32_t latency_histogram[VL53L0X_STATS_BUCKETS];
+    uint32_t polls_histogram[VL53L0X_STATS_BUCKETS];
+} vl53l0x_stats_t;
+
+// Per-module results of the initialization that vl53l0x_init_warm() restores
+typedef struct
+{
+    uint8_t ref_spad_map[6]; // GLOBAL_CONFIG_SPAD_ENABLES_REF_0 through _5
+    uint8_t vhv_settings;
+    uint8_t phase_cal;
+    int8_t temperature;      // degrees Celsius at calibration
+    int32_t offset_um;       // part-to-part range offset
+    uint16_t xtalk_rate;     // crosstalk compensation, MCPS per SPAD, Q3.13
+} vl53l0x_calibration_t;
+
+// Valid readings collected for an offset or crosstalk calibration, see
+// vl53l0x_calibration_add_sample()
+typedef struct
+{
+    uint32_t sum_range_mm;
+    uint32_t sum_signal_rate; // Q9.7
+    uint32_t sum_spads;
+    uint32_t count;
+} vl53l0x_calibration_samples_t;
+
+typedef enum
+{
+    VL53L0X_PROFILE_DEFAULT,
+    VL53L0X_PROFILE_HIGH_SPEED,
+    VL53L0X_PROFILE_HIGH_ACCURACY,
+    VL53L0X_PROFILE_LONG_RANGE
+} vl53l0x_profile_t;
+
+// Ranging configuration applied as a whole by vl53l0x_apply_config()
+typedef struct
+{
+    uint16_t signal_rate_limit; // MCPS, Q9.7
+    uint16_t sigma_limit_mm;
+    uint8_t pre_range_vcsel_period_pclks;
+    uint8_t final_range_vcsel_period_pclks;
+    uint32_t timing_budget_us;
+} vl53l0x_config_t;
+
+// Ranges reported by vl53l0x_set_window_interrupt()
+typedef enum
+{
+    VL53L0X_WINDOW_BELOW,   // range below the low threshold
+    VL53L0X_WINDOW_ABOVE,   // range above the high threshold
+    VL53L0X_WINDOW_OUTSIDE, // range below the low or above the high threshold
+    VL53L0X_WINDOW_INSIDE   // range between the thresholds, filtered by the driver
+} vl53l0x_window_t;
+
+typedef struct vl53l0x_t vl53l0x_t;
+
+typedef void (*vl53l0x_data_ready_handler_t)(vl53l0x_t *self, const vl53l0x_result_t *result, void *param);
+typedef void (*vl53l0x_event_handler_t)(vl53l0x_t *self, vl53l0x_event_t event, const vl53l0x_result_t *result, void *param);
+
+typedef struct vl53l0x_transfer_t vl53l0x_transfer_t;
+
+typedef void (*vl53l0x_transfer_handler_t)(vl53l0x_t *self, const vl53l0x_transfer_t *transfer, bool ok, void *param);
+
+// Queued register transaction; with buffer NULL up to 4 bytes are carried in
+// data, so short writes need no storage of their own and short reads can be
+// picked up by the handler
+struct vl53l0x_transfer_t
+{
+    bool read;
+    uint8_t reg;
+    uint8_t length;
+    uint8_t *buffer;
+    uint8_t data[4];
+    vl53l0x_transfer_handler_t handler; // may be NULL
+    void *param;
+};
+
+struct vl53l0x_t
+{
+    bc_i2c_channel_t _i2c_channel;
+    uint8_t _i2c_address;
+    bc_i2c_speed_t _i2c_speed;
+    bool _did_timeout;
+    vl53l0x_error_t _error;
+    bc_tick_t _io_timeout;
+    bc_tick_t _timeout_start_ms;
+    uint32_t _timeout_start_errors;
+    uint8_t _stop_variable; // read by init and used when starting measurement; is StopVariable field of VL53L0X_DevData_t structure in API
+    bool _stop_variable_set; // written to the device since init or the last stop
+    bool _shot_pending;      // single shot started by vl53l0x_trigger_single() or a rearm
+    uint32_t _measurement_timing_budget_us;
+    uint16_t _signal_rate_limit; // Q9.7
+    uint16_t _sigma_limit_mm;
+
+    bool _sequence_cache_valid;
+    uint8_t _sequence_config;
+    uint8_t _pre_range_vcsel_period_pclks;
+    uint8_t _final_range_vcsel_period_pclks;
+    uint16_t _msrc_dss_tcc_mclks;
+    uint16_t _pre_range_mclks;
+    uint16_t _final_range_mclks; // as in the register, including the pre-range
+
+    uint8_t _good_spad_map[6];
+    uint8_t _ref_spad_map[6];
+    uint16_t _xtalk_rate; // Q3.13
+
+    bc_exti_line_t _data_ready_exti_line;
+    vl53l0x_data_ready_handler_t _data_ready_handler;
+    void *_data_ready_param;
+    bc_scheduler_task_id_t _data_ready_task_id;
+    bc_tick_t _data_ready_tick;
+    bool _data_ready_queued; // status read queued, its handler not run yet
+    uint8_t _interrupt_config; // shadow of SYSTEM_INTERRUPT_CONFIG_GPIO
+    bool _window_inside;
+    uint16_t _window_low_mm;
+    uint16_t _window_high_mm;
+
+    vl53l0x_state_t _async_state;
+    bc_tick_t _async_next_poll;
+    bc_scheduler_task_id_t _async_task_id;
+    bool _async_task_registered;
+    vl53l0x_event_handler_t _event_handler;
+    void *_event_param;
+    bc_tick_t _measurement_start_tick;
+    uint32_t _measurement_period_ms; // 0 for back-to-back
+    bool _measurement_continuous;
+    uint32_t _measurement_index; // of the next result since the start
+    uint32_t _cycle_us;          // learned measurement cycle, 0 until known
+    uint32_t _async_polls;
+
+    vl53l0x_transfer_t _transfers[VL53L0X_TRANSFER_QUEUE_SIZE];
+    bool _transfer_ok[VL53L0X_TRANSFER_QUEUE_SIZE];
+    uint8_t _transfer_head;
+    uint8_t _transfer_count;
+    uint8_t _transfer_done; // at the head, run by a flush, handler still due
+    bc_scheduler_task_id_t _transfer_task_id;
+    bool _transfer_task_registered;
+    uint8_t _result_buffer[13]; // interrupt status and result block
+
+    uint32_t _bus_reads;
+    uint32_t _bus_writes;
+    uint32_t _bus_bytes;
+    uint32_t _bus_retries;
+    uint32_t _bus_errors;
+
+    uint32_t _sequence_transactions_saved;
+    uint32_t _sequence_bytes_saved;
+
+    vl53l0x_stats_t _stats;
+};
+
+bool vl53l0x_init(vl53l0x_t *self, bc_i2c_channel_t i2c_channel, uint8_t addr, bc_tick_t timeout, bool io_2v8);
+bool vl53l0x_init_multi(vl53l0x_t *sensors, const bc_gpio_channel_t *xshut, const uint8_t *addresses, size_t count, bc_i2c_channel_t i2c_channel, bc_tick_t timeout, bool io_2v8);
+bool vl53l0x_init_warm(vl53l0x_t *self, bc_i2c_channel_t i2c_channel, uint8_t addr, bc_tick_t timeout, bool io_2v8, const vl53l0x_calibration_t *calibration, bool recalibrate);
+void vl53l0x_get_calibration(vl53l0x_t *self, vl53l0x_calibration_t *calibration);
+bool vl53l0x_calibration_save(const vl53l0x_calibration_t *calibration, uint32_t address, int8_t temperature);
+bool vl53l0x_calibration_load(vl53l0x_calibration_t *calibration, uint32_t address);
+bool vl53l0x_calibration_is_current(const vl53l0x_calibration_t *calibration, int8_t temperature);
+bool vl53l0x_perform_ref_calibration(vl53l0x_t *self);
+bool vl53l0x_perform_ref_spad_management(vl53l0x_t *self);
+bool vl53l0x_perform_offset_calibration(vl53l0x_t *self, uint16_t distance_mm, int32_t *offset_um);
+bool vl53l0x_perform_xtalk_calibration(vl53l0x_t *self, uint16_t distance_mm, uint16_t *xtalk_rate);
+void vl53l0x_calibration_add_sample(vl53l0x_calibration_samples_t *samples, const vl53l0x_result_t *result);
+bool vl53l0x_finish_offset_calibration(vl53l0x_t *self, const vl53l0x_calibration_samples_t *samples, uint16_t distance_mm, int32_t *offset_um);
+bool vl53l0x_finish_xtalk_calibration(vl53l0x_t *self, const vl53l0x_calibration_samples_t *samples, uint16_t distance_mm, uint16_t *xtalk_rate);
+void vl53l0x_set_offset_calibration(vl53l0x_t *self, int32_t offset_um);
+int32_t vl53l0x_get_offset_calibration(vl53l0x_t *self);
+void vl53l0x_set_xtalk_compensation(vl53l0x_t *self, uint16_t xtalk_rate);
+uint16_t vl53l0x_get_xtalk_compensation(vl53l0x_t *self);
+uint16_t vl53l0x_read_range_single_millimeters(vl53l0x_t *self);
+uint8_t vl53l0x_get_address(vl53l0x_t *self);
+void vl53l0x_set_address(vl53l0x_t *self, uint8_t new_addr);
+bc_tick_t vl53l0x_get_timeout(vl53l0x_t *self);
+void vl53l0x_set_timeout(vl53l0x_t *self, bc_tick_t timeout);
+bool vl53l0x_timeout_occurred(vl53l0x_t *self);
+vl53l0x_error_t vl53l0x_get_error(vl53l0x_t *self);
+void vl53l0x_set_bus_speed(vl53l0x_t *self, bc_i2c_speed_t speed);
+bc_i2c_speed_t vl53l0x_get_bus_speed(vl53l0x_t *self);
+void vl53l0x_write_reg(vl53l0x_t *self, uint8_t reg, uint8_t value);
+void vl53l0x_write_reg16_bit(vl53l0x_t *self, uint8_t reg, uint16_t value);
+void vl53l0x_write_reg32_bit(vl53l0x_t *self, uint8_t reg, uint32_t value);
+uint8_t vl53l0x_read_reg(vl53l0x_t *self, uint8_t reg);
+uint16_t vl53l0x_read_reg16_bit(vl53l0x_t *self, uint8_t reg);
+uint32_t vl53l0x_read_reg32_bit(vl53l0x_t *self, uint8_t reg);
+void vl53l0x_write_multi(vl53l0x_t *self, uint8_t reg, uint8_t const * src, uint8_t count);
+void vl53l0x_read_multi(vl53l0x_t *self, uint8_t reg, uint8_t * dst, uint8_t count);
+bool vl53l0x_queue_transfer(vl53l0x_t *self, const vl53l0x_transfer_t *transfer);
+void vl53l0x_flush_transfers(vl53l0x_t *self);
+size_t vl53l0x_get_pending_transfers(vl53l0x_t *self);
+void vl53l0x_set_signal_rate_limit_q97(vl53l0x_t *self, uint16_t limit);
+uint16_t vl53l0x_get_signal_rate_limit_q97(vl53l0x_t *self);
+#if VL53L0X_FLOAT_API
+bool vl53l0x_set_signal_rate_limit(vl53l0x_t *self, float limit_mcps);
+float vl53l0x_get_signal_rate_limit(vl53l0x_t *self);
+#endif
+void vl53l0x_set_sigma_limit(vl53l0x_t *self, uint16_t sigma_mm);
+uint32_t vl53l0x_estimate_budget_for_sigma(uint16_t signal_rate, uint16_t ambient_rate, uint16_t sigma_mm);
+bool vl53l0x_set_measurement_timing_budget(vl53l0x_t *self, uint32_t budget_us);
+uint32_t vl53l0x_get_measurement_timing_budget(vl53l0x_t *self);
+bool vl53l0x_set_vcsel_pulse_period(vl53l0x_t *self, vcselPeriodType type, uint8_t period_pclks);
+uint8_t vl53l0x_get_vcsel_pulse_period(vl53l0x_t *self, vcselPeriodType type);
+void vl53l0x_get_profile_config(vl53l0x_profile_t profile, vl53l0x_config_t *config);
+void vl53l0x_get_config(vl53l0x_t *self, vl53l0x_config_t *config);
+bool vl53l0x_apply_config(vl53l0x_t *self, const vl53l0x_config_t *config);
+bool vl53l0x_set_profile(vl53l0x_t *self, vl53l0x_profile_t profile);
+void vl53l0x_start_continuous(vl53l0x_t *self, uint32_t period_ms);
+void vl53l0x_stop_continuous(vl53l0x_t *self);
+uint16_t vl53l0x_read_range_continuous_millimeters(vl53l0x_t *self);
+bool vl53l0x_read_result(vl53l0x_t *self, vl53l0x_result_t *result);
+bool vl53l0x_trigger_single(vl53l0x_t *self);
+bool vl53l0x_read_range_pipelined(vl53l0x_t *self, vl53l0x_result_t *result, bool rearm);
+void vl53l0x_set_data_ready_interrupt(vl53l0x_t *self, bc_gpio_channel_t gpio_channel, bc_exti_line_t exti_line, vl53l0x_data_ready_handler_t handler, void *param);
+bool vl53l0x_set_window_interrupt(vl53l0x_t *self, bc_gpio_channel_t gpio_channel, bc_exti_line_t exti_line, vl53l0x_window_t window, uint16_t low_mm, uint16_t high_mm, vl53l0x_data_ready_handler_t handler, void *param);
+void vl53l0x_clear_data_ready_interrupt(vl53l0x_t *self);
+void vl53l0x_set_event_handler(vl53l0x_t *self, vl53l0x_event_handler_t handler, void *param);
+bool vl53l0x_init_async(vl53l0x_t *self, bc_i2c_channel_t i2c_channel, uint8_t addr, bc_tick_t timeout, bool io_2v8);
+bool vl53l0x_read_range_single_async(vl53l0x_t *self);
+bool vl53l0x_read_range_continuous_async(vl53l0x_t *self);
+bool vl53l0x_step(vl53l0x_t *self);
+bool vl53l0x_is_busy(vl53l0x_t *self);
+void vl53l0x_get_bus_stats(vl53l0x_t *self, vl53l0x_bus_stats_t *stats);
+void vl53l0x_reset_bus_stats(vl53l0x_t *self);
+void vl53l0x_get_sequence_savings(vl53l0x_t *self, uint32_t *transactions, uint32_t *bytes);
+void vl53l0x_get_stats(vl53l0x_t *self, vl53l0x_stats_t *stats);
+void vl53l0x_reset_stats(vl53l0x_t *self);
+#if VL53L0X_TRACE
+void vl53l0x_trace_dump(void);
+void vl53l0x_trace_clear(void);
+#endif
 
 #endif // _VL53L0X_H
@@ -0,0 +1,85 @@
+#include <host.h>
+#include <vl53l0x_sim.h>
+#include <vl53l0x.h>
+#include <dutycycle.h>
+#include <stdio.h>
+
+// Energy model of the duty cycle manager over a sweep of sample periods and
+// timing budgets against the simulator, as a tab separated table: energy per
+// sample, average power and the estimated life of a battery of
+// BENCH_BATTERY_MAH, counting the sensor and its I2C traffic only. Every
+// sample is read once its period is over, as after the data ready interrupt;
+// period 0 is back-to-back ranging. The simulated clock makes the figures
+// exact.
+
+#define BENCH_BATTERY_MAH 1000
+#define BENCH_SAMPLES 50
+
+static vl53l0x_sim_t sim;
+static vl53l0x_t vl53l0x;
+static dutycycle_t dutycycle;
+
+static void benchDutycycle(uint32_t period_ms, uint32_t budget_us)
+{
+    host_reset();
+
+    vl53l0x_sim_init(&sim, VL53L0X_DEFAULT_ADDRESS);
+    host_attach(BC_I2C_I2C0, &sim);
+
+    memset(&vl53l0x, 0, sizeof(vl53l0x));
+
+    if (!vl53l0x_init(&vl53l0x, BC_I2C_I2C0, VL53L0X_DEFAULT_ADDRESS, 500, false))
+    {
+        return;
+    }
+
+    dutycycle_init(&dutycycle, &vl53l0x);
+
+    // the budget first, so a short period does not clip it
+    if (!dutycycle_set_budget(&dutycycle, budget_us) || !dutycycle_set_period(&dutycycle, period_ms) ||
+        dutycycle_get_budget(&dutycycle) != budget_us)
+    {
+        return;
+    }
+
+    dutycycle_start(&dutycycle);
+    dutycycle_reset_energy(&dutycycle);
+
+    uint32_t cycle_us = period_ms == 0 ? budget_us : period_ms * 1000;
+
+    for (int i = 0; i < BENCH_SAMPLES; i++)
+    {
+        host_advance(cycle_us);
+        vl53l0x_read_range_continuous_millimeters(&vl53l0x);
+    }
+
+    dutycycle_update(&dutycycle);
+
+    uint32_t hours = dutycycle_estimate_battery_life(&dutycycle, BENCH_BATTERY_MAH);
+
+    printf("%lu\t%lu\t%lu\t%lu\t%lu\t%lu\n", (unsigned long) period_ms, (unsigned long) budget_us,
+           (unsigned long) dutycycle_get_energy_per_sample(&dutycycle), (unsigned long) dutycycle_get_average_power(&dutycycle),
+           (unsigned long) hours, (unsigned long) (hours / 24));
+}
+
+int main(void)
+{
+    static const uint32_t periods_ms[] = { 0, 100, 250, 1000, 5000 };
+    static const uint32_t budgets_us[] = { 20000, 33000, 50000, 100000, 200000 };
+
+    printf("period_ms\tbudget_us\tuj_per_sample\tpower_uw\tbattery_h\tbattery_days\n");
+
+    for (size_t i = 0; i < sizeof(periods_ms) / sizeof(periods_ms[0]); i++)
+    {
+        for (size_t j = 0; j < sizeof(budgets_us) / sizeof(budgets_us[0]); j++)
+        {
+            // budgets that do not fit the period are skipped
+            if (periods_ms[i] == 0 || budgets_us[j] / 1000 < periods_ms[i])
+            {
+                benchDutycycle(periods_ms[i], budgets_us[j]);
+            }
+        }
+    }
+
+    return 0;
+}
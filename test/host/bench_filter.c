@@ -0,0 +1,65 @@
+#include <host.h>
+#include <filter.h>
+#include <stdio.h>
+#include <time.h>
+
+// Throughput of filter_feed() per filter type on the host, as a tab separated
+// table. The numbers only compare the filters with each other; the Cortex-M0+
+// has no FPU, so the Kalman filter is relatively slower on the target.
+
+#define BENCH_SAMPLES 2000000
+
+static uint16_t samples[4096];
+
+static double benchNow(void)
+{
+    struct timespec now;
+
+    clock_gettime(CLOCK_MONOTONIC, &now);
+
+    return now.tv_sec + now.tv_nsec / 1e9;
+}
+
+static void benchFilter(const char *name, filter_type_t type, uint8_t window_size)
+{
+    filter_t filter;
+    volatile uint16_t sink = 0;
+
+    filter_init(&filter, type, window_size);
+
+    double start = benchNow();
+
+    for (uint32_t i = 0; i < BENCH_SAMPLES; i++)
+    {
+        sink = filter_feed(&filter, samples[i % 4096], i * 20);
+    }
+
+    double elapsed = benchNow() - start;
+
+    (void) sink;
+
+    printf("%s\t%u\t%.1f\t%.0f\n", name, window_size, elapsed * 1e9 / BENCH_SAMPLES, BENCH_SAMPLES / elapsed);
+}
+
+int main(void)
+{
+    uint32_t state = 1;
+
+    // noisy ramp, like a target moving through the field of view
+    for (int i = 0; i < 4096; i++)
+    {
+        state = state * 1103515245 + 12345;
+        samples[i] = 100 + i % 2000 + (state >> 16) % 32;
+    }
+
+    printf("filter\twindow\tns_per_sample\tsamples_per_s\n");
+
+    benchFilter("moving_average", FILTER_TYPE_MOVING_AVERAGE, 8);
+    benchFilter("moving_average", FILTER_TYPE_MOVING_AVERAGE, FILTER_WINDOW_MAX);
+    benchFilter("median", FILTER_TYPE_MEDIAN, 5);
+    benchFilter("median", FILTER_TYPE_MEDIAN, FILTER_WINDOW_MAX);
+    benchFilter("ema", FILTER_TYPE_EMA, 1);
+    benchFilter("kalman", FILTER_TYPE_KALMAN, 1);
+
+    return 0;
+}
@@ -0,0 +1,269 @@
+#include <host.h>
+#include <vl53l0x_sim.h>
+#include <vl53l0x.h>
+#include <stdio.h>
+#include <time.h>
+
+// Bus cost of the driver entry points against the simulator: transactions,
+// bytes on the wire and the bus time they take at 100 kHz and 400 kHz, as a
+// tab separated table. Given a baseline table, any entry point that got more
+// expensive fails the run. The simulator is deterministic, so the numbers are
+// exact and the comparison has no tolerance.
+//
+// Without a baseline, the host CPU time per transaction of repeated register
+// reads follows, as a second table. It includes the simulator and only
+// compares builds with each other: make bench also runs bench_vl53l0x_trace,
+// the same benchmark with the transaction trace (VL53L0X_TRACE) compiled in.
+// Register reads do not wait on the device, so both builds run the same
+// transactions even though the trace reads the tick, which the host charges.
+//
+//     bench_vl53l0x [baseline.tsv]
+
+#define BENCH_NAME_SIZE 48
+#define BENCH_ROWS_MAX 32
+#define BENCH_CPU_READS 1000000
+
+typedef struct
+{
+    char name[BENCH_NAME_SIZE];
+    uint32_t transactions;
+    uint32_t bytes;
+    uint32_t bus_time_100khz_us;
+    uint32_t bus_time_400khz_us;
+} bench_row_t;
+
+typedef struct
+{
+    const char *name;
+    bool init; // start from an initialized driver
+    void (*setup)(void);
+    void (*run)(void);
+} bench_case_t;
+
+static vl53l0x_sim_t sim;
+static vl53l0x_t vl53l0x;
+
+static bench_row_t rows[BENCH_ROWS_MAX];
+static size_t row_count;
+
+static void benchInit(void)
+{
+    vl53l0x_init(&vl53l0x, BC_I2C_I2C0, VL53L0X_DEFAULT_ADDRESS, 500, false);
+}
+
+static void benchReadRangeSingle(void)
+{
+    vl53l0x_read_range_single_millimeters(&vl53l0x);
+}
+
+static void benchStartContinuous(void)
+{
+    vl53l0x_start_continuous(&vl53l0x, 0);
+}
+
+static void benchReadRangeContinuous(void)
+{
+    vl53l0x_read_range_continuous_millimeters(&vl53l0x);
+}
+
+static void benchStopContinuous(void)
+{
+    vl53l0x_stop_continuous(&vl53l0x);
+}
+
+static void benchSetMeasurementTimingBudget(void)
+{
+    vl53l0x_set_measurement_timing_budget(&vl53l0x, 50000);
+}
+
+static void benchGetMeasurementTimingBudget(void)
+{
+    vl53l0x_get_measurement_timing_budget(&vl53l0x);
+}
+
+static void benchSetVcselPulsePeriodPreRange(void)
+{
+    vl53l0x_set_vcsel_pulse_period(&vl53l0x, VcselPeriodPreRange, 18);
+}
+
+static void benchSetVcselPulsePeriodFinalRange(void)
+{
+    vl53l0x_set_vcsel_pulse_period(&vl53l0x, VcselPeriodFinalRange, 14);
+}
+
+static const bench_case_t cases[] =
+{
+    { "init", false, NULL, benchInit },
+    { "read_range_single_millimeters", true, NULL, benchReadRangeSingle },
+    { "start_continuous", true, NULL, benchStartContinuous },
+    { "read_range_continuous_millimeters", true, benchStartContinuous, benchReadRangeContinuous },
+    { "stop_continuous", true, benchStartContinuous, benchStopContinuous },
+    { "set_measurement_timing_budget", true, NULL, benchSetMeasurementTimingBudget },
+    { "get_measurement_timing_budget", true, NULL, benchGetMeasurementTimingBudget },
+    { "set_vcsel_pulse_period_pre_range", true, NULL, benchSetVcselPulsePeriodPreRange },
+    { "set_vcsel_pulse_period_final_range", true, NULL, benchSetVcselPulsePeriodFinalRange }
+};
+
+static void benchRun(const bench_case_t *bench, bench_row_t *row)
+{
+    vl53l0x_bus_stats_t stats;
+
+    host_reset();
+
+    vl53l0x_sim_init(&sim, VL53L0X_DEFAULT_ADDRESS);
+    host_attach(BC_I2C_I2C0, &sim);
+
+    memset(&vl53l0x, 0, sizeof(vl53l0x));
+
+    if (bench->init)
+    {
+        benchInit();
+    }
+
+    if (bench->setup != NULL)
+    {
+        bench->setup();
+    }
+
+    vl53l0x_reset_bus_stats(&vl53l0x);
+
+    bench->run();
+
+    vl53l0x_get_bus_stats(&vl53l0x, &stats);
+
+    snprintf(row->name, sizeof(row->name), "%s", bench->name);
+    row->transactions = stats.transactions;
+    row->bytes = stats.bytes;
+    row->bus_time_100khz_us = stats.bus_time_100khz_us;
+    row->bus_time_400khz_us = stats.bus_time_400khz_us;
+}
+
+static double benchNow(void)
+{
+    struct timespec now;
+
+    clock_gettime(CLOCK_MONOTONIC, &now);
+
+    return now.tv_sec + now.tv_nsec / 1e9;
+}
+
+static void benchCpu(void)
+{
+    vl53l0x_bus_stats_t stats;
+
+    host_reset();
+
+    vl53l0x_sim_init(&sim, VL53L0X_DEFAULT_ADDRESS);
+    host_attach(BC_I2C_I2C0, &sim);
+
+    memset(&vl53l0x, 0, sizeof(vl53l0x));
+    benchInit();
+    vl53l0x_reset_bus_stats(&vl53l0x);
+
+    double start = benchNow();
+
+    for (int i = 0; i < BENCH_CPU_READS; i++)
+    {
+        vl53l0x_read_reg(&vl53l0x, 0xC0);
+    }
+
+    double elapsed = benchNow() - start;
+
+    vl53l0x_get_bus_stats(&vl53l0x, &stats);
+
+    printf("\ncpu\ttrace\ttransactions\tns_per_transaction\n");
+    printf("read_reg\t%d\t%u\t%.1f\n", VL53L0X_TRACE, stats.transactions, elapsed * 1e9 / stats.transactions);
+}
+
+static size_t benchLoad(const char *path, bench_row_t *baseline, size_t size)
+{
+    char line[128];
+    size_t count = 0;
+    FILE *file = fopen(path, "r");
+
+    if (file == NULL)
+    {
+        fprintf(stderr, "%s: cannot open\n", path);
+
+        return 0;
+    }
+
+    while (count < size && fgets(line, sizeof(line), file) != NULL)
+    {
+        bench_row_t *row = &baseline[count];
+
+        if (sscanf(line, "%47s %u %u %u %u", row->name, &row->transactions, &row->bytes, &row->bus_time_100khz_us, &row->bus_time_400khz_us) == 5)
+        {
+            count++;
+        }
+    }
+
+    fclose(file);
+
+    return count;
+}
+
+static bool benchCompare(const char *path)
+{
+    bench_row_t baseline[BENCH_ROWS_MAX];
+    size_t baseline_count = benchLoad(path, baseline, BENCH_ROWS_MAX);
+    bool ok = baseline_count != 0;
+
+    for (size_t i = 0; i < row_count; i++)
+    {
+        const bench_row_t *row = &rows[i];
+        const bench_row_t *base = NULL;
+
+        for (size_t j = 0; j < baseline_count; j++)
+        {
+            if (strcmp(baseline[j].name, row->name) == 0)
+            {
+                base = &baseline[j];
+            }
+        }
+
+        if (base == NULL)
+        {
+            fprintf(stderr, "%s: not in %s\n", row->name, path);
+            ok = false;
+        }
+        else if (row->transactions > base->transactions || row->bytes > base->bytes ||
+                 row->bus_time_100khz_us > base->bus_time_100khz_us || row->bus_time_400khz_us > base->bus_time_400khz_us)
+        {
+            fprintf(stderr, "%s: regression, %u transactions %u bytes %u/%u us, baseline %u transactions %u bytes %u/%u us\n",
+                    row->name, row->transactions, row->bytes, row->bus_time_100khz_us, row->bus_time_400khz_us,
+                    base->transactions, base->bytes, base->bus_time_100khz_us, base->bus_time_400khz_us);
+            ok = false;
+        }
+        else if (row->transactions < base->transactions || row->bytes < base->bytes)
+        {
+            fprintf(stderr, "%s: cheaper than %s, update it with make bench-baseline\n", row->name, path);
+        }
+    }
+
+    return ok;
+}
+
+int main(int argc, char **argv)
+{
+    for (size_t i = 0; i < sizeof(cases) / sizeof(cases[0]); i++)
+    {
+        benchRun(&cases[i], &rows[row_count++]);
+    }
+
+    printf("api\ttransactions\tbytes\tbus_time_100khz_us\tbus_time_400khz_us\n");
+
+    for (size_t i = 0; i < row_count; i++)
+    {
+        printf("%s\t%u\t%u\t%u\t%u\n", rows[i].name, rows[i].transactions, rows[i].bytes, rows[i].bus_time_100khz_us, rows[i].bus_time_400khz_us);
+    }
+
+    if (argc > 1)
+    {
+        return benchCompare(argv[1]) ? 0 : 1;
+    }
+
+    benchCpu();
+
+    return 0;
+}
@@ -0,0 +1,60 @@
+#!/bin/sh
+# Flash and floating point cost of the driver with and without the floating
+# point wrappers (VL53L0X_FLOAT_API), and of the range filters with and without
+# the Kalman filter (FILTER_KALMAN), from a host build at -Os.
+#
+# The Cortex-M0+ has no FPU, so every scalar float instruction counted here is
+# a call into the soft-float library (__aeabi_fmul, __aeabi_ui2f, ...) on the
+# target, and any of them pulls those routines into the image. Host sizes are
+# x86-64 code and only meaningful as a difference.
+
+set -e
+
+CC=${CC:-cc}
+BUILD_DIR=${BUILD_DIR:-build}
+SRC=../../app/vl53l0x.c
+
+mkdir -p "$BUILD_DIR"
+
+floatOps()
+{
+    objdump -d --no-show-raw-insn "$1" | awk '
+        /^[0-9a-f]+ <.*>:$/ { name = substr($2, 2, length($2) - 3) }
+        /\t(cvt[a-z0-9]*ss|cvtss[a-z0-9]*|(add|sub|mul|div|ucomi|comi|sqrt|max|min)ss)[ \t]/ { count[name]++; total++ }
+        END { for (name in count) printf "\t%s\t%d\n", name, count[name] > "/dev/stderr"; print total + 0 }'
+}
+
+printf 'config\ttext\tdata\tbss\tfloat_ops\n'
+
+for float_api in 1 0
+do
+    object="$BUILD_DIR/vl53l0x_float_api_$float_api.o"
+
+    $CC -Os -std=gnu99 -I. -Isdk -I../../app -DVL53L0X_FLOAT_API=$float_api -c "$SRC" -o "$object"
+
+    set -- $(size "$object" | tail -n 1)
+
+    printf 'VL53L0X_FLOAT_API=%s\t%s\t%s\t%s\t%s\n' "$float_api" "$1" "$2" "$3" "$(floatOps "$object" 2>/dev/null)"
+done
+
+for kalman in 1 0
+do
+    object="$BUILD_DIR/filter_kalman_$kalman.o"
+
+    $CC -Os -std=gnu99 -I. -Isdk -I../../app -DFILTER_KALMAN=$kalman -c ../../app/filter.c -o "$object"
+
+    set -- $(size "$object" | tail -n 1)
+
+    printf 'FILTER_KALMAN=%s\t%s\t%s\t%s\t%s\n' "$kalman" "$1" "$2" "$3" "$(floatOps "$object" 2>/dev/null)"
+done
+
+printf '\nfloat ops per function, VL53L0X_FLOAT_API=1:\n'
+floatOps "$BUILD_DIR/vl53l0x_float_api_1.o" 2>&1 >/dev/null | sort
+
+# Instructions of the signal rate limit accessors; the float ones also pay for
+# the soft-float library calls on the target
+printf '\ninstructions, VL53L0X_FLOAT_API=1:\n'
+objdump -d --no-show-raw-insn "$BUILD_DIR/vl53l0x_float_api_1.o" | awk '
+    /^[0-9a-f]+ <.*>:$/ { name = substr($2, 2, length($2) - 3); next }
+    /^ +[0-9a-f]+:\t/ && name ~ /signal_rate_limit/ { count[name]++ }
+    END { for (name in count) printf "\t%s\t%d\n", name, count[name] }' | sort
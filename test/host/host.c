@@ -0,0 +1,661 @@
+#include <host.h>
+#include <stm32l0xx.h>
+#include <stdarg.h>
+#include <stdio.h>
+#include <stdlib.h>
+
+// Host implementation of the SDK subset in sdk/bcl.h. The clock is simulated
+// in microseconds and only moves when the code under test spends time: a bus
+// transaction takes its duration on the wire at the configured speed, a timer
+// delay its length and a tick read HOST_TICK_GET_US; host_run() jumps to the
+// next planned task. Devices attached with host_attach() are brought up to
+// the time of every transaction, and their events fire in order on the way.
+
+typedef struct
+{
+    void (*task)(void *);
+    void *param;
+    bc_tick_t tick;
+    bool used;
+} hostTask;
+
+typedef struct
+{
+    void (*callback)(bc_exti_line_t, void *);
+    void *param;
+    bc_exti_edge_t edge;
+    bool used;
+} hostExti;
+
+static struct
+{
+    uint64_t now_us;
+    bool in_event;
+
+    hostTask tasks[HOST_TASK_COUNT];
+    bc_scheduler_task_id_t current_task_id;
+
+    hostExti exti[BC_EXTI_LINE_COUNT];
+
+    bc_gpio_mode_t gpio_mode[BC_GPIO_COUNT];
+    bc_gpio_pull_t gpio_pull[BC_GPIO_COUNT];
+    int gpio_output[BC_GPIO_COUNT];
+
+    bc_i2c_speed_t i2c_speed[BC_I2C_COUNT];
+    vl53l0x_sim_t *sims[BC_I2C_COUNT][HOST_SIM_COUNT];
+
+    bool timer_initialized;
+
+    uint8_t eeprom[HOST_EEPROM_SIZE];
+
+    uint8_t uart[3][HOST_UART_BUFFER_SIZE];
+    size_t uart_length[3];
+
+    uint8_t radio[HOST_RADIO_BUFFER_SIZE];
+    size_t radio_length;
+
+    bool log;
+    char log_text[HOST_LOG_BUFFER_SIZE];
+    size_t log_length;
+
+    host_stats_t stats;
+} host;
+
+static void hostAdvanceTo(uint64_t target_us);
+static uint64_t hostNextEvent(void);
+static bool hostRunDue(void);
+static bc_tick_t hostNextTaskTick(void);
+static bool hostI2cTransfer(bc_i2c_channel_t channel, bool read, const bc_i2c_memory_transfer_t *transfer);
+static void hostLog(const char *level, const char *format, va_list args);
+
+// Start over at time 0 with no tasks, interrupts or devices and an erased
+// EEPROM. Set HOST_LOG in the environment to print the log.
+void host_reset(void)
+{
+    memset(&host, 0, sizeof(host));
+
+    host.log = getenv("HOST_LOG") != NULL;
+}
+
+// Put a simulated device on a bus; it answers at its current address
+void host_attach(bc_i2c_channel_t channel, vl53l0x_sim_t *sim)
+{
+    for (size_t i = 0; i < HOST_SIM_COUNT; i++)
+    {
+        if (host.sims[channel][i] == NULL)
+        {
+            host.sims[channel][i] = sim;
+
+            return;
+        }
+    }
+
+    abort();
+}
+
+uint64_t host_get_us(void)
+{
+    return host.now_us;
+}
+
+// Let time pass without running tasks, as a busy CPU would
+void host_advance(uint64_t us)
+{
+    hostAdvanceTo(host.now_us + us);
+}
+
+// Run the scheduler until the tick until: tasks that are due run in task id
+// order, and in between the clock jumps to whichever comes first, the next
+// planned task or the next device event, which may plan one
+void host_run(bc_tick_t until)
+{
+    for (;;)
+    {
+        if (hostRunDue())
+        {
+            continue;
+        }
+
+        if (host.now_us >= until * 1000)
+        {
+            return;
+        }
+
+        bc_tick_t next_tick = hostNextTaskTick();
+        uint64_t target_us = (next_tick < until ? next_tick : until) * 1000;
+        uint64_t event_us = hostNextEvent();
+
+        hostAdvanceTo(event_us < target_us ? event_us : target_us);
+    }
+}
+
+// Signal an edge on an EXTI line, as a device pin would
+void host_exti_edge(bc_exti_line_t line, bc_exti_edge_t edge)
+{
+    hostExti *exti = &host.exti[line];
+
+    if (!exti->used || (exti->edge != edge && exti->edge != BC_EXTI_EDGE_RISING_AND_FALLING))
+    {
+        return;
+    }
+
+    host.stats.exti_callbacks++;
+
+    exti->callback(line, exti->param);
+}
+
+// Hand out and forget what was written to a UART so far
+size_t host_uart_take(bc_uart_channel_t channel, uint8_t *buffer, size_t size)
+{
+    size_t length = host.uart_length[channel] < size ? host.uart_length[channel] : size;
+
+    memcpy(buffer, host.uart[channel], length);
+    memmove(host.uart[channel], host.uart[channel] + length, host.uart_length[channel] - length);
+    host.uart_length[channel] -= length;
+
+    return length;
+}
+
+// Hand out and forget the log messages so far, one per line without the level,
+// as a string
+size_t host_log_take(char *buffer, size_t size)
+{
+    size_t length = host.log_length < size - 1 ? host.log_length : size - 1;
+
+    memcpy(buffer, host.log_text, length);
+    buffer[length] = '\0';
+    host.log_length = 0;
+
+    return length;
+}
+
+// Copy out the last buffer published over the radio
+size_t host_radio_last(uint8_t *buffer, size_t size)
+{
+    size_t length = host.radio_length < size ? host.radio_length : size;
+
+    memcpy(buffer, host.radio, length);
+
+    return length;
+}
+
+void host_get_stats(host_stats_t *stats)
+{
+    *stats = host.stats;
+}
+
+static void hostAdvanceTo(uint64_t target_us)
+{
+    if (host.in_event)
+    {
+        return;
+    }
+
+    for (;;)
+    {
+        uint64_t event_us = hostNextEvent();
+
+        if (event_us > target_us)
+        {
+            break;
+        }
+
+        if (event_us > host.now_us)
+        {
+            host.now_us = event_us;
+        }
+
+        host.in_event = true;
+
+        for (size_t c = 0; c < BC_I2C_COUNT; c++)
+        {
+            for (size_t i = 0; i < HOST_SIM_COUNT; i++)
+            {
+                if (host.sims[c][i] != NULL)
+                {
+                    vl53l0x_sim_update(host.sims[c][i], host.now_us);
+                }
+            }
+        }
+
+        host.in_event = false;
+    }
+
+    if (target_us > host.now_us)
+    {
+        host.now_us = target_us;
+    }
+}
+
+static uint64_t hostNextEvent(void)
+{
+    uint64_t next_us = VL53L0X_SIM_NEVER;
+
+    for (size_t c = 0; c < BC_I2C_COUNT; c++)
+    {
+        for (size_t i = 0; i < HOST_SIM_COUNT; i++)
+        {
+            if (host.sims[c][i] != NULL)
+            {
+                uint64_t event_us = vl53l0x_sim_next_event(host.sims[c][i]);
+
+                next_us = event_us < next_us ? event_us : next_us;
+            }
+        }
+    }
+
+    return next_us;
+}
+
+// Run every task that is due once, the way bc_scheduler_run() does
+static bool hostRunDue(void)
+{
+    bool ran = false;
+    bc_tick_t now = host.now_us / 1000;
+
+    for (size_t i = 0; i < HOST_TASK_COUNT; i++)
+    {
+        hostTask *task = &host.tasks[i];
+
+        if (task->used && task->tick <= now)
+        {
+            host.current_task_id = i;
+            task->tick = BC_TICK_INFINITY;
+            host.stats.task_runs++;
+
+            task->task(task->param);
+
+            ran = true;
+        }
+    }
+
+    return ran;
+}
+
+static bc_tick_t hostNextTaskTick(void)
+{
+    bc_tick_t next = BC_TICK_INFINITY;
+
+    for (size_t i = 0; i < HOST_TASK_COUNT; i++)
+    {
+        if (host.tasks[i].used && host.tasks[i].tick < next)
+        {
+            next = host.tasks[i].tick;
+        }
+    }
+
+    return next;
+}
+
+// A transaction takes 9 bit times per byte with its ACK, plus START and STOP,
+// plus a repeated START for a read; the device sees it at its start
+static bool hostI2cTransfer(bc_i2c_channel_t channel, bool read, const bc_i2c_memory_transfer_t *transfer)
+{
+    uint32_t bytes = transfer->length + (read ? 3 : 2);
+    uint32_t bits = bytes * 9 + (read ? 3 : 2);
+    uint64_t bus_us = host.i2c_speed[channel] == BC_I2C_SPEED_400_KHZ ? (bits * 5 + 1) / 2 : bits * 10;
+    bool ok = false;
+
+    host.stats.transactions++;
+
+    hostAdvanceTo(host.now_us);
+
+    for (size_t i = 0; i < HOST_SIM_COUNT; i++)
+    {
+        vl53l0x_sim_t *sim = host.sims[channel][i];
+
+        if (sim != NULL && vl53l0x_sim_answers(sim, transfer->device_address, host.now_us))
+        {
+            ok = vl53l0x_sim_transfer(sim, read, transfer->memory_address, transfer->buffer, transfer->length, host.now_us);
+
+            break;
+        }
+    }
+
+    hostAdvanceTo(host.now_us + bus_us);
+
+    return ok;
+}
+
+static void hostLog(const char *level, const char *format, va_list args)
+{
+    size_t space = HOST_LOG_BUFFER_SIZE - host.log_length;
+    va_list copy;
+
+    // kept for host_log_take(); whatever does not fit is dropped
+    va_copy(copy, args);
+    int length = vsnprintf(&host.log_text[host.log_length], space, format, copy);
+    va_end(copy);
+
+    if (length >= 0 && (size_t) length + 1 < space)
+    {
+        host.log_length += length;
+        host.log_text[host.log_length++] = '\n';
+    }
+
+    if (!host.log)
+    {
+        return;
+    }
+
+    fprintf(stderr, "# %llu.%03llu <%s> ", (unsigned long long) (host.now_us / 1000), (unsigned long long) (host.now_us % 1000), level);
+    vfprintf(stderr, format, args);
+    fputc('\n', stderr);
+}
+
+bc_scheduler_task_id_t bc_scheduler_register(void (*task)(void *), void *param, bc_tick_t tick)
+{
+    for (size_t i = 0; i < HOST_TASK_COUNT; i++)
+    {
+        if (!host.tasks[i].used)
+        {
+            host.tasks[i].task = task;
+            host.tasks[i].param = param;
+            host.tasks[i].tick = tick;
+            host.tasks[i].used = true;
+
+            return i;
+        }
+    }
+
+    abort();
+}
+
+void bc_scheduler_unregister(bc_scheduler_task_id_t task_id)
+{
+    host.tasks[task_id].used = false;
+}
+
+bc_scheduler_task_id_t bc_scheduler_get_current_task_id(void)
+{
+    return host.current_task_id;
+}
+
+void bc_scheduler_plan_now(bc_scheduler_task_id_t task_id)
+{
+    host.tasks[task_id].tick = 0;
+}
+
+void bc_scheduler_plan_absolute(bc_scheduler_task_id_t task_id, bc_tick_t tick)
+{
+    host.tasks[task_id].tick = tick;
+}
+
+void bc_scheduler_plan_relative(bc_scheduler_task_id_t task_id, bc_tick_t tick)
+{
+    host.tasks[task_id].tick = host.now_us / 1000 + tick;
+}
+
+void bc_scheduler_plan_current_now(void)
+{
+    bc_scheduler_plan_now(host.current_task_id);
+}
+
+void bc_scheduler_plan_current_absolute(bc_tick_t tick)
+{
+    bc_scheduler_plan_absolute(host.current_task_id, tick);
+}
+
+void bc_scheduler_plan_current_relative(bc_tick_t tick)
+{
+    bc_scheduler_plan_relative(host.current_task_id, tick);
+}
+
+bc_tick_t bc_tick_get(void)
+{
+    hostAdvanceTo(host.now_us + HOST_TICK_GET_US);
+
+    return host.now_us / 1000;
+}
+
+void bc_gpio_init(bc_gpio_channel_t channel)
+{
+    (void) channel;
+}
+
+void bc_gpio_set_mode(bc_gpio_channel_t channel, bc_gpio_mode_t mode)
+{
+    host.gpio_mode[channel] = mode;
+}
+
+bc_gpio_mode_t bc_gpio_get_mode(bc_gpio_channel_t channel)
+{
+    return host.gpio_mode[channel];
+}
+
+void bc_gpio_set_pull(bc_gpio_channel_t channel, bc_gpio_pull_t pull)
+{
+    host.gpio_pull[channel] = pull;
+}
+
+void bc_gpio_set_output(bc_gpio_channel_t channel, int state)
+{
+    host.gpio_output[channel] = state;
+
+    for (size_t c = 0; c < BC_I2C_COUNT; c++)
+    {
+        for (size_t i = 0; i < HOST_SIM_COUNT; i++)
+        {
+            vl53l0x_sim_t *sim = host.sims[c][i];
+
+            if (sim != NULL && sim->_xshut_attached && sim->_xshut_channel == channel)
+            {
+                vl53l0x_sim_set_xshut(sim, state != 0, host.now_us);
+            }
+        }
+    }
+}
+
+// The I2C lines are pulled up and released by the devices
+int bc_gpio_get_input(bc_gpio_channel_t channel)
+{
+    if (channel == BC_GPIO_SCL0 || channel == BC_GPIO_SDA0 || channel == BC_GPIO_SCL1 || channel == BC_GPIO_SDA1)
+    {
+        return 1;
+    }
+
+    if (host.gpio_mode[channel] == BC_GPIO_MODE_OUTPUT || host.gpio_mode[channel] == BC_GPIO_MODE_OUTPUT_OD)
+    {
+        return host.gpio_output[channel];
+    }
+
+    return host.gpio_pull[channel] == BC_GPIO_PULL_UP;
+}
+
+void bc_exti_register(bc_exti_line_t line, bc_exti_edge_t edge, void (*callback)(bc_exti_line_t, void *), void *param)
+{
+    host.exti[line].callback = callback;
+    host.exti[line].param = param;
+    host.exti[line].edge = edge;
+    host.exti[line].used = true;
+}
+
+void bc_exti_unregister(bc_exti_line_t line)
+{
+    host.exti[line].used = false;
+}
+
+void bc_i2c_init(bc_i2c_channel_t channel, bc_i2c_speed_t speed)
+{
+    host.i2c_speed[channel] = speed;
+}
+
+void bc_i2c_set_speed(bc_i2c_channel_t channel, bc_i2c_speed_t speed)
+{
+    host.i2c_speed[channel] = speed;
+}
+
+bc_i2c_speed_t bc_i2c_get_speed(bc_i2c_channel_t channel)
+{
+    return host.i2c_speed[channel];
+}
+
+bool bc_i2c_memory_write(bc_i2c_channel_t channel, const bc_i2c_memory_transfer_t *transfer)
+{
+    return hostI2cTransfer(channel, false, transfer);
+}
+
+bool bc_i2c_memory_read(bc_i2c_channel_t channel, const bc_i2c_memory_transfer_t *transfer)
+{
+    return hostI2cTransfer(channel, true, transfer);
+}
+
+// Register helpers, most significant byte first like the SDK's
+bool bc_i2c_memory_write_8b(bc_i2c_channel_t channel, uint8_t device_address, uint32_t memory_address, uint8_t data)
+{
+    bc_i2c_memory_transfer_t transfer = { device_address, memory_address, &data, 1 };
+
+    return bc_i2c_memory_write(channel, &transfer);
+}
+
+bool bc_i2c_memory_write_16b(bc_i2c_channel_t channel, uint8_t device_address, uint32_t memory_address, uint16_t data)
+{
+    uint8_t buffer[2] = { data >> 8, data & 0xFF };
+    bc_i2c_memory_transfer_t transfer = { device_address, memory_address, buffer, sizeof(buffer) };
+
+    return bc_i2c_memory_write(channel, &transfer);
+}
+
+bool bc_i2c_memory_read_8b(bc_i2c_channel_t channel, uint8_t device_address, uint32_t memory_address, uint8_t *data)
+{
+    bc_i2c_memory_transfer_t transfer = { device_address, memory_address, data, 1 };
+
+    return bc_i2c_memory_read(channel, &transfer);
+}
+
+bool bc_i2c_memory_read_16b(bc_i2c_channel_t channel, uint8_t device_address, uint32_t memory_address, uint16_t *data)
+{
+    uint8_t buffer[2];
+    bc_i2c_memory_transfer_t transfer = { device_address, memory_address, buffer, sizeof(buffer) };
+
+    if (!bc_i2c_memory_read(channel, &transfer))
+    {
+        return false;
+    }
+
+    *data = (uint16_t) buffer[0] << 8 | buffer[1];
+
+    return true;
+}
+
+void bc_timer_init(void)
+{
+    host.timer_initialized = true;
+}
+
+void bc_timer_start(void)
+{
+    if (!host.timer_initialized)
+    {
+        host.stats.timer_uninitialized++;
+    }
+}
+
+void bc_timer_stop(void)
+{
+}
+
+// Sleep until the next interrupt; the tick interrupt is the one always enabled
+void host_wfi(void)
+{
+    host.stats.sleeps++;
+
+    hostAdvanceTo((host.now_us / 1000 + 1) * 1000);
+}
+
+uint32_t bc_timer_get_microseconds(void)
+{
+    return host.now_us;
+}
+
+void bc_timer_delay(uint16_t microseconds)
+{
+    if (!host.timer_initialized)
+    {
+        host.stats.timer_uninitialized++;
+    }
+
+    hostAdvanceTo(host.now_us + microseconds);
+}
+
+bool bc_eeprom_write(uint32_t address, const void *buffer, size_t length)
+{
+    if (address + length > HOST_EEPROM_SIZE)
+    {
+        return false;
+    }
+
+    memcpy(&host.eeprom[address], buffer, length);
+
+    return true;
+}
+
+bool bc_eeprom_read(uint32_t address, void *buffer, size_t length)
+{
+    if (address + length > HOST_EEPROM_SIZE)
+    {
+        return false;
+    }
+
+    memcpy(buffer, &host.eeprom[address], length);
+
+    return true;
+}
+
+size_t bc_uart_write(bc_uart_channel_t channel, const void *buffer, size_t length)
+{
+    size_t space = HOST_UART_BUFFER_SIZE - host.uart_length[channel];
+
+    length = length < space ? length : space;
+
+    memcpy(&host.uart[channel][host.uart_length[channel]], buffer, length);
+    host.uart_length[channel] += length;
+
+    return length;
+}
+
+bool bc_radio_pub_buffer(void *buffer, size_t length)
+{
+    if (length > HOST_RADIO_BUFFER_SIZE)
+    {
+        return false;
+    }
+
+    memcpy(host.radio, buffer, length);
+    host.radio_length = length;
+    host.stats.radio_publishes++;
+
+    return true;
+}
+
+void bc_log_debug(const char *format, ...)
+{
+    va_list args;
+    va_start(args, format);
+    hostLog("D", format, args);
+    va_end(args);
+}
+
+void bc_log_info(const char *format, ...)
+{
+    va_list args;
+    va_start(args, format);
+    hostLog("I", format, args);
+    va_end(args);
+}
+
+void bc_log_warning(const char *format, ...)
+{
+    va_list args;
+    va_start(args, format);
+    hostLog("W", format, args);
+    va_end(args);
+}
+
+void bc_log_error(const char *format, ...)
+{
+    va_list args;
+    va_start(args, format);
+    hostLog("E", format, args);
+    va_end(args);
+}
@@ -0,0 +1,39 @@
+#ifndef _HOST_H
+#define _HOST_H
+
+#include <bcl.h>
+#include <vl53l0x_sim.h>
+
+// CPU time charged for every bc_tick_get() call, so that loops waiting on the
+// tick advance the simulated clock
+#define HOST_TICK_GET_US 1
+
+#define HOST_TASK_COUNT 32
+#define HOST_SIM_COUNT 4
+#define HOST_EEPROM_SIZE 2048
+#define HOST_UART_BUFFER_SIZE 4096
+#define HOST_RADIO_BUFFER_SIZE 64
+#define HOST_LOG_BUFFER_SIZE 4096
+
+typedef struct
+{
+    uint32_t transactions;
+    uint32_t task_runs;
+    uint32_t exti_callbacks;
+    uint32_t timer_uninitialized; // bc_timer_* used before bc_timer_init()
+    uint32_t radio_publishes;
+    uint32_t sleeps; // __WFI()
+} host_stats_t;
+
+void host_reset(void);
+void host_attach(bc_i2c_channel_t channel, vl53l0x_sim_t *sim);
+uint64_t host_get_us(void);
+void host_advance(uint64_t us);
+void host_run(bc_tick_t until);
+void host_exti_edge(bc_exti_line_t line, bc_exti_edge_t edge);
+size_t host_uart_take(bc_uart_channel_t channel, uint8_t *buffer, size_t size);
+size_t host_radio_last(uint8_t *buffer, size_t size);
+size_t host_log_take(char *buffer, size_t size);
+void host_get_stats(host_stats_t *stats);
+
+#endif // _HOST_H
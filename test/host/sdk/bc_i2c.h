@@ -0,0 +1 @@
+#include <bcl.h>
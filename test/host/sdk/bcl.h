@@ -0,0 +1,190 @@
+#ifndef _BCL_H
+#define _BCL_H
+
+// Host stand-in for the parts of the BigClown SDK the application modules use;
+// implemented by host.c on a simulated clock
+
+#include <stdint.h>
+#include <stdbool.h>
+#include <stddef.h>
+#include <string.h>
+
+typedef uint64_t bc_tick_t;
+
+#define BC_TICK_INFINITY ((bc_tick_t) -1)
+
+typedef size_t bc_scheduler_task_id_t;
+
+typedef enum
+{
+    BC_GPIO_P0,
+    BC_GPIO_P1,
+    BC_GPIO_P2,
+    BC_GPIO_P3,
+    BC_GPIO_P4,
+    BC_GPIO_P5,
+    BC_GPIO_P6,
+    BC_GPIO_P7,
+    BC_GPIO_P8,
+    BC_GPIO_P9,
+    BC_GPIO_P10,
+    BC_GPIO_P11,
+    BC_GPIO_P12,
+    BC_GPIO_P13,
+    BC_GPIO_P14,
+    BC_GPIO_P15,
+    BC_GPIO_P16,
+    BC_GPIO_P17,
+    BC_GPIO_LED,
+    BC_GPIO_BUTTON,
+    BC_GPIO_INT,
+    BC_GPIO_SCL0,
+    BC_GPIO_SDA0,
+    BC_GPIO_SCL1,
+    BC_GPIO_SDA1,
+    BC_GPIO_COUNT
+} bc_gpio_channel_t;
+
+typedef enum
+{
+    BC_GPIO_MODE_INPUT,
+    BC_GPIO_MODE_OUTPUT,
+    BC_GPIO_MODE_ALTERNATE,
+    BC_GPIO_MODE_ANALOG,
+    BC_GPIO_MODE_OUTPUT_OD
+} bc_gpio_mode_t;
+
+typedef enum
+{
+    BC_GPIO_PULL_NONE,
+    BC_GPIO_PULL_UP,
+    BC_GPIO_PULL_DOWN
+} bc_gpio_pull_t;
+
+typedef enum
+{
+    BC_EXTI_LINE_P0,
+    BC_EXTI_LINE_P1,
+    BC_EXTI_LINE_P2,
+    BC_EXTI_LINE_P3,
+    BC_EXTI_LINE_P4,
+    BC_EXTI_LINE_P5,
+    BC_EXTI_LINE_P6,
+    BC_EXTI_LINE_P7,
+    BC_EXTI_LINE_P8,
+    BC_EXTI_LINE_P9,
+    BC_EXTI_LINE_P10,
+    BC_EXTI_LINE_P11,
+    BC_EXTI_LINE_P12,
+    BC_EXTI_LINE_P13,
+    BC_EXTI_LINE_P14,
+    BC_EXTI_LINE_P15,
+    BC_EXTI_LINE_COUNT
+} bc_exti_line_t;
+
+typedef enum
+{
+    BC_EXTI_EDGE_RISING,
+    BC_EXTI_EDGE_FALLING,
+    BC_EXTI_EDGE_RISING_AND_FALLING
+} bc_exti_edge_t;
+
+typedef enum
+{
+    BC_I2C_I2C0,
+    BC_I2C_I2C1,
+    BC_I2C_COUNT
+} bc_i2c_channel_t;
+
+typedef enum
+{
+    BC_I2C_SPEED_100_KHZ,
+    BC_I2C_SPEED_400_KHZ
+} bc_i2c_speed_t;
+
+typedef struct
+{
+    uint8_t device_address;
+    uint32_t memory_address;
+    void *buffer;
+    size_t length;
+} bc_i2c_memory_transfer_t;
+
+typedef enum
+{
+    BC_UART_UART0,
+    BC_UART_UART1,
+    BC_UART_UART2
+} bc_uart_channel_t;
+
+// bc_scheduler
+
+bc_scheduler_task_id_t bc_scheduler_register(void (*task)(void *), void *param, bc_tick_t tick);
+void bc_scheduler_unregister(bc_scheduler_task_id_t task_id);
+bc_scheduler_task_id_t bc_scheduler_get_current_task_id(void);
+void bc_scheduler_plan_now(bc_scheduler_task_id_t task_id);
+void bc_scheduler_plan_absolute(bc_scheduler_task_id_t task_id, bc_tick_t tick);
+void bc_scheduler_plan_relative(bc_scheduler_task_id_t task_id, bc_tick_t tick);
+void bc_scheduler_plan_current_now(void);
+void bc_scheduler_plan_current_absolute(bc_tick_t tick);
+void bc_scheduler_plan_current_relative(bc_tick_t tick);
+
+// bc_tick
+
+bc_tick_t bc_tick_get(void);
+
+// bc_gpio
+
+void bc_gpio_init(bc_gpio_channel_t channel);
+void bc_gpio_set_mode(bc_gpio_channel_t channel, bc_gpio_mode_t mode);
+bc_gpio_mode_t bc_gpio_get_mode(bc_gpio_channel_t channel);
+void bc_gpio_set_pull(bc_gpio_channel_t channel, bc_gpio_pull_t pull);
+void bc_gpio_set_output(bc_gpio_channel_t channel, int state);
+int bc_gpio_get_input(bc_gpio_channel_t channel);
+
+// bc_exti
+
+void bc_exti_register(bc_exti_line_t line, bc_exti_edge_t edge, void (*callback)(bc_exti_line_t, void *), void *param);
+void bc_exti_unregister(bc_exti_line_t line);
+
+// bc_i2c
+
+void bc_i2c_init(bc_i2c_channel_t channel, bc_i2c_speed_t speed);
+void bc_i2c_set_speed(bc_i2c_channel_t channel, bc_i2c_speed_t speed);
+bc_i2c_speed_t bc_i2c_get_speed(bc_i2c_channel_t channel);
+bool bc_i2c_memory_write(bc_i2c_channel_t channel, const bc_i2c_memory_transfer_t *transfer);
+bool bc_i2c_memory_read(bc_i2c_channel_t channel, const bc_i2c_memory_transfer_t *transfer);
+bool bc_i2c_memory_write_8b(bc_i2c_channel_t channel, uint8_t device_address, uint32_t memory_address, uint8_t data);
+bool bc_i2c_memory_write_16b(bc_i2c_channel_t channel, uint8_t device_address, uint32_t memory_address, uint16_t data);
+bool bc_i2c_memory_read_8b(bc_i2c_channel_t channel, uint8_t device_address, uint32_t memory_address, uint8_t *data);
+bool bc_i2c_memory_read_16b(bc_i2c_channel_t channel, uint8_t device_address, uint32_t memory_address, uint16_t *data);
+
+// bc_timer
+
+void bc_timer_init(void);
+void bc_timer_start(void);
+void bc_timer_stop(void);
+uint32_t bc_timer_get_microseconds(void);
+void bc_timer_delay(uint16_t microseconds);
+
+// bc_eeprom
+
+bool bc_eeprom_write(uint32_t address, const void *buffer, size_t length);
+bool bc_eeprom_read(uint32_t address, void *buffer, size_t length);
+
+// bc_uart
+
+size_t bc_uart_write(bc_uart_channel_t channel, const void *buffer, size_t length);
+
+// bc_radio
+
+bool bc_radio_pub_buffer(void *buffer, size_t length);
+
+// bc_log
+
+void bc_log_debug(const char *format, ...) __attribute__((format(printf, 1, 2)));
+void bc_log_info(const char *format, ...) __attribute__((format(printf, 1, 2)));
+void bc_log_warning(const char *format, ...) __attribute__((format(printf, 1, 2)));
+void bc_log_error(const char *format, ...) __attribute__((format(printf, 1, 2)));
+
+#endif // _BCL_H
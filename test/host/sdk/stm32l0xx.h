@@ -0,0 +1,10 @@
+#ifndef _STM32L0XX_H
+#define _STM32L0XX_H
+
+// Stand-in for the CMSIS device header, with only what the application uses
+
+void host_wfi(void);
+
+#define __WFI() host_wfi()
+
+#endif // _STM32L0XX_H
@@ -0,0 +1,39 @@
+#include <telemetry_file.h>
+
+// Host telemetry sink: a line per summary on the FILE the param points to,
+// for tests to read back or to keep as a capture
+
+void telemetry_sink_file(const telemetry_summary_t *summary, void *param)
+{
+    FILE *file = param;
+
+    fprintf(file, "%u\t%lu\t%u\t%u\t%u\t%u\t%u\t%u\t%u\n",
+            summary->sequence, (unsigned long) summary->duration_ms, summary->count, summary->valid,
+            summary->min_mm, summary->mean_mm, summary->max_mm, summary->stddev_mm, summary->change ? 1 : 0);
+    fflush(file);
+}
+
+// Read the next summary written by telemetry_sink_file(); false at the end
+bool telemetry_file_read(FILE *file, telemetry_summary_t *summary)
+{
+    unsigned sequence, count, valid, min_mm, mean_mm, max_mm, stddev_mm, change;
+    unsigned long duration_ms;
+
+    if (fscanf(file, "%u %lu %u %u %u %u %u %u %u", &sequence, &duration_ms, &count, &valid,
+               &min_mm, &mean_mm, &max_mm, &stddev_mm, &change) != 9)
+    {
+        return false;
+    }
+
+    summary->sequence = sequence;
+    summary->duration_ms = duration_ms;
+    summary->count = count;
+    summary->valid = valid;
+    summary->min_mm = min_mm;
+    summary->mean_mm = mean_mm;
+    summary->max_mm = max_mm;
+    summary->stddev_mm = stddev_mm;
+    summary->change = change != 0;
+
+    return true;
+}
@@ -0,0 +1,13 @@
+#ifndef _TELEMETRY_FILE_H
+#define _TELEMETRY_FILE_H
+
+#include <telemetry.h>
+#include <stdio.h>
+
+// Tab separated, one summary per line: sequence, duration ms, count, valid,
+// min, mean, max, stddev (mm), 1 for a change summary
+
+void telemetry_sink_file(const telemetry_summary_t *summary, void *param);
+bool telemetry_file_read(FILE *file, telemetry_summary_t *summary);
+
+#endif // _TELEMETRY_FILE_H
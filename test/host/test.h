@@ -0,0 +1,60 @@
+#ifndef _TEST_H
+#define _TEST_H
+
+#include <stdio.h>
+
+// Minimal test runner: a test is a void function that returns at the first
+// failed assertion; TEST_RUN() counts it and test_summary() gives the exit code
+
+static int test_count;
+static int test_failures;
+static bool test_failed;
+
+#define TEST_ASSERT(condition) \
+    do { if (!(condition)) { testFail(__FILE__, __LINE__, #condition); return; } } while (0)
+
+#define TEST_ASSERT_EQUAL(expected, actual) \
+    do { long long _expected = (expected), _actual = (actual); \
+         if (_expected != _actual) { testFailValues(__FILE__, __LINE__, #actual, _expected, _actual); return; } } while (0)
+
+#define TEST_ASSERT_WITHIN(delta, expected, actual) \
+    do { long long _expected = (expected), _actual = (actual); \
+         if (_actual < _expected - (delta) || _actual > _expected + (delta)) { testFailValues(__FILE__, __LINE__, #actual, _expected, _actual); return; } } while (0)
+
+#define TEST_RUN(test) testRun(#test, test)
+
+static void testFail(const char *file, int line, const char *condition)
+{
+    printf("%s:%d: assertion failed: %s\n", file, line, condition);
+    test_failed = true;
+}
+
+static void testFailValues(const char *file, int line, const char *actual, long long expected_value, long long actual_value)
+{
+    printf("%s:%d: %s is %lld, expected %lld\n", file, line, actual, actual_value, expected_value);
+    test_failed = true;
+}
+
+static void testRun(const char *name, void (*test)(void))
+{
+    test_failed = false;
+
+    test();
+
+    test_count++;
+
+    if (test_failed)
+    {
+        printf("FAIL %s\n", name);
+        test_failures++;
+    }
+}
+
+static int test_summary(const char *suite)
+{
+    printf("%s: %d tests, %d failed\n", suite, test_count, test_failures);
+
+    return test_failures == 0 ? 0 : 1;
+}
+
+#endif // _TEST_H
@@ -0,0 +1,194 @@
+#include <host.h>
+#include <vl53l0x_sim.h>
+#include <vl53l0x.h>
+#include <budget.h>
+#include <test.h>
+
+// Timing budget controller against the simulator: every budget it returns is
+// written to the sensor and the next result measured with it, as application.c
+// does
+
+#define SIGMA_TARGET_MM 5
+
+static vl53l0x_sim_t sim;
+static vl53l0x_t vl53l0x;
+static budget_t budget;
+
+static bool initSensor(uint32_t budget_us)
+{
+    host_reset();
+
+    vl53l0x_sim_init(&sim, VL53L0X_DEFAULT_ADDRESS);
+    host_attach(BC_I2C_I2C0, &sim);
+
+    memset(&vl53l0x, 0, sizeof(vl53l0x));
+
+    if (!vl53l0x_init(&vl53l0x, BC_I2C_I2C0, VL53L0X_DEFAULT_ADDRESS, 500, false))
+    {
+        return false;
+    }
+
+    budget_init(&budget, SIGMA_TARGET_MM);
+
+    return vl53l0x_set_measurement_timing_budget(&vl53l0x, budget_us);
+}
+
+static uint32_t sensorBudget(void)
+{
+    vl53l0x_config_t config;
+
+    vl53l0x_get_config(&vl53l0x, &config);
+
+    return config.timing_budget_us;
+}
+
+static void setRates(uint16_t signal_rate, uint16_t ambient_rate)
+{
+    vl53l0x_sim_target_t target = sim._target;
+
+    target.signal_rate = signal_rate;
+    target.ambient_rate = ambient_rate;
+    vl53l0x_sim_set_target(&sim, &target);
+}
+
+// Measure count times, feeding each result to the controller and applying the
+// budget it returns; returns how often the budget changed, -1 on a failure
+static int feed(int count)
+{
+    vl53l0x_result_t result;
+    int changes = 0;
+
+    for (int i = 0; i < count; i++)
+    {
+        uint32_t budget_us = sensorBudget();
+
+        vl53l0x_start_continuous(&vl53l0x, 0);
+        bool ok = vl53l0x_read_result(&vl53l0x, &result);
+        vl53l0x_stop_continuous(&vl53l0x);
+
+        if (!ok)
+        {
+            return -1;
+        }
+
+        uint32_t next_us = budget_feed(&budget, &result, budget_us);
+
+        if (next_us != budget_us)
+        {
+            if (!vl53l0x_set_measurement_timing_budget(&vl53l0x, next_us))
+            {
+                return -1;
+            }
+
+            changes++;
+        }
+    }
+
+    return changes;
+}
+
+static void test_shrink(void)
+{
+    TEST_ASSERT(initSensor(100000));
+
+    // strong signal and low ambient light need far less than the minimum
+    setRates(0x0A00, 0x0040);
+    TEST_ASSERT(vl53l0x_estimate_budget_for_sigma(0x0A00, 0x0040, SIGMA_TARGET_MM) < BUDGET_MIN_US);
+
+    // nothing changes before the holdoff is over, then in one go
+    TEST_ASSERT_EQUAL(0, feed(8));
+    TEST_ASSERT_EQUAL(1, feed(1));
+    TEST_ASSERT_EQUAL(BUDGET_MIN_US, sensorBudget());
+
+    TEST_ASSERT_EQUAL(0, feed(20));
+
+    // a higher minimum is kept
+    budget_set_limits(&budget, 30000, BUDGET_DEFAULT_MAX_US);
+    TEST_ASSERT_EQUAL(1, feed(1));
+    TEST_ASSERT_EQUAL(30000, sensorBudget());
+}
+
+static void test_grow(void)
+{
+    int changes = 0;
+    uint32_t previous_us;
+
+    TEST_ASSERT(initSensor(BUDGET_MIN_US));
+
+    // start from strong signal, then the target moves away and dims
+    setRates(0x0A00, 0x0040);
+
+    TEST_ASSERT_EQUAL(0, feed(10));
+
+    setRates(0x0040, 0x0200);
+    previous_us = sensorBudget();
+
+    // the smoothed rates take a few samples to follow, the budget only ever
+    // grows on the way and ends clamped to the maximum
+    for (int i = 0; i < 60; i++)
+    {
+        int changed = feed(1);
+
+        TEST_ASSERT(changed >= 0);
+
+        if (changed)
+        {
+            TEST_ASSERT(sensorBudget() > previous_us);
+            previous_us = sensorBudget();
+            changes++;
+        }
+    }
+
+    TEST_ASSERT(changes >= 1);
+    TEST_ASSERT(changes <= 60 / 9 + 1);
+    TEST_ASSERT_EQUAL(BUDGET_DEFAULT_MAX_US, sensorBudget());
+
+    // and to a lower maximum
+    budget_set_limits(&budget, BUDGET_MIN_US, 140000);
+
+    TEST_ASSERT_EQUAL(1, feed(1));
+    TEST_ASSERT_EQUAL(140000, sensorBudget());
+}
+
+// Signal rate alternating around 0x64, as noise on a target that needs about
+// 109 ms
+static void noisySignal(vl53l0x_sim_t *self, uint32_t index, vl53l0x_sim_target_t *target, void *param)
+{
+    target->signal_rate = index % 2 == 0 ? 0x005C : 0x006C;
+}
+
+static void test_hysteresis(void)
+{
+    TEST_ASSERT(initSensor(100000));
+
+    // the target is within a quarter of the budget and is never taken
+    setRates(0x0060, 0x0100);
+    TEST_ASSERT(vl53l0x_estimate_budget_for_sigma(0x0060, 0x0100, SIGMA_TARGET_MM) > 100000);
+    TEST_ASSERT(vl53l0x_estimate_budget_for_sigma(0x0060, 0x0100, SIGMA_TARGET_MM) < 125000);
+
+    TEST_ASSERT_EQUAL(0, feed(40));
+
+    // neither is noise around it
+    vl53l0x_sim_set_target_handler(&sim, noisySignal, NULL);
+
+    TEST_ASSERT_EQUAL(0, feed(40));
+
+    TEST_ASSERT_EQUAL(100000, sensorBudget());
+
+    // a target past the band is, once the smoothed rates get there, and then
+    // held for the holdoff
+    vl53l0x_sim_set_target_handler(&sim, NULL, NULL);
+    setRates(0x0040, 0x0100);
+
+    TEST_ASSERT_EQUAL(1, feed(9));
+    TEST_ASSERT(sensorBudget() > 125000);
+}
+
+int main(void)
+{
+    TEST_RUN(test_shrink);
+    TEST_RUN(test_grow);
+    TEST_RUN(test_hysteresis);
+
+    return test_summary("budget");
+}
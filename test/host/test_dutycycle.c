@@ -0,0 +1,193 @@
+#include <host.h>
+#include <vl53l0x_sim.h>
+#include <vl53l0x.h>
+#include <dutycycle.h>
+#include <test.h>
+
+// Duty cycle manager against the simulator: the timing budget it requests is
+// the one the sensor measures with, and is only written when it changes
+
+static vl53l0x_sim_t sim;
+static vl53l0x_t vl53l0x;
+static dutycycle_t dutycycle;
+
+static bool initSensor(void)
+{
+    host_reset();
+
+    vl53l0x_sim_init(&sim, VL53L0X_DEFAULT_ADDRESS);
+    host_attach(BC_I2C_I2C0, &sim);
+
+    memset(&vl53l0x, 0, sizeof(vl53l0x));
+
+    if (!vl53l0x_init(&vl53l0x, BC_I2C_I2C0, VL53L0X_DEFAULT_ADDRESS, 500, false))
+    {
+        return false;
+    }
+
+    dutycycle_init(&dutycycle, &vl53l0x);
+
+    return true;
+}
+
+static uint32_t sensorBudget(void)
+{
+    vl53l0x_config_t config;
+
+    vl53l0x_get_config(&vl53l0x, &config);
+
+    return config.timing_budget_us;
+}
+
+static uint32_t busTransactions(void)
+{
+    vl53l0x_bus_stats_t stats;
+
+    vl53l0x_get_bus_stats(&vl53l0x, &stats);
+
+    return stats.transactions;
+}
+
+static void test_budget(void)
+{
+    TEST_ASSERT(initSensor());
+
+    TEST_ASSERT_EQUAL(sensorBudget(), dutycycle_get_budget(&dutycycle));
+
+    TEST_ASSERT(dutycycle_set_period(&dutycycle, 100));
+    dutycycle_start(&dutycycle);
+
+    TEST_ASSERT(dutycycle_set_budget(&dutycycle, 50000));
+    TEST_ASSERT_EQUAL(50000, dutycycle_get_budget(&dutycycle));
+    TEST_ASSERT_EQUAL(50000, sensorBudget());
+    TEST_ASSERT_WITHIN(100, 50000, vl53l0x_sim_get_budget(&sim));
+
+    // reading the budget back recomputes it with another start overhead, and
+    // leaves the requested one alone
+    TEST_ASSERT(vl53l0x_get_measurement_timing_budget(&vl53l0x) != 50000);
+    TEST_ASSERT_EQUAL(50000, sensorBudget());
+}
+
+static void test_same_budget(void)
+{
+    TEST_ASSERT(initSensor());
+
+    TEST_ASSERT(dutycycle_set_period(&dutycycle, 100));
+    dutycycle_start(&dutycycle);
+    TEST_ASSERT(dutycycle_set_budget(&dutycycle, 40000));
+
+    // a restart costs a stop and a start
+    vl53l0x_reset_bus_stats(&vl53l0x);
+    vl53l0x_stop_continuous(&vl53l0x);
+    vl53l0x_start_continuous(&vl53l0x, 100);
+    uint32_t restart = busTransactions();
+
+    // the same budget again only restarts, without rewriting the timeouts
+    vl53l0x_reset_bus_stats(&vl53l0x);
+    TEST_ASSERT(dutycycle_set_budget(&dutycycle, 40000));
+    TEST_ASSERT_EQUAL(restart, busTransactions());
+
+    // a new one is written
+    vl53l0x_reset_bus_stats(&vl53l0x);
+    TEST_ASSERT(dutycycle_set_budget(&dutycycle, 45000));
+    TEST_ASSERT(busTransactions() > restart);
+    TEST_ASSERT_WITHIN(100, 45000, vl53l0x_sim_get_budget(&sim));
+}
+
+static void test_period_room(void)
+{
+    TEST_ASSERT(initSensor());
+
+    TEST_ASSERT(dutycycle_set_period(&dutycycle, 50));
+    dutycycle_start(&dutycycle);
+
+    // the period grows to keep room for a longer budget
+    TEST_ASSERT(dutycycle_set_budget(&dutycycle, 80000));
+    TEST_ASSERT(dutycycle_get_period(&dutycycle) >= 80);
+
+    uint64_t start_us = host_get_us();
+    TEST_ASSERT(vl53l0x_read_range_continuous_millimeters(&vl53l0x) != 65535);
+    TEST_ASSERT(vl53l0x_read_range_continuous_millimeters(&vl53l0x) != 65535);
+    TEST_ASSERT(host_get_us() - start_us >= dutycycle_get_period(&dutycycle) * 1000 - 1500);
+}
+
+static void test_infeasible_budget(void)
+{
+    TEST_ASSERT(initSensor());
+
+    TEST_ASSERT(dutycycle_set_period(&dutycycle, 100));
+    dutycycle_start(&dutycycle);
+    TEST_ASSERT(dutycycle_set_budget(&dutycycle, 40000));
+
+    // three seconds of final range do not fit its timeout register; the budget
+    // and the period it would have grown to stay as they were
+    TEST_ASSERT(!dutycycle_set_budget(&dutycycle, 3000000));
+    TEST_ASSERT_EQUAL(40000, dutycycle_get_budget(&dutycycle));
+    TEST_ASSERT_EQUAL(100, dutycycle_get_period(&dutycycle));
+    TEST_ASSERT_EQUAL(40000, sensorBudget());
+    TEST_ASSERT_WITHIN(200, 40000, vl53l0x_sim_get_budget(&sim));
+
+    // and ranging goes on with them
+    TEST_ASSERT(vl53l0x_read_range_continuous_millimeters(&vl53l0x) != 65535);
+
+    // a budget set while stopped falls back on the start
+    dutycycle_stop(&dutycycle);
+    TEST_ASSERT(dutycycle_set_period(&dutycycle, 0));
+    TEST_ASSERT(dutycycle_set_budget(&dutycycle, 3000000));
+    dutycycle_start(&dutycycle);
+    TEST_ASSERT_EQUAL(40000, dutycycle_get_budget(&dutycycle));
+    TEST_ASSERT(vl53l0x_read_range_continuous_millimeters(&vl53l0x) != 65535);
+}
+
+// Period dutycycle_set_power() picks after a second of back-to-back ranging,
+// with or without I2C traffic before the energy figures were reset
+static uint32_t powerPeriod(bool traffic_before)
+{
+    if (!initSensor())
+    {
+        return 0;
+    }
+
+    dutycycle_start(&dutycycle);
+
+    for (int i = 0; traffic_before && i < 5000; i++)
+    {
+        vl53l0x_read_reg(&vl53l0x, 0xC0);
+    }
+
+    dutycycle_reset_energy(&dutycycle);
+
+    uint64_t end_us = host_get_us() + 1000000;
+
+    while (host_get_us() < end_us)
+    {
+        vl53l0x_read_range_continuous_millimeters(&vl53l0x);
+    }
+
+    if (!dutycycle_set_power(&dutycycle, 1000))
+    {
+        return 0;
+    }
+
+    return dutycycle_get_period(&dutycycle);
+}
+
+static void test_power_bus_time(void)
+{
+    // only the traffic since the reset counts towards the energy per sample
+    uint32_t period_ms = powerPeriod(false);
+
+    TEST_ASSERT(period_ms != 0);
+    TEST_ASSERT_WITHIN(2, period_ms, powerPeriod(true));
+}
+
+int main(void)
+{
+    TEST_RUN(test_budget);
+    TEST_RUN(test_same_budget);
+    TEST_RUN(test_period_room);
+    TEST_RUN(test_infeasible_budget);
+    TEST_RUN(test_power_bus_time);
+
+    return test_summary("dutycycle");
+}
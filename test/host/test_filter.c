@@ -0,0 +1,197 @@
+#include <host.h>
+#include <filter.h>
+#include <test.h>
+#include <math.h>
+
+// Streaming filters: the sorted window of the running median, convergence of
+// the EMA and the Kalman filter with repeated timestamps
+
+static filter_t filter;
+
+// Pseudo random ranges with repeats, so equal values go in and out of the
+// window
+static uint16_t nextValue(uint32_t *state)
+{
+    *state = *state * 1103515245 + 12345;
+
+    return (*state >> 16) % 64 * 50;
+}
+
+static uint16_t referenceMedian(const filter_t *self)
+{
+    uint16_t sorted[FILTER_WINDOW_MAX];
+    uint8_t count = self->_count;
+
+    memcpy(sorted, self->_window, count * sizeof(sorted[0]));
+
+    for (uint8_t i = 1; i < count; i++)
+    {
+        for (uint8_t j = i; j > 0 && sorted[j - 1] > sorted[j]; j--)
+        {
+            uint16_t value = sorted[j];
+
+            sorted[j] = sorted[j - 1];
+            sorted[j - 1] = value;
+        }
+    }
+
+    if (count & 1)
+    {
+        return sorted[count / 2];
+    }
+
+    return ((uint32_t) sorted[count / 2 - 1] + sorted[count / 2] + 1) / 2;
+}
+
+static void test_median(void)
+{
+    for (uint8_t window_size = 1; window_size <= FILTER_WINDOW_MAX; window_size++)
+    {
+        uint32_t state = window_size;
+
+        filter_init(&filter, FILTER_TYPE_MEDIAN, window_size);
+
+        for (int i = 0; i < 500; i++)
+        {
+            uint16_t median = filter_feed(&filter, nextValue(&state), i);
+
+            // the sorted copy holds exactly the ring buffer contents, in order
+            for (uint8_t j = 1; j < filter._count; j++)
+            {
+                TEST_ASSERT(filter._sorted[j - 1] <= filter._sorted[j]);
+            }
+
+            for (uint8_t j = 0; j < filter._count; j++)
+            {
+                uint8_t in_window = 0;
+                uint8_t in_sorted = 0;
+
+                for (uint8_t k = 0; k < filter._count; k++)
+                {
+                    in_window += filter._window[k] == filter._window[j];
+                    in_sorted += filter._sorted[k] == filter._window[j];
+                }
+
+                TEST_ASSERT_EQUAL(in_window, in_sorted);
+            }
+
+            TEST_ASSERT_EQUAL(referenceMedian(&filter), median);
+        }
+    }
+}
+
+static void test_median_spike(void)
+{
+    filter_init(&filter, FILTER_TYPE_MEDIAN, 5);
+
+    for (int i = 0; i < 5; i++)
+    {
+        filter_feed(&filter, 300, i);
+    }
+
+    // two outliers in a window of five never get through
+    TEST_ASSERT_EQUAL(300, filter_feed(&filter, 8190, 5));
+    TEST_ASSERT_EQUAL(300, filter_feed(&filter, 0, 6));
+    TEST_ASSERT_EQUAL(300, filter_feed(&filter, 300, 7));
+}
+
+static void test_ema_converges(void)
+{
+    static const uint16_t alphas[] = { 1, 16, 64, 255, 256 };
+
+    for (size_t a = 0; a < sizeof(alphas) / sizeof(alphas[0]); a++)
+    {
+        filter_init(&filter, FILTER_TYPE_EMA, 1);
+        filter_set_ema_alpha(&filter, alphas[a]);
+
+        // from below, then from above, the average settles exactly on the
+        // sample
+        static const uint16_t steps[][2] = { { 100, 1000 }, { 1000, 100 }, { 0, 8190 }, { 8190, 0 } };
+
+        for (size_t s = 0; s < sizeof(steps) / sizeof(steps[0]); s++)
+        {
+            uint16_t output;
+            int i;
+
+            filter_reset(&filter);
+            filter_feed(&filter, steps[s][0], 0);
+
+            for (i = 0; i < 10000 && filter._ema != (uint32_t) steps[s][1] << 8; i++)
+            {
+                output = filter_feed(&filter, steps[s][1], i);
+
+                // monotonic, no overshoot
+                TEST_ASSERT(steps[s][1] > steps[s][0] ? output <= steps[s][1] : output >= steps[s][1]);
+            }
+
+            TEST_ASSERT(i < 10000);
+            TEST_ASSERT_EQUAL(steps[s][1], filter_feed(&filter, steps[s][1], i));
+        }
+    }
+}
+
+static void test_ema_alpha(void)
+{
+    filter_init(&filter, FILTER_TYPE_EMA, 1);
+
+    // the first sample is taken as is, then a quarter of every step
+    TEST_ASSERT_EQUAL(1000, filter_feed(&filter, 1000, 0));
+    TEST_ASSERT_EQUAL(750, filter_feed(&filter, 0, 1));
+    TEST_ASSERT_EQUAL(563, filter_feed(&filter, 0, 2));
+
+    // alpha 1.0 follows the input
+    filter_set_ema_alpha(&filter, 256);
+    TEST_ASSERT_EQUAL(4321, filter_feed(&filter, 4321, 3));
+}
+
+static void test_kalman_zero_dt(void)
+{
+    filter_init(&filter, FILTER_TYPE_KALMAN, 1);
+
+    TEST_ASSERT_EQUAL(500, filter_feed(&filter, 500, 1000));
+
+    // several samples with the same tick: no prediction step, only updates
+    for (int i = 0; i < 20; i++)
+    {
+        uint16_t output = filter_feed(&filter, i & 1 ? 520 : 480, 1000);
+
+        TEST_ASSERT(output >= 480 && output <= 520);
+        TEST_ASSERT(isfinite(filter._position));
+        TEST_ASSERT(isfinite(filter_get_velocity(&filter)));
+        TEST_ASSERT(filter._p[0][0] > 0);
+    }
+
+    // the covariance stays usable and the filter follows a moving target
+    for (int i = 1; i <= 50; i++)
+    {
+        filter_feed(&filter, 500 + 10 * i, 1000 + 100 * i);
+    }
+
+    TEST_ASSERT_WITHIN(20, 1000, filter_feed(&filter, 1000, 6100));
+    TEST_ASSERT_WITHIN(30, 100, filter_get_velocity(&filter));
+}
+
+static void test_kalman_reset(void)
+{
+    filter_init(&filter, FILTER_TYPE_KALMAN, 1);
+
+    filter_feed(&filter, 500, 0);
+    filter_feed(&filter, 600, 100);
+
+    // after a reset the next sample starts over, whatever its tick
+    filter_reset(&filter);
+    TEST_ASSERT_EQUAL(200, filter_feed(&filter, 200, 100));
+    TEST_ASSERT(filter_get_velocity(&filter) == 0);
+}
+
+int main(void)
+{
+    TEST_RUN(test_median);
+    TEST_RUN(test_median_spike);
+    TEST_RUN(test_ema_converges);
+    TEST_RUN(test_ema_alpha);
+    TEST_RUN(test_kalman_zero_dt);
+    TEST_RUN(test_kalman_reset);
+
+    return test_summary("filter");
+}
@@ -0,0 +1,304 @@
+#include <host.h>
+#include <vl53l0x_sim.h>
+#include <vl53l0x.h>
+#include <test.h>
+
+// Data ready interrupt path: GPIO1 edges of the simulator reach the driver
+// through bc_exti, the scheduler task reads and clears the result and calls
+// the handler
+
+static vl53l0x_sim_t sim;
+static vl53l0x_t vl53l0x;
+
+static uint32_t handler_calls;
+static uint16_t handler_range_mm;
+static uint64_t handler_us;
+static uint64_t complete_us;
+
+static void dataReadyHandler(vl53l0x_t *self, const vl53l0x_result_t *result, void *param)
+{
+    handler_calls++;
+    handler_range_mm = result->range_mm;
+    handler_us = host_get_us();
+}
+
+static bool initSensor(void)
+{
+    host_reset();
+
+    vl53l0x_sim_init(&sim, VL53L0X_DEFAULT_ADDRESS);
+    vl53l0x_sim_attach_gpio1(&sim, BC_EXTI_LINE_P9);
+    host_attach(BC_I2C_I2C0, &sim);
+
+    memset(&vl53l0x, 0, sizeof(vl53l0x));
+
+    handler_calls = 0;
+    handler_range_mm = 0;
+
+    return vl53l0x_init(&vl53l0x, BC_I2C_I2C0, VL53L0X_DEFAULT_ADDRESS, 500, false);
+}
+
+// Distance steps by 10 mm per measurement from 100 mm
+static void rampTarget(vl53l0x_sim_t *self, uint32_t index, vl53l0x_sim_target_t *target, void *param)
+{
+    target->distance_mm = 100 + 10 * (index % 50);
+    complete_us = host_get_us();
+}
+
+static void test_edges(void)
+{
+    vl53l0x_stats_t stats;
+
+    TEST_ASSERT(initSensor());
+
+    vl53l0x_set_data_ready_interrupt(&vl53l0x, BC_GPIO_P9, BC_EXTI_LINE_P9, dataReadyHandler, NULL);
+    vl53l0x_start_continuous(&vl53l0x, 50);
+
+    uint32_t polls = vl53l0x_sim_get_status_polls(&sim);
+    host_run(host_get_us() / 1000 + 1000);
+
+    // one sample per period, each read with a single status transaction
+    TEST_ASSERT_WITHIN(1, 20, handler_calls);
+    TEST_ASSERT_EQUAL(vl53l0x_sim_get_measurements(&sim), handler_calls);
+    TEST_ASSERT_WITHIN(1, handler_calls, vl53l0x_sim_get_status_polls(&sim) - polls);
+    TEST_ASSERT_EQUAL(0, sim._overruns);
+
+    // every edge was answered with an interrupt clear
+    TEST_ASSERT(!sim._gpio1_asserted);
+
+    vl53l0x_get_stats(&vl53l0x, &stats);
+    TEST_ASSERT_EQUAL(handler_calls, stats.samples);
+    TEST_ASSERT(stats.latency_max_ms <= 1);
+}
+
+static void test_edge_order(void)
+{
+    TEST_ASSERT(initSensor());
+
+    vl53l0x_sim_set_target_handler(&sim, rampTarget, NULL);
+
+    vl53l0x_set_data_ready_interrupt(&vl53l0x, BC_GPIO_P9, BC_EXTI_LINE_P9, dataReadyHandler, NULL);
+    vl53l0x_start_continuous(&vl53l0x, 0);
+
+    for (uint32_t i = 0; i < 10; i++)
+    {
+        uint32_t calls = handler_calls;
+
+        while (handler_calls == calls)
+        {
+            host_run(host_get_us() / 1000 + 1);
+        }
+
+        // delivered in measurement order, within a millisecond of the edge
+        TEST_ASSERT_EQUAL(100 + 10 * i, handler_range_mm);
+        TEST_ASSERT(handler_us - complete_us < 1000);
+    }
+}
+
+static void test_spurious_edge(void)
+{
+    TEST_ASSERT(initSensor());
+
+    vl53l0x_set_data_ready_interrupt(&vl53l0x, BC_GPIO_P9, BC_EXTI_LINE_P9, dataReadyHandler, NULL);
+    host_run(host_get_us() / 1000 + 1);
+
+    // no measurement running: the status read finds nothing
+    host_exti_edge(BC_EXTI_LINE_P9, BC_EXTI_EDGE_FALLING);
+    host_run(host_get_us() / 1000 + 5);
+
+    TEST_ASSERT_EQUAL(0, handler_calls);
+
+    // the rising edge of the interrupt clear is not listened to
+    host_exti_edge(BC_EXTI_LINE_P9, BC_EXTI_EDGE_RISING);
+    host_run(host_get_us() / 1000 + 5);
+
+    TEST_ASSERT_EQUAL(0, handler_calls);
+}
+
+static void test_pending_before_register(void)
+{
+    TEST_ASSERT(initSensor());
+
+    // the edge comes before anyone listens
+    vl53l0x_start_continuous(&vl53l0x, 0);
+    host_advance(vl53l0x_sim_get_budget(&sim) + 1000);
+    TEST_ASSERT(sim._gpio1_asserted);
+
+    // the task runs once on registration and picks the sample up
+    vl53l0x_set_data_ready_interrupt(&vl53l0x, BC_GPIO_P9, BC_EXTI_LINE_P9, dataReadyHandler, NULL);
+    host_run(host_get_us() / 1000 + 1);
+
+    TEST_ASSERT_EQUAL(1, handler_calls);
+    TEST_ASSERT(!sim._gpio1_asserted);
+}
+
+static void test_window(void)
+{
+    TEST_ASSERT(initSensor());
+
+    vl53l0x_sim_set_target_handler(&sim, rampTarget, NULL);
+
+    // below 200 mm: 100 to 190 out of every 50 measurements
+    TEST_ASSERT(vl53l0x_set_window_interrupt(&vl53l0x, BC_GPIO_P9, BC_EXTI_LINE_P9, VL53L0X_WINDOW_BELOW, 200, 400, dataReadyHandler, NULL));
+    vl53l0x_start_continuous(&vl53l0x, 40);
+
+    host_run(host_get_us() / 1000 + 50 * 40);
+
+    TEST_ASSERT_EQUAL(50, vl53l0x_sim_get_measurements(&sim));
+    TEST_ASSERT_EQUAL(10, handler_calls);
+}
+
+static void test_window_far(void)
+{
+    TEST_ASSERT(initSensor());
+
+    // a threshold above 255 mm loads the interrupt threshold tuning on start
+    TEST_ASSERT(vl53l0x_set_window_interrupt(&vl53l0x, BC_GPIO_P9, BC_EXTI_LINE_P9, VL53L0X_WINDOW_ABOVE, 100, 600, dataReadyHandler, NULL));
+    vl53l0x_start_continuous(&vl53l0x, 40);
+
+    TEST_ASSERT_EQUAL(0x01, vl53l0x_sim_get_reg(&sim, 4, 0x70));
+    TEST_ASSERT_EQUAL(0xA5, vl53l0x_sim_get_reg(&sim, 4, 0x71));
+    TEST_ASSERT_EQUAL(0x5A, vl53l0x_sim_get_reg(&sim, 4, 0x72));
+    TEST_ASSERT_EQUAL(0x01, vl53l0x_sim_get_reg(&sim, 0, 0x80));
+    TEST_ASSERT_EQUAL(0x00, vl53l0x_sim_get_reg(&sim, 0, 0xFF));
+
+    // and undoes it on stop
+    vl53l0x_stop_continuous(&vl53l0x);
+
+    TEST_ASSERT_EQUAL(0x00, vl53l0x_sim_get_reg(&sim, 4, 0x70));
+    TEST_ASSERT_EQUAL(0x00, vl53l0x_sim_get_reg(&sim, 0, 0x80));
+    TEST_ASSERT_EQUAL(0x00, vl53l0x_sim_get_reg(&sim, 0, 0xFF));
+}
+
+static void test_window_near(void)
+{
+    TEST_ASSERT(initSensor());
+
+    // thresholds up to 255 mm need no tuning
+    TEST_ASSERT(vl53l0x_set_window_interrupt(&vl53l0x, BC_GPIO_P9, BC_EXTI_LINE_P9, VL53L0X_WINDOW_OUTSIDE, 100, 254, dataReadyHandler, NULL));
+    vl53l0x_start_continuous(&vl53l0x, 40);
+
+    TEST_ASSERT_EQUAL(0x00, vl53l0x_sim_get_reg(&sim, 4, 0x71));
+
+    // nor does the data ready interrupt, whatever the thresholds left behind
+    vl53l0x_stop_continuous(&vl53l0x);
+    vl53l0x_set_window_interrupt(&vl53l0x, BC_GPIO_P9, BC_EXTI_LINE_P9, VL53L0X_WINDOW_ABOVE, 100, 600, dataReadyHandler, NULL);
+    vl53l0x_set_data_ready_interrupt(&vl53l0x, BC_GPIO_P9, BC_EXTI_LINE_P9, dataReadyHandler, NULL);
+    vl53l0x_start_continuous(&vl53l0x, 40);
+
+    TEST_ASSERT_EQUAL(0x00, vl53l0x_sim_get_reg(&sim, 4, 0x71));
+}
+
+// The application task of the firmware is the first one registered, and keeps
+// the core busy with blocking register access, like a reconfiguration through
+// vl53l0x_stop_continuous() would
+static bc_scheduler_task_id_t app_task_id;
+static bool app_blocking;
+static uint32_t app_runs;
+static uint32_t reentered;
+
+static void appTask(void *param)
+{
+    app_runs++;
+
+    app_blocking = true;
+    vl53l0x_read_reg(&vl53l0x, 0x0A);
+    app_blocking = false;
+
+    if (handler_calls < 5 && app_runs < 100000)
+    {
+        bc_scheduler_plan_current_now();
+    }
+}
+
+static void reentryHandler(vl53l0x_t *self, const vl53l0x_result_t *result, void *param)
+{
+    handler_calls++;
+
+    if (app_blocking)
+    {
+        reentered++;
+    }
+}
+
+static void transferDone(vl53l0x_t *self, const vl53l0x_transfer_t *transfer, bool ok, void *param)
+{
+    (*(uint32_t *) param)++;
+}
+
+static void test_blocking_no_reentry(void)
+{
+    uint32_t done = 0;
+    vl53l0x_transfer_t transfer = { .read = true, .reg = 0xC0, .length = 1, .handler = transferDone, .param = &done };
+
+    host_reset();
+
+    vl53l0x_sim_init(&sim, VL53L0X_DEFAULT_ADDRESS);
+    vl53l0x_sim_attach_gpio1(&sim, BC_EXTI_LINE_P9);
+    host_attach(BC_I2C_I2C0, &sim);
+
+    memset(&vl53l0x, 0, sizeof(vl53l0x));
+
+    handler_calls = 0;
+    app_runs = 0;
+    reentered = 0;
+
+    app_task_id = bc_scheduler_register(appTask, NULL, BC_TICK_INFINITY);
+
+    TEST_ASSERT(vl53l0x_init(&vl53l0x, BC_I2C_I2C0, VL53L0X_DEFAULT_ADDRESS, 500, false));
+
+    // a queued transaction runs before a blocking one, its handler only from
+    // the scheduler
+    TEST_ASSERT(vl53l0x_queue_transfer(&vl53l0x, &transfer));
+    TEST_ASSERT_EQUAL(0xEE, vl53l0x_read_reg(&vl53l0x, 0xC0));
+    TEST_ASSERT_EQUAL(0, done);
+    TEST_ASSERT_EQUAL(1, vl53l0x_get_pending_transfers(&vl53l0x));
+
+    host_run(host_get_us() / 1000 + 1);
+    TEST_ASSERT_EQUAL(1, done);
+    TEST_ASSERT_EQUAL(0, vl53l0x_get_pending_transfers(&vl53l0x));
+
+    // the transfer task now comes before the data ready task, so a status read
+    // queued by the latter is still queued when the application task runs next
+    vl53l0x_set_data_ready_interrupt(&vl53l0x, BC_GPIO_P9, BC_EXTI_LINE_P9, reentryHandler, NULL);
+    vl53l0x_start_continuous(&vl53l0x, 0);
+
+    bc_scheduler_plan_now(app_task_id);
+    host_run(host_get_us() / 1000 + 500);
+
+    TEST_ASSERT(handler_calls >= 5);
+    TEST_ASSERT_EQUAL(0, reentered);
+    TEST_ASSERT_EQUAL(0, sim._overruns);
+}
+
+static void test_clear(void)
+{
+    TEST_ASSERT(initSensor());
+
+    vl53l0x_set_data_ready_interrupt(&vl53l0x, BC_GPIO_P9, BC_EXTI_LINE_P9, dataReadyHandler, NULL);
+    vl53l0x_start_continuous(&vl53l0x, 50);
+    host_run(host_get_us() / 1000 + 120);
+
+    uint32_t calls = handler_calls;
+    TEST_ASSERT(calls >= 2);
+
+    vl53l0x_clear_data_ready_interrupt(&vl53l0x);
+    host_run(host_get_us() / 1000 + 200);
+
+    TEST_ASSERT_EQUAL(calls, handler_calls);
+}
+
+int main(void)
+{
+    TEST_RUN(test_edges);
+    TEST_RUN(test_edge_order);
+    TEST_RUN(test_spurious_edge);
+    TEST_RUN(test_pending_before_register);
+    TEST_RUN(test_window);
+    TEST_RUN(test_window_far);
+    TEST_RUN(test_window_near);
+    TEST_RUN(test_clear);
+    TEST_RUN(test_blocking_no_reentry);
+
+    return test_summary("interrupt");
+}
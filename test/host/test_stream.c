@@ -0,0 +1,246 @@
+#include <host.h>
+#include <stream.h>
+#include <test.h>
+
+// Frames written by app/stream.c and read back by the host decoder, built in
+// with STREAM_DECODE_NO_MAIN: the samples survive the round trip, and the
+// decoder copes with a partial frame, text between frames, a corrupted CRC and
+// a sequence gap
+
+#include <stream_decode.c>
+
+#define CAPTURE_FRAMES_MAX 8
+
+static stream_t stream;
+static uint8_t capture[CAPTURE_FRAMES_MAX * STREAM_FRAME_SIZE + 256];
+static size_t capture_length;
+
+static frame_t frames[CAPTURE_FRAMES_MAX];
+static int frame_count;
+
+static void captureWrite(const uint8_t *buffer, size_t length, void *param)
+{
+    if (capture_length + length <= sizeof(capture))
+    {
+        memcpy(&capture[capture_length], buffer, length);
+        capture_length += length;
+    }
+}
+
+static void captureText(const char *text)
+{
+    captureWrite((const uint8_t *) text, strlen(text), NULL);
+}
+
+static void collectFrame(const frame_t *frame)
+{
+    if (frame_count < CAPTURE_FRAMES_MAX)
+    {
+        frames[frame_count++] = *frame;
+    }
+}
+
+static void setUp(void)
+{
+    stream_init(&stream, captureWrite, NULL);
+
+    capture_length = 0;
+    frame_count = 0;
+}
+
+// Sample i of a run: 33 ms apart from tick 1000, a different range and signal
+// rate each, every fifth a sigma failure
+static void feed(int i)
+{
+    vl53l0x_result_t result;
+
+    memset(&result, 0, sizeof(result));
+    result.range_mm = 100 + i * 7;
+    result.range_status = i % 5 == 4 ? 6 : 11;
+    result.signal_rate = 0x0500 + i;
+    result.validity = i % 5 == 4 ? VL53L0X_VALIDITY_SIGMA_FAIL : VL53L0X_VALIDITY_VALID;
+
+    stream_feed(&stream, &result, 1000 + i * 33);
+}
+
+static size_t decodeAll(decoder_t *decoder, const uint8_t *buffer, size_t length)
+{
+    memset(decoder, 0, sizeof(*decoder));
+
+    return decode(decoder, buffer, length, collectFrame);
+}
+
+static void test_round_trip(void)
+{
+    decoder_t decoder;
+
+    setUp();
+
+    // two full frames go out by themselves, the rest on the flush
+    for (int i = 0; i < 20; i++)
+    {
+        feed(i);
+    }
+
+    TEST_ASSERT_EQUAL(2 * STREAM_FRAME_SIZE, capture_length);
+    stream_flush(&stream);
+    TEST_ASSERT_EQUAL(3 * STREAM_FRAME_SIZE, capture_length);
+
+    TEST_ASSERT_EQUAL(capture_length, decodeAll(&decoder, capture, capture_length));
+    TEST_ASSERT_EQUAL(3, decoder.frames);
+    TEST_ASSERT_EQUAL(20, decoder.samples);
+    TEST_ASSERT_EQUAL(0, decoder.crc_errors + decoder.lost_frames + decoder.skipped_bytes);
+
+    TEST_ASSERT_EQUAL(3, frame_count);
+    TEST_ASSERT_EQUAL(4, frames[2].count);
+
+    for (int i = 0; i < 20; i++)
+    {
+        const frame_t *frame = &frames[i / STREAM_FRAME_SAMPLES];
+        const sample_t *sample = &frame->samples[i % STREAM_FRAME_SAMPLES];
+
+        TEST_ASSERT_EQUAL(i / STREAM_FRAME_SAMPLES, frame->sequence);
+        TEST_ASSERT_EQUAL(1000 + i * 33, sample->tick);
+        TEST_ASSERT_EQUAL(100 + i * 7, sample->range_mm);
+        TEST_ASSERT_EQUAL(i % 5 == 4 ? VL53L0X_VALIDITY_SIGMA_FAIL : VL53L0X_VALIDITY_VALID, sample->validity);
+        TEST_ASSERT_EQUAL(i % 5 == 4 ? 6 : 11, sample->range_status);
+        TEST_ASSERT_EQUAL(0x0500 + i, sample->signal_rate);
+    }
+}
+
+static void test_partial_frame(void)
+{
+    decoder_t decoder;
+
+    setUp();
+
+    for (int i = 0; i < 3 * STREAM_FRAME_SAMPLES; i++)
+    {
+        feed(i);
+    }
+
+    // the incomplete third frame is left to be presented again with the rest,
+    // as stream_decode does with the next read
+    size_t consumed = decodeAll(&decoder, capture, capture_length - 10);
+
+    TEST_ASSERT_EQUAL(2 * STREAM_FRAME_SIZE, consumed);
+    TEST_ASSERT_EQUAL(2, decoder.frames);
+    TEST_ASSERT_EQUAL(0, decoder.skipped_bytes);
+
+    TEST_ASSERT_EQUAL(STREAM_FRAME_SIZE, decode(&decoder, &capture[consumed], capture_length - consumed, collectFrame));
+    TEST_ASSERT_EQUAL(3, decoder.frames);
+    TEST_ASSERT_EQUAL(0, decoder.lost_frames);
+    TEST_ASSERT_EQUAL(2, frames[2].sequence);
+}
+
+static void test_garbage(void)
+{
+    static const char text[] = "vl53l0x: init done\r\n";
+    decoder_t decoder;
+
+    setUp();
+
+    // log text before, between and after the frames is skipped
+    captureText(text);
+
+    for (int i = 0; i < STREAM_FRAME_SAMPLES; i++)
+    {
+        feed(i);
+    }
+
+    captureText(text);
+    captureText(text);
+
+    for (int i = 0; i < STREAM_FRAME_SAMPLES; i++)
+    {
+        feed(i);
+    }
+
+    captureText(text);
+
+    decodeAll(&decoder, capture, capture_length);
+
+    TEST_ASSERT_EQUAL(2, decoder.frames);
+    TEST_ASSERT_EQUAL(3 * strlen(text), decoder.skipped_bytes);
+    TEST_ASSERT_EQUAL(0, decoder.crc_errors);
+    TEST_ASSERT_EQUAL(0, decoder.lost_frames);
+
+    // and a stray sync word in it counts as a CRC error, but does not cost
+    // the frame behind it
+    setUp();
+    captureWrite((const uint8_t[]) { STREAM_SYNC_0, STREAM_SYNC_1, 0x01 }, 3, NULL);
+
+    for (int i = 0; i < STREAM_FRAME_SAMPLES; i++)
+    {
+        feed(i);
+    }
+
+    decodeAll(&decoder, capture, capture_length);
+
+    TEST_ASSERT_EQUAL(1, decoder.frames);
+    TEST_ASSERT_EQUAL(1, decoder.crc_errors);
+    TEST_ASSERT_EQUAL(3, decoder.skipped_bytes);
+}
+
+static void test_corrupted_crc(void)
+{
+    decoder_t decoder;
+
+    setUp();
+
+    for (int i = 0; i < 3 * STREAM_FRAME_SAMPLES; i++)
+    {
+        feed(i);
+    }
+
+    // one flipped bit in a range of the second frame drops it, and the gap it
+    // leaves shows as a lost frame
+    capture[STREAM_FRAME_SIZE + STREAM_HEADER_SIZE + 2] ^= 0x04;
+
+    decodeAll(&decoder, capture, capture_length);
+
+    TEST_ASSERT_EQUAL(2, decoder.frames);
+    TEST_ASSERT_EQUAL(1, decoder.crc_errors);
+    TEST_ASSERT_EQUAL(1, decoder.lost_frames);
+    TEST_ASSERT_EQUAL(STREAM_FRAME_SIZE, decoder.skipped_bytes);
+    TEST_ASSERT_EQUAL(0, frames[0].sequence);
+    TEST_ASSERT_EQUAL(2, frames[1].sequence);
+}
+
+static void test_sequence_gap(void)
+{
+    decoder_t decoder;
+
+    setUp();
+
+    // frames 0xFFFE to 0x0002 with 0x0000 and 0x0001 lost on the way: the
+    // sequence wraps, and only the missing frames count
+    stream._sequence = 0xFFFE;
+
+    for (int i = 0; i < 5 * STREAM_FRAME_SAMPLES; i++)
+    {
+        feed(i);
+    }
+
+    memmove(&capture[2 * STREAM_FRAME_SIZE], &capture[4 * STREAM_FRAME_SIZE], STREAM_FRAME_SIZE);
+    capture_length = 3 * STREAM_FRAME_SIZE;
+
+    decodeAll(&decoder, capture, capture_length);
+
+    TEST_ASSERT_EQUAL(3, decoder.frames);
+    TEST_ASSERT_EQUAL(2, decoder.lost_frames);
+    TEST_ASSERT_EQUAL(0, decoder.crc_errors);
+    TEST_ASSERT_EQUAL(0xFFFF, frames[1].sequence);
+    TEST_ASSERT_EQUAL(0x0002, frames[2].sequence);
+}
+
+int main(void)
+{
+    TEST_RUN(test_round_trip);
+    TEST_RUN(test_partial_frame);
+    TEST_RUN(test_garbage);
+    TEST_RUN(test_corrupted_crc);
+    TEST_RUN(test_sequence_gap);
+
+    return test_summary("stream");
+}
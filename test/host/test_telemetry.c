@@ -0,0 +1,130 @@
+#include <host.h>
+#include <telemetry.h>
+#include <telemetry_file.h>
+#include <util.h>
+#include <test.h>
+
+// Telemetry windows through the host file sink: the statistics of a window,
+// the early summary on a change and the UART frame
+
+static telemetry_t telemetry;
+
+static FILE *setUp(bc_tick_t window_ms, uint16_t change_mm)
+{
+    FILE *file = tmpfile();
+
+    host_reset();
+
+    telemetry_init(&telemetry, window_ms, change_mm);
+    telemetry_add_sink(&telemetry, telemetry_sink_file, file);
+
+    return file;
+}
+
+static void feed(uint16_t range_mm, bool valid)
+{
+    vl53l0x_result_t result;
+
+    memset(&result, 0, sizeof(result));
+    result.range_mm = range_mm;
+    result.validity = valid ? VL53L0X_VALIDITY_VALID : VL53L0X_VALIDITY_SIGMA_FAIL;
+
+    telemetry_feed(&telemetry, &result);
+}
+
+static void test_window(void)
+{
+    telemetry_summary_t summary;
+    FILE *file = setUp(1000, 0);
+
+    feed(100, true);
+    feed(110, true);
+    feed(5000, false);
+    feed(120, true);
+    feed(130, true);
+
+    // the window ends, and an empty one after it sends nothing
+    host_run(2500);
+    rewind(file);
+
+    TEST_ASSERT(telemetry_file_read(file, &summary));
+    TEST_ASSERT_EQUAL(0, summary.sequence);
+    TEST_ASSERT_EQUAL(1000, summary.duration_ms);
+    TEST_ASSERT_EQUAL(5, summary.count);
+    TEST_ASSERT_EQUAL(4, summary.valid);
+    TEST_ASSERT_EQUAL(100, summary.min_mm);
+    TEST_ASSERT_EQUAL(130, summary.max_mm);
+    TEST_ASSERT_EQUAL(115, summary.mean_mm);
+    TEST_ASSERT_EQUAL(11, summary.stddev_mm); // sqrt(125)
+    TEST_ASSERT(!summary.change);
+
+    TEST_ASSERT(!telemetry_file_read(file, &summary));
+
+    fclose(file);
+}
+
+static void test_change(void)
+{
+    telemetry_summary_t summary;
+    FILE *file = setUp(1000, 50);
+
+    feed(100, true);
+    feed(100, true);
+    feed(100, true);
+    host_run(1000);
+    host_run(1100);
+
+    // a change summary needs TELEMETRY_CHANGE_MIN_SAMPLES in the window
+    feed(200, true);
+    feed(200, true);
+    TEST_ASSERT_EQUAL(2, telemetry._valid);
+    feed(200, true);
+    TEST_ASSERT_EQUAL(0, telemetry._valid);
+
+    rewind(file);
+
+    TEST_ASSERT(telemetry_file_read(file, &summary));
+    TEST_ASSERT_EQUAL(100, summary.mean_mm);
+    TEST_ASSERT_EQUAL(0, summary.stddev_mm);
+    TEST_ASSERT(!summary.change);
+
+    TEST_ASSERT(telemetry_file_read(file, &summary));
+    TEST_ASSERT_EQUAL(1, summary.sequence);
+    TEST_ASSERT_EQUAL(200, summary.mean_mm);
+    TEST_ASSERT_EQUAL(100, summary.duration_ms);
+    TEST_ASSERT(summary.change);
+
+    TEST_ASSERT(!telemetry_file_read(file, &summary));
+
+    fclose(file);
+}
+
+static void test_uart_frame(void)
+{
+    bc_uart_channel_t channel = BC_UART_UART1;
+    uint8_t frame[64];
+    FILE *file = setUp(1000, 0);
+
+    telemetry_add_sink(&telemetry, telemetry_sink_uart, &channel);
+
+    feed(300, true);
+    feed(302, true);
+    telemetry_flush(&telemetry);
+
+    TEST_ASSERT_EQUAL(2 + TELEMETRY_PACKED_SIZE + 2, host_uart_take(channel, frame, sizeof(frame)));
+    TEST_ASSERT_EQUAL(TELEMETRY_UART_SYNC_0, frame[0]);
+    TEST_ASSERT_EQUAL(TELEMETRY_UART_SYNC_1, frame[1]);
+    TEST_ASSERT_EQUAL(301, frame[2 + 14] | frame[2 + 15] << 8);
+    TEST_ASSERT_EQUAL(util_crc16(&frame[2], TELEMETRY_PACKED_SIZE), frame[2 + TELEMETRY_PACKED_SIZE] | frame[2 + TELEMETRY_PACKED_SIZE + 1] << 8);
+
+    fclose(file);
+}
+
+int main(void)
+{
+    TEST_RUN(test_window);
+    TEST_RUN(test_change);
+    TEST_RUN(test_uart_frame);
+
+    return test_summary("telemetry");
+}
@@ -0,0 +1,190 @@
+#include <host.h>
+#include <vl53l0x_sim.h>
+#include <vl53l0x.h>
+#include <test.h>
+
+// Transaction trace ring, built with VL53L0X_TRACE=1 and VL53L0X_TRACE_SIZE=8:
+// the recorded fields, failed attempts, wraparound and the dump format
+
+#if !VL53L0X_TRACE || VL53L0X_TRACE_SIZE != 8
+#error "build with -DVL53L0X_TRACE=1 -DVL53L0X_TRACE_SIZE=8"
+#endif
+
+typedef struct
+{
+    unsigned long tick;
+    unsigned address;
+    char direction;
+    unsigned reg;
+    unsigned length;
+    unsigned long value;
+    char status[4];
+} trace_line_t;
+
+static vl53l0x_sim_t sim;
+static vl53l0x_t vl53l0x;
+static char log_text[HOST_LOG_BUFFER_SIZE];
+
+static bool initSensor(void)
+{
+    host_reset();
+
+    vl53l0x_sim_init(&sim, VL53L0X_DEFAULT_ADDRESS);
+    host_attach(BC_I2C_I2C0, &sim);
+
+    memset(&vl53l0x, 0, sizeof(vl53l0x));
+
+    bool ok = vl53l0x_init(&vl53l0x, BC_I2C_I2C0, VL53L0X_DEFAULT_ADDRESS, 500, false);
+
+    vl53l0x_trace_clear();
+
+    return ok;
+}
+
+// Dump the ring and parse it; returns the entry count of the header line, and
+// -1 if any line does not have the documented format
+static int dumpTrace(trace_line_t *lines, int size)
+{
+    int count;
+    int offset;
+
+    host_log_take(log_text, sizeof(log_text));
+    vl53l0x_trace_dump();
+    host_log_take(log_text, sizeof(log_text));
+
+    char *line = log_text;
+
+    if (sscanf(line, "vl53l0x trace: %d entries\n%n", &count, &offset) != 1)
+    {
+        return -1;
+    }
+
+    line += offset;
+
+    for (int i = 0; i < count && i < size; i++)
+    {
+        trace_line_t *entry = &lines[i];
+
+        if (sscanf(line, "%lu %2x %c%2x/%u %8lx %3s\n%n", &entry->tick, &entry->address, &entry->direction, &entry->reg,
+                   &entry->length, &entry->value, entry->status, &offset) != 7)
+        {
+            return -1;
+        }
+
+        line += offset;
+    }
+
+    return *line == '\0' ? count : -1;
+}
+
+static void test_fields(void)
+{
+    trace_line_t lines[8];
+    uint8_t buffer[6];
+
+    TEST_ASSERT(initSensor());
+
+    host_advance(5000);
+    bc_tick_t tick = bc_tick_get();
+
+    vl53l0x_write_reg(&vl53l0x, 0x0A, 0x04);
+    vl53l0x_write_reg16_bit(&vl53l0x, 0x44, 0x0020);
+    vl53l0x_read_multi(&vl53l0x, 0xB0, buffer, 6);
+
+    TEST_ASSERT_EQUAL(3, dumpTrace(lines, 8));
+
+    TEST_ASSERT_WITHIN(1, tick, lines[0].tick);
+    TEST_ASSERT_EQUAL(VL53L0X_DEFAULT_ADDRESS, lines[0].address);
+    TEST_ASSERT_EQUAL('W', lines[0].direction);
+    TEST_ASSERT_EQUAL(0x0A, lines[0].reg);
+    TEST_ASSERT_EQUAL(1, lines[0].length);
+    TEST_ASSERT_EQUAL(0x04, lines[0].value);
+    TEST_ASSERT(strcmp(lines[0].status, "ok") == 0);
+
+    TEST_ASSERT_EQUAL('W', lines[1].direction);
+    TEST_ASSERT_EQUAL(0x44, lines[1].reg);
+    TEST_ASSERT_EQUAL(2, lines[1].length);
+    TEST_ASSERT_EQUAL(0x0020, lines[1].value);
+
+    // the first four bytes of longer transfers, big endian
+    TEST_ASSERT_EQUAL('R', lines[2].direction);
+    TEST_ASSERT_EQUAL(0xB0, lines[2].reg);
+    TEST_ASSERT_EQUAL(6, lines[2].length);
+    TEST_ASSERT_EQUAL(((uint32_t) buffer[0] << 24) | ((uint32_t) buffer[1] << 16) | ((uint32_t) buffer[2] << 8) | buffer[3], lines[2].value);
+    TEST_ASSERT(lines[2].tick >= lines[0].tick);
+}
+
+static void test_failed_attempts(void)
+{
+    trace_line_t lines[8];
+
+    TEST_ASSERT(initSensor());
+
+    // every attempt is recorded, the failed ones marked
+    vl53l0x_sim_fail_next(&sim, 1);
+    vl53l0x_write_reg(&vl53l0x, 0x0A, 0x04);
+
+    TEST_ASSERT_EQUAL(2, dumpTrace(lines, 8));
+    TEST_ASSERT(strcmp(lines[0].status, "ERR") == 0);
+    TEST_ASSERT(strcmp(lines[1].status, "ok") == 0);
+    TEST_ASSERT_EQUAL(0x0A, lines[1].reg);
+}
+
+static void test_wraparound(void)
+{
+    trace_line_t lines[8];
+
+    TEST_ASSERT(initSensor());
+
+    for (int i = 0; i < 11; i++)
+    {
+        vl53l0x_write_reg(&vl53l0x, 0x0A, i);
+    }
+
+    // the last eight, oldest first
+    TEST_ASSERT_EQUAL(8, dumpTrace(lines, 8));
+
+    for (int i = 0; i < 8; i++)
+    {
+        TEST_ASSERT_EQUAL(i + 3, lines[i].value);
+    }
+
+    // and again after the ring went round a second time
+    for (int i = 11; i < 20; i++)
+    {
+        vl53l0x_write_reg(&vl53l0x, 0x0A, i);
+    }
+
+    TEST_ASSERT_EQUAL(8, dumpTrace(lines, 8));
+    TEST_ASSERT_EQUAL(12, lines[0].value);
+    TEST_ASSERT_EQUAL(19, lines[7].value);
+
+    vl53l0x_trace_clear();
+    TEST_ASSERT_EQUAL(0, dumpTrace(lines, 8));
+}
+
+static void test_instances(void)
+{
+    trace_line_t lines[8];
+
+    TEST_ASSERT(initSensor());
+
+    // one ring for all instances, told apart by the address
+    vl53l0x_set_address(&vl53l0x, 0x30);
+    vl53l0x_read_reg(&vl53l0x, 0xC0);
+
+    TEST_ASSERT_EQUAL(2, dumpTrace(lines, 8));
+    TEST_ASSERT_EQUAL(VL53L0X_DEFAULT_ADDRESS, lines[0].address);
+    TEST_ASSERT_EQUAL(0x30, lines[1].address);
+    TEST_ASSERT_EQUAL(0xEE, lines[1].value);
+}
+
+int main(void)
+{
+    TEST_RUN(test_fields);
+    TEST_RUN(test_failed_attempts);
+    TEST_RUN(test_wraparound);
+    TEST_RUN(test_instances);
+
+    return test_summary("trace");
+}
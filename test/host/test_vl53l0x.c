@@ -0,0 +1,743 @@
+#include <host.h>
+#include <vl53l0x_sim.h>
+#include <vl53l0x.h>
+#include <test.h>
+#include <math.h>
+
+// Driver against the register file simulator: initialization, the ranging
+// modes and their timing, paging and the interrupt handshake
+
+static vl53l0x_sim_t sim;
+static vl53l0x_t vl53l0x;
+
+static void setUp(void)
+{
+    host_reset();
+
+    vl53l0x_sim_init(&sim, VL53L0X_DEFAULT_ADDRESS);
+    host_attach(BC_I2C_I2C0, &sim);
+
+    memset(&vl53l0x, 0, sizeof(vl53l0x));
+}
+
+static bool initSensor(void)
+{
+    setUp();
+
+    return vl53l0x_init(&vl53l0x, BC_I2C_I2C0, VL53L0X_DEFAULT_ADDRESS, 500, false);
+}
+
+static void setDistance(uint16_t distance_mm)
+{
+    vl53l0x_sim_target_t target = sim._target;
+
+    target.distance_mm = distance_mm;
+    vl53l0x_sim_set_target(&sim, &target);
+}
+
+static void test_init(void)
+{
+    vl53l0x_bus_stats_t stats;
+
+    TEST_ASSERT(initSensor());
+
+    vl53l0x_get_bus_stats(&vl53l0x, &stats);
+    TEST_ASSERT_EQUAL(0, stats.errors);
+    TEST_ASSERT_EQUAL(VL53L0X_ERROR_NONE, vl53l0x_get_error(&vl53l0x));
+
+    // back on page 0, MSRC and TCC off, new sample ready on GPIO1, active low
+    TEST_ASSERT_EQUAL(0x00, vl53l0x_sim_get_reg(&sim, 0, 0xFF));
+    TEST_ASSERT_EQUAL(0xE8, vl53l0x_sim_get_reg(&sim, 0, 0x01));
+    TEST_ASSERT_EQUAL(0x04, vl53l0x_sim_get_reg(&sim, 0, 0x0A));
+    TEST_ASSERT_EQUAL(0x00, vl53l0x_sim_get_reg(&sim, 0, 0x84) & 0x10);
+
+    // both reference calibrations ran and left the device idle
+    TEST_ASSERT_EQUAL(0x1C, vl53l0x_sim_get_reg(&sim, 0, 0xCB));
+    TEST_ASSERT_EQUAL(VL53L0X_SIM_MODE_IDLE, vl53l0x_sim_get_mode(&sim));
+
+    // the device measures with the budget the driver set up
+    TEST_ASSERT_WITHIN(50, vl53l0x._measurement_timing_budget_us, vl53l0x_sim_get_budget(&sim));
+}
+
+static void test_stop_variable_paging(void)
+{
+    TEST_ASSERT(initSensor());
+
+    TEST_ASSERT_EQUAL(0x3C, vl53l0x._stop_variable);
+
+    vl53l0x_start_continuous(&vl53l0x, 0);
+    TEST_ASSERT_EQUAL(0x3C, vl53l0x_sim_get_reg(&sim, 1, 0x91));
+    TEST_ASSERT_EQUAL(0x00, vl53l0x_sim_get_reg(&sim, 0, 0xFF));
+
+    vl53l0x_stop_continuous(&vl53l0x);
+    TEST_ASSERT_EQUAL(0x00, vl53l0x_sim_get_reg(&sim, 1, 0x91));
+    TEST_ASSERT_EQUAL(VL53L0X_SIM_MODE_IDLE, vl53l0x_sim_get_mode(&sim));
+}
+
+static void test_single(void)
+{
+    TEST_ASSERT(initSensor());
+
+    setDistance(321);
+
+    uint64_t start_us = host_get_us();
+    TEST_ASSERT_EQUAL(321, vl53l0x_read_range_single_millimeters(&vl53l0x));
+    uint64_t elapsed_us = host_get_us() - start_us;
+
+    // no result before the budget is over
+    TEST_ASSERT(elapsed_us >= vl53l0x_sim_get_budget(&sim));
+    TEST_ASSERT(elapsed_us < vl53l0x_sim_get_budget(&sim) + 3000);
+    TEST_ASSERT_EQUAL(1, vl53l0x_sim_get_measurements(&sim));
+
+    // interrupt cleared
+    TEST_ASSERT_EQUAL(0x00, vl53l0x_sim_get_reg(&sim, 0, 0x13));
+    TEST_ASSERT(!vl53l0x_timeout_occurred(&vl53l0x));
+}
+
+static void test_back_to_back(void)
+{
+    uint64_t ready_us[5];
+
+    TEST_ASSERT(initSensor());
+
+    vl53l0x_sim_set_cycle_overhead(&sim, 400);
+
+    vl53l0x_start_continuous(&vl53l0x, 0);
+    TEST_ASSERT_EQUAL(VL53L0X_SIM_MODE_BACK_TO_BACK, vl53l0x_sim_get_mode(&sim));
+
+    for (int i = 0; i < 5; i++)
+    {
+        TEST_ASSERT_EQUAL(500, vl53l0x_read_range_continuous_millimeters(&vl53l0x));
+        ready_us[i] = host_get_us();
+    }
+
+    uint32_t cycle_us = vl53l0x_sim_get_budget(&sim) + 400;
+
+    for (int i = 1; i < 5; i++)
+    {
+        TEST_ASSERT_WITHIN(1500, cycle_us, ready_us[i] - ready_us[i - 1]);
+    }
+
+    TEST_ASSERT_EQUAL(5, vl53l0x_sim_get_measurements(&sim));
+
+    vl53l0x_stop_continuous(&vl53l0x);
+    TEST_ASSERT_EQUAL(VL53L0X_SIM_MODE_IDLE, vl53l0x_sim_get_mode(&sim));
+}
+
+static void test_timed(void)
+{
+    uint64_t ready_us[4];
+
+    TEST_ASSERT(initSensor());
+
+    vl53l0x_start_continuous(&vl53l0x, 100);
+    TEST_ASSERT_EQUAL(VL53L0X_SIM_MODE_TIMED, vl53l0x_sim_get_mode(&sim));
+
+    for (int i = 0; i < 4; i++)
+    {
+        TEST_ASSERT_EQUAL(500, vl53l0x_read_range_continuous_millimeters(&vl53l0x));
+        ready_us[i] = host_get_us();
+    }
+
+    for (int i = 1; i < 4; i++)
+    {
+        TEST_ASSERT_WITHIN(1500, 100000, ready_us[i] - ready_us[i - 1]);
+    }
+
+    vl53l0x_stop_continuous(&vl53l0x);
+}
+
+static void test_wait_polls(void)
+{
+    host_stats_t stats;
+
+    TEST_ASSERT(initSensor());
+
+    // the status is first read WAKE_GUARD_MS before the predicted data ready
+    // time, which leaves the last tick or two of the measurement to poll; from
+    // its start it would take about 340 status reads per single-shot reading
+    // and 940 per timed one at 100 ms
+    uint32_t polls = vl53l0x_sim_get_status_polls(&sim);
+
+    for (int i = 0; i < 10; i++)
+    {
+        TEST_ASSERT_EQUAL(500, vl53l0x_read_range_single_millimeters(&vl53l0x));
+    }
+
+    TEST_ASSERT(vl53l0x_sim_get_status_polls(&sim) - polls < 10 * 40);
+
+    vl53l0x_start_continuous(&vl53l0x, 100);
+    polls = vl53l0x_sim_get_status_polls(&sim);
+
+    for (int i = 0; i < 10; i++)
+    {
+        TEST_ASSERT_EQUAL(500, vl53l0x_read_range_continuous_millimeters(&vl53l0x));
+    }
+
+    TEST_ASSERT(vl53l0x_sim_get_status_polls(&sim) - polls < 10 * 40);
+
+    // and the wait until then sleeps, woken by every tick
+    host_get_stats(&stats);
+    TEST_ASSERT(stats.sleeps > 10 * 90);
+    TEST_ASSERT(stats.sleeps < host_get_us() / 1000);
+
+    vl53l0x_stop_continuous(&vl53l0x);
+}
+
+// VL53L0X_calc_sigma_estimate() in floating point for the current sequence
+// step timeouts, with the pre-range enabled and a final range VCSEL period
+// above 8 PCLKs
+static double sigmaReference(uint16_t signal_rate, uint16_t ambient_rate)
+{
+    double signal_mcps = signal_rate / 128.0;
+    double ambient_mcps = ambient_rate / 128.0;
+    double pre_mclks = vl53l0x._pre_range_mclks;
+    double final_mclks = vl53l0x._final_range_mclks - vl53l0x._pre_range_mclks;
+
+    double peak_vcsel_us = 3 * 2048 * (pre_mclks + final_mclks) * 1.655e-3;
+    double integration_ms = (pre_mclks * 2304 * vl53l0x._pre_range_vcsel_period_pclks +
+                             final_mclks * 2304 * vl53l0x._final_range_vcsel_period_pclks) * 1.655e-6;
+
+    double width_ns = sqrt(8.0 * 8.0 + pow(6.0 * ambient_mcps / signal_mcps, 2));
+    double sigma_rtn_mm = 299.7 * width_ns / (2 * sqrt(12 * signal_mcps * peak_vcsel_us));
+
+    return sqrt(sigma_rtn_mm * sigma_rtn_mm + 25 / integration_ms);
+}
+
+static void test_sigma(void)
+{
+    static const uint16_t rates[][2] =
+    {
+        { 0x0A00, 0x0040 }, // 20 MCPS signal, 0.5 MCPS ambient
+        { 0x0100, 0x0040 },
+        { 0x0040, 0x0100 },
+        { 0x0020, 0x0100 },
+        { 0x0040, 0x0800 },
+    };
+    vl53l0x_result_t result;
+
+    TEST_ASSERT(initSensor());
+
+    for (size_t i = 0; i < sizeof(rates) / sizeof(rates[0]); i++)
+    {
+        vl53l0x_sim_target_t target = sim._target;
+
+        target.signal_rate = rates[i][0];
+        target.ambient_rate = rates[i][1];
+        vl53l0x_sim_set_target(&sim, &target);
+
+        vl53l0x_start_continuous(&vl53l0x, 0);
+        TEST_ASSERT(vl53l0x_read_result(&vl53l0x, &result));
+        vl53l0x_stop_continuous(&vl53l0x);
+
+        TEST_ASSERT_WITHIN(1, (int) lround(sigmaReference(rates[i][0], rates[i][1])), result.sigma_mm);
+    }
+
+    // strong signal passes ST's default limit of 18 mm, weak signal in bright
+    // ambient light does not
+    TEST_ASSERT_EQUAL(VL53L0X_VALIDITY_SIGMA_FAIL, result.validity);
+    TEST_ASSERT(sigmaReference(0x0A00, 0x0040) < VL53L0X_DEFAULT_SIGMA_LIMIT_MM);
+
+    // the budget estimated for a sigma target meets it
+    uint32_t budget_us = vl53l0x_estimate_budget_for_sigma(0x0040, 0x0100, 10);
+
+    TEST_ASSERT(vl53l0x_set_measurement_timing_budget(&vl53l0x, budget_us));
+    TEST_ASSERT_WITHIN(1, 10, (int) lround(sigmaReference(0x0040, 0x0100)));
+}
+
+static void test_timing_budget(void)
+{
+    TEST_ASSERT(initSensor());
+
+    // the final range timeout register has a resolution of 2^n macro periods
+    TEST_ASSERT(vl53l0x_set_measurement_timing_budget(&vl53l0x, 200000));
+    TEST_ASSERT_WITHIN(1500, 200000, vl53l0x_sim_get_budget(&sim));
+
+    uint64_t start_us = host_get_us();
+    TEST_ASSERT_EQUAL(500, vl53l0x_read_range_single_millimeters(&vl53l0x));
+    TEST_ASSERT(host_get_us() - start_us >= vl53l0x_sim_get_budget(&sim));
+
+    TEST_ASSERT(vl53l0x_set_measurement_timing_budget(&vl53l0x, 20000));
+    TEST_ASSERT_WITHIN(50, 20000, vl53l0x_sim_get_budget(&sim));
+
+    TEST_ASSERT(!vl53l0x_set_measurement_timing_budget(&vl53l0x, 19999));
+}
+
+static void test_vcsel_period(void)
+{
+    TEST_ASSERT(initSensor());
+
+    TEST_ASSERT(vl53l0x_set_vcsel_pulse_period(&vl53l0x, VcselPeriodPreRange, 18));
+    TEST_ASSERT(vl53l0x_set_vcsel_pulse_period(&vl53l0x, VcselPeriodFinalRange, 14));
+
+    TEST_ASSERT_EQUAL(0x08, vl53l0x_sim_get_reg(&sim, 0, 0x50));
+    TEST_ASSERT_EQUAL(0x06, vl53l0x_sim_get_reg(&sim, 0, 0x70));
+
+    // the budget is kept across the period change
+    TEST_ASSERT_WITHIN(100, vl53l0x._measurement_timing_budget_us, vl53l0x_sim_get_budget(&sim));
+
+    TEST_ASSERT(!vl53l0x_set_vcsel_pulse_period(&vl53l0x, VcselPeriodFinalRange, 9));
+}
+
+static void test_apply_config(void)
+{
+    vl53l0x_config_t config;
+
+    TEST_ASSERT(initSensor());
+
+    vl53l0x_get_profile_config(VL53L0X_PROFILE_LONG_RANGE, &config);
+    TEST_ASSERT(vl53l0x_apply_config(&vl53l0x, &config));
+
+    TEST_ASSERT_EQUAL(18, vl53l0x_get_vcsel_pulse_period(&vl53l0x, VcselPeriodPreRange));
+    TEST_ASSERT_EQUAL(14, vl53l0x_get_vcsel_pulse_period(&vl53l0x, VcselPeriodFinalRange));
+    TEST_ASSERT_WITHIN(100, config.timing_budget_us, vl53l0x_sim_get_budget(&sim));
+}
+
+static void test_apply_config_infeasible(void)
+{
+    vl53l0x_config_t config;
+    vl53l0x_bus_stats_t stats;
+
+    TEST_ASSERT(initSensor());
+
+    // a pre-range timeout of about 15 ms leaves no room for the final range
+    // in a 20 ms budget; written behind the driver, which reloads its shadow
+    sim._regs[0][0x51] = 0x01;
+    sim._regs[0][0x52] = 0x8C;
+    vl53l0x._sequence_cache_valid = false;
+
+    vl53l0x_get_profile_config(VL53L0X_PROFILE_LONG_RANGE, &config);
+    config.timing_budget_us = 20000;
+
+    // refused before the first write, the sensor keeps its configuration
+    vl53l0x_reset_bus_stats(&vl53l0x);
+    TEST_ASSERT(!vl53l0x_apply_config(&vl53l0x, &config));
+
+    vl53l0x_get_bus_stats(&vl53l0x, &stats);
+    TEST_ASSERT_EQUAL(0, stats.writes);
+    TEST_ASSERT_EQUAL(14, vl53l0x_get_vcsel_pulse_period(&vl53l0x, VcselPeriodPreRange));
+    TEST_ASSERT_EQUAL(10, vl53l0x_get_vcsel_pulse_period(&vl53l0x, VcselPeriodFinalRange));
+
+    config.timing_budget_us = 33000;
+    TEST_ASSERT(vl53l0x_apply_config(&vl53l0x, &config));
+}
+
+static void test_offset(void)
+{
+    TEST_ASSERT(initSensor());
+
+    setDistance(200);
+
+    vl53l0x_set_offset_calibration(&vl53l0x, -12000);
+    TEST_ASSERT_EQUAL(-12000, vl53l0x_get_offset_calibration(&vl53l0x));
+    TEST_ASSERT_EQUAL(188, vl53l0x_read_range_single_millimeters(&vl53l0x));
+}
+
+// Every fifth sample is a phase failure far off the target
+static void invalidEveryFifth(vl53l0x_sim_t *self, uint32_t index, vl53l0x_sim_target_t *target, void *param)
+{
+    if (index % 5 == 0)
+    {
+        target->distance_mm = 20;
+        target->range_status = 4;
+    }
+}
+
+// Enabled reference SPADs in the map on the device, and whether any of them is
+// an aperture SPAD (index 12 on); the two types are never mixed
+static uint8_t refSpadCount(bool *aperture)
+{
+    uint8_t count = 0;
+
+    *aperture = false;
+
+    for (uint8_t i = 0; i < 48; i++)
+    {
+        if ((vl53l0x_sim_get_reg(&sim, 0, 0xB0 + i / 8) >> (i % 8)) & 0x01)
+        {
+            count++;
+            *aperture = i >= 12;
+        }
+    }
+
+    return count;
+}
+
+static void test_ref_spad_management(void)
+{
+    vl53l0x_calibration_t calibration;
+    bool aperture;
+
+    TEST_ASSERT(initSensor());
+
+    // three non-aperture SPADs give 0x0900 against the 0x0A00 target, a fourth
+    // 0x0C00, which is further off
+    TEST_ASSERT(vl53l0x_perform_ref_spad_management(&vl53l0x));
+    TEST_ASSERT_EQUAL(3, refSpadCount(&aperture));
+    TEST_ASSERT(!aperture);
+    TEST_ASSERT_EQUAL(0x07, vl53l0x_sim_get_reg(&sim, 0, 0xB0));
+
+    TEST_ASSERT_EQUAL(0x2C, vl53l0x_sim_get_reg(&sim, 1, 0x4E)); // DYNAMIC_SPAD_NUM_REQUESTED_REF_SPAD
+    TEST_ASSERT_EQUAL(0x00, vl53l0x_sim_get_reg(&sim, 1, 0x4F)); // DYNAMIC_SPAD_REF_EN_START_OFFSET
+    TEST_ASSERT_EQUAL(0xB4, vl53l0x_sim_get_reg(&sim, 0, 0xB6)); // GLOBAL_CONFIG_REF_EN_START_SELECT
+
+    vl53l0x_get_calibration(&vl53l0x, &calibration);
+    TEST_ASSERT_EQUAL(0x07, calibration.ref_spad_map[0]);
+
+    // a cover glass reflecting into the reference array: the minimum of
+    // non-aperture SPADs is already too much, ten aperture SPADs hit the target
+    sim._ref_rate_spad = 0x0400;
+
+    TEST_ASSERT(vl53l0x_perform_ref_spad_management(&vl53l0x));
+    TEST_ASSERT_EQUAL(10, refSpadCount(&aperture));
+    TEST_ASSERT(aperture);
+    TEST_ASSERT_EQUAL(0x00, vl53l0x_sim_get_reg(&sim, 0, 0xB0));
+    TEST_ASSERT_EQUAL(0xF0, vl53l0x_sim_get_reg(&sim, 0, 0xB1));
+    TEST_ASSERT_EQUAL(0x3F, vl53l0x_sim_get_reg(&sim, 0, 0xB2));
+
+    vl53l0x_get_calibration(&vl53l0x, &calibration);
+    TEST_ASSERT_EQUAL(0xF0, calibration.ref_spad_map[1]);
+}
+
+static void test_ref_spad_management_exhausted(void)
+{
+    vl53l0x_calibration_t calibration;
+    vl53l0x_calibration_t after;
+
+    // only the first four SPADs are good, and all of them together do not
+    // reach the target
+    setUp();
+    memset(&sim._regs[0][0xB0], 0, 6);
+    sim._regs[0][0xB0] = 0x0F;
+    sim._ref_rate_spad = 0x0100;
+    TEST_ASSERT(vl53l0x_init(&vl53l0x, BC_I2C_I2C0, VL53L0X_DEFAULT_ADDRESS, 500, false));
+
+    vl53l0x_get_calibration(&vl53l0x, &calibration);
+
+    TEST_ASSERT(!vl53l0x_perform_ref_spad_management(&vl53l0x));
+
+    // the selection of the initialization is still the one reported
+    vl53l0x_get_calibration(&vl53l0x, &after);
+    TEST_ASSERT(memcmp(calibration.ref_spad_map, after.ref_spad_map, sizeof(after.ref_spad_map)) == 0);
+}
+
+static void test_offset_calibration(void)
+{
+    int32_t offset_um;
+
+    TEST_ASSERT(initSensor());
+
+    // reads 10 mm long; the invalid samples, the first one included, are
+    // skipped rather than ending the calibration
+    setDistance(110);
+    vl53l0x_sim_set_target_handler(&sim, invalidEveryFifth, NULL);
+
+    TEST_ASSERT(vl53l0x_perform_offset_calibration(&vl53l0x, 100, &offset_um));
+    TEST_ASSERT_EQUAL(-10000, offset_um);
+    TEST_ASSERT_EQUAL(VL53L0X_CALIBRATION_SAMPLES, vl53l0x_sim_get_measurements(&sim));
+
+    vl53l0x_sim_set_target_handler(&sim, NULL, NULL);
+    TEST_ASSERT_EQUAL(100, vl53l0x_read_range_single_millimeters(&vl53l0x));
+}
+
+static void test_offset_calibration_steps(void)
+{
+    vl53l0x_calibration_samples_t samples;
+    vl53l0x_result_t result;
+    int32_t offset_um;
+
+    TEST_ASSERT(initSensor());
+
+    // the readings taken one pipelined shot at a time, as the application
+    // does from a task, give the same offset as the blocking calibration
+    setDistance(110);
+    vl53l0x_sim_set_target_handler(&sim, invalidEveryFifth, NULL);
+
+    memset(&samples, 0, sizeof(samples));
+    vl53l0x_set_offset_calibration(&vl53l0x, 0);
+    TEST_ASSERT(vl53l0x_trigger_single(&vl53l0x));
+
+    for (int i = 0; i < VL53L0X_CALIBRATION_SAMPLES; i++)
+    {
+        host_advance(vl53l0x_sim_get_budget(&sim));
+        TEST_ASSERT(vl53l0x_read_range_pipelined(&vl53l0x, &result, i + 1 < VL53L0X_CALIBRATION_SAMPLES));
+        vl53l0x_calibration_add_sample(&samples, &result);
+    }
+
+    TEST_ASSERT_EQUAL(VL53L0X_CALIBRATION_SAMPLES * 4 / 5, samples.count);
+    TEST_ASSERT(vl53l0x_finish_offset_calibration(&vl53l0x, &samples, 100, &offset_um));
+    TEST_ASSERT_EQUAL(-10000, offset_um);
+    TEST_ASSERT_EQUAL(VL53L0X_CALIBRATION_SAMPLES, vl53l0x_sim_get_measurements(&sim));
+
+    // nothing valid, nothing set
+    memset(&samples, 0, sizeof(samples));
+    TEST_ASSERT(!vl53l0x_finish_offset_calibration(&vl53l0x, &samples, 100, &offset_um));
+    TEST_ASSERT_EQUAL(-10000, vl53l0x_get_offset_calibration(&vl53l0x));
+}
+
+static void test_xtalk_calibration(void)
+{
+    vl53l0x_sim_target_t target;
+    uint16_t xtalk_rate;
+
+    TEST_ASSERT(initSensor());
+
+    // 0.25 MCPS of cover glass crosstalk over 10 SPADs next to 1 MCPS from a
+    // grey target at 600 mm
+    target = sim._target;
+    target.distance_mm = 600;
+    target.signal_rate = 128;
+    target.xtalk_rate = 32;
+    target.spad_count = 10 << 8;
+    vl53l0x_sim_set_target(&sim, &target);
+
+    TEST_ASSERT(vl53l0x_read_range_single_millimeters(&vl53l0x) < 600);
+
+    // 0.025 MCPS per SPAD in Q3.13
+    TEST_ASSERT(vl53l0x_perform_xtalk_calibration(&vl53l0x, 600, &xtalk_rate));
+    TEST_ASSERT_WITHIN(2, 205, xtalk_rate);
+    TEST_ASSERT_EQUAL(xtalk_rate, vl53l0x_get_xtalk_compensation(&vl53l0x));
+}
+
+static void test_init_warm(void)
+{
+    vl53l0x_calibration_t calibration;
+    host_stats_t stats;
+
+    TEST_ASSERT(initSensor());
+    vl53l0x_get_calibration(&vl53l0x, &calibration);
+
+    setUp();
+    TEST_ASSERT(vl53l0x_init_warm(&vl53l0x, BC_I2C_I2C0, VL53L0X_DEFAULT_ADDRESS, 500, false, &calibration, false));
+    TEST_ASSERT_EQUAL(calibration.vhv_settings, vl53l0x_sim_get_reg(&sim, 0, 0xCB));
+
+    // a device that does not answer fails it, and the bus recovery between the
+    // retries runs on an initialized timer
+    setUp();
+    vl53l0x_sim_fail_next(&sim, 100000);
+    TEST_ASSERT(!vl53l0x_init_warm(&vl53l0x, BC_I2C_I2C0, VL53L0X_DEFAULT_ADDRESS, 500, false, &calibration, false));
+    TEST_ASSERT_EQUAL(VL53L0X_ERROR_BUS, vl53l0x_get_error(&vl53l0x));
+
+    host_get_stats(&stats);
+    TEST_ASSERT_EQUAL(0, stats.timer_uninitialized);
+}
+
+static void test_timeout(void)
+{
+    TEST_ASSERT(initSensor());
+
+    // the budget outlasts the timeout
+    TEST_ASSERT(vl53l0x_set_measurement_timing_budget(&vl53l0x, 800000));
+
+    TEST_ASSERT_EQUAL(65535, vl53l0x_read_range_single_millimeters(&vl53l0x));
+    TEST_ASSERT(vl53l0x_timeout_occurred(&vl53l0x));
+    TEST_ASSERT_EQUAL(VL53L0X_ERROR_TIMEOUT, vl53l0x_get_error(&vl53l0x));
+}
+
+static void test_address(void)
+{
+    TEST_ASSERT(initSensor());
+
+    vl53l0x_set_address(&vl53l0x, 0x30);
+    TEST_ASSERT_EQUAL(0x30, sim._address);
+    TEST_ASSERT_EQUAL(500, vl53l0x_read_range_single_millimeters(&vl53l0x));
+}
+
+static vl53l0x_event_t async_event;
+static uint16_t async_range_mm;
+
+static void asyncHandler(vl53l0x_t *self, vl53l0x_event_t event, const vl53l0x_result_t *result, void *param)
+{
+    async_event = event;
+    async_range_mm = result != NULL ? result->range_mm : 0;
+}
+
+static void test_init_multi(void)
+{
+    static vl53l0x_sim_t sims[2];
+    static vl53l0x_t sensors[2];
+    const bc_gpio_channel_t xshut[2] = { BC_GPIO_P0, BC_GPIO_P1 };
+    const uint8_t addresses[2] = { 0x30, 0x31 };
+    const uint16_t distances_mm[2] = { 200, 700 };
+    vl53l0x_bus_stats_t stats;
+
+    host_reset();
+
+    // both power up at the default address, held in reset until released
+    for (int i = 0; i < 2; i++)
+    {
+        vl53l0x_sim_init(&sims[i], VL53L0X_DEFAULT_ADDRESS);
+        vl53l0x_sim_attach_xshut(&sims[i], xshut[i]);
+        host_attach(BC_I2C_I2C0, &sims[i]);
+
+        vl53l0x_sim_target_t target = sims[i]._target;
+        target.distance_mm = distances_mm[i];
+        vl53l0x_sim_set_target(&sims[i], &target);
+    }
+
+    TEST_ASSERT(vl53l0x_init_multi(sensors, xshut, addresses, 2, BC_I2C_I2C0, 500, false));
+
+    for (int i = 0; i < 2; i++)
+    {
+        TEST_ASSERT_EQUAL(addresses[i], sims[i]._address);
+
+        // no transaction was refused, so none came before the device booted
+        vl53l0x_get_bus_stats(&sensors[i], &stats);
+        TEST_ASSERT_EQUAL(0, stats.retries);
+        TEST_ASSERT_EQUAL(0, stats.errors);
+    }
+
+    // each answers at its own address with its own target
+    for (int i = 0; i < 2; i++)
+    {
+        TEST_ASSERT_EQUAL(distances_mm[i], vl53l0x_read_range_single_millimeters(&sensors[i]));
+        TEST_ASSERT_EQUAL(1, vl53l0x_sim_get_measurements(&sims[i]));
+    }
+
+    TEST_ASSERT_EQUAL(distances_mm[0], vl53l0x_read_range_single_millimeters(&sensors[0]));
+    TEST_ASSERT_EQUAL(2, vl53l0x_sim_get_measurements(&sims[0]));
+    TEST_ASSERT_EQUAL(1, vl53l0x_sim_get_measurements(&sims[1]));
+}
+
+// Every measurement 10 mm further than the previous one
+static void receding(vl53l0x_sim_t *self, uint32_t index, vl53l0x_sim_target_t *target, void *param)
+{
+    target->distance_mm = 100 + index * 10;
+}
+
+static uint32_t busTransactions(void)
+{
+    vl53l0x_bus_stats_t stats;
+
+    vl53l0x_get_bus_stats(&vl53l0x, &stats);
+
+    return stats.transactions;
+}
+
+static void test_pipelined(void)
+{
+    vl53l0x_result_t result;
+
+    TEST_ASSERT(initSensor());
+
+    vl53l0x_sim_set_target_handler(&sim, receding, NULL);
+
+    // nothing to collect before a trigger
+    TEST_ASSERT(!vl53l0x_read_range_pipelined(&vl53l0x, &result, true));
+
+    // every result is the shot that was pending, in order, and the rearmed
+    // shot is measured while the previous one is returned
+    uint32_t first = vl53l0x_sim_get_measurements(&sim);
+    TEST_ASSERT(vl53l0x_trigger_single(&vl53l0x));
+
+    for (uint32_t i = 0; i < 10; i++)
+    {
+        TEST_ASSERT(vl53l0x_read_range_pipelined(&vl53l0x, &result, i < 9));
+        TEST_ASSERT_EQUAL(100 + (first + i) * 10, result.range_mm);
+    }
+
+    TEST_ASSERT_EQUAL(first + 10, vl53l0x_sim_get_measurements(&sim));
+    TEST_ASSERT(!vl53l0x_read_range_pipelined(&vl53l0x, &result, true));
+    TEST_ASSERT_EQUAL(0x00, vl53l0x_sim_get_reg(&sim, 0, 0x13));
+
+    // per sample, besides the status polls: the result block, the interrupt
+    // clear and the start, two transactions as they are separate registers; a
+    // single shot adds the start bit polls
+    TEST_ASSERT(vl53l0x_trigger_single(&vl53l0x));
+    TEST_ASSERT(vl53l0x_read_range_pipelined(&vl53l0x, &result, true));
+    vl53l0x_reset_bus_stats(&vl53l0x);
+    uint32_t polls = vl53l0x_sim_get_status_polls(&sim);
+
+    for (int i = 0; i < 10; i++)
+    {
+        TEST_ASSERT(vl53l0x_read_range_pipelined(&vl53l0x, &result, true));
+    }
+
+    TEST_ASSERT_EQUAL(10 * 3, busTransactions() - (vl53l0x_sim_get_status_polls(&sim) - polls));
+
+    TEST_ASSERT(vl53l0x_read_range_pipelined(&vl53l0x, &result, false));
+    vl53l0x_reset_bus_stats(&vl53l0x);
+    polls = vl53l0x_sim_get_status_polls(&sim);
+
+    for (int i = 0; i < 10; i++)
+    {
+        TEST_ASSERT(vl53l0x_read_range_single_millimeters(&vl53l0x) != 65535);
+    }
+
+    TEST_ASSERT(busTransactions() - (vl53l0x_sim_get_status_polls(&sim) - polls) > 10 * 3);
+
+    // with 5 ms of processing per sample, the pipelined shots range during it
+    // and keep the pace of the budget; single shots add it to every sample
+    uint64_t start_us = host_get_us();
+
+    for (int i = 0; i < 10; i++)
+    {
+        TEST_ASSERT(vl53l0x_read_range_single_millimeters(&vl53l0x) != 65535);
+        host_advance(5000);
+    }
+
+    uint64_t single_us = host_get_us() - start_us;
+
+    start_us = host_get_us();
+    TEST_ASSERT(vl53l0x_trigger_single(&vl53l0x));
+
+    for (int i = 0; i < 10; i++)
+    {
+        TEST_ASSERT(vl53l0x_read_range_pipelined(&vl53l0x, &result, i < 9));
+        host_advance(5000);
+    }
+
+    uint64_t pipelined_us = host_get_us() - start_us;
+
+    TEST_ASSERT(pipelined_us < 10 * (vl53l0x_sim_get_budget(&sim) + 1500));
+    TEST_ASSERT(pipelined_us + 10 * 4000 < single_us);
+}
+
+static void test_async(void)
+{
+    setUp();
+
+    async_event = VL53L0X_EVENT_TIMEOUT;
+    vl53l0x_set_event_handler(&vl53l0x, asyncHandler, NULL);
+
+    TEST_ASSERT(vl53l0x_init_async(&vl53l0x, BC_I2C_I2C0, VL53L0X_DEFAULT_ADDRESS, 500, false));
+    host_run(100);
+    TEST_ASSERT(!vl53l0x_is_busy(&vl53l0x));
+    TEST_ASSERT_EQUAL(VL53L0X_EVENT_INIT_DONE, async_event);
+
+    setDistance(750);
+
+    TEST_ASSERT(vl53l0x_read_range_single_async(&vl53l0x));
+    host_run(host_get_us() / 1000 + 100);
+    TEST_ASSERT_EQUAL(VL53L0X_EVENT_RESULT, async_event);
+    TEST_ASSERT_EQUAL(750, async_range_mm);
+}
+
+int main(void)
+{
+    TEST_RUN(test_init);
+    TEST_RUN(test_stop_variable_paging);
+    TEST_RUN(test_single);
+    TEST_RUN(test_back_to_back);
+    TEST_RUN(test_timed);
+    TEST_RUN(test_wait_polls);
+    TEST_RUN(test_sigma);
+    TEST_RUN(test_timing_budget);
+    TEST_RUN(test_vcsel_period);
+    TEST_RUN(test_apply_config);
+    TEST_RUN(test_apply_config_infeasible);
+    TEST_RUN(test_offset);
+    TEST_RUN(test_ref_spad_management);
+    TEST_RUN(test_ref_spad_management_exhausted);
+    TEST_RUN(test_offset_calibration);
+    TEST_RUN(test_offset_calibration_steps);
+    TEST_RUN(test_xtalk_calibration);
+    TEST_RUN(test_init_warm);
+    TEST_RUN(test_timeout);
+    TEST_RUN(test_address);
+    TEST_RUN(test_init_multi);
+    TEST_RUN(test_async);
+    TEST_RUN(test_pipelined);
+
+    return test_summary("vl53l0x");
+}
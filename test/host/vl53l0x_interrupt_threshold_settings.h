@@ -0,0 +1,18 @@
+#ifndef _VL53L0X_INTERRUPT_THRESHOLD_SETTINGS_H
+#define _VL53L0X_INTERRUPT_THRESHOLD_SETTINGS_H
+
+// Stand-in for InterruptThresholdSettings of the ST API in the host build: the
+// layout is ST's, the values only show that the table was written
+
+uint8_t InterruptThresholdSettings[] =
+{
+    0x01, 0xFF, 0x04,
+    0x01, 0x70, 0x01,
+    0x02, 0x71, 0xA5, 0x5A,
+    0xFF, 0x02, 0x00, 0x10, // an ST API parameter, skipped
+    0x01, 0xFF, 0x00,
+    0x01, 0x80, 0x01,
+    0x00
+};
+
+#endif // _VL53L0X_INTERRUPT_THRESHOLD_SETTINGS_H
@@ -0,0 +1,591 @@
+#include <vl53l0x_sim.h>
+#include <host.h>
+
+typedef enum
+{
+    SYSRANGE_START                       = 0x00,
+    SYSTEM_SEQUENCE_CONFIG               = 0x01,
+    SYSTEM_INTERMEASUREMENT_PERIOD       = 0x04,
+    SYSTEM_INTERRUPT_CONFIG_GPIO         = 0x0A,
+    SYSTEM_INTERRUPT_CLEAR               = 0x0B,
+    SYSTEM_THRESH_HIGH                   = 0x0C,
+    SYSTEM_THRESH_LOW                    = 0x0E,
+    RESULT_INTERRUPT_STATUS              = 0x13,
+    RESULT_RANGE_STATUS                  = 0x14,
+    ALGO_PART_TO_PART_RANGE_OFFSET_MM    = 0x28,
+    MSRC_CONFIG_TIMEOUT_MACROP           = 0x46,
+    PRE_RANGE_CONFIG_VCSEL_PERIOD        = 0x50,
+    PRE_RANGE_CONFIG_TIMEOUT_MACROP_HI   = 0x51,
+    FINAL_RANGE_CONFIG_VCSEL_PERIOD      = 0x70,
+    FINAL_RANGE_CONFIG_TIMEOUT_MACROP_HI = 0x71,
+    GPIO_HV_MUX_ACTIVE_HIGH              = 0x84,
+    I2C_SLAVE_DEVICE_ADDRESS             = 0x8A,
+    GLOBAL_CONFIG_SPAD_ENABLES_REF_0     = 0xB0,
+    IDENTIFICATION_MODEL_ID              = 0xC0,
+    IDENTIFICATION_REVISION_ID           = 0xC2,
+    OSC_CALIBRATE_VAL                    = 0xF8,
+    PAGE_SELECT                          = 0xFF
+} simRegAddr;
+
+// Registers outside page 0
+#define PAGE1_STOP_VARIABLE 0x91
+#define PAGE1_PEAK_SIGNAL_RATE_REF 0xB6
+#define PAGE7_NVM_READY 0x83
+#define PAGE7_SPAD_INFO 0x92
+
+// Reference calibration results, page 0
+#define REF_CALIBRATION_VHV 0xCB
+#define REF_CALIBRATION_PHASE 0xEE
+
+#define SIM_STOP_VARIABLE 0x3C
+#define SIM_SPAD_INFO 0x05 // 5 non-aperture SPADs
+#define SIM_VHV_SETTINGS 0x1C
+#define SIM_PHASE_CAL 0x21
+#define SIM_OSC_CALIBRATE_VAL 1000
+
+static uint8_t simRead(vl53l0x_sim_t *self, uint8_t reg, uint64_t now_us);
+static void simWrite(vl53l0x_sim_t *self, uint8_t reg, uint8_t value, uint64_t now_us);
+static void simStart(vl53l0x_sim_t *self, uint8_t value, uint64_t now_us);
+static void simComplete(vl53l0x_sim_t *self, uint64_t at_us);
+static void simInterrupt(vl53l0x_sim_t *self, uint8_t status);
+static void simInterruptClear(vl53l0x_sim_t *self);
+static uint16_t simRefSignalRate(vl53l0x_sim_t *self);
+static uint16_t simGet16(vl53l0x_sim_t *self, uint8_t reg);
+static void simPut16(vl53l0x_sim_t *self, uint8_t reg, uint16_t value);
+static uint32_t simTimeoutUs(uint16_t timeout_mclks, uint8_t vcsel_period_pclks);
+
+// Power up the device at the given address, with the register contents the
+// driver depends on: identification, stop variable, SPAD info, good SPAD map
+// and the oscillator calibration. The target defaults to a white card at
+// 500 mm.
+void vl53l0x_sim_init(vl53l0x_sim_t *self, uint8_t address)
+{
+    memset(self, 0, sizeof(*self));
+
+    self->_address = address;
+    self->_powered = true;
+    self->_ready_us = VL53L0X_SIM_NEVER;
+    self->_nvm_ready_us = VL53L0X_SIM_NEVER;
+    self->_osc_ticks_per_ms = SIM_OSC_CALIBRATE_VAL;
+
+    self->_regs[0][SYSTEM_SEQUENCE_CONFIG] = 0xFF;
+    self->_regs[0][MSRC_CONFIG_TIMEOUT_MACROP] = 0x25;
+    self->_regs[0][PRE_RANGE_CONFIG_VCSEL_PERIOD] = 0x06;
+    simPut16(self, PRE_RANGE_CONFIG_TIMEOUT_MACROP_HI, 0x0096);
+    self->_regs[0][FINAL_RANGE_CONFIG_VCSEL_PERIOD] = 0x04;
+    simPut16(self, FINAL_RANGE_CONFIG_TIMEOUT_MACROP_HI, 0x01FE);
+    self->_regs[0][GPIO_HV_MUX_ACTIVE_HIGH] = 0x11;
+    memset(&self->_regs[0][GLOBAL_CONFIG_SPAD_ENABLES_REF_0], 0xFF, 6);
+    self->_regs[0][IDENTIFICATION_MODEL_ID] = 0xEE;
+    self->_regs[0][IDENTIFICATION_REVISION_ID] = 0x10;
+    simPut16(self, OSC_CALIBRATE_VAL, SIM_OSC_CALIBRATE_VAL);
+
+    self->_regs[1][PAGE1_STOP_VARIABLE] = SIM_STOP_VARIABLE;
+    self->_regs[7][PAGE7_SPAD_INFO] = SIM_SPAD_INFO;
+
+    self->_target.distance_mm = 500;
+    self->_target.signal_rate = 0x0A00;
+    self->_target.ambient_rate = 0x0040;
+    self->_target.spad_count = 0x0A00;
+    self->_target.range_status = 11;
+
+    self->_ref_rate_spad = VL53L0X_SIM_REF_RATE_SPAD;
+    self->_ref_rate_aperture_spad = VL53L0X_SIM_REF_RATE_APERTURE_SPAD;
+}
+
+// Deliver the GPIO1 edges to an EXTI line
+void vl53l0x_sim_attach_gpio1(vl53l0x_sim_t *self, bc_exti_line_t exti_line)
+{
+    self->_gpio1_attached = true;
+    self->_gpio1_exti_line = exti_line;
+}
+
+// Power the device through the XSHUT pin at channel: it is held in reset
+// while the pin is low, and boots at the default address when it goes high
+void vl53l0x_sim_attach_xshut(vl53l0x_sim_t *self, bc_gpio_channel_t channel)
+{
+    self->_xshut_attached = true;
+    self->_xshut_channel = channel;
+    self->_powered = false;
+}
+
+// XSHUT edge from host.c; a reset loses the registers but keeps the target
+// and the attached pins
+void vl53l0x_sim_set_xshut(vl53l0x_sim_t *self, bool high, uint64_t now_us)
+{
+    if (!high)
+    {
+        self->_powered = false;
+
+        return;
+    }
+
+    if (self->_powered)
+    {
+        return;
+    }
+
+    vl53l0x_sim_t state = *self;
+
+    vl53l0x_sim_init(self, VL53L0X_SIM_DEFAULT_ADDRESS);
+
+    self->_target = state._target;
+    self->_target_handler = state._target_handler;
+    self->_target_param = state._target_param;
+    self->_gpio1_attached = state._gpio1_attached;
+    self->_gpio1_exti_line = state._gpio1_exti_line;
+    self->_xshut_attached = true;
+    self->_xshut_channel = state._xshut_channel;
+    self->_boot_us = now_us + VL53L0X_SIM_BOOT_US;
+}
+
+// Does the device acknowledge its address now? Not in reset or while booting.
+bool vl53l0x_sim_answers(vl53l0x_sim_t *self, uint8_t address, uint64_t now_us)
+{
+    return self->_address == address && self->_powered && now_us >= self->_boot_us;
+}
+
+void vl53l0x_sim_set_target(vl53l0x_sim_t *self, const vl53l0x_sim_target_t *target)
+{
+    self->_target = *target;
+}
+
+// Have the handler adjust the target before every measurement, starting from
+// the one set by vl53l0x_sim_set_target()
+void vl53l0x_sim_set_target_handler(vl53l0x_sim_t *self, vl53l0x_sim_target_handler_t handler, void *param)
+{
+    self->_target_handler = handler;
+    self->_target_param = param;
+}
+
+// Time continuous ranging spends between the end of one measurement and the
+// start of the next, on top of the timing budget
+void vl53l0x_sim_set_cycle_overhead(vl53l0x_sim_t *self, uint32_t overhead_us)
+{
+    self->_cycle_overhead_us = overhead_us;
+}
+
+// Actual oscillator ticks per millisecond, against the OSC_CALIBRATE_VAL the
+// driver scales the timed ranging period with
+void vl53l0x_sim_set_oscillator(vl53l0x_sim_t *self, uint16_t ticks_per_ms)
+{
+    self->_osc_ticks_per_ms = ticks_per_ms;
+}
+
+// NACK the next count transactions
+void vl53l0x_sim_fail_next(vl53l0x_sim_t *self, uint32_t count)
+{
+    self->_fail_next = count;
+}
+
+uint8_t vl53l0x_sim_get_reg(vl53l0x_sim_t *self, uint8_t page, uint8_t reg)
+{
+    return reg == PAGE_SELECT ? self->_page : self->_regs[page & 0x07][reg];
+}
+
+// Measurement time programmed into the sequence step registers, computed the
+// way VL53L0X_set_measurement_timing_budget_micro_seconds() splits it
+uint32_t vl53l0x_sim_get_budget(vl53l0x_sim_t *self)
+{
+    uint8_t sequence_config = self->_regs[0][SYSTEM_SEQUENCE_CONFIG];
+    uint8_t pre_range_vcsel = (self->_regs[0][PRE_RANGE_CONFIG_VCSEL_PERIOD] + 1) << 1;
+    uint8_t final_range_vcsel = (self->_regs[0][FINAL_RANGE_CONFIG_VCSEL_PERIOD] + 1) << 1;
+    uint16_t pre_range_reg = simGet16(self, PRE_RANGE_CONFIG_TIMEOUT_MACROP_HI);
+    uint16_t final_range_reg = simGet16(self, FINAL_RANGE_CONFIG_TIMEOUT_MACROP_HI);
+    uint16_t msrc_mclks = self->_regs[0][MSRC_CONFIG_TIMEOUT_MACROP] + 1;
+    uint16_t pre_range_mclks = ((pre_range_reg & 0xFF) << (pre_range_reg >> 8)) + 1;
+    uint16_t final_range_mclks = ((final_range_reg & 0xFF) << (final_range_reg >> 8)) + 1;
+
+    uint32_t msrc_us = simTimeoutUs(msrc_mclks, pre_range_vcsel);
+    uint32_t budget_us = 1320 + 960;
+
+    if (sequence_config & 0x10)
+    {
+        budget_us += msrc_us + 590;
+    }
+
+    if (sequence_config & 0x08)
+    {
+        budget_us += 2 * (msrc_us + 690);
+    }
+    else if (sequence_config & 0x04)
+    {
+        budget_us += msrc_us + 660;
+    }
+
+    if (sequence_config & 0x40)
+    {
+        budget_us += simTimeoutUs(pre_range_mclks, pre_range_vcsel) + 660;
+        final_range_mclks -= pre_range_mclks;
+    }
+
+    if (sequence_config & 0x80)
+    {
+        budget_us += simTimeoutUs(final_range_mclks, final_range_vcsel) + 550;
+    }
+
+    return budget_us;
+}
+
+vl53l0x_sim_mode_t vl53l0x_sim_get_mode(vl53l0x_sim_t *self)
+{
+    return self->_mode;
+}
+
+// Ranging measurements completed since power up
+uint32_t vl53l0x_sim_get_measurements(vl53l0x_sim_t *self)
+{
+    return self->_measurements;
+}
+
+// Reads that covered RESULT_INTERRUPT_STATUS
+uint32_t vl53l0x_sim_get_status_polls(vl53l0x_sim_t *self)
+{
+    return self->_status_polls;
+}
+
+// Run one I2C transaction starting at now_us, auto-incrementing the register
+// address; false for a NACK
+bool vl53l0x_sim_transfer(vl53l0x_sim_t *self, bool read, uint8_t reg, uint8_t *buffer, size_t length, uint64_t now_us)
+{
+    vl53l0x_sim_update(self, now_us);
+
+    if (self->_fail_next != 0)
+    {
+        self->_fail_next--;
+
+        return false;
+    }
+
+    if (read)
+    {
+        self->_reads++;
+        self->_bytes += 3 + length;
+
+        if (self->_page == 0 && reg <= RESULT_INTERRUPT_STATUS && reg + length > RESULT_INTERRUPT_STATUS)
+        {
+            self->_status_polls++;
+        }
+
+        for (size_t i = 0; i < length; i++)
+        {
+            buffer[i] = simRead(self, reg + i, now_us);
+        }
+    }
+    else
+    {
+        self->_writes++;
+        self->_bytes += 2 + length;
+
+        for (size_t i = 0; i < length; i++)
+        {
+            simWrite(self, reg + i, buffer[i], now_us);
+        }
+    }
+
+    return true;
+}
+
+// Time of the next change of state on its own, VL53L0X_SIM_NEVER if none
+uint64_t vl53l0x_sim_next_event(vl53l0x_sim_t *self)
+{
+    return self->_nvm_ready_us < self->_ready_us ? self->_nvm_ready_us : self->_ready_us;
+}
+
+// Bring the device up to now_us, completing the measurements due in between
+void vl53l0x_sim_update(vl53l0x_sim_t *self, uint64_t now_us)
+{
+    while (vl53l0x_sim_next_event(self) <= now_us)
+    {
+        if (self->_nvm_ready_us <= self->_ready_us)
+        {
+            self->_regs[7][PAGE7_NVM_READY] = 0x10;
+            self->_nvm_ready_us = VL53L0X_SIM_NEVER;
+        }
+        else
+        {
+            simComplete(self, self->_ready_us);
+        }
+    }
+}
+
+static uint8_t simRead(vl53l0x_sim_t *self, uint8_t reg, uint64_t now_us)
+{
+    if (reg == PAGE_SELECT)
+    {
+        return self->_page;
+    }
+
+    uint8_t value = self->_regs[self->_page & 0x07][reg];
+
+    if (self->_page == 0 && reg == SYSRANGE_START && now_us >= self->_start_us + VL53L0X_SIM_START_US)
+    {
+        value &= ~0x01;
+    }
+
+    return value;
+}
+
+static void simWrite(vl53l0x_sim_t *self, uint8_t reg, uint8_t value, uint64_t now_us)
+{
+    if (reg == PAGE_SELECT)
+    {
+        self->_page = value;
+
+        return;
+    }
+
+    self->_regs[self->_page & 0x07][reg] = value;
+
+    if (self->_page == 7 && reg == PAGE7_NVM_READY && value == 0x00)
+    {
+        self->_nvm_ready_us = now_us + VL53L0X_SIM_NVM_US;
+    }
+
+    if (self->_page != 0)
+    {
+        return;
+    }
+
+    switch (reg)
+    {
+        case SYSRANGE_START:
+        {
+            simStart(self, value, now_us);
+            break;
+        }
+        case SYSTEM_INTERRUPT_CLEAR:
+        {
+            if (value & 0x01)
+            {
+                simInterruptClear(self);
+            }
+            break;
+        }
+        case I2C_SLAVE_DEVICE_ADDRESS:
+        {
+            self->_address = value & 0x7F;
+            break;
+        }
+        default:
+        {
+            break;
+        }
+    }
+}
+
+// SYSRANGE_START: 0x01 starts a single shot, or a reference calibration when
+// the sequence config selects only VHV or phase calibration, 0x02 starts back
+// to back and 0x04 timed ranging; 0x01 stops continuous ranging
+static void simStart(vl53l0x_sim_t *self, uint8_t value, uint64_t now_us)
+{
+    uint8_t sequence_config = self->_regs[0][SYSTEM_SEQUENCE_CONFIG];
+
+    if ((self->_mode == VL53L0X_SIM_MODE_BACK_TO_BACK || self->_mode == VL53L0X_SIM_MODE_TIMED) && value == 0x01)
+    {
+        self->_mode = VL53L0X_SIM_MODE_IDLE;
+        self->_ready_us = VL53L0X_SIM_NEVER;
+        self->_regs[0][SYSRANGE_START] = 0x00;
+
+        return;
+    }
+
+    if (value & 0x02)
+    {
+        self->_mode = VL53L0X_SIM_MODE_BACK_TO_BACK;
+        self->_ready_us = now_us + vl53l0x_sim_get_budget(self);
+    }
+    else if (value & 0x04)
+    {
+        self->_mode = VL53L0X_SIM_MODE_TIMED;
+        self->_ready_us = now_us + vl53l0x_sim_get_budget(self);
+    }
+    else if (value & 0x01)
+    {
+        if (sequence_config == 0x01 || sequence_config == 0x02)
+        {
+            self->_mode = VL53L0X_SIM_MODE_REF_CALIBRATION;
+            self->_ready_us = now_us + VL53L0X_SIM_REF_CALIBRATION_US;
+        }
+        else
+        {
+            self->_mode = VL53L0X_SIM_MODE_SINGLE;
+            self->_ready_us = now_us + vl53l0x_sim_get_budget(self);
+        }
+    }
+    else
+    {
+        return;
+    }
+
+    self->_start_us = now_us;
+}
+
+// Finish the measurement due at at_us: fill in the result block, raise the
+// interrupt if the GPIO1 configuration asks for it and plan the next
+// measurement of continuous ranging
+static void simComplete(vl53l0x_sim_t *self, uint64_t at_us)
+{
+    if (self->_mode == VL53L0X_SIM_MODE_REF_CALIBRATION)
+    {
+        if (self->_regs[0][SYSTEM_SEQUENCE_CONFIG] == 0x01)
+        {
+            self->_regs[0][REF_CALIBRATION_VHV] = SIM_VHV_SETTINGS;
+        }
+        else
+        {
+            self->_regs[0][REF_CALIBRATION_PHASE] = (self->_regs[0][REF_CALIBRATION_PHASE] & 0x80) | SIM_PHASE_CAL;
+        }
+
+        self->_mode = VL53L0X_SIM_MODE_IDLE;
+        self->_ready_us = VL53L0X_SIM_NEVER;
+        simInterrupt(self, 0x04);
+
+        return;
+    }
+
+    vl53l0x_sim_target_t target = self->_target;
+
+    if (self->_target_handler != NULL)
+    {
+        self->_target_handler(self, self->_measurements, &target, self->_target_param);
+    }
+
+    self->_measurements++;
+
+    // crosstalk adds signal from zero distance, which pulls the range short
+    uint32_t signal_rate = (uint32_t) target.signal_rate + target.xtalk_rate;
+    int32_t range_mm = signal_rate == 0 ? target.distance_mm : (int32_t) ((uint32_t) target.distance_mm * target.signal_rate / signal_rate);
+
+    // 12-bit two's complement in quarter millimeters
+    int32_t offset = simGet16(self, ALGO_PART_TO_PART_RANGE_OFFSET_MM) & 0x0FFF;
+    offset = offset & 0x0800 ? offset - 0x1000 : offset;
+    range_mm += offset / 4;
+    range_mm = range_mm < 0 ? 0 : range_mm;
+
+    self->_regs[0][RESULT_RANGE_STATUS] = target.range_status << 3;
+    simPut16(self, RESULT_RANGE_STATUS + 2, target.spad_count);
+    simPut16(self, RESULT_RANGE_STATUS + 6, signal_rate > UINT16_MAX ? UINT16_MAX : signal_rate);
+    simPut16(self, RESULT_RANGE_STATUS + 8, target.ambient_rate);
+    simPut16(self, RESULT_RANGE_STATUS + 10, range_mm);
+
+    uint16_t ref_rate = simRefSignalRate(self);
+    self->_regs[1][PAGE1_PEAK_SIGNAL_RATE_REF] = ref_rate >> 8;
+    self->_regs[1][PAGE1_PEAK_SIGNAL_RATE_REF + 1] = ref_rate & 0xFF;
+
+    uint8_t interrupt_config = self->_regs[0][SYSTEM_INTERRUPT_CONFIG_GPIO] & 0x07;
+    int32_t high_mm = simGet16(self, SYSTEM_THRESH_HIGH) * 2;
+    int32_t low_mm = simGet16(self, SYSTEM_THRESH_LOW) * 2;
+
+    if ((interrupt_config == 0x01 && range_mm < low_mm) ||
+        (interrupt_config == 0x02 && range_mm > high_mm) ||
+        (interrupt_config == 0x03 && (range_mm < low_mm || range_mm > high_mm)) ||
+        interrupt_config == 0x04)
+    {
+        simInterrupt(self, interrupt_config);
+    }
+
+    switch (self->_mode)
+    {
+        case VL53L0X_SIM_MODE_BACK_TO_BACK:
+        {
+            self->_ready_us = at_us + vl53l0x_sim_get_budget(self) + self->_cycle_overhead_us;
+            break;
+        }
+        case VL53L0X_SIM_MODE_TIMED:
+        {
+            uint32_t period_ticks = ((uint32_t) simGet16(self, SYSTEM_INTERMEASUREMENT_PERIOD) << 16) | simGet16(self, SYSTEM_INTERMEASUREMENT_PERIOD + 2);
+            uint64_t period_us = (uint64_t) period_ticks * 1000 / self->_osc_ticks_per_ms;
+            uint64_t cycle_us = vl53l0x_sim_get_budget(self) + self->_cycle_overhead_us;
+
+            self->_ready_us = at_us + (period_us > cycle_us ? period_us : cycle_us);
+            break;
+        }
+        default:
+        {
+            self->_mode = VL53L0X_SIM_MODE_IDLE;
+            self->_ready_us = VL53L0X_SIM_NEVER;
+            break;
+        }
+    }
+}
+
+// Set the interrupt status and assert GPIO1; a result that replaces one still
+// pending is an overrun, and the line stays asserted without a new edge
+static void simInterrupt(vl53l0x_sim_t *self, uint8_t status)
+{
+    if (self->_regs[0][RESULT_INTERRUPT_STATUS] & 0x07)
+    {
+        self->_overruns++;
+    }
+
+    self->_regs[0][RESULT_INTERRUPT_STATUS] = status;
+
+    if (self->_gpio1_asserted)
+    {
+        return;
+    }
+
+    self->_gpio1_asserted = true;
+
+    if (self->_gpio1_attached)
+    {
+        bool active_high = self->_regs[0][GPIO_HV_MUX_ACTIVE_HIGH] & 0x10;
+
+        host_exti_edge(self->_gpio1_exti_line, active_high ? BC_EXTI_EDGE_RISING : BC_EXTI_EDGE_FALLING);
+    }
+}
+
+static void simInterruptClear(vl53l0x_sim_t *self)
+{
+    self->_regs[0][RESULT_INTERRUPT_STATUS] = 0;
+
+    if (!self->_gpio1_asserted)
+    {
+        return;
+    }
+
+    self->_gpio1_asserted = false;
+
+    if (self->_gpio1_attached)
+    {
+        bool active_high = self->_regs[0][GPIO_HV_MUX_ACTIVE_HIGH] & 0x10;
+
+        host_exti_edge(self->_gpio1_exti_line, active_high ? BC_EXTI_EDGE_FALLING : BC_EXTI_EDGE_RISING);
+    }
+}
+
+// Reference signal rate of the enabled reference SPADs; the first 12 from
+// GLOBAL_CONFIG_REF_EN_START_SELECT on are non-aperture SPADs
+static uint16_t simRefSignalRate(vl53l0x_sim_t *self)
+{
+    uint32_t rate = 0;
+
+    for (uint8_t i = 0; i < 48; i++)
+    {
+        if ((self->_regs[0][GLOBAL_CONFIG_SPAD_ENABLES_REF_0 + i / 8] >> (i % 8)) & 0x01)
+        {
+            rate += i < 12 ? self->_ref_rate_spad : self->_ref_rate_aperture_spad;
+        }
+    }
+
+    return rate > UINT16_MAX ? UINT16_MAX : rate;
+}
+
+static uint16_t simGet16(vl53l0x_sim_t *self, uint8_t reg)
+{
+    return ((uint16_t) self->_regs[0][reg] << 8) | self->_regs[0][reg + 1];
+}
+
+static void simPut16(vl53l0x_sim_t *self, uint8_t reg, uint16_t value)
+{
+    self->_regs[0][reg] = value >> 8;
+    self->_regs[0][reg + 1] = value & 0xFF;
+}
+
+static uint32_t simTimeoutUs(uint16_t timeout_mclks, uint8_t vcsel_period_pclks)
+{
+    uint32_t macro_period_ns = ((uint32_t) 2304 * vcsel_period_pclks * 1655 + 500) / 1000;
+
+    return ((uint32_t) timeout_mclks * macro_period_ns + macro_period_ns / 2) / 1000;
+}
@@ -0,0 +1,114 @@
+#ifndef _VL53L0X_SIM_H
+#define _VL53L0X_SIM_H
+
+#include <bcl.h>
+
+#define VL53L0X_SIM_NEVER UINT64_MAX
+
+// Address the device answers at after power up
+#define VL53L0X_SIM_DEFAULT_ADDRESS 0x29
+
+// Firmware boot time after XSHUT goes high (tBOOT)
+#define VL53L0X_SIM_BOOT_US 1200
+
+// Time the device takes to load the SPAD info from its NVM
+#define VL53L0X_SIM_NVM_US 500
+
+// Time from the SYSRANGE_START write until the start bit clears
+#define VL53L0X_SIM_START_US 100
+
+// Duration of a VHV or phase reference calibration
+#define VL53L0X_SIM_REF_CALIBRATION_US 1000
+
+// Default reference signal rate of one enabled reference SPAD, MCPS in Q9.7
+#define VL53L0X_SIM_REF_RATE_SPAD 0x0300
+#define VL53L0X_SIM_REF_RATE_APERTURE_SPAD 0x0100
+
+typedef enum
+{
+    VL53L0X_SIM_MODE_IDLE,
+    VL53L0X_SIM_MODE_SINGLE,
+    VL53L0X_SIM_MODE_BACK_TO_BACK,
+    VL53L0X_SIM_MODE_TIMED,
+    VL53L0X_SIM_MODE_REF_CALIBRATION
+} vl53l0x_sim_mode_t;
+
+// What the next measurement sees
+typedef struct
+{
+    uint16_t distance_mm;
+    uint16_t signal_rate;   // MCPS, Q9.7, from the target alone
+    uint16_t xtalk_rate;    // MCPS, Q9.7, reflected by a cover glass
+    uint16_t ambient_rate;  // MCPS, Q9.7
+    uint16_t spad_count;    // effective return SPADs, Q8.8
+    uint8_t range_status;   // DeviceRangeStatus, 11 for a valid range
+} vl53l0x_sim_target_t;
+
+typedef struct vl53l0x_sim_t vl53l0x_sim_t;
+
+// Called before every measurement with the number of measurements so far
+typedef void (*vl53l0x_sim_target_handler_t)(vl53l0x_sim_t *self, uint32_t index, vl53l0x_sim_target_t *target, void *param);
+
+// Register file of a VL53L0X with the timing of its measurements. Registers are
+// kept per page selected through 0xFF; a measurement takes the timing budget
+// programmed into the sequence step registers, after which the result block
+// and RESULT_INTERRUPT_STATUS are set and GPIO1 is asserted until
+// SYSTEM_INTERRUPT_CLEAR. Time is driven by host.c.
+struct vl53l0x_sim_t
+{
+    uint8_t _address;
+    uint8_t _page;
+    uint8_t _regs[8][256];
+
+    vl53l0x_sim_mode_t _mode;
+    uint64_t _start_us;
+    uint64_t _ready_us;
+    uint64_t _nvm_ready_us;
+    uint32_t _measurements;
+
+    bool _gpio1_asserted;
+    bool _gpio1_attached;
+    bc_exti_line_t _gpio1_exti_line;
+
+    bool _xshut_attached;
+    bc_gpio_channel_t _xshut_channel;
+    bool _powered;
+    uint64_t _boot_us;
+
+    vl53l0x_sim_target_t _target;
+    vl53l0x_sim_target_handler_t _target_handler;
+    void *_target_param;
+    uint32_t _cycle_overhead_us;
+    uint16_t _osc_ticks_per_ms;
+    uint16_t _ref_rate_spad;          // per enabled non-aperture reference SPAD
+    uint16_t _ref_rate_aperture_spad; // per enabled aperture reference SPAD
+
+    uint32_t _fail_next;
+
+    uint32_t _reads;
+    uint32_t _writes;
+    uint32_t _bytes;
+    uint32_t _status_polls;
+    uint32_t _overruns;
+};
+
+void vl53l0x_sim_init(vl53l0x_sim_t *self, uint8_t address);
+void vl53l0x_sim_attach_gpio1(vl53l0x_sim_t *self, bc_exti_line_t exti_line);
+void vl53l0x_sim_attach_xshut(vl53l0x_sim_t *self, bc_gpio_channel_t channel);
+void vl53l0x_sim_set_xshut(vl53l0x_sim_t *self, bool high, uint64_t now_us);
+bool vl53l0x_sim_answers(vl53l0x_sim_t *self, uint8_t address, uint64_t now_us);
+void vl53l0x_sim_set_target(vl53l0x_sim_t *self, const vl53l0x_sim_target_t *target);
+void vl53l0x_sim_set_target_handler(vl53l0x_sim_t *self, vl53l0x_sim_target_handler_t handler, void *param);
+void vl53l0x_sim_set_cycle_overhead(vl53l0x_sim_t *self, uint32_t overhead_us);
+void vl53l0x_sim_set_oscillator(vl53l0x_sim_t *self, uint16_t ticks_per_ms);
+void vl53l0x_sim_fail_next(vl53l0x_sim_t *self, uint32_t count);
+uint8_t vl53l0x_sim_get_reg(vl53l0x_sim_t *self, uint8_t page, uint8_t reg);
+uint32_t vl53l0x_sim_get_budget(vl53l0x_sim_t *self);
+vl53l0x_sim_mode_t vl53l0x_sim_get_mode(vl53l0x_sim_t *self);
+uint32_t vl53l0x_sim_get_measurements(vl53l0x_sim_t *self);
+uint32_t vl53l0x_sim_get_status_polls(vl53l0x_sim_t *self);
+bool vl53l0x_sim_transfer(vl53l0x_sim_t *self, bool read, uint8_t reg, uint8_t *buffer, size_t length, uint64_t now_us);
+uint64_t vl53l0x_sim_next_event(vl53l0x_sim_t *self);
+void vl53l0x_sim_update(vl53l0x_sim_t *self, uint64_t now_us);
+
+#endif // _VL53L0X_SIM_H
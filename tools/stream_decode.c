@@ -0,0 +1,266 @@
+// Host-side decoder of the binary sample stream of app/stream.c
+//
+//   cc -O2 -Iapp -o stream_decode tools/stream_decode.c app/util.c
+//   stream_decode [capture]      decode a capture (stdin by default) to CSV
+//   stream_decode -b [frames]    decoder throughput on synthetic frames
+//
+// Decoding resynchronizes on the sync word, so log text or line noise between
+// frames is skipped; frames failing the CRC are dropped and sequence gaps are
+// reported on stderr. Built with STREAM_DECODE_NO_MAIN, the decoder can be
+// included by the host tests.
+
+#include <stdint.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+
+#define STREAM_LAYOUT_ONLY
+#include <stream.h>
+#include <util.h>
+
+#define BENCHMARK_DEFAULT_FRAMES 1000000
+
+typedef struct
+{
+    uint32_t tick;
+    uint16_t range_mm;
+    uint8_t validity;
+    uint8_t range_status;
+    uint16_t signal_rate; // Q9.7
+} sample_t;
+
+typedef struct
+{
+    uint16_t sequence;
+    uint8_t count;
+    sample_t samples[STREAM_FRAME_SAMPLES];
+} frame_t;
+
+typedef struct
+{
+    unsigned long frames;
+    unsigned long samples;
+    unsigned long crc_errors;
+    unsigned long lost_frames;
+    unsigned long skipped_bytes;
+    int have_sequence;
+    uint16_t next_sequence;
+} decoder_t;
+
+static uint16_t get16(const uint8_t *buffer)
+{
+    return (uint16_t) (buffer[0] | buffer[1] << 8);
+}
+
+static uint32_t get32(const uint8_t *buffer)
+{
+    return get16(buffer) | (uint32_t) get16(&buffer[2]) << 16;
+}
+
+static void put16(uint8_t *buffer, uint16_t value)
+{
+    buffer[0] = value & 0xFF;
+    buffer[1] = value >> 8;
+}
+
+// Decode one frame starting at its sync word; 0 if the CRC does not match
+static int decode_frame(const uint8_t *buffer, frame_t *frame)
+{
+    if (util_crc16(&buffer[2], STREAM_FRAME_SIZE - 4) != get16(&buffer[STREAM_FRAME_SIZE - 2]))
+    {
+        return 0;
+    }
+
+    uint32_t tick = get32(&buffer[4]);
+
+    frame->sequence = get16(&buffer[2]);
+    frame->count = buffer[8] > STREAM_FRAME_SAMPLES ? STREAM_FRAME_SAMPLES : buffer[8];
+
+    for (int i = 0; i < frame->count; i++)
+    {
+        const uint8_t *sample = &buffer[STREAM_HEADER_SIZE + i * STREAM_SAMPLE_SIZE];
+
+        tick += get16(&sample[0]);
+
+        frame->samples[i].tick = tick;
+        frame->samples[i].range_mm = get16(&sample[2]);
+        frame->samples[i].validity = sample[4] & 0x0F;
+        frame->samples[i].range_status = sample[4] >> 4;
+        frame->samples[i].signal_rate = get16(&sample[5]);
+    }
+
+    return 1;
+}
+
+// Decode all complete frames in buffer, calling output for each; returns the
+// bytes consumed, the rest has to be presented again with more data
+static size_t decode(decoder_t *decoder, const uint8_t *buffer, size_t length, void (*output)(const frame_t *frame))
+{
+    size_t offset = 0;
+    frame_t frame;
+
+    while (length - offset >= STREAM_FRAME_SIZE)
+    {
+        if (buffer[offset] != STREAM_SYNC_0 || buffer[offset + 1] != STREAM_SYNC_1 || !decode_frame(&buffer[offset], &frame))
+        {
+            if (buffer[offset] == STREAM_SYNC_0 && buffer[offset + 1] == STREAM_SYNC_1)
+            {
+                decoder->crc_errors++;
+            }
+
+            decoder->skipped_bytes++;
+            offset++;
+            continue;
+        }
+
+        if (decoder->have_sequence && frame.sequence != decoder->next_sequence)
+        {
+            decoder->lost_frames += (uint16_t) (frame.sequence - decoder->next_sequence);
+        }
+
+        decoder->have_sequence = 1;
+        decoder->next_sequence = frame.sequence + 1;
+        decoder->frames++;
+        decoder->samples += frame.count;
+
+        if (output != NULL)
+        {
+            output(&frame);
+        }
+
+        offset += STREAM_FRAME_SIZE;
+    }
+
+    return offset;
+}
+
+static void print_frame(const frame_t *frame)
+{
+    for (int i = 0; i < frame->count; i++)
+    {
+        const sample_t *sample = &frame->samples[i];
+
+        printf("%u,%u,%u,%u,%u,%u.%02u\n", frame->sequence, sample->tick, sample->range_mm, sample->validity,
+               sample->range_status, sample->signal_rate >> 7, ((sample->signal_rate & 0x7F) * 100) >> 7);
+    }
+}
+
+static volatile unsigned long benchmark_sink;
+
+static void count_frame(const frame_t *frame)
+{
+    benchmark_sink += frame->samples[frame->count - 1].range_mm;
+}
+
+// Build a frame the way app/stream.c does
+static void encode_frame(uint8_t *buffer, uint16_t sequence, uint32_t tick)
+{
+    memset(buffer, 0, STREAM_FRAME_SIZE);
+
+    buffer[0] = STREAM_SYNC_0;
+    buffer[1] = STREAM_SYNC_1;
+    put16(&buffer[2], sequence);
+    put16(&buffer[4], tick & 0xFFFF);
+    put16(&buffer[6], tick >> 16);
+    buffer[8] = STREAM_FRAME_SAMPLES;
+
+    for (int i = 0; i < STREAM_FRAME_SAMPLES; i++)
+    {
+        uint8_t *sample = &buffer[STREAM_HEADER_SIZE + i * STREAM_SAMPLE_SIZE];
+
+        put16(&sample[0], i == 0 ? 0 : 33);
+        put16(&sample[2], (uint16_t) (100 + (sequence + i) % 1000));
+        sample[4] = 0;
+        put16(&sample[5], 0x0500);
+    }
+
+    put16(&buffer[STREAM_FRAME_SIZE - 2], util_crc16(&buffer[2], STREAM_FRAME_SIZE - 4));
+}
+
+static int benchmark(unsigned long frames)
+{
+    size_t length = frames * STREAM_FRAME_SIZE;
+    uint8_t *buffer = malloc(length);
+    decoder_t decoder;
+
+    if (buffer == NULL)
+    {
+        fprintf(stderr, "out of memory\n");
+        return 1;
+    }
+
+    for (unsigned long i = 0; i < frames; i++)
+    {
+        encode_frame(&buffer[i * STREAM_FRAME_SIZE], (uint16_t) i, (uint32_t) (i * STREAM_FRAME_SAMPLES * 33));
+    }
+
+    memset(&decoder, 0, sizeof(decoder));
+
+    clock_t start = clock();
+    decode(&decoder, buffer, length, count_frame);
+    double seconds = (double) (clock() - start) / CLOCKS_PER_SEC;
+
+    free(buffer);
+
+    if (seconds <= 0)
+    {
+        seconds = 1e-9;
+    }
+
+    printf("%lu frames, %lu samples, %lu bytes in %.3f s\n", decoder.frames, decoder.samples, (unsigned long) length, seconds);
+    printf("%.0f frames/s, %.0f samples/s, %.1f MB/s\n", decoder.frames / seconds, decoder.samples / seconds, length / seconds / 1e6);
+
+    return decoder.frames == frames && decoder.crc_errors == 0 ? 0 : 1;
+}
+
+#ifndef STREAM_DECODE_NO_MAIN
+
+int main(int argc, char **argv)
+{
+    if (argc > 1 && strcmp(argv[1], "-b") == 0)
+    {
+        return benchmark(argc > 2 ? strtoul(argv[2], NULL, 0) : BENCHMARK_DEFAULT_FRAMES);
+    }
+
+    FILE *input = argc > 1 ? fopen(argv[1], "rb") : stdin;
+
+    if (input == NULL)
+    {
+        perror(argv[1]);
+        return 1;
+    }
+
+    uint8_t buffer[4096];
+    size_t length = 0;
+    size_t count;
+    decoder_t decoder;
+
+    memset(&decoder, 0, sizeof(decoder));
+
+    printf("sequence,tick,range_mm,validity,range_status,signal_rate_mcps\n");
+
+    while ((count = fread(&buffer[length], 1, sizeof(buffer) - length, input)) > 0)
+    {
+        length += count;
+
+        size_t consumed = decode(&decoder, buffer, length, print_frame);
+
+        memmove(buffer, &buffer[consumed], length - consumed);
+        length -= consumed;
+    }
+
+    decoder.skipped_bytes += length;
+
+    fprintf(stderr, "%lu frames, %lu samples, %lu lost frames, %lu CRC errors, %lu bytes skipped\n",
+            decoder.frames, decoder.samples, decoder.lost_frames, decoder.crc_errors, decoder.skipped_bytes);
+
+    if (input != stdin)
+    {
+        fclose(input);
+    }
+
+    return 0;
+}
+
+#endif // STREAM_DECODE_NO_MAIN